@@ -82,6 +82,10 @@ class URLPreloader final : public nsIMemoryReporter {
 
   void SetStartupFinished() { mStartupFinished = true; }
 
+  // Returns true once the preloader has been initialized, after which reads
+  // go through its cache and are recorded for the next session.
+  static bool IsInitialized() { return sInitialized; }
+
  private:
   struct CacheKey;
 
@@ -1379,7 +1379,11 @@ nsresult XPCJSContext::Initialize() {
     if (auto* sc = scache::StartupCache::GetSingleton()) {
       const char* buf = nullptr;
       uint32_t len = 0;
-      if (NS_SUCCEEDED(sc->GetBuffer(kSelfHostCacheKey, &buf, &len))) {
+      // The bytecode is copied into shared memory right away, under the mmap
+      // fault handler, so it doesn't need a heap copy of its own.
+      if (NS_SUCCEEDED(
+              sc->GetBuffer(kSelfHostCacheKey, &buf, &len,
+                            scache::StartupCache::BufferMode::Mapped))) {
         shm.InitFromParent(AsBytes(mozilla::Span(buf, len)));
       }
     }
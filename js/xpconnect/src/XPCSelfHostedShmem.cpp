@@ -5,6 +5,7 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include "XPCSelfHostedShmem.h"
+#include "mozilla/MmapFaultHandler.h"
 #include "xpcprivate.h"
 
 // static
@@ -54,7 +55,9 @@ void xpc::SelfHostedShmem::InitFromParent(ContentType aXdr) {
   }
 
   void* address = mapping.Address();
+  MMAP_FAULT_HANDLER_BEGIN_BUFFER(aXdr.Elements(), aXdr.LengthBytes())
   memcpy(address, aXdr.Elements(), aXdr.LengthBytes());
+  MMAP_FAULT_HANDLER_CATCH()
 
   mHandle = std::move(mapping).Freeze();
   mMem = mHandle.Map();
@@ -39,6 +39,8 @@ class SelfHostedShmem final : public nsIMemoryReporter {
 
   // Initialize this singleton with the content of the Self-hosted Stencil XDR.
   // This will be used to initialize the shared memory which would hold a copy.
+  // |aXdr| may point into a mapped file: if reading it faults, this singleton
+  // is left uninitialized.
   //
   // This function is not thread-safe and should be call at most once and from
   // the main thread.
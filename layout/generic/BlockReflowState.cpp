@@ -998,7 +998,7 @@ void BlockReflowState::PushFloatPastBreak(nsIFrame* aFloat) {
  */
 void BlockReflowState::PlaceBelowCurrentLineFloats(nsLineBox* aLine) {
   MOZ_ASSERT(!mBelowCurrentLineFloats.IsEmpty());
-  nsTArray<nsIFrame*> floatsPlacedInLine;
+  nsLineBox::FloatArray floatsPlacedInLine;
   for (nsIFrame* f : mBelowCurrentLineFloats) {
 #ifdef DEBUG
     if (nsBlockFrame::gNoisyReflow) {
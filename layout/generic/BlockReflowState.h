@@ -383,13 +383,13 @@ class BlockReflowState {
   // The list of floats that are "current-line" floats. These are
   // added to the line after the line has been reflowed, to keep the
   // list fiddling from being N^2.
-  nsTArray<nsIFrame*> mCurrentLineFloats;
+  nsLineBox::FloatArray mCurrentLineFloats;
 
   // The list of floats which are "below current-line"
   // floats. These are reflowed/placed after the line is reflowed
   // and placed. Again, this is done to keep the list fiddling from
   // being N^2.
-  nsTArray<nsIFrame*> mBelowCurrentLineFloats;
+  nsLineBox::FloatArray mBelowCurrentLineFloats;
 
   // The list of floats that are waiting on a break opportunity in order to be
   // placed, since we're on a nowrap context.
@@ -8474,7 +8474,7 @@ void nsBlockFrame::CheckFloats(BlockReflowState& aState) {
   AutoTArray<nsIFrame*, 8> lineFloats;
   for (auto& line : Lines()) {
     if (line.HasFloats()) {
-      lineFloats.AppendElements(line.Floats());
+      lineFloats.AppendElements(Span(line.Floats()));
     }
     if (line.IsDirty()) {
       anyLineDirty = true;
@@ -173,7 +173,7 @@ void nsLineBox::Cleanup() {
 
 #ifdef DEBUG_FRAME_DUMP
 static void ListFloats(FILE* out, const char* aPrefix,
-                       const nsTArray<nsIFrame*>& aFloats,
+                       const nsLineBox::FloatArray& aFloats,
                        bool aListOnlyDeterministic) {
   for (nsIFrame* f : aFloats) {
     nsCString str(aPrefix);
@@ -485,7 +485,7 @@ void nsLineBox::ClearFloats() {
   }
 }
 
-void nsLineBox::AppendFloats(nsTArray<nsIFrame*>&& aFloats) {
+void nsLineBox::AppendFloats(FloatArray&& aFloats) {
   MOZ_ASSERT(IsInline(), "block line can't have floats");
   if (MOZ_UNLIKELY(!IsInline())) {
     return;
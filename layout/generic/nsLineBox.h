@@ -12,6 +12,7 @@
 #include <algorithm>
 
 #include "mozilla/Attributes.h"
+#include "mozilla/CompactTArray.h"
 #include "mozilla/Likely.h"
 #include "nsIFrame.h"
 #include "nsILineIterator.h"
@@ -267,16 +268,18 @@ class nsLineBox final : public nsLineLink {
   // Returns true if the margin changed
   bool SetCarriedOutBEndMargin(mozilla::CollapsingMargin aValue);
 
-  // mFloats
+  // mFloats. Most lines have no more than a couple of floats, and those are
+  // kept without a separate allocation.
+  using FloatArray = mozilla::CompactTArray<nsIFrame*, 2>;
   bool HasFloats() const {
     return (IsInline() && mInlineData) && !mInlineData->mFloats.IsEmpty();
   }
-  const nsTArray<nsIFrame*>& Floats() const {
+  const FloatArray& Floats() const {
     MOZ_ASSERT(HasFloats());
     return mInlineData->mFloats;
   }
   // Append aFloats to mFloat. aFloats will be empty.
-  void AppendFloats(nsTArray<nsIFrame*>&& aFloats);
+  void AppendFloats(FloatArray&& aFloats);
   void ClearFloats();
   bool RemoveFloat(nsIFrame* aFrame);
 
@@ -554,7 +557,7 @@ class nsLineBox final : public nsLineLink {
           mFloatEdgeIEnd(nscoord_MIN) {}
     nscoord mFloatEdgeIStart;
     nscoord mFloatEdgeIEnd;
-    nsTArray<nsIFrame*> mFloats;
+    FloatArray mFloats;
   };
 
   bool GetFloatEdges(nscoord* aStart, nscoord* aEnd) const {
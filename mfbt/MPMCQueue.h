@@ -0,0 +1,189 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+ * Multiple Producer Multiple Consumer bounded lock-free queue.
+ * Allocation-free is guaranteed outside of the constructor.
+ *
+ * This is an implementation of Dmitry Vyukov's bounded MPMC queue:
+ * https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+
+#ifndef mozilla_MPMCQueue_h
+#define mozilla_MPMCQueue_h
+
+#include "mozilla/Assertions.h"
+#include "mozilla/Attributes.h"
+#include "mozilla/MathAlgorithms.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mozilla {
+
+namespace detail {
+
+// Size used to keep the producer and the consumer cursors on separate cache
+// lines, to avoid false sharing between threads that only push and threads
+// that only pop.
+static const size_t kMPMCCacheLineSize = 64;
+
+}  // namespace detail
+
+/**
+ * This data structure allows producing data from any number of threads, and
+ * consuming it from any number of threads, safely and without performing
+ * memory allocations or locking.
+ *
+ * Some words about the inner workings of this class:
+ * - Capacity is fixed, and rounded up to the next power of two. Only one
+ *   allocation is performed, in the constructor.
+ * - Each cell carries a sequence number. A producer can write to a cell when
+ *   its sequence number is equal to the enqueue position, and publishes it by
+ *   bumping the sequence number to position + 1. A consumer can read a cell
+ *   when its sequence number is equal to the dequeue position + 1, and frees
+ *   it by bumping the sequence number to position + capacity.
+ * - Producers and consumers only contend on a single compare/exchange of their
+ *   respective cursor, there is no shared lock.
+ * - This is lock-free but not wait-free: a thread preempted between claiming a
+ *   cell and publishing it will make other threads see the queue as full (for
+ *   producers) or empty (for consumers) for that cell until it resumes.
+ */
+template <typename T>
+class MPMCQueue {
+ public:
+  explicit MPMCQueue(size_t aCapacity)
+      : mMask(RoundUpPow2(aCapacity < 2 ? 2 : aCapacity) - 1) {
+    MOZ_RELEASE_ASSERT(aCapacity > 0);
+    // This should be the only allocation performed.
+    mCells = std::make_unique<Cell[]>(Capacity());
+    for (size_t i = 0; i < Capacity(); ++i) {
+      mCells[i].mSequence.store(i, std::memory_order_relaxed);
+    }
+    mEnqueuePos.store(0, std::memory_order_relaxed);
+    mDequeuePos.store(0, std::memory_order_relaxed);
+  }
+
+  ~MPMCQueue() {
+    // Destroy any element still in the queue.
+    while (Pop()) {
+    }
+  }
+
+  MPMCQueue(const MPMCQueue&) = delete;
+  MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+  /**
+   * Put an element in the queue, by moving it. Returns false if the queue is
+   * full, in which case `aElement` is left untouched and the caller MUST decide
+   * whether to retry or drop the element.
+   */
+  [[nodiscard]] bool Push(T&& aElement) {
+    return Emplace(std::move(aElement));
+  }
+
+  [[nodiscard]] bool Push(const T& aElement) { return Emplace(aElement); }
+
+  template <typename... Args>
+  [[nodiscard]] bool Emplace(Args&&... aArgs) {
+    Cell* cell;
+    size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &mCells[pos & mMask];
+      size_t seq = cell->mSequence.load(std::memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        // The cell is free for this lap, try to claim it.
+        if (mEnqueuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+        // `pos` has been updated by compare_exchange_weak, try again.
+      } else if (diff < 0) {
+        // The cell still holds an element from the previous lap: full.
+        return false;
+      } else {
+        // Another producer claimed this cell, reload the cursor.
+        pos = mEnqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    new (cell->Storage()) T(std::forward<Args>(aArgs)...);
+    // Publish the element to consumers.
+    cell->mSequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Retrieve one element from the queue and move it to `*aElement`, if
+   * non-null. Returns false if the queue was empty.
+   */
+  [[nodiscard]] bool Pop(T* aElement = nullptr) {
+    Cell* cell;
+    size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &mCells[pos & mMask];
+      size_t seq = cell->mSequence.load(std::memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+      if (diff == 0) {
+        if (mDequeuePos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Nothing has been published in this cell yet: empty.
+        return false;
+      } else {
+        pos = mDequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    T* element = cell->Element();
+    if (aElement) {
+      *aElement = std::move(*element);
+    }
+    element->~T();
+    // Hand the cell back to producers for the next lap.
+    cell->mSequence.store(pos + mMask + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Approximate number of elements in the queue. This is only a snapshot and
+   * can be stale by the time it is returned if other threads are using the
+   * queue concurrently.
+   */
+  size_t ApproximateLength() const {
+    size_t enq = mEnqueuePos.load(std::memory_order_relaxed);
+    size_t deq = mDequeuePos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+
+  size_t Capacity() const { return mMask + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> mSequence;
+    alignas(T) unsigned char mStorage[sizeof(T)];
+
+    void* Storage() { return mStorage; }
+    T* Element() { return std::launder(reinterpret_cast<T*>(mStorage)); }
+  };
+
+  const size_t mMask;
+  std::unique_ptr<Cell[]> mCells;
+
+  alignas(detail::kMPMCCacheLineSize) std::atomic<size_t> mEnqueuePos;
+  alignas(detail::kMPMCCacheLineSize) std::atomic<size_t> mDequeuePos;
+};
+
+}  // namespace mozilla
+
+#endif  // mozilla_MPMCQueue_h
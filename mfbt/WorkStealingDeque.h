@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+/*
+ * Chase-Lev work-stealing deque.
+ *
+ * This follows "Correct and Efficient Work-Stealing for Weak Memory Models"
+ * (Lê, Pop, Cohen, Zappa Nardelli, PPoPP 2013), which gives the C11 memory
+ * orderings for the original "Dynamic Circular Work-Stealing Deque" (Chase,
+ * Lev, SPAA 2005).
+ */
+
+#ifndef mozilla_WorkStealingDeque_h
+#define mozilla_WorkStealingDeque_h
+
+#include "mozilla/Assertions.h"
+#include "mozilla/Attributes.h"
+#include "mozilla/MathAlgorithms.h"
+#include "mozilla/UniquePtr.h"
+#include "mozilla/Vector.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+namespace mozilla {
+
+/**
+ * A deque owned by a single thread (the "owner"), that can push and pop
+ * elements at the bottom end, while any number of other threads (the
+ * "thieves") can steal elements from the top end.
+ *
+ * This is the building block of work-stealing schedulers: each worker owns a
+ * deque, runs work from its own bottom end in LIFO order (which is good for
+ * locality), and idle workers take work from the top end of other workers'
+ * deques in FIFO order.
+ *
+ * Some words about the inner workings of this class:
+ * - Push() and Pop() must only be called from the owner thread. Steal() can be
+ *   called from any thread.
+ * - The storage grows (doubling) when the owner pushes to a full deque. Since
+ *   thieves may still be reading from the previous buffer, old buffers are
+ *   retired rather than freed, and are released when the deque is destroyed.
+ *   The total amount of retired memory is bounded by the size of the live
+ *   buffer.
+ * - Thieves read an element before claiming it with a compare/exchange, so
+ *   elements must be trivially copyable. In practice this is used to store
+ *   pointers to tasks.
+ * - Steal() is lock-free, Push() and Pop() are wait-free except when growing.
+ */
+template <typename T>
+class WorkStealingDeque {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "WorkStealingDeque elements are read racily by thieves and "
+                "must be trivially copyable");
+
+ public:
+  explicit WorkStealingDeque(size_t aInitialCapacity = 64)
+      : mTop(0), mBottom(0) {
+    auto buffer = MakeUnique<Buffer>(
+        RoundUpPow2(aInitialCapacity < 2 ? 2 : aInitialCapacity));
+    mBuffer.store(buffer.get(), std::memory_order_relaxed);
+    if (!mBuffers.append(std::move(buffer))) {
+      MOZ_CRASH("WorkStealingDeque: out of memory");
+    }
+  }
+
+  WorkStealingDeque(const WorkStealingDeque&) = delete;
+  WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+  /**
+   * Push an element at the bottom of the deque. Owner thread only.
+   */
+  void Push(T aElement) {
+    int64_t b = mBottom.load(std::memory_order_relaxed);
+    int64_t t = mTop.load(std::memory_order_acquire);
+    Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+    if (b - t > int64_t(buffer->Capacity()) - 1) {
+      buffer = Grow(buffer, b, t);
+    }
+    buffer->Put(b, aElement);
+    std::atomic_thread_fence(std::memory_order_release);
+    mBottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Pop an element from the bottom of the deque. Owner thread only. Returns
+   * std::nullopt if the deque was empty, or if a thief took the last element.
+   */
+  std::optional<T> Pop() {
+    int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+    Buffer* buffer = mBuffer.load(std::memory_order_relaxed);
+    mBottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = mTop.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      // Empty deque.
+      mBottom.store(b + 1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+
+    T element = buffer->Get(b);
+    if (t == b) {
+      // Last element: race against thieves for it.
+      bool won = mTop.compare_exchange_strong(t, t + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      mBottom.store(b + 1, std::memory_order_relaxed);
+      if (!won) {
+        return std::nullopt;
+      }
+    }
+    return std::make_optional(element);
+  }
+
+  /**
+   * Steal an element from the top of the deque. Can be called from any
+   * thread. Returns std::nullopt if the deque was empty or if another thread
+   * won the race for the top element, in which case the caller may retry.
+   */
+  std::optional<T> Steal() {
+    int64_t t = mTop.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = mBottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return std::nullopt;
+    }
+
+    // This may read from a retired buffer if the owner grew the deque in the
+    // meantime, which is fine: retired buffers stay alive, and elements in
+    // [t, b) were copied over when growing.
+    Buffer* buffer = mBuffer.load(std::memory_order_acquire);
+    T element = buffer->Get(t);
+    if (!mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return std::nullopt;
+    }
+    return std::make_optional(element);
+  }
+
+  /**
+   * Approximate number of elements in the deque. Only exact when called from
+   * the owner thread while no thief is active.
+   */
+  size_t ApproximateLength() const {
+    int64_t b = mBottom.load(std::memory_order_relaxed);
+    int64_t t = mTop.load(std::memory_order_relaxed);
+    return b > t ? size_t(b - t) : 0;
+  }
+
+  bool IsEmpty() const { return ApproximateLength() == 0; }
+
+  size_t Capacity() const {
+    return mBuffer.load(std::memory_order_relaxed)->Capacity();
+  }
+
+ private:
+  class Buffer {
+   public:
+    explicit Buffer(size_t aCapacity)
+        : mMask(aCapacity - 1),
+          mData(MakeUnique<std::atomic<T>[]>(aCapacity)) {
+      MOZ_ASSERT(IsPowerOfTwo(aCapacity));
+    }
+
+    size_t Capacity() const { return mMask + 1; }
+
+    T Get(int64_t aIndex) const {
+      return mData[size_t(aIndex) & mMask].load(std::memory_order_relaxed);
+    }
+
+    void Put(int64_t aIndex, T aElement) {
+      mData[size_t(aIndex) & mMask].store(aElement, std::memory_order_relaxed);
+    }
+
+   private:
+    const size_t mMask;
+    UniquePtr<std::atomic<T>[]> mData;
+  };
+
+  Buffer* Grow(Buffer* aOld, int64_t aBottom, int64_t aTop) {
+    auto grown = MakeUnique<Buffer>(aOld->Capacity() * 2);
+    for (int64_t i = aTop; i < aBottom; ++i) {
+      grown->Put(i, aOld->Get(i));
+    }
+    Buffer* raw = grown.get();
+    if (!mBuffers.append(std::move(grown))) {
+      MOZ_CRASH("WorkStealingDeque: out of memory");
+    }
+    mBuffer.store(raw, std::memory_order_release);
+    return raw;
+  }
+
+  std::atomic<int64_t> mTop;
+  std::atomic<int64_t> mBottom;
+  std::atomic<Buffer*> mBuffer;
+  // Owns the live buffer (last element) and every retired buffer. Only
+  // touched by the owner thread.
+  Vector<UniquePtr<Buffer>> mBuffers;
+};
+
+}  // namespace mozilla
+
+#endif  // mozilla_WorkStealingDeque_h
@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "mozilla/MPMCQueue.h"
+#include "mozilla/Vector.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace mozilla;
+
+void TestCapacity() {
+  MPMCQueue<int> q1(1);
+  MOZ_RELEASE_ASSERT(q1.Capacity() == 2);
+  MPMCQueue<int> q5(5);
+  MOZ_RELEASE_ASSERT(q5.Capacity() == 8);
+  MPMCQueue<int> q16(16);
+  MOZ_RELEASE_ASSERT(q16.Capacity() == 16);
+}
+
+void TestBasicAPI() {
+  MPMCQueue<int> q(4);
+  int v = -1;
+
+  // Popping from an empty queue fails and leaves the output untouched.
+  MOZ_RELEASE_ASSERT(!q.Pop(&v));
+  MOZ_RELEASE_ASSERT(v == -1);
+
+  for (int i = 0; i < 4; ++i) {
+    MOZ_RELEASE_ASSERT(q.Push(i));
+  }
+  MOZ_RELEASE_ASSERT(q.ApproximateLength() == 4);
+  // Full.
+  MOZ_RELEASE_ASSERT(!q.Push(42));
+
+  // FIFO order, over several laps of the ring buffer.
+  for (int lap = 0; lap < 3; ++lap) {
+    for (int i = 0; i < 4; ++i) {
+      MOZ_RELEASE_ASSERT(q.Pop(&v));
+      MOZ_RELEASE_ASSERT(v == lap * 4 + i);
+      MOZ_RELEASE_ASSERT(q.Push((lap + 1) * 4 + i));
+    }
+  }
+  for (int i = 0; i < 4; ++i) {
+    MOZ_RELEASE_ASSERT(q.Pop());
+  }
+  MOZ_RELEASE_ASSERT(!q.Pop());
+  MOZ_RELEASE_ASSERT(q.ApproximateLength() == 0);
+}
+
+void TestNonTrivialElements() {
+  auto counter = std::make_shared<int>(0);
+  {
+    MPMCQueue<std::shared_ptr<int>> q(8);
+    MOZ_RELEASE_ASSERT(q.Push(counter));
+    MOZ_RELEASE_ASSERT(q.Emplace(counter));
+    MOZ_RELEASE_ASSERT(counter.use_count() == 3);
+
+    std::shared_ptr<int> out;
+    MOZ_RELEASE_ASSERT(q.Pop(&out));
+    MOZ_RELEASE_ASSERT(out == counter);
+    MOZ_RELEASE_ASSERT(counter.use_count() == 3);
+    out = nullptr;
+    MOZ_RELEASE_ASSERT(counter.use_count() == 2);
+    // The remaining element is destroyed with the queue.
+  }
+  MOZ_RELEASE_ASSERT(counter.use_count() == 1);
+
+  MPMCQueue<std::string> strings(2);
+  MOZ_RELEASE_ASSERT(strings.Push(std::string("hello")));
+  std::string s;
+  MOZ_RELEASE_ASSERT(strings.Pop(&s));
+  MOZ_RELEASE_ASSERT(s == "hello");
+}
+
+// Every producer sends a disjoint range of values, every consumer sums what it
+// receives. The total must match, which checks that no element is lost or
+// duplicated.
+void StressTest(size_t aCapacity, size_t aProducers, size_t aConsumers,
+                size_t aPerProducer) {
+  MPMCQueue<uint64_t> q(aCapacity);
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> sum{0};
+  const uint64_t total = aProducers * aPerProducer;
+
+  Vector<std::thread> threads;
+  for (size_t p = 0; p < aProducers; ++p) {
+    MOZ_RELEASE_ASSERT(threads.emplaceBack([&q, p, aPerProducer] {
+      for (size_t i = 0; i < aPerProducer; ++i) {
+        uint64_t value = p * aPerProducer + i + 1;
+        while (!q.Push(value)) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+  for (size_t c = 0; c < aConsumers; ++c) {
+    MOZ_RELEASE_ASSERT(threads.emplaceBack([&q, &received, &sum, total] {
+      uint64_t localSum = 0;
+      uint64_t value;
+      while (received.load(std::memory_order_relaxed) < total) {
+        if (q.Pop(&value)) {
+          localSum += value;
+          received.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      sum.fetch_add(localSum);
+    }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  MOZ_RELEASE_ASSERT(received == total);
+  MOZ_RELEASE_ASSERT(sum == total * (total + 1) / 2);
+  MOZ_RELEASE_ASSERT(!q.Pop());
+}
+
+int main() {
+  TestCapacity();
+  TestBasicAPI();
+  TestNonTrivialElements();
+
+  StressTest(2, 1, 1, 20000);
+  StressTest(16, 4, 1, 10000);
+  StressTest(16, 1, 4, 40000);
+  StressTest(64, 4, 4, 10000);
+  StressTest(1024, 8, 8, 5000);
+
+  return 0;
+}
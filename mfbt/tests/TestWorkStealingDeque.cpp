@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "mozilla/UniquePtr.h"
+#include "mozilla/Vector.h"
+#include "mozilla/WorkStealingDeque.h"
+#include <atomic>
+#include <thread>
+
+using namespace mozilla;
+
+void TestOwnerOnly() {
+  WorkStealingDeque<int> d(2);
+  MOZ_RELEASE_ASSERT(d.IsEmpty());
+  MOZ_RELEASE_ASSERT(!d.Pop());
+  MOZ_RELEASE_ASSERT(!d.Steal());
+
+  // Push past the initial capacity to exercise growing.
+  for (int i = 0; i < 100; ++i) {
+    d.Push(i);
+  }
+  MOZ_RELEASE_ASSERT(d.ApproximateLength() == 100);
+  MOZ_RELEASE_ASSERT(d.Capacity() >= 100);
+
+  // The owner pops in LIFO order, thieves steal in FIFO order.
+  MOZ_RELEASE_ASSERT(*d.Pop() == 99);
+  MOZ_RELEASE_ASSERT(*d.Steal() == 0);
+  MOZ_RELEASE_ASSERT(*d.Pop() == 98);
+  MOZ_RELEASE_ASSERT(*d.Steal() == 1);
+
+  for (int i = 97; i >= 2; --i) {
+    auto v = d.Pop();
+    MOZ_RELEASE_ASSERT(v && *v == i);
+  }
+  MOZ_RELEASE_ASSERT(d.IsEmpty());
+  MOZ_RELEASE_ASSERT(!d.Pop());
+  MOZ_RELEASE_ASSERT(!d.Steal());
+
+  // Still usable once drained.
+  d.Push(7);
+  MOZ_RELEASE_ASSERT(*d.Steal() == 7);
+  MOZ_RELEASE_ASSERT(!d.Pop());
+}
+
+// The owner pushes and pops values while thieves steal concurrently. Each
+// value must be taken exactly once.
+void StressTest(size_t aThieves, size_t aCount) {
+  WorkStealingDeque<uint32_t> d(16);
+  auto seen = MakeUnique<std::atomic<uint8_t>[]>(aCount + 1);
+  std::atomic<size_t> taken{0};
+  std::atomic<bool> done{false};
+
+  auto take = [&](uint32_t aValue) {
+    MOZ_RELEASE_ASSERT(aValue > 0 && aValue <= aCount);
+    uint8_t previous = seen[aValue].fetch_add(1);
+    MOZ_RELEASE_ASSERT(previous == 0, "Value taken twice");
+    taken.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  Vector<std::thread> thieves;
+  for (size_t t = 0; t < aThieves; ++t) {
+    MOZ_RELEASE_ASSERT(thieves.emplaceBack([&] {
+      while (!done.load(std::memory_order_acquire)) {
+        if (auto v = d.Steal()) {
+          take(*v);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+
+  // Push in bursts and pop some of them back, so that the owner races against
+  // thieves on the last element regularly.
+  uint32_t next = 1;
+  while (next <= aCount) {
+    for (int i = 0; i < 8 && next <= aCount; ++i) {
+      d.Push(next++);
+    }
+    for (int i = 0; i < 3; ++i) {
+      if (auto v = d.Pop()) {
+        take(*v);
+      }
+    }
+  }
+  while (auto v = d.Pop()) {
+    take(*v);
+  }
+  // Whatever is left, if anything, has been claimed by a thief that hasn't
+  // recorded it yet.
+  while (taken.load(std::memory_order_relaxed) < aCount) {
+    std::this_thread::yield();
+  }
+  done.store(true, std::memory_order_release);
+  for (auto& t : thieves) {
+    t.join();
+  }
+
+  MOZ_RELEASE_ASSERT(taken == aCount);
+  for (size_t i = 1; i <= aCount; ++i) {
+    MOZ_RELEASE_ASSERT(seen[i] == 1);
+  }
+}
+
+int main() {
+  TestOwnerOnly();
+
+  StressTest(1, 50000);
+  StressTest(4, 50000);
+  StressTest(16, 50000);
+
+  return 0;
+}
@@ -0,0 +1,179 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+
+#include "mozilla/MPMCQueue.h"
+#include "mozilla/Mutex.h"
+#include "mozilla/Queue.h"
+#include "mozilla/Vector.h"
+#include "mozilla/WorkStealingDeque.h"
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <utility>
+
+using namespace mozilla;
+
+namespace {
+
+const uint64_t kQueueBenchElements = 1 << 20;
+
+// A mutex-protected FIFO, which is what the thread pools use today. Pop and
+// Steal both take from the front.
+class LockedBenchQueue {
+ public:
+  bool Push(uint64_t aValue) {
+    MutexAutoLock lock(mMutex);
+    mQueue.Push(std::move(aValue));
+    return true;
+  }
+
+  bool Pop(uint64_t* aValue) {
+    MutexAutoLock lock(mMutex);
+    if (mQueue.IsEmpty()) {
+      return false;
+    }
+    *aValue = mQueue.Pop();
+    return true;
+  }
+
+  std::optional<uint64_t> Pop() {
+    uint64_t value;
+    return Pop(&value) ? std::make_optional(value) : std::nullopt;
+  }
+
+  std::optional<uint64_t> Steal() { return Pop(); }
+
+ private:
+  Mutex mMutex{"LockedBenchQueue::mMutex"};
+  Queue<uint64_t> mQueue MOZ_GUARDED_BY(mMutex);
+};
+
+// Moves kQueueBenchElements through aQueue, from aProducers threads to
+// aConsumers threads.
+template <typename Q>
+void ProducersToConsumers(Q& aQueue, size_t aProducers, size_t aConsumers) {
+  const uint64_t perProducer = kQueueBenchElements / aProducers;
+  const uint64_t total = perProducer * aProducers;
+  std::atomic<uint64_t> received{0};
+  std::atomic<uint64_t> sum{0};
+
+  Vector<std::thread> threads;
+  for (size_t p = 0; p < aProducers; ++p) {
+    MOZ_RELEASE_ASSERT(threads.emplaceBack([&aQueue, p, perProducer] {
+      for (uint64_t i = 0; i < perProducer; ++i) {
+        while (!aQueue.Push(p * perProducer + i + 1)) {
+          std::this_thread::yield();
+        }
+      }
+    }));
+  }
+  for (size_t c = 0; c < aConsumers; ++c) {
+    MOZ_RELEASE_ASSERT(threads.emplaceBack([&aQueue, &received, &sum, total] {
+      uint64_t localSum = 0;
+      uint64_t value;
+      while (received.load(std::memory_order_relaxed) < total) {
+        if (aQueue.Pop(&value)) {
+          localSum += value;
+          received.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      sum.fetch_add(localSum);
+    }));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  ASSERT_EQ(total * (total + 1) / 2, sum.load());
+}
+
+// The owner pushes kQueueBenchElements in bursts and pops some of each burst
+// back, while aThieves threads steal from the other end.
+template <typename D>
+void OwnerAndThieves(D& aDeque, size_t aThieves) {
+  std::atomic<uint64_t> taken{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<bool> done{false};
+
+  Vector<std::thread> thieves;
+  for (size_t t = 0; t < aThieves; ++t) {
+    MOZ_RELEASE_ASSERT(thieves.emplaceBack([&] {
+      uint64_t localSum = 0;
+      while (!done.load(std::memory_order_acquire)) {
+        if (auto v = aDeque.Steal()) {
+          localSum += *v;
+          taken.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+      sum.fetch_add(localSum);
+    }));
+  }
+
+  uint64_t ownerSum = 0;
+  auto pop = [&] {
+    if (auto v = aDeque.Pop()) {
+      ownerSum += *v;
+      taken.fetch_add(1, std::memory_order_relaxed);
+    }
+  };
+  for (uint64_t next = 1; next <= kQueueBenchElements;) {
+    for (uint32_t i = 0; i < 64 && next <= kQueueBenchElements; ++i) {
+      aDeque.Push(next++);
+    }
+    for (uint32_t i = 0; i < 16; ++i) {
+      pop();
+    }
+  }
+  while (taken.load(std::memory_order_relaxed) < kQueueBenchElements) {
+    pop();
+  }
+  done.store(true, std::memory_order_release);
+  for (std::thread& thread : thieves) {
+    thread.join();
+  }
+
+  ASSERT_EQ(kQueueBenchElements * (kQueueBenchElements + 1) / 2,
+            sum.load() + ownerSum);
+}
+
+}  // namespace
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, MPMCQueue_1x1, [] {
+  MPMCQueue<uint64_t> queue(1024);
+  ProducersToConsumers(queue, 1, 1);
+});
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, LockedQueue_1x1, [] {
+  LockedBenchQueue queue;
+  ProducersToConsumers(queue, 1, 1);
+});
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, MPMCQueue_4x4, [] {
+  MPMCQueue<uint64_t> queue(1024);
+  ProducersToConsumers(queue, 4, 4);
+});
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, LockedQueue_4x4, [] {
+  LockedBenchQueue queue;
+  ProducersToConsumers(queue, 4, 4);
+});
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, WorkStealingDeque_4Thieves, [] {
+  WorkStealingDeque<uint64_t> deque;
+  OwnerAndThieves(deque, 4);
+});
+
+MOZ_GTEST_BENCH(MFBT_ConcurrentQueues, LockedQueue_4Thieves, [] {
+  LockedBenchQueue queue;
+  OwnerAndThieves(queue, 4);
+});
@@ -309,7 +309,11 @@ nsJAR::GetInputStream(const nsACString& aEntryName, nsIInputStream** result) {
     rv = jis->InitDirectory(this, entry.get());
   } else {
     RefPtr<nsZipHandle> fd = mZip->GetFD();
-    rv = jis->InitFile(fd, mZip->GetData(item), item);
+    if (UniquePtr<uint8_t[]> prefetched = mZip->TakePrefetched(item)) {
+      rv = jis->InitPrefetched(fd, std::move(prefetched), item);
+    } else {
+      rv = jis->InitFile(fd, mZip->GetData(item), item);
+    }
   }
   if (NS_SUCCEEDED(rv)) {
     // Callers use getter_addrefs
@@ -318,6 +322,17 @@ nsJAR::GetInputStream(const nsACString& aEntryName, nsIInputStream** result) {
   return rv;
 }
 
+NS_IMETHODIMP
+nsJAR::PrefetchEntries(const nsTArray<nsCString>& aEntryNames) {
+  RecursiveMutexAutoLock lock(mLock);
+  if (!mZip) {
+    return NS_ERROR_FAILURE;
+  }
+
+  mZip->Prefetch(aEntryNames);
+  return NS_OK;
+}
+
 nsresult nsJAR::GetFullJarPath(nsACString& aResult) {
   RecursiveMutexAutoLock lock(mLock);
   NS_ENSURE_ARG_POINTER(mZipFile);
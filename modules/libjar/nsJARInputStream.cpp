@@ -76,6 +76,25 @@ nsresult nsJARInputStream::InitFile(nsZipHandle* aFd, const uint8_t* aData,
   return NS_OK;
 }
 
+nsresult nsJARInputStream::InitPrefetched(nsZipHandle* aFd,
+                                          mozilla::UniquePtr<uint8_t[]> aData,
+                                          nsZipItem* aItem) {
+  MOZ_ASSERT(aFd, "Argument may not be null");
+  MOZ_ASSERT(aData, "Argument may not be null");
+  MOZ_ASSERT(aItem, "Argument may not be null");
+
+  // The data was already inflated and checked against the CRC, so it is read
+  // like a stored item.
+  mMode = MODE_COPY;
+  mFd = aFd;
+  mPrefetched = std::move(aData);
+  mZs.next_in = mPrefetched.get();
+  mZs.avail_in = aItem->RealSize();
+  mOutSize = aItem->RealSize();
+  mZs.total_out = 0;
+  return NS_OK;
+}
+
 nsresult nsJARInputStream::InitDirectory(nsJAR* aJar, const char* aDir) {
   MOZ_ASSERT(aJar, "Argument may not be null");
   MOZ_ASSERT(aDir, "Argument may not be null");
@@ -233,6 +252,7 @@ nsJARInputStream::Read(char* aBuffer, uint32_t aCount, uint32_t* aBytesRead) {
       // note that sometimes, we will release mFd before we've finished copying.
       if (mZs.total_out >= mOutSize) {
         mFd = nullptr;
+        mPrefetched = nullptr;
       }
       break;
   }
@@ -260,6 +280,7 @@ nsJARInputStream::Close() {
   }
   mMode = MODE_CLOSED;
   mFd = nullptr;
+  mPrefetched = nullptr;
   return NS_OK;
 }
 
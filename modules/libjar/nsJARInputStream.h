@@ -11,6 +11,7 @@
 #include "nsJAR.h"
 #include "nsTArray.h"
 #include "mozilla/Attributes.h"
+#include "mozilla/UniquePtr.h"
 
 /*-------------------------------------------------------------------------
  * Class nsJARInputStream declaration. This class defines the type of the
@@ -36,6 +37,11 @@ class nsJARInputStream final : public nsIInputStream {
   // takes ownership of |fd|, even on failure
   nsresult InitFile(nsZipHandle* aFd, const uint8_t* aData, nsZipItem* item);
 
+  // for items inflated ahead of time by nsZipArchive::Prefetch
+  nsresult InitPrefetched(nsZipHandle* aFd,
+                          mozilla::UniquePtr<uint8_t[]> aData,
+                          nsZipItem* aItem);
+
   nsresult InitDirectory(nsJAR* aJar, const char* aDir);
 
  private:
@@ -46,6 +52,7 @@ class nsJARInputStream final : public nsIInputStream {
   uint32_t mInCrc;          // CRC as provided by the zipentry
   uint32_t mOutCrc;         // CRC as calculated by me
   z_stream mZs;             // zip data structure
+  mozilla::UniquePtr<uint8_t[]> mPrefetched;  // inflated data, if prefetched
 
   /* For directory reading */
   RefPtr<nsJAR> mJar;          // string reference to zipreader
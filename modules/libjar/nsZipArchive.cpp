@@ -15,6 +15,7 @@
 #include "mozilla/Attributes.h"
 #include "mozilla/Logging.h"
 #include "mozilla/MemUtils.h"
+#include "mozilla/ScopeExit.h"
 #include "mozilla/UniquePtrExtensions.h"
 #include "mozilla/StaticMutex.h"
 #include "mozilla/StaticPrefs_network.h"
@@ -24,6 +25,7 @@
 #include "nsXULAppAPI.h"
 #include "nsZipArchive.h"
 #include "nsString.h"
+#include "nsThreadUtils.h"
 #include "prenv.h"
 #if defined(XP_WIN)
 #  include <windows.h>
@@ -880,13 +882,178 @@ const uint8_t* nsZipArchive::GetData(nsZipItem* aItem) {
 //---------------------------------------------
 int64_t nsZipArchive::SizeOfMapping() { return mFd ? mFd->SizeOfMapping() : 0; }
 
+//---------------------------------------------
+// nsZipArchive::Prefetch
+//---------------------------------------------
+void nsZipArchive::Prefetch(const nsTArray<nsCString>& aEntryNames,
+                            nsIEventTarget* aTarget) {
+  uint32_t budget = StaticPrefs::network_jar_prefetch_max_size();
+  if (!budget) {
+    return;
+  }
+
+  for (const auto& name : aEntryNames) {
+    nsZipItem* item = GetItem(name);
+    if (!item || item->IsDirectory() || item->Compression() != DEFLATED) {
+      continue;
+    }
+
+    uint32_t size = item->RealSize();
+    {
+      MonitorAutoLock lock(mPrefetchMonitor);
+      // The budget may have been lowered below what is already prefetched.
+      if (mPrefetched.Contains(item) ||
+          uint64_t(mPrefetchedSize) + size > budget) {
+        continue;
+      }
+      mPrefetched.InsertOrUpdate(item, PrefetchedItem());
+      mPrefetchedSize += size;
+    }
+
+    LOG(("ZipHandle::Prefetch[%p] %s", this, name.get()));
+    RefPtr<nsZipArchive> self = this;
+    nsCOMPtr<nsIRunnable> task =
+        NS_NewRunnableFunction("nsZipArchive::Prefetch",
+                               [self, item] { self->InflatePrefetched(item); });
+    if (aTarget) {
+      aTarget->Dispatch(task.forget(), NS_DISPATCH_NORMAL);
+    } else {
+      NS_DispatchBackgroundTask(task.forget(), NS_DISPATCH_EVENT_MAY_BLOCK);
+    }
+  }
+}
+
+// Inflates a whole item in one go, which lets zlib stay in its fast path for
+// most of the stream. Returns null if the item is corrupt.
+static UniquePtr<uint8_t[]> InflateItem(nsZipArchive* aZip, nsZipItem* aItem) {
+  uint32_t size = aItem->RealSize();
+  uint32_t maxSize = StaticPrefs::network_jar_max_entry_size();
+  if (maxSize && size > maxSize) {
+    return nullptr;
+  }
+
+  const uint8_t* data = aZip->GetData(aItem);
+  if (!data) {
+    return nullptr;
+  }
+
+  auto buf = MakeUniqueFallible<uint8_t[]>(size);
+  if (!buf) {
+    return nullptr;
+  }
+
+  z_stream zs;
+  if (NS_FAILED(gZlibInit(&zs))) {
+    return nullptr;
+  }
+  auto cleanup = MakeScopeExit([&] { inflateEnd(&zs); });
+
+  zs.next_in = (Bytef*)data;
+  zs.avail_in = aItem->Size();
+  zs.next_out = buf.get();
+  zs.avail_out = size;
+
+  MMAP_FAULT_HANDLER_BEGIN_BUFFER(data, aItem->Size())
+  int zerr = inflate(&zs, Z_FINISH);
+  if (zerr != Z_STREAM_END || zs.total_out != size) {
+    return nullptr;
+  }
+  MMAP_FAULT_HANDLER_CATCH(nullptr)
+
+  if (crc32(crc32(0L, Z_NULL, 0), buf.get(), size) != aItem->CRC32()) {
+    return nullptr;
+  }
+  return buf;
+}
+
+void nsZipArchive::InflatePrefetched(nsZipItem* aItem) {
+  {
+    MonitorAutoLock lock(mPrefetchMonitor);
+    auto entry = mPrefetched.Lookup(aItem);
+    // The item may already have been read, and its prefetch cancelled.
+    if (!entry || entry->mState != PrefetchedItem::State::Queued) {
+      return;
+    }
+    entry->mState = PrefetchedItem::State::Inflating;
+  }
+
+  UniquePtr<uint8_t[]> data = InflateItem(this, aItem);
+
+  MonitorAutoLock lock(mPrefetchMonitor);
+  auto entry = mPrefetched.Lookup(aItem);
+  MOZ_ASSERT(entry, "Items can't be taken while they are being inflated");
+  if (data) {
+    entry->mState = PrefetchedItem::State::Done;
+    entry->mData = std::move(data);
+  } else {
+    // Let the reader run into the error on its own.
+    entry.Remove();
+    mPrefetchedSize -= aItem->RealSize();
+  }
+  lock.NotifyAll();
+}
+
+//---------------------------------------------
+// nsZipArchive::TakePrefetched
+//---------------------------------------------
+UniquePtr<uint8_t[]> nsZipArchive::TakePrefetched(nsZipItem* aItem) {
+  MonitorAutoLock lock(mPrefetchMonitor);
+  if (mPrefetched.IsEmpty()) {
+    return nullptr;
+  }
+
+  while (true) {
+    auto entry = mPrefetched.Lookup(aItem);
+    if (!entry) {
+      // Once enough reads in a row were for other items, whatever the
+      // prefetched items were meant for is over, and they won't be read.
+      if (++mPrefetchMisses >= kPrefetchMissWindow) {
+        EvictPrefetched();
+      }
+      return nullptr;
+    }
+    mPrefetchMisses = 0;
+    if (entry->mState == PrefetchedItem::State::Inflating) {
+      // Inflating it here instead would only take longer.
+      lock.Wait();
+      continue;
+    }
+
+    UniquePtr<uint8_t[]> data = std::move(entry->mData);
+    entry.Remove();
+    mPrefetchedSize -= aItem->RealSize();
+    return data;
+  }
+}
+
+void nsZipArchive::EvictPrefetched() {
+  for (auto iter = mPrefetched.Iter(); !iter.Done(); iter.Next()) {
+    // Items being inflated are left to InflatePrefetched().
+    if (iter.Data().mState != PrefetchedItem::State::Inflating) {
+      mPrefetchedSize -= iter.Key()->RealSize();
+      iter.Remove();
+    }
+  }
+  mPrefetchMisses = 0;
+}
+
+uint32_t nsZipArchive::PrefetchedSize() {
+  MonitorAutoLock lock(mPrefetchMonitor);
+  return mPrefetchedSize;
+}
+
 //------------------------------------------
 // nsZipArchive constructor and destructor
 //------------------------------------------
 
 nsZipArchive::nsZipArchive(nsZipHandle* aZipHandle, PRFileDesc* aFd,
                            nsresult& aRv)
-    : mRefCnt(0), mFd(aZipHandle), mUseZipLog(false), mBuiltSynthetics(false) {
+    : mRefCnt(0),
+      mFd(aZipHandle),
+      mUseZipLog(false),
+      mBuiltSynthetics(false),
+      mPrefetchedSize(0),
+      mPrefetchMisses(0) {
   // initialize the table to nullptr
   memset(mFiles, 0, sizeof(mFiles));
   MOZ_DIAGNOSTIC_ASSERT(aZipHandle);
@@ -1212,6 +1379,14 @@ nsZipItemPtr_base::nsZipItemPtr_base(nsZipArchive* aZip,
   nsZipItem* item = aZip->GetItem(aEntryName);
   if (!item) return;
 
+  // Prefetched items have already been checked against their CRC.
+  mAutoBuf = aZip->TakePrefetched(item);
+  if (mAutoBuf) {
+    mReturnBuf = mAutoBuf.get();
+    mReadlen = item->RealSize();
+    return;
+  }
+
   uint32_t size = 0;
   bool compressed = (item->Compression() == DEFLATED);
   if (compressed) {
@@ -19,9 +19,14 @@
 #include "mozilla/ArenaAllocator.h"
 #include "mozilla/FileUtils.h"
 #include "mozilla/FileLocation.h"
+#include "mozilla/Monitor.h"
 #include "mozilla/Mutex.h"
 #include "mozilla/UniquePtr.h"
+#include "nsHashKeys.h"
+#include "nsTArray.h"
+#include "nsTHashMap.h"
 
+class nsIEventTarget;
 class nsZipFind;
 struct PRFileDesc;
 
@@ -176,6 +181,47 @@ class nsZipArchive final {
    */
   int64_t SizeOfMapping();
 
+  /**
+   * Prefetch
+   *
+   * Starts inflating the given items on background threads, so that they are
+   * ready by the time they are read through nsJARInputStream or nsZipItemPtr.
+   * Meant for items that are known to be read soon, e.g. at startup. Missing,
+   * stored and directory items are skipped, and so are items that don't fit
+   * in what remains of the network.jar.prefetch_max_size budget.
+   *
+   * Once kPrefetchMissWindow reads in a row were for items that weren't
+   * prefetched, the prefetched items that are left are dropped.
+   *
+   * @param   aEntryNames Names of files in the archive
+   * @param   aTarget     Where to inflate the items, the background task pool
+   *                      if null
+   */
+  void Prefetch(const nsTArray<nsCString>& aEntryNames,
+                nsIEventTarget* aTarget = nullptr);
+
+  /**
+   * TakePrefetched
+   *
+   * Hands out the inflated, CRC-checked contents of a prefetched item. Waits
+   * if the item is being inflated, and cancels its prefetch if that hasn't
+   * started yet. Prefetched contents can only be taken once.
+   *
+   * @param   aItem       Pointer to nsZipItem
+   * @return  buffer of aItem->RealSize() bytes, or null.
+   */
+  mozilla::UniquePtr<uint8_t[]> TakePrefetched(nsZipItem* aItem);
+
+  /**
+   * PrefetchedSize
+   *
+   * @return  the inflated size of the items that are being prefetched, or
+   *          have been and weren't read yet.
+   */
+  uint32_t PrefetchedSize();
+
+  static constexpr uint32_t kPrefetchMissWindow = 32;
+
   /*
    * Refcounting
    */
@@ -206,11 +252,28 @@ class nsZipArchive final {
   // Whether we synthesized the directory entries
   bool mBuiltSynthetics MOZ_GUARDED_BY(mLock);
 
+  struct PrefetchedItem {
+    enum class State : uint8_t { Queued, Inflating, Done };
+    State mState = State::Queued;
+    mozilla::UniquePtr<uint8_t[]> mData;
+  };
+
+  mozilla::Monitor mPrefetchMonitor{"nsZipArchive::mPrefetchMonitor"};
+  // all of the following members are guarded by mPrefetchMonitor:
+  nsTHashMap<nsPtrHashKey<nsZipItem>, PrefetchedItem> mPrefetched
+      MOZ_GUARDED_BY(mPrefetchMonitor);
+  // Total inflated size of the items in mPrefetched
+  uint32_t mPrefetchedSize MOZ_GUARDED_BY(mPrefetchMonitor);
+  // Number of reads in a row that found nothing in mPrefetched
+  uint32_t mPrefetchMisses MOZ_GUARDED_BY(mPrefetchMonitor);
+
  private:
   //--- private methods ---
   nsZipItem* CreateZipItem() MOZ_REQUIRES(mLock);
   nsresult BuildFileList(PRFileDesc* aFd = nullptr);
   nsresult BuildSynthetics();
+  void InflatePrefetched(nsZipItem* aItem);
+  void EvictPrefetched() MOZ_REQUIRES(mPrefetchMonitor);
 
   nsZipArchive& operator=(const nsZipArchive& rhs) = delete;
   nsZipArchive(const nsZipArchive& rhs) = delete;
@@ -29,6 +29,7 @@
 #include "mozilla/Logging.h"
 #include "mozilla/Maybe.h"
 #include "mozilla/MemoryReporting.h"
+#include "mozilla/Monitor.h"
 #include "mozilla/Omnijar.h"
 #include "mozilla/Preferences.h"
 #include "mozilla/ProfilerLabels.h"
@@ -42,6 +43,7 @@
 #include "mozilla/StaticPrefsAll.h"
 #include "mozilla/StaticPtr.h"
 #include "mozilla/SyncRunnable.h"
+#include "mozilla/ThreadLocal.h"
 #include "mozilla/Try.h"
 #include "mozilla/UniquePtrExtensions.h"
 #include "mozilla/URLPreloader.h"
@@ -1800,6 +1802,30 @@ Maybe<PrefWrapper> pref_Lookup(const char* aPrefName,
   return Nothing();
 }
 
+// Serializes the given preferences like pref_savePrefs() does. Returns false if
+// one of them no longer has a user value worth saving, since the prefs file
+// syntax can't express its removal.
+static bool pref_saveDirtyPrefs(const nsTHashSet<nsCString>& aPrefNames,
+                                PrefSaveData& aSavedPrefs) {
+  MOZ_ASSERT(NS_IsMainThread());
+
+  for (const nsCString& name : aPrefNames) {
+    Maybe<PrefWrapper> pref = pref_Lookup(name.get());
+    nsAutoCString prefValueStr;
+    if (!pref || !pref->UserValueToStringForSaving(prefValueStr)) {
+      return false;
+    }
+
+    nsAutoCString prefNameStr;
+    StrEscape(name.get(), prefNameStr);
+
+    aSavedPrefs.AppendElement(nsPrintfCString(
+        "user_pref(%s, %s);", prefNameStr.get(), prefValueStr.get()));
+  }
+
+  return true;
+}
+
 static Result<Pref*, nsresult> pref_LookupForModify(
     const char* aPrefName,
     const std::function<bool(const PrefWrapper&)>& aCheckFn) {
@@ -1903,7 +1929,7 @@ static nsresult pref_SetPref(const nsCString& aPrefName, PrefType aType,
     }
 
     if (aKind == PrefValueKind::User) {
-      Preferences::HandleDirty();
+      Preferences::HandleDirty(aPrefName.get());
     }
     NotifyCallbacks(aPrefName, PrefWrapper(pref));
   }
@@ -2009,6 +2035,81 @@ bool prefs_parser_parse(const char* aPath, PrefValueKind aKind,
                         PrefsParserPrefFn aPrefFn, PrefsParserErrorFn aErrorFn);
 }
 
+static void pref_ReportParseError(const char* aMsg) {
+  nsresult rv;
+  nsCOMPtr<nsIConsoleService> console =
+      do_GetService("@mozilla.org/consoleservice;1", &rv);
+  if (NS_SUCCEEDED(rv)) {
+    console->LogStringMessage(NS_ConvertUTF8toUTF16(aMsg).get());
+  }
+#ifdef DEBUG
+  NS_ERROR(aMsg);
+#else
+  printf_stderr("%s\n", aMsg);
+#endif
+}
+
+// The preferences and errors found by Parser::ParseInto(), which can be
+// collected on any thread and are applied to the database later on the main
+// thread.
+class ParsedPrefs {
+ public:
+  void AddPref(const char* aPrefName, PrefType aType, PrefValueKind aKind,
+               PrefValue aValue, bool aIsSticky, bool aIsLocked) {
+    Entry* entry = mEntries.AppendElement();
+    entry->mName.Assign(aPrefName);
+    entry->mType = aType;
+    entry->mKind = aKind;
+    if (aType == PrefType::String) {
+      entry->mString.Assign(aValue.mStringVal);
+    } else {
+      entry->mValue = aValue;
+    }
+    entry->mIsSticky = aIsSticky;
+    entry->mIsLocked = aIsLocked;
+  }
+
+  void AddError(const char* aMsg) { mErrors.AppendElement(aMsg); }
+
+  uint32_t Length() const { return mEntries.Length(); }
+
+  void ClearErrors() { mErrors.Clear(); }
+
+  void Apply() const {
+    MOZ_ASSERT(NS_IsMainThread());
+    for (const Entry& entry : mEntries) {
+      PrefValue value = entry.mType == PrefType::String
+                            ? PrefValue(entry.mString.get())
+                            : entry.mValue;
+      pref_SetPref(entry.mName, entry.mType, entry.mKind, value,
+                   entry.mIsSticky, entry.mIsLocked,
+                   /* fromInit */ true);
+    }
+    for (const nsCString& error : mErrors) {
+      pref_ReportParseError(error.get());
+    }
+  }
+
+ private:
+  struct Entry {
+    nsCString mName;
+    // Owns the chars of string values, mValue is unused for those.
+    nsCString mString;
+    PrefValue mValue;
+    PrefType mType;
+    PrefValueKind mKind;
+    bool mIsSticky;
+    bool mIsLocked;
+  };
+
+  nsTArray<Entry> mEntries;
+  nsTArray<nsCString> mErrors;
+};
+
+// The parser callbacks don't take a closure, so Parser::ParseInto() passes
+// its output to them through this.
+static MOZ_THREAD_LOCAL(ParsedPrefs*) sParsedPrefs;
+
 class Parser {
  public:
   Parser() = default;
@@ -2020,6 +2121,19 @@ class Parser {
                               HandlePref, HandleError);
   }
 
+  // Like Parse(), but collects the preferences in aPrefs rather than setting
+  // them, so that it can be used off the main thread.
+  static bool ParseInto(PrefValueKind aKind, const char* aPath,
+                        const nsCString& aBuf, ParsedPrefs& aPrefs) {
+    MOZ_ASSERT(XRE_IsParentProcess());
+    MOZ_ASSERT(!sParsedPrefs.get());
+    sParsedPrefs.set(&aPrefs);
+    bool ok = prefs_parser_parse(aPath, aKind, aBuf.get(), aBuf.Length(),
+                                 CollectPref, CollectError);
+    sParsedPrefs.set(nullptr);
+    return ok;
+  }
+
  private:
   static void HandlePref(const char* aPrefName, PrefType aType,
                          PrefValueKind aKind, PrefValue aValue, bool aIsSticky,
@@ -2030,18 +2144,17 @@ class Parser {
                  /* fromInit */ true);
   }
 
-  static void HandleError(const char* aMsg) {
-    nsresult rv;
-    nsCOMPtr<nsIConsoleService> console =
-        do_GetService("@mozilla.org/consoleservice;1", &rv);
-    if (NS_SUCCEEDED(rv)) {
-      console->LogStringMessage(NS_ConvertUTF8toUTF16(aMsg).get());
-    }
-#ifdef DEBUG
-    NS_ERROR(aMsg);
-#else
-    printf_stderr("%s\n", aMsg);
-#endif
+  static void HandleError(const char* aMsg) { pref_ReportParseError(aMsg); }
+
+  static void CollectPref(const char* aPrefName, PrefType aType,
+                          PrefValueKind aKind, PrefValue aValue,
+                          bool aIsSticky, bool aIsLocked) {
+    sParsedPrefs.get()->AddPref(aPrefName, aType, aKind, aValue, aIsSticky,
+                                aIsLocked);
+  }
+
+  static void CollectError(const char* aMsg) {
+    sParsedPrefs.get()->AddError(aMsg);
   }
 };
 
@@ -3121,7 +3234,7 @@ namespace mozilla {
 
 #define INITIAL_PREF_FILES 10
 
-void Preferences::HandleDirty() {
+void Preferences::HandleDirty(const char* aPrefName) {
   MOZ_ASSERT(XRE_IsParentProcess());
 
   if (!HashTable() || !sPreferences) {
@@ -3133,6 +3246,20 @@ void Preferences::HandleDirty() {
     return;
   }
 
+  if (!sPreferences->mNeedsFullSave) {
+    auto& dirtyPrefs = sPreferences->mDirtyPrefs;
+    if (aPrefName &&
+        sPreferences->mJournalLength + dirtyPrefs.Count() <
+            StaticPrefs::preferences_incremental_write_max_journal_length()) {
+      dirtyPrefs.Insert(nsDependentCString(aPrefName));
+    } else {
+      // Either we don't know what changed, or the journal is long enough that
+      // it is time to compact it into the prefs file.
+      sPreferences->mNeedsFullSave = true;
+      dirtyPrefs.Clear();
+    }
+  }
+
   if (!sPreferences->mDirty) {
     sPreferences->mDirty = true;
 
@@ -3149,7 +3276,158 @@ void Preferences::HandleDirty() {
   }
 }
 
-static nsresult openPrefFile(nsIFile* aFile, PrefValueKind aKind);
+static nsresult openPrefFile(nsIFile* aFile, PrefValueKind aKind,
+                             uint32_t* aGeneration = nullptr);
+
+// Every full write of the user prefs file gets a new generation, which is
+// written in its header. Its journal starts with the generation of the file it
+// was appended to, so that a journal left behind by a crash during a full
+// write isn't replayed on top of the newer file.
+static const char kPrefFileGenerationPrefix[] = "// Journal generation: ";
+
+static nsCString PrefFileGenerationLine(uint32_t aGeneration) {
+  nsCString line(kPrefFileGenerationPrefix);
+  line.AppendInt(aGeneration);
+  line.AppendLiteral(NS_LINEBREAK);
+  return line;
+}
+
+// Returns the generation written in the header of a prefs file or journal, or
+// 0 if there is none, e.g. because the file predates generations.
+static uint32_t GetPrefFileGeneration(const nsACString& aData) {
+  for (const nsACString& rawLine : aData.Split('\n')) {
+    nsDependentCSubstring line(rawLine, 0);
+    if (StringEndsWith(line, "\r"_ns)) {
+      line.Rebind(rawLine, 0, rawLine.Length() - 1);
+    }
+    if (StringBeginsWith(line,
+                         nsDependentCString(kPrefFileGenerationPrefix))) {
+      nsresult rv;
+      uint32_t generation =
+          Substring(line, sizeof(kPrefFileGenerationPrefix) - 1)
+              .ToUnsignedInteger(&rv);
+      return NS_SUCCEEDED(rv) ? generation : 0;
+    }
+    // The generation is in the leading comments.
+    if (!line.IsEmpty() && !StringBeginsWith(line, "//"_ns)) {
+      break;
+    }
+  }
+  return 0;
+}
+
+// Reads and parses the user prefs file on a background thread, so that
+// InitializeUserPrefs() only has to apply its contents. It is started as soon
+// as the profile is known, which usually leaves it time to finish before the
+// preferences are needed.
+class UserPrefsReader final {
+ public:
+  NS_INLINE_DECL_THREADSAFE_REFCOUNTING(UserPrefsReader)
+
+  explicit UserPrefsReader(nsIFile* aFile) : mFile(aFile) {}
+
+  void Run() {
+    nsresult rv = Read();
+    MonitorAutoLock lock(mMonitor);
+    mResult = rv;
+    mDone = true;
+    lock.Notify();
+  }
+
+  // Waits for the read to finish, and moves its results to aPrefs and
+  // aGeneration. Returns Nothing() if aFile isn't the file that was read, or if
+  // it changed in the meantime (e.g. it was written by a profile migration).
+  // Otherwise, returns what openPrefFile() would have.
+  Maybe<nsresult> Take(nsIFile* aFile, ParsedPrefs& aPrefs,
+                       uint32_t* aGeneration) {
+    MOZ_ASSERT(NS_IsMainThread());
+    {
+      MonitorAutoLock lock(mMonitor);
+      while (!mDone) {
+        lock.Wait();
+      }
+    }
+
+    bool equals = false;
+    if (NS_FAILED(mFile->Equals(aFile, &equals)) || !equals) {
+      return Nothing();
+    }
+
+    PRTime lastModified = 0;
+    int64_t size = 0;
+    nsresult rv = Stat(aFile, &lastModified, &size);
+    if (rv != mStatResult || lastModified != mLastModified || size != mSize) {
+      return Nothing();
+    }
+
+    aPrefs = std::move(mPrefs);
+    *aGeneration = mGeneration;
+    return Some(mResult);
+  }
+
+ private:
+  ~UserPrefsReader() = default;
+
+  static nsresult Stat(nsIFile* aFile, PRTime* aLastModified, int64_t* aSize) {
+    MOZ_TRY(aFile->GetLastModifiedTime(aLastModified));
+    return aFile->GetFileSize(aSize);
+  }
+
+  nsresult Read() {
+    mStatResult = Stat(mFile, &mLastModified, &mSize);
+    MOZ_TRY(mStatResult);
+
+    nsCOMPtr<nsIInputStream> stream;
+    MOZ_TRY(NS_NewLocalFileInputStream(getter_AddRefs(stream), mFile));
+    nsCString data;
+    MOZ_TRY(NS_ReadInputStreamToString(stream, data, -1));
+    mGeneration = GetPrefFileGeneration(data);
+
+    // If the file was replaced while we were reading it, Take() will see a
+    // different modification time than the one we have.
+    nsAutoString path;
+    mFile->GetPath(path);
+    if (!Parser::ParseInto(PrefValueKind::User,
+                           NS_ConvertUTF16toUTF8(path).get(), data, mPrefs)) {
+      return NS_ERROR_FILE_CORRUPTED;
+    }
+    return NS_OK;
+  }
+
+  Monitor mMonitor{"UserPrefsReader"};
+  bool mDone MOZ_GUARDED_BY(mMonitor) = false;
+
+  // Only accessed by Read() until mDone is set, and by Take() afterwards.
+  const nsCOMPtr<nsIFile> mFile;
+  nsresult mResult = NS_OK;
+  nsresult mStatResult = NS_OK;
+  PRTime mLastModified = 0;
+  int64_t mSize = 0;
+  uint32_t mGeneration = 0;
+  ParsedPrefs mPrefs;
+};
+
+static StaticRefPtr<UserPrefsReader> sUserPrefsReader;
+
+// Like openPrefFile(), but uses the results of the background read started by
+// Preferences::StartReadingUserPrefs(), if any.
+static nsresult openUserPrefFile(nsIFile* aFile, uint32_t* aGeneration) {
+  MOZ_ASSERT(XRE_IsParentProcess());
+
+  *aGeneration = 0;
+  if (RefPtr<UserPrefsReader> reader = sUserPrefsReader.forget()) {
+    ParsedPrefs prefs;
+    Maybe<nsresult> rv = reader->Take(aFile, prefs, aGeneration);
+    // If the URLPreloader is up, it may already have the file, and it needs to
+    // see it read to preload it in the next session.
+    if (rv && !URLPreloader::IsInitialized()) {
+      prefs.Apply();
+      return *rv;
+    }
+  }
+
+  return openPrefFile(aFile, PrefValueKind::User, aGeneration);
+}
 
 static nsresult parsePrefData(const nsCString& aData, PrefValueKind aKind);
 
@@ -3184,12 +3462,51 @@ bool Preferences::sShutdown = false;
 // This globally enables or disables OMT pref writing, both sync and async.
 static int32_t sAllowOMTPrefWrite = -1;
 
+// This globally enables or disables incremental pref writing.
+static int32_t sAllowIncrementalPrefWrite = -1;
+
+// The data for one write by PreferencesWriter.
+struct PrefWriteData {
+  PrefSaveData mPrefs;
+  // If true, mPrefs only holds the preferences which changed since the file
+  // was last written, and they are appended to its journal. Otherwise, mPrefs
+  // holds all the preferences, and the file is replaced and its journal
+  // removed.
+  bool mIsJournal = false;
+  // If true, the file is the one user preferences are read from at startup,
+  // whose generation is tracked by PreferencesWriter.
+  bool mIsCurrentFile = false;
+};
+
+// Returns the journal of the given prefs file. Entries in the journal use the
+// prefs file syntax, and are read after the file itself if the journal starts
+// with the generation of the file.
+static already_AddRefed<nsIFile> GetPrefFileJournal(nsIFile* aFile) {
+  nsCOMPtr<nsIFile> journal;
+  nsAutoString leafName;
+  if (NS_FAILED(aFile->Clone(getter_AddRefs(journal))) ||
+      NS_FAILED(aFile->GetLeafName(leafName))) {
+    return nullptr;
+  }
+  leafName.AppendLiteral("-journal");
+  if (NS_FAILED(journal->SetLeafName(leafName))) {
+    return nullptr;
+  }
+  return journal.forget();
+}
+
 // Write the preference data to a file.
 class PreferencesWriter final {
  public:
   PreferencesWriter() = default;
 
-  static nsresult Write(nsIFile* aFile, PrefSaveData& aPrefs) {
+  static nsresult Write(nsIFile* aFile, PrefWriteData& aData) {
+    if (aData.mIsJournal) {
+      MOZ_ASSERT(aData.mIsCurrentFile);
+      return AppendToJournal(aFile, aData.mPrefs);
+    }
+
+    PrefSaveData& aPrefs = aData.mPrefs;
     nsCOMPtr<nsIOutputStream> outStreamSink;
     nsCOMPtr<nsIOutputStream> outStream;
     uint32_t writeAmount;
@@ -3225,6 +3542,13 @@ class PreferencesWriter final {
     outStream->Write(kPrefFileHeader, sizeof(kPrefFileHeader) - 1,
                      &writeAmount);
 
+    uint32_t generation = sGeneration + 1;
+    if (aData.mIsCurrentFile) {
+      nsCString line = PrefFileGenerationLine(generation);
+      line.AppendLiteral(NS_LINEBREAK);
+      outStream->Write(line.get(), line.Length(), &writeAmount);
+    }
+
     for (nsCString& pref : aPrefs) {
       outStream->Write(pref.get(), pref.Length(), &writeAmount);
       outStream->Write(NS_LINEBREAK, NS_LINEBREAK_LEN, &writeAmount);
@@ -3244,9 +3568,59 @@ class PreferencesWriter final {
     }
 #endif
 
+    if (NS_SUCCEEDED(rv) && aData.mIsCurrentFile) {
+      // Everything in the journal is in the file now. The journal is of the
+      // previous generation, so it is ignored even if we crash before it is
+      // gone, and truncated by the next append otherwise.
+      sGeneration = generation;
+      nsCOMPtr<nsIFile> journal = GetPrefFileJournal(aFile);
+      if (journal) {
+        Unused << journal->Remove(false);
+      }
+    }
+
     return rv;
   }
 
+  static nsresult AppendToJournal(nsIFile* aFile, const PrefSaveData& aPrefs) {
+    nsCOMPtr<nsIFile> journal = GetPrefFileJournal(aFile);
+    if (!journal) {
+      return NS_ERROR_FAILURE;
+    }
+
+    // Start the journal over if it belongs to another generation of the file.
+    nsCString header = PrefFileGenerationLine(sGeneration);
+    bool append = JournalStartsWith(journal, header);
+
+    nsAutoCString data;
+    if (!append) {
+      data.Append(header);
+    }
+    for (const nsCString& pref : aPrefs) {
+      data.Append(pref);
+      data.AppendLiteral(NS_LINEBREAK);
+    }
+
+    PRFileDesc* fd;
+    nsresult rv = journal->OpenNSPRFileDesc(
+        PR_WRONLY | PR_CREATE_FILE | (append ? PR_APPEND : PR_TRUNCATE), 0600,
+        &fd);
+    if (NS_FAILED(rv)) {
+      return rv;
+    }
+    // A short write leaves a truncated entry behind, which makes the next
+    // startup ignore the rest of the journal and rewrite the prefs file.
+    int32_t written = PR_Write(fd, data.get(), int32_t(data.Length()));
+    PR_Close(fd);
+    return written == int32_t(data.Length()) ? NS_OK : NS_ERROR_FAILURE;
+  }
+
+  // Sets the generation of the current file, once it has been read.
+  static void SetGeneration(uint32_t aGeneration) {
+    StaticMutexAutoLock lock(sWritingToFile);
+    sGeneration = aGeneration;
+  }
+
   static void Flush() {
     MOZ_DIAGNOSTIC_ASSERT(sPendingWriteCount >= 0);
     // SpinEventLoopUntil is unfortunate, but ultimately it's the best thing
@@ -3268,7 +3642,7 @@ class PreferencesWriter final {
   // This is the data that all of the runnables (see below) will attempt
   // to write.  It will always have the most up to date version, or be
   // null, if the up to date information has already been written out.
-  static Atomic<PrefSaveData*> sPendingWriteData;
+  static Atomic<PrefWriteData*> sPendingWriteData;
 
   // This is the number of writes via PWRunnables which have been dispatched
   // but not yet completed. This is intended to be used by Flush to ensure
@@ -3278,11 +3652,29 @@ class PreferencesWriter final {
 
   // See PWRunnable::Run for details on why we need this lock.
   static StaticMutex sWritingToFile MOZ_UNANNOTATED;
+
+ private:
+  static bool JournalStartsWith(nsIFile* aJournal, const nsACString& aHeader) {
+    PRFileDesc* fd;
+    if (NS_FAILED(aJournal->OpenNSPRFileDesc(PR_RDONLY, 0, &fd))) {
+      return false;
+    }
+    nsAutoCString start;
+    start.SetLength(aHeader.Length());
+    int32_t read = PR_Read(fd, start.BeginWriting(), int32_t(start.Length()));
+    PR_Close(fd);
+    return read == int32_t(aHeader.Length()) && start == aHeader;
+  }
+
+  // The generation of the current file on disk. Only accessed with
+  // sWritingToFile held, or on the main thread if writes can't happen off it.
+  static uint32_t sGeneration;
 };
 
-Atomic<PrefSaveData*> PreferencesWriter::sPendingWriteData(nullptr);
+Atomic<PrefWriteData*> PreferencesWriter::sPendingWriteData(nullptr);
 Atomic<int> PreferencesWriter::sPendingWriteCount(0);
 StaticMutex PreferencesWriter::sWritingToFile;
+uint32_t PreferencesWriter::sGeneration = 0;
 
 class PWRunnable : public Runnable {
  public:
@@ -3334,7 +3726,7 @@ class PWRunnable : public Runnable {
       StaticMutexAutoLock lock(PreferencesWriter::sWritingToFile);
       // If we get a nullptr on the exchange, it means that somebody
       // else has already processed the request, and we can just return.
-      UniquePtr<PrefSaveData> prefs(
+      UniquePtr<PrefWriteData> prefs(
           PreferencesWriter::sPendingWriteData.exchange(nullptr));
       if (prefs) {
         rv = PreferencesWriter::Write(mFile, *prefs);
@@ -3670,6 +4062,9 @@ already_AddRefed<Preferences> Preferences::GetInstanceForService() {
 
   sPreferences = new Preferences();
 
+  // The saved preferences may be parsed off the main thread.
+  sParsedPrefs.infallibleInit();
+
   MOZ_ASSERT(!HashTable());
   HashTable() = new PrefsHashTable(XRE_IsParentProcess()
                                        ? kHashTableInitialLengthParent
@@ -3771,6 +4166,7 @@ void Preferences::Shutdown() {
   if (!sShutdown) {
     sShutdown = true;  // Don't create the singleton instance after here.
     sPreferences = nullptr;
+    sUserPrefsReader = nullptr;
     StaticPrefs::ShutdownAlwaysPrefs();
   }
 }
@@ -3915,6 +4311,88 @@ void Preferences::InitSnapshot(
   StaticPrefs::InitStaticPrefsFromShared();
 }
 
+/* static */
+void Preferences::StartReadingUserPrefs() {
+  MOZ_ASSERT(XRE_IsParentProcess());
+  MOZ_ASSERT(NS_IsMainThread());
+
+  if (!InitStaticMembers() || sPreferences->mCurrentFile || sUserPrefsReader) {
+    return;
+  }
+
+  // The user prefs haven't been read yet, so only the default value counts.
+  bool allowed = false;
+  Preferences::GetBool("preferences.allow.omt-read", &allowed,
+                       PrefValueKind::Default);
+  if (!allowed || URLPreloader::IsInitialized()) {
+    return;
+  }
+
+  nsCOMPtr<nsIFile> file;
+  nsresult rv =
+      NS_GetSpecialDirectory(NS_APP_PREFS_50_FILE, getter_AddRefs(file));
+  if (NS_WARN_IF(NS_FAILED(rv))) {
+    return;
+  }
+
+  StartReadingPrefFile(file);
+}
+
+/* static */
+void Preferences::StartReadingPrefFile(nsIFile* aFile) {
+  RefPtr<UserPrefsReader> reader = new UserPrefsReader(aFile);
+  nsresult rv = NS_DispatchBackgroundTask(NewRunnableMethod(
+      "UserPrefsReader::Run", reader, &UserPrefsReader::Run));
+  if (NS_SUCCEEDED(rv)) {
+    sUserPrefsReader = std::move(reader);
+  }
+}
+
+/* static */
+already_AddRefed<nsIFile> Preferences::SetPrefFileForTesting(
+    nsIFile* aFile, bool aReadOffMainThread) {
+  MOZ_ASSERT(XRE_IsParentProcess());
+  MOZ_ASSERT(NS_IsMainThread());
+  MOZ_RELEASE_ASSERT(InitStaticMembers());
+
+  PreferencesWriter::Flush();
+  // Let the test change preferences.allow.incremental-write.
+  sAllowIncrementalPrefWrite = -1;
+
+  nsCOMPtr<nsIFile> previous = std::move(sPreferences->mCurrentFile);
+  if (aFile) {
+    if (aReadOffMainThread) {
+      StartReadingPrefFile(aFile);
+    }
+    sPreferences->ReadSavedPrefs(aFile);
+  }
+
+  sPreferences->mDirty = false;
+  sPreferences->mDirtyPrefs.Clear();
+  sPreferences->mCurrentFile = aFile;
+  return previous.forget();
+}
+
+/* static */
+void Preferences::RestorePrefFileForTesting(already_AddRefed<nsIFile> aFile) {
+  MOZ_ASSERT(XRE_IsParentProcess());
+  MOZ_ASSERT(NS_IsMainThread());
+  MOZ_RELEASE_ASSERT(InitStaticMembers());
+
+  PreferencesWriter::Flush();
+  sAllowIncrementalPrefWrite = -1;
+
+  // The length of the journal of aFile isn't known without reading it, so
+  // the next save is a full one.
+  sPreferences->mNeedsFullSave = true;
+  sPreferences->mDirty = false;
+  sPreferences->mDirtyPrefs.Clear();
+  sPreferences->mCurrentFile = aFile;
+}
+
+/* static */
+void Preferences::FlushPrefFileForTesting() { PreferencesWriter::Flush(); }
+
 /* static */
 void Preferences::InitializeUserPrefs() {
   MOZ_ASSERT(XRE_IsParentProcess());
@@ -3929,6 +4407,7 @@ void Preferences::InitializeUserPrefs() {
   sPreferences->ReadUserOverridePrefs();
 
   sPreferences->mDirty = false;
+  sPreferences->mDirtyPrefs.Clear();
 
   // Don't set mCurrentFile until we're done so that dirty flags work properly.
   sPreferences->mCurrentFile = std::move(prefsFile);
@@ -4055,6 +4534,16 @@ bool Preferences::AllowOffMainThreadSave() {
   return !!sAllowOMTPrefWrite;
 }
 
+bool Preferences::AllowIncrementalSave() {
+  if (sAllowIncrementalPrefWrite < 0) {
+    bool value = false;
+    Preferences::GetBool("preferences.allow.incremental-write", &value);
+    sAllowIncrementalPrefWrite = value ? 1 : 0;
+  }
+
+  return sAllowIncrementalPrefWrite && AllowOffMainThreadSave();
+}
+
 nsresult Preferences::SavePrefFileBlocking() {
   if (mDirty) {
     return SavePrefFileInternal(nullptr, SaveMethod::Blocking);
@@ -4382,25 +4871,85 @@ already_AddRefed<nsIFile> Preferences::ReadSavedPrefs() {
     return nullptr;
   }
 
-  rv = openPrefFile(file, PrefValueKind::User);
+  ReadSavedPrefs(file);
+  return file.forget();
+}
+
+void Preferences::ReadSavedPrefs(nsIFile* aFile) {
+  uint32_t generation = 0;
+  nsresult rv = openUserPrefFile(aFile, &generation);
   if (rv == NS_ERROR_FILE_NOT_FOUND) {
     // This is a normal case for new users.
     rv = NS_OK;
   } else {
     // Store the last modified time of the file while we've got it.
     // We don't really care if this fails.
-    Unused << file->GetLastModifiedTime(&mUserPrefsFileLastModifiedAtStartup);
+    Unused << aFile->GetLastModifiedTime(&mUserPrefsFileLastModifiedAtStartup);
 
     if (NS_FAILED(rv)) {
       // Save a backup copy of the current (invalid) prefs file, since all prefs
       // from the error line to the end of the file will be lost (bug 361102).
       // TODO we should notify the user about it (bug 523725).
       glean::preferences::prefs_file_was_invalid.Set(true);
-      MakeBackupPrefFile(file);
+      MakeBackupPrefFile(aFile);
     }
   }
 
-  return file.forget();
+  PreferencesWriter::SetGeneration(generation);
+  ReadPrefFileJournal(aFile, generation);
+  if (NS_FAILED(rv)) {
+    // Rewrite the file rather than appending to its journal, so that we don't
+    // trip over the same error on the next startup.
+    mNeedsFullSave = true;
+  }
+}
+
+void Preferences::ReadPrefFileJournal(nsIFile* aFile, uint32_t aGeneration) {
+  mNeedsFullSave = !AllowIncrementalSave();
+  mJournalLength = 0;
+
+  nsCOMPtr<nsIFile> journal = GetPrefFileJournal(aFile);
+  if (!journal) {
+    mNeedsFullSave = true;
+    return;
+  }
+
+  nsCOMPtr<nsIInputStream> stream;
+  nsresult rv = NS_NewLocalFileInputStream(getter_AddRefs(stream), journal);
+  if (rv == NS_ERROR_FILE_NOT_FOUND) {
+    return;
+  }
+  nsCString data;
+  if (NS_SUCCEEDED(rv)) {
+    rv = NS_ReadInputStreamToString(stream, data, -1);
+  }
+  if (NS_FAILED(rv)) {
+    mNeedsFullSave = true;
+    return;
+  }
+
+  if (GetPrefFileGeneration(data) != aGeneration) {
+    // The file was rewritten after the last append, and we crashed before the
+    // journal was removed. Everything in it is already in the file, possibly
+    // with newer values.
+    return;
+  }
+
+  nsAutoString path;
+  journal->GetPath(path);
+
+  ParsedPrefs prefs;
+  if (!Parser::ParseInto(PrefValueKind::User, NS_ConvertUTF16toUTF8(path).get(),
+                         data, prefs)) {
+    // The last append was probably cut short by a crash, which isn't worth
+    // reporting. Nothing can be appended after it, so the next save has to
+    // rewrite the prefs file.
+    NS_WARNING("Truncated prefs journal");
+    prefs.ClearErrors();
+    mNeedsFullSave = true;
+  }
+  prefs.Apply();
+  mJournalLength = prefs.Length();
 }
 
 void Preferences::ReadUserOverridePrefs() {
@@ -4476,7 +5025,16 @@ nsresult Preferences::SavePrefFileInternal(nsIFile* aFile,
     // It's possible that we never got a prefs file.
     nsresult rv = NS_OK;
     if (mCurrentFile) {
-      rv = WritePrefFile(mCurrentFile, aSaveMethod);
+      if (aSaveMethod != SaveMethod::Asynchronous || !AppendPrefFileJournal()) {
+        rv = WritePrefFile(mCurrentFile, aSaveMethod);
+        if (NS_SUCCEEDED(rv)) {
+          // The write removes the journal. If it fails later on, the writer
+          // calls HandleDirty(), which asks for another full write.
+          mDirtyPrefs.Clear();
+          mJournalLength = 0;
+          mNeedsFullSave = !AllowIncrementalSave();
+        }
+      }
     }
 
     // If we succeeded writing to mCurrentFile, reset the dirty flag.
@@ -4492,6 +5050,55 @@ nsresult Preferences::SavePrefFileInternal(nsIFile* aFile,
   }
 }
 
+bool Preferences::AppendPrefFileJournal() {
+  MOZ_ASSERT(mCurrentFile);
+
+  // A write which is queued but hasn't started yet may be a full one, which
+  // must not be replaced by a partial one. Just replace it with another full
+  // write instead.
+  if (mNeedsFullSave || PreferencesWriter::sPendingWriteData) {
+    return false;
+  }
+  if (mDirtyPrefs.IsEmpty()) {
+    return true;
+  }
+
+  UniquePtr<PrefWriteData> prefs = MakeUnique<PrefWriteData>();
+  prefs->mIsJournal = true;
+  prefs->mIsCurrentFile = true;
+  if (!pref_saveDirtyPrefs(mDirtyPrefs, prefs->mPrefs)) {
+    return false;
+  }
+
+  nsresult rv;
+  nsCOMPtr<nsIEventTarget> target =
+      do_GetService(NS_STREAMTRANSPORTSERVICE_CONTRACTID, &rv);
+  if (NS_FAILED(rv)) {
+    return false;
+  }
+
+  uint32_t length = prefs->mPrefs.Length();
+  if (!PreferencesWriter::sPendingWriteData.compareExchange(nullptr,
+                                                            prefs.get())) {
+    return false;
+  }
+  Unused << prefs.release();
+
+  // See WritePrefFile() for the bookkeeping of sPendingWriteCount.
+  PreferencesWriter::sPendingWriteCount++;
+  rv = target->Dispatch(new PWRunnable(mCurrentFile, nullptr),
+                        nsIEventTarget::DISPATCH_NORMAL);
+  if (NS_FAILED(rv)) {
+    PreferencesWriter::sPendingWriteCount--;
+    // The full write we fall back to replaces the data we queued.
+    return false;
+  }
+
+  mDirtyPrefs.Clear();
+  mJournalLength += length;
+  return true;
+}
+
 nsresult Preferences::WritePrefFile(
     nsIFile* aFile, SaveMethod aSaveMethod,
     UniquePtr<MozPromiseHolder<WritePrefFilePromise>>
@@ -4511,7 +5118,8 @@ nsresult Preferences::WritePrefFile(
   AUTO_PROFILER_LABEL("Preferences::WritePrefFile", OTHER);
 
   if (AllowOffMainThreadSave()) {
-    UniquePtr<PrefSaveData> prefs = MakeUnique<PrefSaveData>(pref_savePrefs());
+    UniquePtr<PrefWriteData> prefs = MakeUnique<PrefWriteData>();
+    prefs->mPrefs = pref_savePrefs();
 
     nsresult rv = NS_OK;
     bool writingToCurrent = false;
@@ -4522,6 +5130,7 @@ nsresult Preferences::WritePrefFile(
         REJECT_IF_PROMISE_HOLDER_EXISTS(rv);
       }
     }
+    prefs->mIsCurrentFile = writingToCurrent;
 
     // Put the newly constructed preference data into sPendingWriteData
     // for the next request to pick up
@@ -4582,7 +5191,11 @@ nsresult Preferences::WritePrefFile(
   // This will do a main thread write. It is safe to do it this way because
   // AllowOffMainThreadSave() returns a consistent value for the lifetime of
   // the parent process.
-  PrefSaveData prefsData = pref_savePrefs();
+  PrefWriteData prefsData{pref_savePrefs()};
+  if (mCurrentFile &&
+      NS_FAILED(mCurrentFile->Equals(aFile, &prefsData.mIsCurrentFile))) {
+    prefsData.mIsCurrentFile = false;
+  }
 
   // If we were given a MozPromiseHolder, this means the caller is attempting
   // to write prefs asynchronously to the disk - but if we get here, it means
@@ -4605,12 +5218,21 @@ nsresult Preferences::WritePrefFile(
 #undef REJECT_IF_PROMISE_HOLDER_EXISTS
 }
 
-static nsresult openPrefFile(nsIFile* aFile, PrefValueKind aKind) {
+static nsresult openPrefFile(nsIFile* aFile, PrefValueKind aKind,
+                             uint32_t* aGeneration) {
   MOZ_ASSERT(XRE_IsParentProcess());
 
+  if (aGeneration) {
+    *aGeneration = 0;
+  }
+
   nsCString data;
   MOZ_TRY_VAR(data, URLPreloader::ReadFile(aFile));
 
+  if (aGeneration) {
+    *aGeneration = GetPrefFileGeneration(data);
+  }
+
   nsAutoString filenameUtf16;
   aFile->GetLeafName(filenameUtf16);
   NS_ConvertUTF16toUTF8 filename(filenameUtf16);
@@ -5368,7 +5990,7 @@ nsresult Preferences::ClearUser(const char* aPrefName) {
       NotifyCallbacks(nsDependentCString{aPrefName}, PrefWrapper(pref));
     }
 
-    Preferences::HandleDirty();
+    Preferences::HandleDirty(aPrefName);
   }
   return NS_OK;
 }
@@ -24,6 +24,7 @@
 #include "nsIPrefService.h"
 #include "nsString.h"
 #include "nsTArray.h"
+#include "nsTHashSet.h"
 #include "nsWeakReference.h"
 #include "nsXULAppAPI.h"
 #include <atomic>
@@ -111,6 +112,10 @@ class Preferences final : public nsIPrefService,
   // Returns true if the Preferences service is available, false otherwise.
   static bool IsServiceAvailable();
 
+  // Starts reading prefs.js on a background thread, once the profile is known,
+  // so that InitializeUserPrefs() only has to apply its contents.
+  static void StartReadingUserPrefs();
+
   // Initialize user prefs from prefs.js/user.js
   static void InitializeUserPrefs();
   static void FinishInitializingUserPrefs();
@@ -427,7 +432,9 @@ class Preferences final : public nsIPrefService,
   static void AddSizeOfIncludingThis(mozilla::MallocSizeOf aMallocSizeOf,
                                      PrefsSizes& aSizes);
 
-  static void HandleDirty();
+  // Notes that the user preferences need saving. aPrefName is the preference
+  // whose user value changed, if there is a single one.
+  static void HandleDirty(const char* aPrefName = nullptr);
 
   // Explicitly choosing synchronous or asynchronous (if allowed) preferences
   // file write. Only for the default file.  The guarantee for the "blocking"
@@ -439,6 +446,27 @@ class Preferences final : public nsIPrefService,
   // If this is false, only blocking writes, on main thread are allowed.
   bool AllowOffMainThreadSave();
 
+  // If this is true, asynchronous saves only append the preferences which
+  // changed to a journal next to the prefs file, which is compacted into the
+  // prefs file once it grows too long.
+  bool AllowIncrementalSave();
+
+  // Only for tests. Loads aFile and its journal like InitializeUserPrefs()
+  // does, without clearing the current user preferences first, and saves user
+  // preferences to it from now on. If aReadOffMainThread is true, aFile is
+  // parsed on a background thread like at startup. Returns the file user
+  // preferences were saved to until now.
+  static already_AddRefed<nsIFile> SetPrefFileForTesting(
+      nsIFile* aFile, bool aReadOffMainThread);
+
+  // Only for tests. Saves user preferences to aFile from now on, without
+  // reading it, to go back to the file SetPrefFileForTesting() returned once
+  // the preferences it loaded have been cleared.
+  static void RestorePrefFileForTesting(already_AddRefed<nsIFile> aFile);
+
+  // Only for tests. Waits for the pending writes of preferences files.
+  static void FlushPrefFileForTesting();
+
  private:
   ~Preferences();
 
@@ -447,6 +475,14 @@ class Preferences final : public nsIPrefService,
   // Loads the prefs.js file from the profile, or creates a new one. Returns
   // the prefs file if successful, or nullptr on failure.
   already_AddRefed<nsIFile> ReadSavedPrefs();
+  void ReadSavedPrefs(nsIFile* aFile);
+
+  // Starts parsing aFile on a background thread, for ReadSavedPrefs().
+  static void StartReadingPrefFile(nsIFile* aFile);
+
+  // Loads the journal of the given prefs file, if present and of the given
+  // generation of the file.
+  void ReadPrefFileJournal(nsIFile* aFile, uint32_t aGeneration);
 
   // Loads the user.js file from the profile if present.
   void ReadUserOverridePrefs();
@@ -461,6 +497,9 @@ class Preferences final : public nsIPrefService,
   nsresult WritePrefFile(
       nsIFile* aFile, SaveMethod aSaveMethod,
       UniquePtr<MozPromiseHolder<WritePrefFilePromise>> aPromise = nullptr);
+  // Queues an asynchronous append of mDirtyPrefs to the journal of
+  // mCurrentFile. Returns false if the file must be written in full instead.
+  bool AppendPrefFileJournal();
 
   nsresult ResetUserPrefs();
 
@@ -533,6 +572,13 @@ class Preferences final : public nsIPrefService,
   // We wait a bit after prefs are dirty before writing them. In this period,
   // mDirty and mSavePending will both be true.
   bool mSavePending = false;
+  // The preferences whose user values changed since mCurrentFile or its
+  // journal were last written. Only tracked while mNeedsFullSave is false,
+  // i.e. while the next save can be an incremental one.
+  nsTHashSet<nsCString> mDirtyPrefs;
+  bool mNeedsFullSave = true;
+  // The number of entries in the journal of mCurrentFile.
+  uint32_t mJournalLength = 0;
 
   nsCOMPtr<nsIPrefBranch> mRootBranch;
   nsCOMPtr<nsIPrefBranch> mDefaultRootBranch;
@@ -8,7 +8,7 @@
 
 #include "mozilla/dom/ipc/MemMapSnapshot.h"
 
-#include "mozilla/BinarySearch.h"
+#include "mozilla/PerfectHash.h"
 #include "mozilla/ResultExtensions.h"
 #include "mozilla/Try.h"
 #include "mozilla/ipc/FileDescriptor.h"
@@ -66,14 +66,26 @@ Maybe<const SharedPrefMap::Pref> SharedPrefMap::Get(const char* aKey) const {
 }
 
 bool SharedPrefMap::Find(const char* aKey, size_t* aIndex) const {
-  const auto& keys = KeyTable();
-
-  return BinarySearchIf(
-      Entries(), 0, EntryCount(),
-      [&](const Entry& aEntry) {
-        return strcmp(aKey, keys.GetBare(aEntry.mKey));
-      },
-      aIndex);
+  using perfecthash::FNV_OFFSET_BASIS;
+  using perfecthash::Hash;
+
+  uint32_t count = EntryCount();
+  if (!count) {
+    return false;
+  }
+
+  size_t length = strlen(aKey);
+  uint32_t basis = KeyHashBases()[Hash(FNV_OFFSET_BASIS, aKey, length) % count];
+  uint32_t index = KeyHashIndices()[Hash(basis, aKey, length) % count];
+
+  const Entry& entry = Entries()[index];
+  if (entry.mKey.mLength != length ||
+      memcmp(KeyTable().GetBare(entry.mKey), aKey, length)) {
+    return false;
+  }
+
+  *aIndex = index;
+  return true;
 }
 
 void SharedPrefMapBuilder::Add(const nsCString& aKey, const Flags& aFlags,
@@ -141,12 +153,80 @@ void SharedPrefMapBuilder::Add(const nsCString& aKey, const Flags& aFlags,
   });
 }
 
+// This uses the same hash-and-displace scheme as perfecthash.py: names are
+// bucketed by their hash with the default FNV basis, then, starting with the
+// largest bucket, each bucket is given the first basis which moves all of its
+// names to distinct free slots. Names must be unique.
+/* static */
+void SharedPrefMapBuilder::BuildKeyHash(const nsTArray<Entry*>& aEntries,
+                                        nsTArray<uint32_t>& aBases,
+                                        nsTArray<uint32_t>& aIndices) {
+  using perfecthash::FNV_OFFSET_BASIS;
+  using perfecthash::Hash;
+
+  uint32_t count = aEntries.Length();
+  aBases.InsertElementsAt(0, count, 0);
+  aIndices.InsertElementsAt(0, count, 0);
+
+  nsTArray<nsTArray<uint32_t>> buckets(count);
+  nsTArray<uint32_t> bucketOrder(count);
+  for (uint32_t i = 0; i < count; i++) {
+    buckets.AppendElement();
+    bucketOrder.AppendElement(i);
+  }
+  for (uint32_t i = 0; i < count; i++) {
+    const Entry* entry = aEntries[i];
+    uint32_t hash =
+        Hash(FNV_OFFSET_BASIS, entry->mKeyString, entry->mKey.mLength);
+    buckets[hash % count].AppendElement(i);
+  }
+  bucketOrder.Sort([&](uint32_t aA, uint32_t aB) {
+    return int(buckets[aB].Length()) - int(buckets[aA].Length());
+  });
+
+  nsTArray<bool> usedSlots;
+  usedSlots.InsertElementsAt(0, count, false);
+
+  AutoTArray<uint32_t, 8> slots;
+  for (uint32_t bucketIndex : bucketOrder) {
+    const auto& bucket = buckets[bucketIndex];
+    if (bucket.IsEmpty()) {
+      break;
+    }
+
+    for (uint32_t basis = 1;; basis++) {
+      MOZ_RELEASE_ASSERT(basis != 0, "Duplicate preference names?");
+
+      slots.ClearAndRetainStorage();
+      for (uint32_t i : bucket) {
+        const Entry* entry = aEntries[i];
+        uint32_t slot =
+            Hash(basis, entry->mKeyString, entry->mKey.mLength) % count;
+        if (usedSlots[slot] || slots.Contains(slot)) {
+          break;
+        }
+        slots.AppendElement(slot);
+      }
+      if (slots.Length() != bucket.Length()) {
+        continue;
+      }
+
+      aBases[bucketIndex] = basis;
+      for (uint32_t i = 0; i < slots.Length(); i++) {
+        usedSlots[slots[i]] = true;
+        aIndices[slots[i]] = bucket[i];
+      }
+      break;
+    }
+  }
+}
+
 Result<ReadOnlySharedMemoryHandle, nsresult> SharedPrefMapBuilder::Finalize() {
   using Header = SharedPrefMap::Header;
 
   // Create an array of entry pointers for the entry array, and sort it by
-  // preference name prior to serialization, so that entries can be looked up
-  // using binary search.
+  // preference name prior to serialization, so that GetKeyAt() and iteration
+  // return entries in order.
   nsTArray<Entry*> entries(mEntries.Length());
   for (auto& entry : mEntries) {
     entries.AppendElement(&entry);
@@ -155,6 +235,10 @@ Result<ReadOnlySharedMemoryHandle, nsresult> SharedPrefMapBuilder::Finalize() {
     return strcmp(aA->mKeyString, aB->mKeyString);
   });
 
+  nsTArray<uint32_t> keyHashBases;
+  nsTArray<uint32_t> keyHashIndices;
+  BuildKeyHash(entries, keyHashBases, keyHashIndices);
+
   Header header = {uint32_t(entries.Length())};
 
   size_t offset = sizeof(header);
@@ -162,6 +246,15 @@ Result<ReadOnlySharedMemoryHandle, nsresult> SharedPrefMapBuilder::Finalize() {
 
   offset += entries.Length() * sizeof(SharedPrefMap::Entry);
 
+  offset += GetAlignmentOffset(offset, alignof(uint32_t));
+  header.mKeyHashBases.mOffset = offset;
+  header.mKeyHashBases.mSize = keyHashBases.Length() * sizeof(uint32_t);
+  offset += header.mKeyHashBases.mSize;
+
+  header.mKeyHashIndices.mOffset = offset;
+  header.mKeyHashIndices.mSize = keyHashIndices.Length() * sizeof(uint32_t);
+  offset += header.mKeyHashIndices.mSize;
+
   header.mKeyStrings.mOffset = offset;
   header.mKeyStrings.mSize = mKeyTable.Size();
   offset += header.mKeyStrings.mSize;
@@ -214,6 +307,11 @@ Result<ReadOnlySharedMemoryHandle, nsresult> SharedPrefMapBuilder::Finalize() {
 
   auto ptr = mem.Get<uint8_t>();
 
+  memcpy(&ptr[header.mKeyHashBases.mOffset], keyHashBases.Elements(),
+         header.mKeyHashBases.mSize);
+  memcpy(&ptr[header.mKeyHashIndices.mOffset], keyHashIndices.Elements(),
+         header.mKeyHashIndices.mSize);
+
   mKeyTable.Write({&ptr[header.mKeyStrings.mOffset], header.mKeyStrings.mSize});
 
   mValueStringTable.Write(
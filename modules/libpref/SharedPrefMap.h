@@ -44,10 +44,10 @@ class SharedPrefMapBuilder;
 // whereas if we returned a nsDependentCString or a dynamically allocated
 // nsCString, it would.
 //
-// The set of entries is stored in sorted order by preference name, so look-ups
-// are done by binary search. This means that look-ups have O(log n) complexity,
-// rather than the O(1) complexity of a dynamic hashtable. Consumers should keep
-// this in mind when planning their accesses.
+// The set of entries is stored in sorted order by preference name, alongside a
+// minimal perfect hash of the names which is computed when the map is built.
+// A look-up hashes the name twice and then makes a single string comparison,
+// so it takes the same time regardless of the size of the map.
 //
 // Important: The mapped memory created by this class is persistent. Once an
 // instance has been initialized, the memory that it allocates can never be
@@ -237,6 +237,18 @@ class SharedPrefMap {
     // in the map.
     DataBlock mKeyStrings;
 
+    // The minimal perfect hash of the preference names, as two uint32_t arrays
+    // with mEntryCount elements each. The index of a name's entry is:
+    //
+    //   basis = mKeyHashBases[Hash(FNV_OFFSET_BASIS, name) % mEntryCount]
+    //   index = mKeyHashIndices[Hash(basis, name) % mEntryCount]
+    //
+    // where Hash() is the FNV hash from mozilla/PerfectHash.h. Names which are
+    // not in the map also map to some entry, so callers must compare the
+    // entry's name with the one they are looking for.
+    DataBlock mKeyHashBases;
+    DataBlock mKeyHashIndices;
+
     // The int32_t arrays of user and default int preference values. Entries in
     // the map store their values as indices into these arrays.
     DataBlock mUserIntValues;
@@ -534,6 +546,13 @@ class SharedPrefMap {
         .ReinterpretCast<const T>();
   }
 
+  RangedPtr<const uint32_t> KeyHashBases() const {
+    return GetBlock<uint32_t>(GetHeader().mKeyHashBases);
+  }
+  RangedPtr<const uint32_t> KeyHashIndices() const {
+    return GetBlock<uint32_t>(GetHeader().mKeyHashIndices);
+  }
+
   RangedPtr<const int32_t> DefaultIntValues() const {
     return GetBlock<int32_t>(GetHeader().mDefaultIntValues);
   }
@@ -821,6 +840,12 @@ class MOZ_RAII SharedPrefMapBuilder {
     uint8_t mIsSkippedByIteration : 1;
   };
 
+  // Computes the contents of the mKeyHashBases and mKeyHashIndices blocks
+  // described in SharedPrefMap::Header for the given sorted entries.
+  static void BuildKeyHash(const nsTArray<Entry*>& aEntries,
+                           nsTArray<uint32_t>& aBases,
+                           nsTArray<uint32_t>& aIndices);
+
   // Converts a builder Value struct to a SharedPrefMap::Value struct for
   // serialization. This must not be called before callers have finished adding
   // entries to the value array builders.
@@ -0,0 +1,284 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+
+#include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/Unused.h"
+#include "nsDirectoryServiceDefs.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsIFile.h"
+#include "nsIPrefService.h"
+#include "nsNetUtil.h"
+#include "nsPrintfCString.h"
+#include "nsString.h"
+#include "prio.h"
+
+using namespace mozilla;
+
+namespace {
+
+const char kJournalPrefA[] = "test.prefs_journal.a";
+const char kJournalPrefB[] = "test.prefs_journal.b";
+const char kJournalPrefC[] = "test.prefs_journal.c";
+const char kJournalPrefD[] = "test.prefs_journal.d";
+
+const char* const kJournalTestPrefs[] = {kJournalPrefA, kJournalPrefB,
+                                         kJournalPrefC, kJournalPrefD};
+
+nsCString ReadJournalTestFile(nsIFile* aFile) {
+  nsCString data;
+  nsCOMPtr<nsIInputStream> stream;
+  if (NS_SUCCEEDED(NS_NewLocalFileInputStream(getter_AddRefs(stream), aFile))) {
+    MOZ_ALWAYS_SUCCEEDS(NS_ReadInputStreamToString(stream, data, -1));
+  }
+  return data;
+}
+
+void WriteJournalTestFile(nsIFile* aFile, const nsACString& aData,
+                          bool aAppend) {
+  PRFileDesc* fd;
+  MOZ_ALWAYS_SUCCEEDS(aFile->OpenNSPRFileDesc(
+      PR_WRONLY | PR_CREATE_FILE | (aAppend ? PR_APPEND : PR_TRUNCATE), 0600,
+      &fd));
+  nsCString data(aData);
+  MOZ_RELEASE_ASSERT(PR_Write(fd, data.get(), int32_t(data.Length())) ==
+                     int32_t(data.Length()));
+  PR_Close(fd);
+}
+
+bool JournalTestFileContains(nsIFile* aFile, const char* aString) {
+  return ReadJournalTestFile(aFile).Find(aString) != kNotFound;
+}
+
+}  // namespace
+
+// Saves user preferences to a prefs.js of its own, with incremental saves
+// enabled, and "restarts" by forgetting the test preferences and reading them
+// back from it.
+class TestPrefsJournal : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_NS_SUCCEEDED(
+        NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(mDir)));
+    ASSERT_NS_SUCCEEDED(mDir->AppendNative("TestPrefsJournal"_ns));
+    ASSERT_NS_SUCCEEDED(mDir->CreateUnique(nsIFile::DIRECTORY_TYPE, 0700));
+    ASSERT_NS_SUCCEEDED(mDir->Clone(getter_AddRefs(mFile)));
+    ASSERT_NS_SUCCEEDED(mFile->AppendNative("prefs.js"_ns));
+    ASSERT_NS_SUCCEEDED(mDir->Clone(getter_AddRefs(mJournal)));
+    ASSERT_NS_SUCCEEDED(mJournal->AppendNative("prefs.js-journal"_ns));
+
+    ASSERT_NS_SUCCEEDED(
+        Preferences::SetBool("preferences.allow.incremental-write", true));
+    mPreviousFile = Preferences::SetPrefFileForTesting(mFile, false);
+  }
+
+  void TearDown() override {
+    Unused << Preferences::SetPrefFileForTesting(nullptr, false);
+    ClearTestPrefs();
+    Preferences::ClearUser("preferences.allow.incremental-write");
+    Preferences::ClearUser("preferences.incremental-write.max-journal-length");
+    Preferences::RestorePrefFileForTesting(mPreviousFile.forget());
+    mDir->Remove(true);
+  }
+
+  static void ClearTestPrefs() {
+    for (const char* name : kJournalTestPrefs) {
+      Preferences::ClearUser(name);
+    }
+  }
+
+  void Restart(bool aReadOffMainThread = false) {
+    Unused << Preferences::SetPrefFileForTesting(nullptr, false);
+    ClearTestPrefs();
+    Unused << Preferences::SetPrefFileForTesting(mFile, aReadOffMainThread);
+  }
+
+  // An asynchronous save, which can be incremental.
+  static void Save() {
+    ASSERT_NS_SUCCEEDED(Preferences::GetService()->SavePrefFile(nullptr));
+    Preferences::FlushPrefFileForTesting();
+  }
+
+  // A blocking save, which is always a full one.
+  static void SaveBlocking() {
+    RefPtr<Preferences> prefs = Preferences::GetInstanceForService();
+    ASSERT_NS_SUCCEEDED(prefs->SavePrefFileBlocking());
+    Preferences::FlushPrefFileForTesting();
+  }
+
+  bool JournalExists() {
+    bool exists = false;
+    MOZ_ALWAYS_SUCCEEDS(mJournal->Exists(&exists));
+    return exists;
+  }
+
+  nsCOMPtr<nsIFile> mDir;
+  nsCOMPtr<nsIFile> mFile;
+  nsCOMPtr<nsIFile> mJournal;
+  nsCOMPtr<nsIFile> mPreviousFile;
+};
+
+TEST_F(TestPrefsJournal, AppendThenReplay)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Save();
+  EXPECT_TRUE(JournalTestFileContains(mJournal, kJournalPrefA));
+  EXPECT_FALSE(JournalTestFileContains(mFile, kJournalPrefA));
+
+  Preferences::SetInt(kJournalPrefA, 2);
+  Preferences::SetCString(kJournalPrefB, "b"_ns);
+  Save();
+  EXPECT_FALSE(JournalTestFileContains(mFile, kJournalPrefA));
+
+  Restart();
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefA));
+  nsAutoCString value;
+  EXPECT_NS_SUCCEEDED(Preferences::GetCString(kJournalPrefB, value));
+  EXPECT_TRUE(value.EqualsLiteral("b"));
+}
+
+TEST_F(TestPrefsJournal, TruncatedLastRecord)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Save();
+  Preferences::SetInt(kJournalPrefB, 2);
+  Save();
+  WriteJournalTestFile(mJournal, "user_pref(\"test.prefs_journal.c\", 3"_ns,
+                       /* aAppend */ true);
+
+  // The records before the truncated one are replayed.
+  Restart();
+  EXPECT_EQ(1, Preferences::GetInt(kJournalPrefA));
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefB));
+  EXPECT_FALSE(Preferences::HasUserValue(kJournalPrefC));
+
+  // Nothing can be appended after it, so the next save is a full one.
+  Preferences::SetInt(kJournalPrefD, 4);
+  Save();
+  EXPECT_FALSE(JournalExists());
+  EXPECT_TRUE(JournalTestFileContains(mFile, kJournalPrefA));
+  EXPECT_TRUE(JournalTestFileContains(mFile, kJournalPrefD));
+
+  Restart();
+  EXPECT_EQ(1, Preferences::GetInt(kJournalPrefA));
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefB));
+  EXPECT_EQ(4, Preferences::GetInt(kJournalPrefD));
+}
+
+TEST_F(TestPrefsJournal, FullWriteClearsJournal)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Save();
+  EXPECT_TRUE(JournalExists());
+
+  Preferences::SetInt(kJournalPrefB, 2);
+  SaveBlocking();
+  EXPECT_FALSE(JournalExists());
+  EXPECT_TRUE(JournalTestFileContains(mFile, kJournalPrefA));
+  EXPECT_TRUE(JournalTestFileContains(mFile, kJournalPrefB));
+
+  Restart();
+  EXPECT_EQ(1, Preferences::GetInt(kJournalPrefA));
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefB));
+}
+
+TEST_F(TestPrefsJournal, StaleJournalIsIgnored)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Save();
+  nsCString staleJournal = ReadJournalTestFile(mJournal);
+
+  // As if we crashed after the full write replaced prefs.js, but before it
+  // removed the journal.
+  Preferences::SetInt(kJournalPrefA, 2);
+  SaveBlocking();
+  WriteJournalTestFile(mJournal, staleJournal, /* aAppend */ false);
+
+  Restart();
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefA));
+
+  // The next append starts the journal over.
+  Preferences::SetInt(kJournalPrefB, 3);
+  Save();
+  EXPECT_FALSE(JournalTestFileContains(mJournal, kJournalPrefA));
+  EXPECT_TRUE(JournalTestFileContains(mJournal, kJournalPrefB));
+
+  Restart();
+  EXPECT_EQ(2, Preferences::GetInt(kJournalPrefA));
+  EXPECT_EQ(3, Preferences::GetInt(kJournalPrefB));
+}
+
+TEST_F(TestPrefsJournal, ClearedPrefDoesNotComeBack)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Save();
+  EXPECT_TRUE(JournalTestFileContains(mJournal, kJournalPrefA));
+
+  // The journal can't express the clear, so the file is rewritten without it.
+  Preferences::ClearUser(kJournalPrefA);
+  Save();
+  EXPECT_FALSE(JournalExists());
+  EXPECT_FALSE(JournalTestFileContains(mFile, kJournalPrefA));
+
+  Restart();
+  EXPECT_FALSE(Preferences::HasUserValue(kJournalPrefA));
+}
+
+TEST_F(TestPrefsJournal, MaxJournalLength)
+{
+  // This is the first entry in the journal.
+  Preferences::SetUint("preferences.incremental-write.max-journal-length", 4);
+  Save();
+
+  Preferences::SetInt(kJournalPrefA, 1);
+  Preferences::SetInt(kJournalPrefB, 2);
+  Save();
+  EXPECT_TRUE(JournalTestFileContains(mJournal, kJournalPrefB));
+  EXPECT_FALSE(JournalTestFileContains(mFile, kJournalPrefB));
+
+  // The fifth entry doesn't fit, so the journal is compacted into prefs.js.
+  Preferences::SetInt(kJournalPrefC, 3);
+  Preferences::SetInt(kJournalPrefD, 4);
+  Save();
+  EXPECT_FALSE(JournalExists());
+  for (const char* name : kJournalTestPrefs) {
+    EXPECT_TRUE(JournalTestFileContains(mFile, name)) << name;
+  }
+
+  Restart();
+  EXPECT_EQ(1, Preferences::GetInt(kJournalPrefA));
+  EXPECT_EQ(4, Preferences::GetInt(kJournalPrefD));
+}
+
+TEST_F(TestPrefsJournal, OffMainThreadRead)
+{
+  Preferences::SetInt(kJournalPrefA, 1);
+  Preferences::SetCString(kJournalPrefB, "b"_ns);
+  Preferences::SetInt(kJournalPrefD, 4);
+  SaveBlocking();
+  Preferences::SetInt(kJournalPrefA, 2);
+  Preferences::SetBool(kJournalPrefC, true);
+  Save();
+  EXPECT_TRUE(JournalExists());
+
+  auto state = [] {
+    nsAutoCString b;
+    Preferences::GetCString(kJournalPrefB, b);
+    return nsPrintfCString("%d %s %d %d", Preferences::GetInt(kJournalPrefA),
+                           b.get(), Preferences::GetBool(kJournalPrefC),
+                           Preferences::HasUserValue(kJournalPrefD));
+  };
+
+  Restart(/* aReadOffMainThread */ false);
+  nsCString syncState(state());
+  EXPECT_TRUE(syncState.EqualsLiteral("2 b 1 1")) << syncState.get();
+
+  Restart(/* aReadOffMainThread */ true);
+  nsCString omtState(state());
+  EXPECT_TRUE(omtState.Equals(syncState)) << omtState.get();
+}
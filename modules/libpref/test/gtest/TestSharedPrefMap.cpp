@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <iterator>
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "mozilla/BinarySearch.h"
+#include "mozilla/RefPtr.h"
+#include "nsPrintfCString.h"
+#include "nsTArray.h"
+#include "SharedPrefMap.h"
+
+using namespace mozilla;
+
+namespace {
+
+// Roughly the shape of a real preference database: a few thousand dotted
+// names sharing long common prefixes.
+static const uint32_t kPrefCount = 5000;
+
+static void MakeNames(nsTArray<nsCString>& aNames) {
+  static const char* const kBranches[] = {
+      "browser.", "dom.",     "gfx.",     "javascript.options.", "layout.",
+      "media.",   "network.", "privacy.", "security.",           "ui.",
+  };
+  for (uint32_t i = 0; i < kPrefCount; i++) {
+    aNames.AppendElement(nsPrintfCString(
+        "%ssection%u.pref%u", kBranches[i % std::size(kBranches)], i / 100, i));
+  }
+}
+
+static already_AddRefed<SharedPrefMap> MakeMap(
+    const nsTArray<nsCString>& aNames) {
+  SharedPrefMapBuilder builder;
+  nsCString empty;
+  SharedPrefMapBuilder::Flags flags{};
+  flags.mHasDefaultValue = true;
+  for (uint32_t i = 0; i < aNames.Length(); i++) {
+    switch (i % 3) {
+      case 0:
+        builder.Add(aNames[i], flags, bool(i & 1), false);
+        break;
+      case 1:
+        builder.Add(aNames[i], flags, int32_t(i), 0);
+        break;
+      default:
+        builder.Add(aNames[i], flags, aNames[i], empty);
+        break;
+    }
+  }
+  return MakeAndAddRef<SharedPrefMap>(std::move(builder));
+}
+
+// How the map found its entries before it had a perfect hash.
+static bool BinarySearchKey(const SharedPrefMap& aMap, const char* aKey,
+                            size_t* aIndex) {
+  struct Keys {
+    const SharedPrefMap& mMap;
+    nsCString operator[](size_t aIndex) const {
+      return mMap.GetKeyAt(aIndex);
+    }
+  };
+  return BinarySearchIf(
+      Keys{aMap}, 0, aMap.Count(),
+      [&](const nsCString& aEntryKey) { return strcmp(aKey, aEntryKey.get()); },
+      aIndex);
+}
+
+}  // namespace
+
+TEST(SharedPrefMap, Lookup)
+{
+  nsTArray<nsCString> names;
+  MakeNames(names);
+  RefPtr<SharedPrefMap> map = MakeMap(names);
+  ASSERT_EQ(kPrefCount, map->Count());
+
+  for (uint32_t i = 0; i < map->Count(); i++) {
+    nsCString key = map->GetKeyAt(i);
+    if (i) {
+      ASSERT_LT(strcmp(map->GetKeyAt(i - 1).get(), key.get()), 0);
+    }
+
+    Maybe<const SharedPrefMap::Pref> pref = map->Get(key);
+    ASSERT_TRUE(pref.isSome());
+    ASSERT_EQ(size_t(i), pref->Index());
+    ASSERT_TRUE(pref->NameString() == key);
+  }
+
+  ASSERT_FALSE(map->Has(""));
+  ASSERT_FALSE(map->Has("browser."));
+  ASSERT_FALSE(map->Has("browser.section0.pref"));
+  ASSERT_FALSE(map->Has("browser.section0.pref00"));
+  ASSERT_FALSE(map->Has("browser.section0.pref0.x"));
+  ASSERT_FALSE(map->Has("dom.section0.pref0"));
+}
+
+TEST(SharedPrefMap, Empty)
+{
+  nsTArray<nsCString> names;
+  RefPtr<SharedPrefMap> map = MakeMap(names);
+  ASSERT_EQ(0u, map->Count());
+  ASSERT_FALSE(map->Has(""));
+  ASSERT_FALSE(map->Has("browser.section0.pref0"));
+}
+
+class SharedPrefMapBench : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    MakeNames(mNames);
+    mMap = MakeMap(mNames);
+  }
+
+  nsTArray<nsCString> mNames;
+  RefPtr<SharedPrefMap> mMap;
+};
+
+MOZ_GTEST_BENCH_F(SharedPrefMapBench, Lookup_PerfectHash, [this] {
+  for (uint32_t i = 0; i < 100; i++) {
+    for (const auto& name : mNames) {
+      ASSERT_TRUE(mMap->Has(name));
+    }
+  }
+});
+
+MOZ_GTEST_BENCH_F(SharedPrefMapBench, Lookup_BinarySearch, [this] {
+  size_t index;
+  for (uint32_t i = 0; i < 100; i++) {
+    for (const auto& name : mNames) {
+      ASSERT_TRUE(BinarySearchKey(*mMap, name.get(), &index));
+    }
+  }
+});
@@ -28,6 +28,16 @@ inline bool operator==(const SocketInfo& a, const SocketInfo& b) {
          a.port == b.port && a.active == b.active && a.type == b.type;
 }
 
+// Load of one socket thread, see nsSocketTransportService::PickShard().
+struct SocketThreadInfo {
+  uint32_t index;
+  uint32_t sockets;
+  // Time since the thread started, and how much of it was spent doing work
+  // rather than waiting in poll(), in milliseconds.
+  uint64_t uptime;
+  uint64_t busy;
+};
+
 struct DnsAndConnectSockets {
   bool speculative;
 };
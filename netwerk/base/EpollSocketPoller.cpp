@@ -0,0 +1,214 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "EpollSocketPoller.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "nsSocketTransportService2.h"
+#include "prerror.h"
+#include "prinrval.h"
+
+namespace mozilla {
+namespace net {
+
+// Upper bound on the number of events collected by a single epoll_wait().
+// The interest set is level-triggered, so whatever doesn't fit is reported
+// again on the next call.
+static const uint32_t kMaxEventsPerWait = 1024;
+
+/* static */
+UniquePtr<EpollSocketPoller> EpollSocketPoller::Create() {
+  int epollFD = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFD < 0) {
+    SOCKET_LOG(("epoll_create1 failed [errno=%d]\n", errno));
+    return nullptr;
+  }
+  return UniquePtr<EpollSocketPoller>(new EpollSocketPoller(epollFD));
+}
+
+EpollSocketPoller::~EpollSocketPoller() { close(mEpollFD); }
+
+bool EpollSocketPoller::Register(int aOSFD, PRFileDesc* aFD,
+                                 uint32_t aEvents) {
+  if (size_t(aOSFD) >= mRegistrations.Length()) {
+    mRegistrations.SetLength(aOSFD + 1);
+  }
+  Registration& reg = mRegistrations[aOSFD];
+  if (reg.mFD == aFD && reg.mEvents == aEvents) {
+    return true;
+  }
+
+  struct epoll_event event = {};
+  event.events = aEvents;
+  event.data.fd = aOSFD;
+  int op = reg.mFD ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  int rv = epoll_ctl(mEpollFD, op, aOSFD, &event);
+  if (rv < 0 && errno == ENOENT) {
+    // The handle was closed (and dropped from the set by the kernel) and
+    // reused since we last saw it.
+    rv = epoll_ctl(mEpollFD, EPOLL_CTL_ADD, aOSFD, &event);
+  } else if (rv < 0 && errno == EEXIST) {
+    rv = epoll_ctl(mEpollFD, EPOLL_CTL_MOD, aOSFD, &event);
+  }
+  if (rv < 0) {
+    SOCKET_LOG(("epoll_ctl failed [fd=%d errno=%d]\n", aOSFD, errno));
+    reg = Registration();
+    return false;
+  }
+
+  reg.mFD = aFD;
+  reg.mEvents = aEvents;
+  return true;
+}
+
+void EpollSocketPoller::Remove(PRFileDesc* aFD) {
+  PRFileDesc* bottom = PR_GetIdentitiesLayer(aFD, PR_NSPR_IO_LAYER);
+  if (!bottom) {
+    return;
+  }
+  int osfd = PR_FileDesc2NativeHandle(bottom);
+  if (osfd < 0 || size_t(osfd) >= mRegistrations.Length() ||
+      mRegistrations[osfd].mFD != aFD) {
+    return;
+  }
+  epoll_ctl(mEpollFD, EPOLL_CTL_DEL, osfd, nullptr);
+  mRegistrations[osfd] = Registration();
+}
+
+int32_t EpollSocketPoller::Poll(PRPollDesc* aPollList, uint32_t aCount,
+                                PRIntervalTime aTimeout) {
+  ++mGeneration;
+  int32_t ready = 0;
+
+  // Ask every layer stack what it needs from the OS, exactly like PR_Poll()
+  // does.  A layer may already be able to satisfy the request (buffered TLS
+  // records, for instance), in which case we must not block.
+  for (uint32_t i = 0; i < aCount; ++i) {
+    PRPollDesc& desc = aPollList[i];
+    desc.out_flags = 0;
+    if (!desc.fd) {
+      continue;
+    }
+
+    int16_t readFlags = 0;
+    int16_t writeFlags = 0;
+    int16_t readOut = 0;
+    int16_t writeOut = 0;
+    if (desc.in_flags & PR_POLL_READ) {
+      readFlags = desc.fd->methods->poll(
+          desc.fd, desc.in_flags & ~PR_POLL_WRITE, &readOut);
+    }
+    if (desc.in_flags & PR_POLL_WRITE) {
+      writeFlags = desc.fd->methods->poll(
+          desc.fd, desc.in_flags & ~PR_POLL_READ, &writeOut);
+    }
+    if ((readFlags & readOut) || (writeFlags & writeOut)) {
+      desc.out_flags = readOut | writeOut;
+      ++ready;
+    }
+
+    PRFileDesc* bottom = PR_GetIdentitiesLayer(desc.fd, PR_NSPR_IO_LAYER);
+    int osfd = bottom ? PR_FileDesc2NativeHandle(bottom) : -1;
+    uint32_t events = 0;
+    if ((readFlags | writeFlags) & PR_POLL_READ) {
+      events |= EPOLLIN;
+    }
+    if ((readFlags | writeFlags) & PR_POLL_WRITE) {
+      events |= EPOLLOUT;
+    }
+    if (desc.in_flags & PR_POLL_EXCEPT) {
+      events |= EPOLLPRI;
+    }
+    if (osfd < 0 || !Register(osfd, desc.fd, events)) {
+      if (!desc.out_flags) {
+        ++ready;
+      }
+      desc.out_flags = PR_POLL_NVAL;
+      continue;
+    }
+
+    Registration& reg = mRegistrations[osfd];
+    reg.mReadFlags = readFlags;
+    reg.mWriteFlags = writeFlags;
+    reg.mIndex = i;
+    reg.mGeneration = mGeneration;
+  }
+
+  int timeout;
+  if (ready) {
+    timeout = 0;
+  } else if (aTimeout == PR_INTERVAL_NO_TIMEOUT) {
+    timeout = -1;
+  } else {
+    timeout = int(PR_IntervalToMilliseconds(aTimeout));
+  }
+
+  mReadyEvents.SetLength(std::clamp(aCount, 1u, kMaxEventsPerWait));
+  int n = epoll_wait(mEpollFD, mReadyEvents.Elements(),
+                     int(mReadyEvents.Length()), timeout);
+  if (n < 0) {
+    if (errno == EINTR) {
+      return ready;
+    }
+    PR_SetError(PR_UNKNOWN_ERROR, errno);
+    return -1;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    const struct epoll_event& event = mReadyEvents[i];
+    Registration& reg = mRegistrations[event.data.fd];
+    if (reg.mGeneration != mGeneration) {
+      // Not part of this call's list; the caller stopped polling it without
+      // telling us.  Drop it, or it would keep waking us up.
+      epoll_ctl(mEpollFD, EPOLL_CTL_DEL, event.data.fd, nullptr);
+      reg = Registration();
+      continue;
+    }
+
+    int16_t flags = 0;
+    if (event.events & EPOLLIN) {
+      if (reg.mReadFlags & PR_POLL_READ) {
+        flags |= PR_POLL_READ;
+      }
+      if (reg.mWriteFlags & PR_POLL_READ) {
+        flags |= PR_POLL_WRITE;
+      }
+    }
+    if (event.events & EPOLLOUT) {
+      if (reg.mReadFlags & PR_POLL_WRITE) {
+        flags |= PR_POLL_READ;
+      }
+      if (reg.mWriteFlags & PR_POLL_WRITE) {
+        flags |= PR_POLL_WRITE;
+      }
+    }
+    if (event.events & EPOLLPRI) {
+      flags |= PR_POLL_EXCEPT;
+    }
+    if (event.events & EPOLLERR) {
+      flags |= PR_POLL_ERR;
+    }
+    if (event.events & EPOLLHUP) {
+      flags |= PR_POLL_HUP;
+    }
+
+    PRPollDesc& desc = aPollList[reg.mIndex];
+    if (flags && !desc.out_flags) {
+      ++ready;
+    }
+    desc.out_flags |= flags;
+  }
+
+  return ready;
+}
+
+}  // namespace net
+}  // namespace mozilla
@@ -0,0 +1,84 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef EpollSocketPoller_h__
+#define EpollSocketPoller_h__
+
+#include "mozilla/UniquePtr.h"
+#include "nsTArray.h"
+#include "prio.h"
+
+struct epoll_event;
+
+namespace mozilla {
+namespace net {
+
+// A drop-in replacement for PR_Poll() backed by a persistent epoll set, used
+// by the socket transport service on Linux.
+//
+// PR_Poll() hands the whole descriptor array to the kernel on every call, so
+// each wakeup costs O(n) in the kernel no matter how few sockets are ready.
+// Here the interest set lives in the kernel between calls: Poll() only issues
+// an epoll_ctl() for the descriptors whose flags changed since the previous
+// call, and epoll_wait() only reports the ready ones.
+//
+// The NSPR semantics are kept: every entry still goes through its layers'
+// poll methods, so that e.g. data buffered by the TLS layer is reported
+// without waiting, and the interest set is level-triggered, just like
+// poll(2).  Callers are expected to pass the same PRPollDesc array on each
+// call (reordered as they wish), and to call Remove() for a descriptor before
+// it is closed or once they stop polling it.
+//
+// Must only be used on one thread.
+class EpollSocketPoller final {
+ public:
+  // Returns null if an epoll instance could not be created.
+  static UniquePtr<EpollSocketPoller> Create();
+
+  ~EpollSocketPoller();
+
+  // Same contract as PR_Poll(): fills in the out_flags of every entry and
+  // returns the number of entries with non-zero out_flags, 0 on timeout or
+  // -1 on error.
+  int32_t Poll(PRPollDesc* aPollList, uint32_t aCount,
+               PRIntervalTime aTimeout);
+
+  // Unregisters a descriptor, if it was registered.
+  void Remove(PRFileDesc* aFD);
+
+ private:
+  explicit EpollSocketPoller(int aEpollFD) : mEpollFD(aEpollFD) {}
+
+  struct Registration {
+    // The descriptor this OS handle was last registered for, to tell apart a
+    // handle that got closed and reused behind our back.
+    PRFileDesc* mFD = nullptr;
+    // The epoll events it is registered for, if mFD is set.
+    uint32_t mEvents = 0;
+    // The NSPR flags the OS-level readiness maps back to, as reported by the
+    // layers' poll methods for the current call.
+    int16_t mReadFlags = 0;
+    int16_t mWriteFlags = 0;
+    // Index of the entry in the list passed to the Poll() call numbered
+    // mGeneration.
+    uint32_t mIndex = 0;
+    uint32_t mGeneration = 0;
+  };
+
+  bool Register(int aOSFD, PRFileDesc* aFD, uint32_t aEvents);
+
+  const int mEpollFD;
+  // Indexed by OS handle, which the kernel keeps dense.
+  nsTArray<Registration> mRegistrations;
+  // Incremented by every Poll() call.
+  uint32_t mGeneration = 0;
+  nsTArray<epoll_event> mReadyEvents;
+};
+
+}  // namespace net
+}  // namespace mozilla
+
+#endif  // EpollSocketPoller_h__
@@ -9,6 +9,7 @@
 #include "mozilla/Assertions.h"
 #include "mozilla/DebugOnly.h"
 #include "mozilla/Logging.h"
+#include "mozilla/Unused.h"
 #include "mozilla/net/DNS.h"
 #include "prerror.h"
 #include "prio.h"
@@ -31,13 +32,15 @@ static PRIOMethods sPollableEventLayerMethods;
 static PRIOMethods* sPollableEventLayerMethodsPtr = nullptr;
 
 static void LazyInitSocket() {
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
-  if (sPollableEventLayerMethodsPtr) {
-    return;
-  }
-  sPollableEventLayerIdentity = PR_GetUniqueIdentity("PollableEvent Layer");
-  sPollableEventLayerMethods = *PR_GetDefaultIOMethods();
-  sPollableEventLayerMethodsPtr = &sPollableEventLayerMethods;
+  // Every socket thread creates its own pollable event, possibly at the same
+  // time.
+  static const bool sInitialized = [] {
+    sPollableEventLayerIdentity = PR_GetUniqueIdentity("PollableEvent Layer");
+    sPollableEventLayerMethods = *PR_GetDefaultIOMethods();
+    sPollableEventLayerMethodsPtr = &sPollableEventLayerMethods;
+    return true;
+  }();
+  Unused << sInitialized;
 }
 
 static bool NewTCPSocketPair(PRFileDesc* fd[], bool aSetRecvBuff) {
@@ -138,11 +141,10 @@ failed:
 
 #endif
 
-PollableEvent::PollableEvent()
-
-{
+PollableEvent::PollableEvent(nsSocketTransportService* aOwner)
+    : mOwner(aOwner) {
   MOZ_COUNT_CTOR(PollableEvent);
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(OnOwningThread(), "not on socket thread");
   // create pair of prfiledesc that can be used as a poll()ble
   // signal. on windows use a localhost socket pair, and on
   // unix use a pipe.
@@ -257,8 +259,8 @@ bool PollableEvent::Signal() {
   // behavior on windows to be as before bug 698882, e.g. write to the socket
   // also if an event dispatch is on the socket thread and writing to the
   // socket for each event. See bug 1292181.
-  if (OnSocketThread()) {
-    SOCKET_LOG(("PollableEvent::Signal OnSocketThread nop\n"));
+  if (OnOwningThread()) {
+    SOCKET_LOG(("PollableEvent::Signal OnOwningThread nop\n"));
     return true;
   }
 #endif
@@ -292,7 +294,7 @@ bool PollableEvent::Signal() {
 
 bool PollableEvent::Clear() {
   // necessary because of the "dont signal on socket thread" optimization
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(OnOwningThread(), "not on socket thread");
 
   SOCKET_LOG(("PollableEvent::Clear\n"));
 
@@ -359,6 +361,11 @@ bool PollableEvent::Clear() {
 #endif  // XP_WIN
 }
 
+bool PollableEvent::OnOwningThread() const {
+  // With several socket threads, OnSocketThread() only means the first one.
+  return mOwner->IsOnCurrentThreadInfallible();
+}
+
 void PollableEvent::MarkFirstSignalTimestamp() {
   if (mFirstSignalAfterClear.IsNull()) {
     SOCKET_LOG(("PollableEvent::MarkFirstSignalTimestamp"));
@@ -15,10 +15,14 @@ struct PRFileDesc;
 namespace mozilla {
 namespace net {
 
+class nsSocketTransportService;
+
 // class must be called locked
 class PollableEvent {
  public:
-  PollableEvent();
+  // aOwner is the socket transport service, possibly one of its shards, whose
+  // poll loop waits on this event. Must be created on its thread.
+  explicit PollableEvent(nsSocketTransportService* aOwner);
   ~PollableEvent();
 
   // Signal/Clear return false only if they fail
@@ -46,6 +50,10 @@ class PollableEvent {
   PRFileDesc* PollableFD() { return mReadFD; }
 
  private:
+  bool OnOwningThread() const;
+
+  // Owns this event.
+  nsSocketTransportService* const mOwner;
   PRFileDesc* mWriteFD{nullptr};
   PRFileDesc* mReadFD{nullptr};
   bool mSignaled{false};
@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_net_UDPDatagramBatch_h
+#define mozilla_net_UDPDatagramBatch_h
+
+#include <algorithm>
+#include <string.h>
+
+#include "mozilla/Span.h"
+#include "mozilla/net/DNS.h"
+#include "nsTArray.h"
+
+namespace mozilla {
+namespace net {
+
+// A set of datagrams exchanged with nsIUDPSocket::RecvBatch() and
+// nsIUDPSocket::SendBatch().
+//
+// The payloads share a single buffer, so that a batch that is cleared and
+// reused does not allocate once it has grown to its working size. Datagrams
+// appended for sending are stored back to back, which lets the socket hand a
+// run of them to the kernel as one segmented (GSO) send.
+class UDPDatagramBatch final {
+ public:
+  struct Datagram {
+    NetAddr mAddr;
+    uint32_t mOffset;
+    uint32_t mLength;
+  };
+
+  uint32_t Length() const { return mDatagrams.Length(); }
+  bool IsEmpty() const { return mDatagrams.IsEmpty(); }
+  const NetAddr& Addr(uint32_t aIndex) const {
+    return mDatagrams[aIndex].mAddr;
+  }
+  Span<const uint8_t> Data(uint32_t aIndex) const {
+    const Datagram& datagram = mDatagrams[aIndex];
+    return Span(mBuffer.Elements() + datagram.mOffset, datagram.mLength);
+  }
+  uint64_t TotalBytes() const { return mTotalBytes; }
+
+  // Copies a datagram at the end of the batch. Returns false on OOM.
+  [[nodiscard]] bool Append(const NetAddr& aAddr, const uint8_t* aData,
+                            uint32_t aLength) {
+    uint32_t offset = mBufferUsed;
+    if (mBuffer.Length() < offset + aLength &&
+        !mBuffer.SetLength(offset + aLength, fallible)) {
+      return false;
+    }
+    memcpy(mBuffer.Elements() + offset, aData, aLength);
+    return AppendReceived(aAddr, offset, aLength);
+  }
+
+  // Forgets all datagrams but keeps the storage.
+  void Clear() {
+    mDatagrams.ClearAndRetainStorage();
+    mBufferUsed = 0;
+    mTotalBytes = 0;
+  }
+
+  // Removes the first aCount datagrams, e.g. once they have been sent.
+  void RemoveFirst(uint32_t aCount) {
+    if (aCount >= mDatagrams.Length()) {
+      Clear();
+      return;
+    }
+    for (uint32_t i = 0; i < aCount; ++i) {
+      mTotalBytes -= mDatagrams[i].mLength;
+    }
+    mDatagrams.RemoveElementsAt(0, aCount);
+  }
+
+ private:
+  friend class nsUDPSocket;
+
+  // Used by the socket when receiving: makes room for aSize bytes that the
+  // kernel writes to directly, then records datagrams within that region.
+  uint8_t* ReserveForReceive(uint32_t aSize) {
+    Clear();
+    if (mBuffer.Length() < aSize && !mBuffer.SetLength(aSize, fallible)) {
+      return nullptr;
+    }
+    return mBuffer.Elements();
+  }
+
+  [[nodiscard]] bool AppendReceived(const NetAddr& aAddr, uint32_t aOffset,
+                                    uint32_t aLength) {
+    if (!mDatagrams.AppendElement(Datagram{aAddr, aOffset, aLength},
+                                  fallible)) {
+      return false;
+    }
+    mBufferUsed = std::max(mBufferUsed, aOffset + aLength);
+    mTotalBytes += aLength;
+    return true;
+  }
+
+  nsTArray<uint8_t> mBuffer;
+  uint32_t mBufferUsed = 0;
+  nsTArray<Datagram> mDatagrams;
+  uint64_t mTotalBytes = 0;
+};
+
+}  // namespace net
+}  // namespace mozilla
+
+#endif  // mozilla_net_UDPDatagramBatch_h
@@ -24,6 +24,7 @@
 #include "nsCRT.h"
 #include "nsSimpleNestedURI.h"
 #include "nsSocketTransport2.h"
+#include "nsStandardURL.h"
 #include "nsTArray.h"
 #include "nsIConsoleService.h"
 #include "nsIUploadChannel2.h"
@@ -309,6 +310,7 @@ nsresult nsIOService::Init() {
   AddObserver(this, NS_NETWORK_LINK_TOPIC, true);
   AddObserver(this, NS_NETWORK_ID_CHANGED_TOPIC, true);
   AddObserver(this, NS_WIDGET_WAKE_OBSERVER_TOPIC, true);
+  AddObserver(this, "last-pb-context-exited", true);
 
   // Register observers for sending notifications to nsSocketTransportService
   if (XRE_IsParentProcess()) {
@@ -1873,6 +1875,9 @@ nsIOService::Observe(nsISupports* subject, const char* topic,
     mInSleepMode = false;
   } else if (!strcmp(topic, NS_WIDGET_SLEEP_OBSERVER_TOPIC)) {
     mInSleepMode = true;
+  } else if (!strcmp(topic, "last-pb-context-exited")) {
+    // Don't keep the URLs parsed for private windows around.
+    nsStandardURL::ClearParseCache();
   }
 
   return NS_OK;
@@ -1781,10 +1781,8 @@ nsresult NS_NewURI(nsIURI** result, const char* spec,
 static nsresult NewStandardURI(const nsACString& aSpec, const char* aCharset,
                                nsIURI* aBaseURI, int32_t aDefaultPort,
                                nsIURI** aURI) {
-  return NS_MutateURI(new nsStandardURL::Mutator())
-      .Apply(&nsIStandardURLMutator::Init, nsIStandardURL::URLTYPE_AUTHORITY,
-             aDefaultPort, aSpec, aCharset, aBaseURI, nullptr)
-      .Finalize(aURI);
+  return nsStandardURL::NewAuthorityURI(aSpec, aCharset, aBaseURI, aDefaultPort,
+                                        aURI);
 }
 
 nsresult NS_GetSpecWithNSURLEncoding(nsACString& aResult,
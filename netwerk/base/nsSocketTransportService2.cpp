@@ -33,6 +33,10 @@
 #include "prerror.h"
 #include "prnetdb.h"
 
+#ifdef XP_LINUX
+#  include "EpollSocketPoller.h"
+#endif
+
 namespace mozilla {
 namespace net {
 
@@ -44,6 +48,8 @@ LazyLogModule gTCPSocketLog("TCPSocket");
 
 nsSocketTransportService* gSocketTransportService = nullptr;
 static Atomic<PRThread*, Relaxed> gSocketThread(nullptr);
+// Sockets attached to any of the socket threads, see CanAttachSocket().
+static Atomic<uint32_t, Relaxed> gAttachedSocketCount(0);
 
 #define SEND_BUFFER_PREF "network.tcp.sendbuffer"
 #define KEEPALIVE_ENABLED_PREF "network.tcp.keepalive.enabled"
@@ -120,7 +126,11 @@ void nsSocketTransportService::SocketContext::MaybeResetEpoch() {
 // ctor/dtor (called on the main/UI thread by the service manager)
 
 nsSocketTransportService::nsSocketTransportService()
-    : mPollableEventTimeout(TimeDuration::FromSeconds(6)),
+    : nsSocketTransportService(0) {}
+
+nsSocketTransportService::nsSocketTransportService(uint32_t aShardIndex)
+    : mShardIndex(aShardIndex),
+      mPollableEventTimeout(TimeDuration::FromSeconds(6)),
       mMaxTimeForPrClosePref(PR_SecondsToInterval(5)),
       mNetworkLinkChangeBusyWaitPeriod(PR_SecondsToInterval(50)),
       mNetworkLinkChangeBusyWaitTimeout(PR_SecondsToInterval(7)) {
@@ -128,8 +138,10 @@ nsSocketTransportService::nsSocketTransportService()
 
   PR_CallOnce(&gMaxCountInitOnce, DiscoverMaxCount);
 
-  NS_ASSERTION(!gSocketTransportService, "must not instantiate twice");
-  gSocketTransportService = this;
+  if (!mShardIndex) {
+    NS_ASSERTION(!gSocketTransportService, "must not instantiate twice");
+    gSocketTransportService = this;
+  }
 
   // The Poll list always has an entry at [0].   The rest of the
   // list is a duplicate of the Active list's PRFileDesc file descriptors.
@@ -256,7 +268,9 @@ nsSocketTransportService::~nsSocketTransportService() {
   NS_ASSERTION(NS_IsMainThread(), "wrong thread");
   NS_ASSERTION(!mInitialized, "not shutdown properly");
 
-  gSocketTransportService = nullptr;
+  if (!mShardIndex) {
+    gSocketTransportService = nullptr;
+  }
 }
 
 //-----------------------------------------------------------------------------
@@ -313,13 +327,16 @@ nsSocketTransportService::UnregisterShutdownTask(nsITargetShutdownTask* task) {
 
 NS_IMETHODIMP
 nsSocketTransportService::IsOnCurrentThread(bool* result) {
-  *result = OnSocketThread();
+  *result = IsOnCurrentThreadInfallible();
   return NS_OK;
 }
 
 NS_IMETHODIMP_(bool)
 nsSocketTransportService::IsOnCurrentThreadInfallible() {
-  return OnSocketThread();
+  if (!mShardIndex) {
+    return OnSocketThread();
+  }
+  return PR_GetCurrentThread() == mPRThread;
 }
 
 //-----------------------------------------------------------------------------
@@ -368,7 +385,7 @@ NS_IMETHODIMP
 nsSocketTransportService::NotifyWhenCanAttachSocket(nsIRunnable* event) {
   SOCKET_LOG(("nsSocketTransportService::NotifyWhenCanAttachSocket\n"));
 
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(IsOnCurrentThreadInfallible(), "not on socket thread");
 
   if (CanAttachSocket()) {
     return Dispatch(event, NS_DISPATCH_NORMAL);
@@ -376,6 +393,7 @@ nsSocketTransportService::NotifyWhenCanAttachSocket(nsIRunnable* event) {
 
   auto* runnable = new LinkedRunnableEvent(event);
   mPendingSocketQueue.insertBack(runnable);
+  ++mPendingSocketCount;
   return NS_OK;
 }
 
@@ -385,7 +403,7 @@ nsSocketTransportService::AttachSocket(PRFileDesc* fd,
   SOCKET_LOG(
       ("nsSocketTransportService::AttachSocket [handler=%p]\n", handler));
 
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(IsOnCurrentThreadInfallible(), "not on socket thread");
 
   if (!CanAttachSocket()) {
     return NS_ERROR_NOT_AVAILABLE;
@@ -394,6 +412,8 @@ nsSocketTransportService::AttachSocket(PRFileDesc* fd,
   SocketContext sock{fd, handler, 0};
 
   AddToIdleList(&sock);
+  ++mAttachedCount;
+  ++gAttachedSocketCount;
   return NS_OK;
 }
 
@@ -402,10 +422,11 @@ nsSocketTransportService::AttachSocket(PRFileDesc* fd,
 // limit the number of sockets that can be created by an application.
 // AttachSocket will fail if the limit is exceeded.  consumers should
 // call CanAttachSocket and check the result before creating a socket.
+// the limit applies to the sockets of all socket threads together.
 
 bool nsSocketTransportService::CanAttachSocket() {
   MOZ_ASSERT(!mShuttingDown);
-  uint32_t total = mActiveList.Length() + mIdleList.Length();
+  uint32_t total = gAttachedSocketCount;
   bool rv = total < gMaxCount;
 
   if (!rv) {
@@ -437,12 +458,19 @@ nsresult nsSocketTransportService::DetachSocket(SocketContextList& listHead,
   MOZ_ASSERT((&listHead == &mActiveList) || (&listHead == &mIdleList),
              "DetachSocket invalid head");
 
+  if (&listHead == &mActiveList) {
+    // The handler is about to close the socket.
+    StopPollingFD(sock->mFD);
+  }
+
   {
     // inform the handler that this socket is going away
     sock->mHandler->OnSocketDetached(sock->mFD);
   }
   mSentBytesCount += sock->mHandler->ByteCountSent();
   mReceivedBytesCount += sock->mHandler->ByteCountReceived();
+  --mAttachedCount;
+  --gAttachedSocketCount;
 
   // cleanup
   sock->mFD = nullptr;
@@ -458,12 +486,40 @@ nsresult nsSocketTransportService::DetachSocket(SocketContextList& listHead,
   //
   // notify the first element on the pending socket queue...
   //
+  if (!mPendingSocketQueue.isEmpty()) {
+    return DispatchPendingSocket();
+  }
+
+  // ... or, since the limit is shared, the first waiting on another shard.
+  RefPtr<nsSocketTransportService> primary = gSocketTransportService;
+  if (!primary) {
+    return NS_OK;
+  }
+  nsTArray<RefPtr<nsSocketTransportService>> services =
+      primary->GetShardsSafely();
+  services.InsertElementAt(0, std::move(primary));
+  for (const auto& service : services) {
+    if (service != this && service->mPendingSocketCount) {
+      return service->Dispatch(
+          NewRunnableMethod(
+              "net::nsSocketTransportService::DispatchPendingSocket", service,
+              &nsSocketTransportService::DispatchPendingSocket),
+          NS_DISPATCH_NORMAL);
+    }
+  }
+  return NS_OK;
+}
+
+nsresult nsSocketTransportService::DispatchPendingSocket() {
+  MOZ_ASSERT(IsOnCurrentThreadInfallible(), "not on socket thread");
+
   nsCOMPtr<nsIRunnable> event;
   LinkedRunnableEvent* runnable = mPendingSocketQueue.getFirst();
   if (runnable) {
     event = runnable->TakeEvent();
     runnable->remove();
     delete runnable;
+    --mPendingSocketCount;
   }
   if (event) {
     // move event from pending queue to dispatch queue
@@ -564,6 +620,7 @@ void nsSocketTransportService::MoveToIdleList(SocketContext* sock) {
               sock, sock->mHandler.get()));
   MOZ_ASSERT(SockIndex(mIdleList, sock) == -1);
   MOZ_ASSERT(SockIndex(mActiveList, sock) != -1);
+  StopPollingFD(sock->mFD);
   AddToIdleList(sock);
   RemoveFromPollList(sock);
 }
@@ -577,6 +634,14 @@ void nsSocketTransportService::MoveToPollList(SocketContext* sock) {
   RemoveFromIdleList(sock);
 }
 
+void nsSocketTransportService::StopPollingFD(PRFileDesc* aFD) {
+#ifdef XP_LINUX
+  if (mEpollPoller && aFD) {
+    mEpollPoller->Remove(aFD);
+  }
+#endif
+}
+
 void nsSocketTransportService::ApplyPortRemapPreference(
     TPortRemapping const& portRemapping) {
   MOZ_ASSERT(IsOnCurrentThreadInfallible());
@@ -668,7 +733,17 @@ int32_t nsSocketTransportService::Poll(TimeDuration* pollDuration,
     }
 #endif
 
-    n = PR_Poll(firstPollEntry, pollCount, pollTimeout);
+    TimeStamp blockStart = TimeStamp::Now();
+#ifdef XP_LINUX
+    if (mEpollPoller) {
+      n = mEpollPoller->Poll(firstPollEntry, pollCount, pollTimeout);
+    } else
+#endif
+    {
+      n = PR_Poll(firstPollEntry, pollCount, pollTimeout);
+    }
+    mBlockedTimeUs +=
+        uint64_t((TimeStamp::Now() - blockStart).ToMicroseconds());
 
 #ifdef MOZ_GECKO_PROFILER
     if (pollTimeout != PR_INTERVAL_NO_WAIT) {
@@ -760,11 +835,23 @@ nsSocketTransportService::Init() {
 
   nsCOMPtr<nsIThread> thread;
 
-  if (!XRE_IsContentProcess() ||
-      StaticPrefs::network_allow_raw_sockets_in_content_processes_AtStartup()) {
+  bool polls =
+      !XRE_IsContentProcess() ||
+      StaticPrefs::network_allow_raw_sockets_in_content_processes_AtStartup();
+  MOZ_ASSERT(polls || !mShardIndex);
+
+  if (polls) {
+    mStartTimeUs = uint64_t(
+        (TimeStamp::Now() - TimeStamp::ProcessCreation()).ToMicroseconds());
+    mBlockedTimeUs = 0;
+
+    nsAutoCString name("Socket Thread"_ns);
+    if (mShardIndex) {
+      name.AppendPrintf(" %u", mShardIndex);
+    }
     // Since we Poll, we can't use normal LongTask support in Main Process
     nsresult rv = NS_NewNamedThread(
-        "Socket Thread", getter_AddRefs(thread), this,
+        name, getter_AddRefs(thread), this,
         {GetThreadStackSize(), false, false, Some(SOCKET_THREAD_LONGTASK_MS)});
     NS_ENSURE_SUCCESS(rv, rv);
   } else {
@@ -801,7 +888,9 @@ nsSocketTransportService::Init() {
   // Note that the observr notifications are forwarded from parent process to
   // socket process. We have to make sure the topics registered below are also
   // registered in nsIObserver::Init().
-  if (obsSvc) {
+  // The other shards are shut down by shard 0, which also forwards them the
+  // other notifications.
+  if (obsSvc && !mShardIndex) {
     obsSvc->AddObserver(this, "last-pb-context-exited", false);
     obsSvc->AddObserver(this, NS_WIDGET_SLEEP_OBSERVER_TOPIC, true);
     obsSvc->AddObserver(this, NS_WIDGET_WAKE_OBSERVER_TOPIC, true);
@@ -811,6 +900,20 @@ nsSocketTransportService::Init() {
 
   // We can now dispatch tasks to the socket thread.
   mInitialized = true;
+
+  if (polls && !mShardIndex) {
+    uint32_t threadCount = std::min(
+        StaticPrefs::network_sts_thread_count_AtStartup(), MAX_SOCKET_THREADS);
+    for (uint32_t i = 1; i < threadCount; ++i) {
+      RefPtr<nsSocketTransportService> shard = new nsSocketTransportService(i);
+      if (NS_FAILED(shard->Init())) {
+        NS_WARNING("failed to start an additional socket thread");
+        break;
+      }
+      MutexAutoLock lock(mLock);
+      mShards.AppendElement(std::move(shard));
+    }
+  }
   return NS_OK;
 }
 
@@ -843,6 +946,10 @@ nsSocketTransportService::Shutdown(bool aXpcomShutdown) {
     }
   }
 
+  for (const auto& shard : GetShardsSafely()) {
+    shard->Shutdown(aXpcomShutdown);
+  }
+
   // If we're shutting down due to going offline (rather than due to XPCOM
   // shutdown), also tear down the thread. The thread will be shutdown during
   // xpcom-shutdown-threads if during xpcom-shutdown proper.
@@ -862,6 +969,15 @@ nsresult nsSocketTransportService::ShutdownThread() {
     return NS_OK;
   }
 
+  nsTArray<RefPtr<nsSocketTransportService>> shards;
+  {
+    MutexAutoLock lock(mLock);
+    shards = std::move(mShards);
+  }
+  for (const auto& shard : shards) {
+    shard->ShutdownThread();
+  }
+
   // join with thread
   nsCOMPtr<nsIThread> thread = GetThreadSafely();
   thread->Shutdown();
@@ -876,7 +992,7 @@ nsresult nsSocketTransportService::ShutdownThread() {
   Preferences::UnregisterCallbacks(UpdatePrefs, gCallbackPrefs, this);
 
   nsCOMPtr<nsIObserverService> obsSvc = services::GetObserverService();
-  if (obsSvc) {
+  if (obsSvc && !mShardIndex) {
     obsSvc->RemoveObserver(this, "last-pb-context-exited");
     obsSvc->RemoveObserver(this, NS_WIDGET_SLEEP_OBSERVER_TOPIC);
     obsSvc->RemoveObserver(this, NS_WIDGET_WAKE_OBSERVER_TOPIC);
@@ -904,6 +1020,10 @@ nsSocketTransportService::GetOffline(bool* offline) {
 
 NS_IMETHODIMP
 nsSocketTransportService::SetOffline(bool offline) {
+  for (const auto& shard : GetShardsSafely()) {
+    shard->SetOffline(offline);
+  }
+
   MutexAutoLock lock(mLock);
   if (!mOffline && offline) {
     // signal the socket thread to go offline, so it will detach sockets
@@ -1034,7 +1154,7 @@ nsSocketTransportService::OnDispatchedEvent() {
   // behavior on windows to be as before bug 698882, e.g. write to the socket
   // also if an event dispatch is on the socket thread and writing to the
   // socket for each event.
-  if (OnSocketThread()) {
+  if (IsOnCurrentThreadInfallible()) {
     // this check is redundant to one done inside ::Signal(), but
     // we can do it here and skip obtaining the lock - given that
     // this is a relatively common occurance its worth the
@@ -1090,16 +1210,19 @@ nsSocketTransportService::Run() {
   Unused << gethostname(ignoredStackBuffer, 255);
 #endif
 
-  psm::InitializeSSLServerCertVerificationThreads();
+  mPRThread = PR_GetCurrentThread();
+  if (!mShardIndex) {
+    psm::InitializeSSLServerCertVerificationThreads();
 
-  gSocketThread = PR_GetCurrentThread();
+    gSocketThread = PR_GetCurrentThread();
+  }
 
   {
     // See bug 1843384:
     // Avoid blocking the main thread by allocating the PollableEvent outside
     // the mutex. Still has the potential to hang the socket thread, but the
     // main thread remains responsive.
-    PollableEvent* pollable = new PollableEvent();
+    PollableEvent* pollable = new PollableEvent(this);
     MutexAutoLock lock(mLock);
     mPollableEvent.reset(pollable);
 
@@ -1125,6 +1248,15 @@ nsSocketTransportService::Run() {
     mPollList[0] = entry;
   }
 
+#ifdef XP_LINUX
+  if (StaticPrefs::network_sts_use_epoll()) {
+    mEpollPoller = EpollSocketPoller::Create();
+    if (!mEpollPoller) {
+      NS_WARNING("falling back to PR_Poll, could not create an epoll set");
+    }
+  }
+#endif
+
   mRawThread = NS_GetCurrentThread();
 
   // Ensure a call to GetCurrentSerialEventTarget() returns this event target.
@@ -1258,12 +1390,18 @@ nsSocketTransportService::Run() {
 
   // We don't clear gSocketThread so that OnSocketThread() won't be a false
   // alarm for events generated by stopping the SSL threads during shutdown.
-  psm::StopSSLServerCertVerificationThreads();
+  if (!mShardIndex) {
+    psm::StopSSLServerCertVerificationThreads();
+  }
 
   // Final pass over the event queue. This makes sure that events posted by
   // socket detach handlers get processed.
   NS_ProcessPendingEvents(mRawThread);
 
+#ifdef XP_LINUX
+  mEpollPoller = nullptr;
+#endif
+
   SOCKET_LOG(("STS thread exit\n"));
   MOZ_ASSERT(mPollList.Length() == 1);
   MOZ_ASSERT(mActiveList.IsEmpty());
@@ -1578,8 +1716,8 @@ nsresult nsSocketTransportService::UpdatePrefs() {
 
 void nsSocketTransportService::OnKeepaliveEnabledPrefChange() {
   // Dispatch to socket thread if we're not executing there.
-  if (!OnSocketThread()) {
-    gSocketTransportService->Dispatch(
+  if (!IsOnCurrentThreadInfallible()) {
+    Dispatch(
         NewRunnableMethod(
             "net::nsSocketTransportService::OnKeepaliveEnabledPrefChange", this,
             &nsSocketTransportService::OnKeepaliveEnabledPrefChange),
@@ -1622,6 +1760,13 @@ nsSocketTransportService::Observe(nsISupports* subject, const char* topic,
                                   const char16_t* data) {
   SOCKET_LOG(("nsSocketTransportService::Observe topic=%s", topic));
 
+  if (strcmp(topic, NS_TIMER_CALLBACK_TOPIC) &&
+      strcmp(topic, "xpcom-shutdown-threads")) {
+    for (const auto& shard : GetShardsSafely()) {
+      shard->Observe(subject, topic, data);
+    }
+  }
+
   if (!strcmp(topic, "last-pb-context-exited")) {
     nsCOMPtr<nsIRunnable> ev = NewRunnableMethod(
         "net::nsSocketTransportService::ClosePrivateConnections", this,
@@ -1807,7 +1952,7 @@ void nsSocketTransportService::AnalyzeConnection(nsTArray<SocketInfo>* data,
 
 void nsSocketTransportService::GetSocketConnections(
     nsTArray<SocketInfo>* data) {
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(IsOnCurrentThreadInfallible(), "not on socket thread");
   for (uint32_t i = 0; i < mActiveList.Length(); i++) {
     AnalyzeConnection(data, &mActiveList[i], true);
   }
@@ -1816,6 +1961,60 @@ void nsSocketTransportService::GetSocketConnections(
   }
 }
 
+nsTArray<RefPtr<nsSocketTransportService>>
+nsSocketTransportService::GetShardsSafely() {
+  MutexAutoLock lock(mLock);
+  return mShards.Clone();
+}
+
+/* static */
+already_AddRefed<nsSocketTransportService>
+nsSocketTransportService::PickShard() {
+  RefPtr<nsSocketTransportService> best = gSocketTransportService;
+  if (!best) {
+    return nullptr;
+  }
+  for (const auto& shard : best->GetShardsSafely()) {
+    if (shard->mAttachedCount < best->mAttachedCount) {
+      best = shard;
+    }
+  }
+  return best.forget();
+}
+
+/* static */
+already_AddRefed<nsSocketTransportService>
+nsSocketTransportService::StartShardForTesting(uint32_t aShardIndex) {
+  MOZ_ASSERT(aShardIndex);
+  RefPtr<nsSocketTransportService> shard =
+      new nsSocketTransportService(aShardIndex);
+  if (NS_FAILED(shard->Init())) {
+    return nullptr;
+  }
+  return shard.forget();
+}
+
+void nsSocketTransportService::GetSocketThreadLoad(
+    nsTArray<SocketThreadInfo>* aData) {
+  uint64_t now = uint64_t(
+      (TimeStamp::Now() - TimeStamp::ProcessCreation()).ToMicroseconds());
+  auto report = [&](nsSocketTransportService* aService) {
+    if (!aService->mPRThread) {
+      return;
+    }
+    uint64_t uptime = now - std::min(now, uint64_t(aService->mStartTimeUs));
+    uint64_t blocked = std::min(uptime, uint64_t(aService->mBlockedTimeUs));
+    SocketThreadInfo info = {aService->mShardIndex, aService->mAttachedCount,
+                             uptime / 1000, (uptime - blocked) / 1000};
+    aData->AppendElement(info);
+  };
+
+  report(this);
+  for (const auto& shard : GetShardsSafely()) {
+    report(shard);
+  }
+}
+
 bool nsSocketTransportService::IsTelemetryEnabledAndNotSleepPhase() {
   return Telemetry::CanRecordPrereleaseData() && !mSleepPhase;
 }
@@ -1874,10 +2073,11 @@ void nsSocketTransportService::TryRepairPollableEvent() MOZ_REQUIRES(mLock) {
     // when callign PR_NewTCPSocketPair.
     // We unlock the mutex to prevent main thread hangs acquiring the lock.
     MutexAutoUnlock unlock(mLock);
-    pollable = new PollableEvent();
+    pollable = new PollableEvent(this);
   }
 
   NS_WARNING("Trying to repair mPollableEvent");
+  StopPollingFD(mPollList[0].fd);
   mPollableEvent.reset(pollable);
   if (!mPollableEvent->Valid()) {
     mPollableEvent = nullptr;
@@ -69,6 +69,10 @@ static const int32_t kDefaultTCPKeepCount =
     4;  // Specifiable in Linux.
 #endif
 
+#ifdef XP_LINUX
+class EpollSocketPoller;
+#endif
+
 class LinkedRunnableEvent final
     : public LinkedListElement<LinkedRunnableEvent> {
  public:
@@ -103,9 +107,36 @@ class nsSocketTransportService final : public nsPISocketTransportService,
   NS_DECL_NSIDIRECTTASKDISPATCHER
 
   static const uint32_t SOCKET_LIMIT_MIN = 50U;
+  // Upper bound for network.sts.thread_count.
+  static const uint32_t MAX_SOCKET_THREADS = 16U;
 
   nsSocketTransportService();
 
+  // With network.sts.thread_count > 1, the service runs additional socket
+  // threads ("shards"), each with its own poll loop over its own sockets.
+  //
+  // The service registered with XPCOM is shard 0 and its thread is the
+  // socket thread that OnSocketThread() refers to.  Everything built on that
+  // guarantee -- the HTTP connection manager and its connections, TLS socket
+  // controls -- stays there.  The other shards host the sockets of handlers
+  // that don't depend on it, which opt in by attaching through the shard
+  // returned by PickShard(); the handler is then driven on that shard's
+  // thread.
+  uint32_t ShardIndex() const { return mShardIndex; }
+
+  // Returns the shard with the fewest attached sockets, or the main service
+  // when there are no other shards.  Any thread.
+  static already_AddRefed<nsSocketTransportService> PickShard();
+
+  // Only for tests.  Starts a shard that PickShard() doesn't know about, and
+  // that the caller must Shutdown().  network.sts.thread_count is only read
+  // at startup.  Main thread.
+  static already_AddRefed<nsSocketTransportService> StartShardForTesting(
+      uint32_t aShardIndex);
+
+  // Fills the passed array with the load of every socket thread.  Any thread.
+  void GetSocketThreadLoad(nsTArray<SocketThreadInfo>* aData);
+
   // Max Socket count may need to get initialized/used by nsHttpHandler
   // before this class is initialized.
   static uint32_t gMaxCount;
@@ -139,6 +170,20 @@ class nsSocketTransportService final : public nsPISocketTransportService,
   ~nsSocketTransportService();
 
  private:
+  explicit nsSocketTransportService(uint32_t aShardIndex);
+
+  const uint32_t mShardIndex;
+  // The thread running this instance's poll loop, once started.
+  Atomic<PRThread*, Relaxed> mPRThread{nullptr};
+  // Number of sockets attached to this instance.
+  Atomic<uint32_t, Relaxed> mAttachedCount{0};
+  // Length of mPendingSocketQueue, for the other shards to see.
+  Atomic<uint32_t, Relaxed> mPendingSocketCount{0};
+  // When the thread was started, in microseconds since process creation, and
+  // how long it spent blocked in poll() since, to report its load.
+  Atomic<uint64_t, Relaxed> mStartTimeUs{0};
+  Atomic<uint64_t, Relaxed> mBlockedTimeUs{0};
+
   //-------------------------------------------------------------------------
   // misc (any thread)
   //-------------------------------------------------------------------------
@@ -173,12 +218,16 @@ class nsSocketTransportService final : public nsPISocketTransportService,
   // to do do_QueryInterface whenever we need to access the interface.
   nsCOMPtr<nsIDirectTaskDispatcher> mDirectTaskDispatcher MOZ_GUARDED_BY(mLock);
   UniquePtr<PollableEvent> mPollableEvent MOZ_GUARDED_BY(mLock);
+  // The other shards, owned by shard 0.
+  nsTArray<RefPtr<nsSocketTransportService>> mShards MOZ_GUARDED_BY(mLock);
   bool mOffline MOZ_GUARDED_BY(mLock) = false;
   bool mGoingOffline MOZ_GUARDED_BY(mLock) = false;
 
   // Detaches all sockets.
   void Reset(bool aGuardLocals);
 
+  nsTArray<RefPtr<nsSocketTransportService>> GetShardsSafely();
+
   nsresult ShutdownThread();
 
   //-------------------------------------------------------------------------
@@ -234,6 +283,8 @@ class nsSocketTransportService final : public nsPISocketTransportService,
   SocketContextList mIdleList;
 
   nsresult DetachSocket(SocketContextList& listHead, SocketContext*);
+  // Dispatches the first event of mPendingSocketQueue, if any.
+  nsresult DispatchPendingSocket();
   void AddToIdleList(SocketContext* sock);
   void AddToPollList(SocketContext* sock);
   void RemoveFromIdleList(SocketContext* sock);
@@ -255,6 +306,14 @@ class nsSocketTransportService final : public nsPISocketTransportService,
 
   nsTArray<PRPollDesc> mPollList;
 
+#ifdef XP_LINUX
+  // Used instead of PR_Poll() when network.sts.use_epoll is set.
+  UniquePtr<EpollSocketPoller> mEpollPoller;
+#endif
+  // Must be called for a socket leaving the poll list, before its file
+  // descriptor may be closed.
+  void StopPollingFD(PRFileDesc* aFD);
+
   PRIntervalTime PollTimeout(
       PRIntervalTime now);  // computes ideal poll timeout
   nsresult DoPollIteration(TimeDuration* pollDuration);
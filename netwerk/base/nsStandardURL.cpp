@@ -10,6 +10,7 @@
 #include "nsStandardURL.h"
 #include "nsCRT.h"
 #include "nsEscape.h"
+#include "nsHashKeys.h"
 #include "nsIFile.h"
 #include "nsIObjectInputStream.h"
 #include "nsIObjectOutputStream.h"
@@ -19,10 +20,14 @@
 #include "nsPrintfCString.h"
 #include "nsNetCID.h"
 #include "mozilla/MemoryReporting.h"
+#include "mozilla/MruCache.h"
 #include "mozilla/ipc/URIUtils.h"
 #include "mozilla/ScopeExit.h"
+#include "mozilla/StaticMutex.h"
+#include "mozilla/StaticPtr.h"
 #include "mozilla/StaticPrefs_network.h"
 #include "mozilla/TextUtils.h"
+#include "mozilla/UniquePtr.h"
 #include <algorithm>
 #include "nsContentUtils.h"
 #include "prprf.h"
@@ -204,6 +209,61 @@ static StaticMutex gAllURLsMutex MOZ_UNANNOTATED;
 MOZ_RUNINIT static LinkedList<nsStandardURL> gAllURLs;
 #endif
 
+// Cache of the URLs created by NewAuthorityURI, keyed by its arguments.
+// Pages tend to resolve the same relative URLs against the same base many
+// times (stylesheet url() values, srcset candidates, links), so a small
+// direct-mapped cache is enough to catch most of the repeats. URLs are parsed
+// on many threads at once, so the cache is split in shards, each with its own
+// lock, picked by the hash of the key.
+namespace {
+
+// Longer specs and base specs are rarely parsed twice, and would make the
+// cache hold on to a lot of memory.
+const uint32_t kParseCacheMaxSpecLength = 1024;
+
+const uint32_t kParseCacheShards = 8;
+
+struct ParseCacheKey {
+  const nsACString& mSpec;
+  const nsACString& mCharset;
+  // Empty when there is no base URI.
+  const nsACString& mBaseSpec;
+  int32_t mDefaultPort;
+};
+
+struct ParseCacheEntry {
+  nsCString mSpec;
+  nsCString mCharset;
+  nsCString mBaseSpec;
+  int32_t mDefaultPort = -1;
+  nsCOMPtr<nsIURI> mURI;
+};
+
+class ParseCache
+    : public MruCache<ParseCacheKey, ParseCacheEntry, ParseCache, 31> {
+ public:
+  static HashNumber Hash(const ParseCacheKey& aKey) {
+    return AddToHash(HashString(aKey.mSpec), HashString(aKey.mBaseSpec),
+                     HashString(aKey.mCharset), aKey.mDefaultPort);
+  }
+  static bool Match(const ParseCacheKey& aKey, const ParseCacheEntry& aEntry) {
+    return aEntry.mURI && aEntry.mDefaultPort == aKey.mDefaultPort &&
+           aEntry.mSpec == aKey.mSpec && aEntry.mBaseSpec == aKey.mBaseSpec &&
+           aEntry.mCharset == aKey.mCharset;
+  }
+};
+
+}  // namespace
+
+// gParseCaches[i] is guarded by gParseCacheMutexes[i].
+static StaticMutex gParseCacheMutexes[kParseCacheShards] MOZ_UNANNOTATED;
+static StaticAutoPtr<ParseCache> gParseCaches[kParseCacheShards];
+// Set before the shards are cleared at shutdown, so that nothing is put in
+// them afterwards.
+static Atomic<bool> gParseCacheShutdown{false};
+static Atomic<uint32_t, Relaxed> gParseCacheHits;
+static Atomic<uint32_t, Relaxed> gParseCacheMisses;
+
 nsStandardURL::nsStandardURL(bool aSupportsFileURL, bool aTrackURL)
     : mURLType(URLTYPE_STANDARD),
       mSupportsFileURL(aSupportsFileURL),
@@ -357,6 +417,11 @@ void nsStandardURL::ShutdownGlobalObjects() {
   MOZ_DIAGNOSTIC_ASSERT(NS_IsMainThread());
   gIDN = nullptr;
 
+  gParseCacheShutdown = true;
+  ClearParseCache();
+  LOG(("nsStandardURL parse cache: %u hits, %u misses\n",
+       uint32_t(gParseCacheHits), uint32_t(gParseCacheMisses)));
+
 #ifdef DEBUG_DUMP_URLS_AT_SHUTDOWN
   if (gInitialized) {
     // This instanciates a dummy class, and will trigger the class
@@ -368,6 +433,97 @@ void nsStandardURL::ShutdownGlobalObjects() {
 #endif
 }
 
+/* static */
+nsresult nsStandardURL::NewAuthorityURI(const nsACString& aSpec,
+                                        const char* aCharset,
+                                        nsIURI* aBaseURI, int32_t aDefaultPort,
+                                        nsIURI** aURI) {
+  auto parse = [&](nsIURI** aResult) {
+    return NS_MutateURI(new Mutator())
+        .Apply(&nsIStandardURLMutator::Init, URLTYPE_AUTHORITY, aDefaultPort,
+               aSpec, aCharset, aBaseURI, nullptr)
+        .Finalize(aResult);
+  };
+
+  if (!StaticPrefs::network_url_parse_cache_enabled() ||
+      aSpec.Length() > kParseCacheMaxSpecLength) {
+    return parse(aURI);
+  }
+
+  // How a relative spec resolves against other kinds of base URIs may
+  // depend on more than their spec, so only nsStandardURL bases are used.
+  nsAutoCString baseSpec;
+  if (aBaseURI) {
+    RefPtr<nsStandardURL> base;
+    if (NS_FAILED(aBaseURI->QueryInterface(kThisImplCID,
+                                           getter_AddRefs(base))) ||
+        base->mSpec.Length() > kParseCacheMaxSpecLength) {
+      return parse(aURI);
+    }
+    baseSpec = base->mSpec;
+  }
+
+  nsDependentCString charset(aCharset ? aCharset : "");
+  ParseCacheKey key{aSpec, charset, baseSpec, aDefaultPort};
+  // The slot within a shard is the hash modulo its size, so the shard is
+  // picked with the high bits.
+  uint32_t shard = (ParseCache::Hash(key) >> 24) % kParseCacheShards;
+  {
+    StaticMutexAutoLock lock(gParseCacheMutexes[shard]);
+    if (gParseCaches[shard]) {
+      if (auto entry = gParseCaches[shard]->Lookup(key)) {
+        ++gParseCacheHits;
+        nsCOMPtr<nsIURI> uri = entry.Data().mURI;
+        uri.forget(aURI);
+        return NS_OK;
+      }
+    }
+  }
+  ++gParseCacheMisses;
+
+  nsCOMPtr<nsIURI> uri;
+  nsresult rv = parse(getter_AddRefs(uri));
+  if (NS_FAILED(rv)) {
+    return rv;
+  }
+
+  // The URL is never modified once created (mutators work on a copy), and
+  // Init already computed the cached display host, so it can be handed out
+  // to any thread as is.
+  {
+    StaticMutexAutoLock lock(gParseCacheMutexes[shard]);
+    if (!gParseCacheShutdown) {
+      if (!gParseCaches[shard]) {
+        gParseCaches[shard] = new ParseCache();
+      }
+      gParseCaches[shard]->Put(
+          key, ParseCacheEntry{nsCString(aSpec), nsCString(charset), baseSpec,
+                               aDefaultPort, uri});
+    }
+  }
+
+  uri.forget(aURI);
+  return NS_OK;
+}
+
+/* static */
+void nsStandardURL::ClearParseCache() {
+  for (uint32_t i = 0; i < kParseCacheShards; ++i) {
+    UniquePtr<ParseCache> cache;
+    {
+      StaticMutexAutoLock lock(gParseCacheMutexes[i]);
+      cache.reset(gParseCaches[i].forget());
+    }
+    // The URLs are released outside of the lock.
+  }
+}
+
+/* static */
+void nsStandardURL::GetParseCacheStats(uint32_t* aHits, uint32_t* aMisses) {
+  *aHits = gParseCacheHits;
+  *aMisses = gParseCacheMisses;
+}
+
 //----------------------------------------------------------------------------
 // nsStandardURL <private>
 //----------------------------------------------------------------------------
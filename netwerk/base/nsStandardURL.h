@@ -139,6 +139,19 @@ class nsStandardURL : public nsIFileURL,
   static void InitGlobalObjects();
   static void ShutdownGlobalObjects();
 
+  // Creates an authority URL like nsIStandardURLMutator::Init would. The
+  // result may be shared with earlier callers that passed the same arguments,
+  // since a small cache of recent results is kept to avoid parsing the URLs
+  // that documents resolve over and over again.
+  static nsresult NewAuthorityURI(const nsACString& aSpec,
+                                  const char* aCharset, nsIURI* aBaseURI,
+                                  int32_t aDefaultPort, nsIURI** aURI);
+  // Forgets the URLs kept by NewAuthorityURI, e.g. once the last private
+  // browsing context is gone.
+  static void ClearParseCache();
+  // Hit and miss counts of the cache used by NewAuthorityURI.
+  static void GetParseCacheStats(uint32_t* aHits, uint32_t* aMisses);
+
   //
   // location and length of an url segment relative to mSpec
   //
@@ -37,6 +37,14 @@
 #include "HttpConnectionUDP.h"
 #include "mozilla/ProfilerBandwidthCounter.h"
 #include "mozilla/StaticPrefs_network.h"
+#include "mozilla/net/UDPDatagramBatch.h"
+
+#ifdef XP_LINUX
+#  include <errno.h>
+#  include <netinet/in.h>
+#  include <netinet/udp.h>
+#  include <sys/socket.h>
+#endif
 
 #if defined(FUZZING)
 #  include "FuzzyLayer.h"
@@ -48,16 +56,23 @@ namespace net {
 
 static const uint32_t UDP_PACKET_CHUNK_SIZE = 1400;
 
-//-----------------------------------------------------------------------------
-
-using nsUDPSocketFunc = void (nsUDPSocket::*)();
-
-static nsresult PostEvent(nsUDPSocket* s, nsUDPSocketFunc func) {
-  if (!gSocketTransportService) return NS_ERROR_FAILURE;
+// Largest datagram RecvWithAddr() and RecvBatch() read without GRO.
+static const uint32_t UDP_MAX_DATAGRAM_SIZE = 9216;
+// Number of datagrams RecvBatch() and SendBatch() hand to one system call.
+static const uint32_t UDP_BATCH_SIZE = 16;
+
+#ifdef XP_LINUX
+// With GRO a single read returns up to 64KiB of coalesced datagrams; fewer
+// of those fit in a batch of the same memory footprint.
+static const uint32_t UDP_GRO_BUFFER_SIZE = 65535;
+static const uint32_t UDP_GRO_BATCH_SIZE = 4;
+// Kernel limits on a single segmented send: the number of segments
+// (UDP_MAX_SEGMENTS) and the payload of an IPv4 datagram.
+static const uint32_t UDP_MAX_GSO_SEGMENTS = 64;
+static const uint32_t UDP_MAX_GSO_BYTES = 65507;
+#endif
 
-  return gSocketTransportService->Dispatch(
-      NewRunnableMethod("net::PostEvent", s, func), NS_DISPATCH_NORMAL);
-}
+//-----------------------------------------------------------------------------
 
 static nsresult ResolveHost(const nsACString& host,
                             const OriginAttributes& aOriginAttributes,
@@ -256,6 +271,13 @@ nsUDPSocket::nsUDPSocket() {
 
 nsUDPSocket::~nsUDPSocket() { CloseSocket(); }
 
+nsresult nsUDPSocket::PostEvent(void (nsUDPSocket::*aFunc)()) {
+  if (!mSts) return NS_ERROR_FAILURE;
+
+  return mSts->Dispatch(NewRunnableMethod("net::PostEvent", this, aFunc),
+                        NS_DISPATCH_NORMAL);
+}
+
 void nsUDPSocket::AddOutputBytes(uint32_t aBytes) {
   mByteWriteCount += aBytes;
   profiler_count_bandwidth_written_bytes(aBytes);
@@ -300,7 +322,7 @@ void nsUDPSocket::OnMsgAttach() {
 nsresult nsUDPSocket::TryAttach() {
   nsresult rv;
 
-  if (!gSocketTransportService) return NS_ERROR_FAILURE;
+  if (!mSts) return NS_ERROR_FAILURE;
 
   rv = CheckIOStatus(&mAddr);
   if (NS_FAILED(rv)) {
@@ -319,18 +341,18 @@ nsresult nsUDPSocket::TryAttach() {
   // FIFO ordering (which wouldn't even be that valuable IMO).  see bug
   // 194402 for more info.
   //
-  if (!gSocketTransportService->CanAttachSocket()) {
+  if (!mSts->CanAttachSocket()) {
     nsCOMPtr<nsIRunnable> event = NewRunnableMethod(
         "net::nsUDPSocket::OnMsgAttach", this, &nsUDPSocket::OnMsgAttach);
 
-    nsresult rv = gSocketTransportService->NotifyWhenCanAttachSocket(event);
+    nsresult rv = mSts->NotifyWhenCanAttachSocket(event);
     if (NS_FAILED(rv)) return rv;
   }
 
   //
   // ok, we can now attach our socket to the STS for polling
   //
-  rv = gSocketTransportService->AttachSocket(mFD, this);
+  rv = mSts->AttachSocket(mFD, this);
   if (NS_FAILED(rv)) return rv;
 
   mAttached = true;
@@ -431,7 +453,7 @@ void nsUDPSocket::OnSocketReady(PRFileDesc* fd, int16_t outFlags) {
   int32_t count;
   // Bug 1252755 - use 9216 bytes to allign with nICEr and transportlayer to
   // support the maximum size of jumbo frames
-  char buff[9216];
+  char buff[UDP_MAX_DATAGRAM_SIZE];
   count = PR_RecvFrom(mFD, buff, sizeof(buff), 0, &prClientAddr,
                       PR_INTERVAL_NO_WAIT);
   if (count < 0) {
@@ -728,7 +750,7 @@ nsUDPSocket::Close() {
       return NS_OK;
     }
   }
-  return PostEvent(this, &nsUDPSocket::OnMsgClose);
+  return PostEvent(&nsUDPSocket::OnMsgClose);
 }
 
 NS_IMETHODIMP
@@ -1114,7 +1136,14 @@ nsUDPSocket::AsyncListen(nsIUDPSocketListener* aListener) {
       mListener = new SocketListenerProxyBackground(aListener);
     }
   }
-  return PostEvent(this, &nsUDPSocket::OnMsgAttach);
+  // Packets are handed to asynchronous listeners on their own thread, so the
+  // socket can be polled by any socket thread.  Like the rest of the setup,
+  // this happens before the socket is used from other threads.
+  if (RefPtr<nsSocketTransportService> sts =
+          nsSocketTransportService::PickShard()) {
+    mSts = std::move(sts);
+  }
+  return PostEvent(&nsUDPSocket::OnMsgAttach);
 }
 
 NS_IMETHODIMP
@@ -1126,7 +1155,7 @@ nsUDPSocket::SyncListen(nsIUDPSocketSyncListener* aListener) {
 
   mSyncListener = aListener;
 
-  return PostEvent(this, &nsUDPSocket::OnMsgAttach);
+  return PostEvent(&nsUDPSocket::OnMsgAttach);
 }
 
 NS_IMETHODIMP
@@ -1252,7 +1281,7 @@ nsUDPSocket::SendBinaryStreamWithAddress(const NetAddr* aAddr,
 
 NS_IMETHODIMP
 nsUDPSocket::RecvWithAddr(NetAddr* addr, nsTArray<uint8_t>& aData) {
-  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(mSts->IsOnCurrentThreadInfallible(), "not on socket thread");
   PRNetAddr prAddr;
   int32_t count;
   char buff[9216];
@@ -1274,6 +1303,303 @@ nsUDPSocket::RecvWithAddr(NetAddr* addr, nsTArray<uint8_t>& aData) {
   return NS_OK;
 }
 
+NS_IMETHODIMP
+nsUDPSocket::RecvBatch(UDPDatagramBatch& aBatch) {
+  MOZ_ASSERT(mSts->IsOnCurrentThreadInfallible(), "not on socket thread");
+  aBatch.Clear();
+  if (!mFD) {
+    return NS_OK;
+  }
+
+#ifdef XP_LINUX
+  // Layers (fuzzing, mock network) must see every read, so talk to the OS
+  // socket directly only when there are none.
+  if (PR_GetLayersIdentity(mFD) == PR_NSPR_IO_LAYER) {
+    RecvMultiple(aBatch);
+    return NS_OK;
+  }
+#endif
+
+  uint8_t* buffer =
+      aBatch.ReserveForReceive(UDP_BATCH_SIZE * UDP_MAX_DATAGRAM_SIZE);
+  if (!buffer) {
+    mCondition = NS_ERROR_UNEXPECTED;
+    return NS_OK;
+  }
+  for (uint32_t i = 0; i < UDP_BATCH_SIZE; ++i) {
+    uint32_t offset = i * UDP_MAX_DATAGRAM_SIZE;
+    PRNetAddr prAddr;
+    int32_t count = PR_RecvFrom(mFD, buffer + offset, UDP_MAX_DATAGRAM_SIZE, 0,
+                                &prAddr, PR_INTERVAL_NO_WAIT);
+    if (count < 0) {
+      break;
+    }
+    this->AddInputBytes(count);
+    NetAddr addr;
+    PRNetAddrToNetAddr(&prAddr, &addr);
+    if (!aBatch.AppendReceived(addr, offset, count)) {
+      mCondition = NS_ERROR_UNEXPECTED;
+      break;
+    }
+  }
+  return NS_OK;
+}
+
+NS_IMETHODIMP
+nsUDPSocket::SendBatch(UDPDatagramBatch& aBatch, uint64_t* _retval) {
+  MOZ_ASSERT(mSts->IsOnCurrentThreadInfallible(), "not on socket thread");
+  NS_ENSURE_ARG_POINTER(_retval);
+  *_retval = 0;
+
+  MutexAutoLock lock(mLock);
+  if (!mFD) {
+    // socket is not initialized or has been closed
+    return NS_ERROR_FAILURE;
+  }
+
+#ifdef XP_LINUX
+  if (PR_GetLayersIdentity(mFD) == PR_NSPR_IO_LAYER) {
+    return SendMultiple(aBatch, _retval);
+  }
+#endif
+
+  uint32_t sent = 0;
+  nsresult rv = NS_OK;
+  for (; sent < aBatch.Length(); ++sent) {
+    const NetAddr& addr = aBatch.Addr(sent);
+    if (StaticPrefs::network_http_http3_block_loopback_ipv6_addr() &&
+        addr.raw.family == AF_INET6 && addr.IsLoopbackAddr()) {
+      rv = NS_ERROR_CONNECTION_REFUSED;
+      break;
+    }
+    PRNetAddr prAddr;
+    NetAddrToPRNetAddr(&addr, &prAddr);
+    Span<const uint8_t> data = aBatch.Data(sent);
+    int32_t count = PR_SendTo(mFD, data.Elements(), data.Length(), 0, &prAddr,
+                              PR_INTERVAL_NO_WAIT);
+    if (count < 0) {
+      PRErrorCode code = PR_GetError();
+      if (code != PR_WOULD_BLOCK_ERROR) {
+        rv = ErrorAccordingToNSPR(code);
+      }
+      break;
+    }
+    this->AddOutputBytes(count);
+    *_retval += count;
+  }
+  aBatch.RemoveFirst(sent);
+  return rv;
+}
+
+#ifdef XP_LINUX
+// PRNetAddr has the layout of the OS socket addresses on Linux; NSPR passes
+// it to the socket calls as is, and so do we.
+static_assert(sizeof(PRNetAddr) >= sizeof(struct sockaddr_in6));
+
+void nsUDPSocket::RecvMultiple(UDPDatagramBatch& aBatch) {
+  int fd = PR_FileDesc2NativeHandle(mFD);
+  if (mGRO == Offload::Unknown) {
+    int one = 1;
+    mGRO = setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0
+               ? Offload::Enabled
+               : Offload::Disabled;
+  }
+  bool gro = mGRO == Offload::Enabled;
+  uint32_t slots = gro ? UDP_GRO_BATCH_SIZE : UDP_BATCH_SIZE;
+  uint32_t slotSize = gro ? UDP_GRO_BUFFER_SIZE : UDP_MAX_DATAGRAM_SIZE;
+  uint8_t* buffer = aBatch.ReserveForReceive(slots * slotSize);
+  if (!buffer) {
+    mCondition = NS_ERROR_UNEXPECTED;
+    return;
+  }
+
+  struct mmsghdr msgs[UDP_BATCH_SIZE] = {};
+  struct iovec iovs[UDP_BATCH_SIZE];
+  PRNetAddr addrs[UDP_BATCH_SIZE];
+  union {
+    char mBuf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr mAlign;
+  } controls[UDP_BATCH_SIZE];
+  for (uint32_t i = 0; i < slots; ++i) {
+    iovs[i].iov_base = buffer + i * slotSize;
+    iovs[i].iov_len = slotSize;
+    msgs[i].msg_hdr.msg_name = &addrs[i];
+    msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    if (gro) {
+      msgs[i].msg_hdr.msg_control = controls[i].mBuf;
+      msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].mBuf);
+    }
+  }
+
+  int n;
+  do {
+    n = recvmmsg(fd, msgs, slots, MSG_DONTWAIT, nullptr);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      UDPSOCKET_LOG(("nsUDPSocket::RecvMultiple: recvmmsg failed [this=%p "
+                     "errno=%d]\n",
+                     this, errno));
+    }
+    return;
+  }
+
+  for (int i = 0; i < n; ++i) {
+    uint32_t length = msgs[i].msg_len;
+    this->AddInputBytes(length);
+
+    // A GRO read holds several datagrams of the same size, the last of
+    // which may be shorter.
+    uint32_t segment = length;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        int size;
+        memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+        if (size > 0) {
+          segment = size;
+        }
+      }
+    }
+
+    NetAddr addr;
+    PRNetAddrToNetAddr(&addrs[i], &addr);
+    uint32_t offset = i * slotSize;
+    for (uint32_t done = 0; done < length; done += segment) {
+      if (!aBatch.AppendReceived(addr, offset + done,
+                                 std::min(segment, length - done))) {
+        mCondition = NS_ERROR_UNEXPECTED;
+        return;
+      }
+    }
+  }
+}
+
+nsresult nsUDPSocket::SendMultiple(UDPDatagramBatch& aBatch,
+                                   uint64_t* aBytesSent) {
+  int fd = PR_FileDesc2NativeHandle(mFD);
+  if (mGSO == Offload::Unknown) {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    mGSO = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &len) == 0
+               ? Offload::Enabled
+               : Offload::Disabled;
+  }
+
+  while (!aBatch.IsEmpty()) {
+    struct mmsghdr msgs[UDP_BATCH_SIZE] = {};
+    struct iovec iovs[UDP_BATCH_SIZE];
+    PRNetAddr addrs[UDP_BATCH_SIZE];
+    union {
+      char mBuf[CMSG_SPACE(sizeof(uint16_t))];
+      struct cmsghdr mAlign;
+    } controls[UDP_BATCH_SIZE];
+    // Number of datagrams carried by each message.
+    uint32_t counts[UDP_BATCH_SIZE];
+    bool segmented = false;
+
+    uint32_t next = 0;
+    uint32_t m = 0;
+    for (; m < UDP_BATCH_SIZE && next < aBatch.Length(); ++m) {
+      const NetAddr& addr = aBatch.Addr(next);
+      if (StaticPrefs::network_http_http3_block_loopback_ipv6_addr() &&
+          addr.raw.family == AF_INET6 && addr.IsLoopbackAddr()) {
+        if (!m) {
+          return NS_ERROR_CONNECTION_REFUSED;
+        }
+        break;
+      }
+
+      // Extend the message with the datagrams that follow, as long as they
+      // go to the same address, are stored right after it and are no larger
+      // than the first one.
+      Span<const uint8_t> first = aBatch.Data(next);
+      uint32_t segment = first.Length();
+      uint32_t total = segment;
+      uint32_t count = 1;
+      if (mGSO == Offload::Enabled) {
+        while (next + count < aBatch.Length() &&
+               count < UDP_MAX_GSO_SEGMENTS) {
+          Span<const uint8_t> data = aBatch.Data(next + count);
+          if (data.Length() > segment || !data.Length() ||
+              total + data.Length() > UDP_MAX_GSO_BYTES ||
+              data.Elements() != first.Elements() + total ||
+              !(aBatch.Addr(next + count) == addr)) {
+            break;
+          }
+          total += data.Length();
+          ++count;
+          if (data.Length() < segment) {
+            // Only the last segment may be short.
+            break;
+          }
+        }
+      }
+
+      NetAddrToPRNetAddr(&addr, &addrs[m]);
+      iovs[m].iov_base = const_cast<uint8_t*>(first.Elements());
+      iovs[m].iov_len = total;
+      msgs[m].msg_hdr.msg_name = &addrs[m];
+      msgs[m].msg_hdr.msg_namelen = PR_NETADDR_SIZE(&addrs[m]);
+      msgs[m].msg_hdr.msg_iov = &iovs[m];
+      msgs[m].msg_hdr.msg_iovlen = 1;
+      if (count > 1) {
+        segmented = true;
+        msgs[m].msg_hdr.msg_control = controls[m].mBuf;
+        msgs[m].msg_hdr.msg_controllen = sizeof(controls[m].mBuf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[m].msg_hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = segment;
+        memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+      }
+      counts[m] = count;
+      next += count;
+    }
+
+    int n;
+    do {
+      n = sendmmsg(fd, msgs, m, MSG_DONTWAIT);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+        return NS_OK;
+      }
+      if (segmented && (errno == EIO || errno == EINVAL)) {
+        // The route's device can't segment (no checksum offload, for
+        // instance). Send the datagrams one by one from now on.
+        UDPSOCKET_LOG(("nsUDPSocket::SendMultiple: disabling GSO [this=%p "
+                       "errno=%d]\n",
+                       this, errno));
+        mGSO = Offload::Disabled;
+        continue;
+      }
+      UDPSOCKET_LOG(
+          ("nsUDPSocket::SendMultiple: sendmmsg failed [this=%p errno=%d]\n",
+           this, errno));
+      return errno == ECONNREFUSED ? NS_ERROR_CONNECTION_REFUSED
+                                   : NS_ERROR_FAILURE;
+    }
+
+    uint32_t sent = 0;
+    for (int i = 0; i < n; ++i) {
+      this->AddOutputBytes(msgs[i].msg_len);
+      *aBytesSent += msgs[i].msg_len;
+      sent += counts[i];
+    }
+    aBatch.RemoveFirst(sent);
+    if (uint32_t(n) < m) {
+      // The socket buffer is full.
+      return NS_OK;
+    }
+  }
+  return NS_OK;
+}
+#endif  // XP_LINUX
+
 nsresult nsUDPSocket::SetSocketOption(const PRSocketOptionData& aOpt) {
   bool onSTSThread = false;
   mSts->IsOnCurrentThread(&onSTSThread);
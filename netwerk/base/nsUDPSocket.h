@@ -42,6 +42,9 @@ class nsUDPSocket final : public nsASocketHandler, public nsIUDPSocket {
   void OnMsgClose();
   void OnMsgAttach();
 
+  // dispatch a call to the thread polling our socket.
+  nsresult PostEvent(void (nsUDPSocket::*aFunc)());
+
   // try attaching our socket (mFD) to the STS's poll list.
   nsresult TryAttach();
 
@@ -55,6 +58,13 @@ class nsUDPSocket final : public nsASocketHandler, public nsIUDPSocket {
 
   void CloseSocket();
 
+#ifdef XP_LINUX
+  // recvmmsg()/sendmmsg() based RecvBatch()/SendBatch(), for when mFD has no
+  // I/O layer on top of the OS socket.
+  void RecvMultiple(UDPDatagramBatch& aBatch);
+  nsresult SendMultiple(UDPDatagramBatch& aBatch, uint64_t* aBytesSent);
+#endif
+
   // lock protects access to mListener;
   // so mListener is not cleared while being used/locked.
   Mutex mLock MOZ_UNANNOTATED{"nsUDPSocket.mLock"};
@@ -69,6 +79,15 @@ class nsUDPSocket final : public nsASocketHandler, public nsIUDPSocket {
 
   uint64_t mByteReadCount{0};
   uint64_t mByteWriteCount{0};
+
+#ifdef XP_LINUX
+  // Whether the kernel segments our sends (UDP_SEGMENT) and coalesces
+  // received datagrams (UDP_GRO) on this socket. Probed on first use, on the
+  // socket thread.
+  enum class Offload : uint8_t { Unknown, Enabled, Disabled };
+  Offload mGSO{Offload::Unknown};
+  Offload mGRO{Offload::Unknown};
+#endif
 };
 
 //-----------------------------------------------------------------------------
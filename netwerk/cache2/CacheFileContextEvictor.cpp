@@ -5,6 +5,7 @@
 #include "CacheLog.h"
 #include "CacheFileContextEvictor.h"
 #include "CacheFileIOManager.h"
+#include "CacheFilePackStore.h"
 #include "CacheFileMetadata.h"
 #include "CacheIndex.h"
 #include "CacheIndexIterator.h"
@@ -206,7 +207,8 @@ void CacheFileContextEvictor::CacheIndexStateChanged() {
   }
 }
 
-void CacheFileContextEvictor::WasEvicted(const nsACString& aKey, nsIFile* aFile,
+void CacheFileContextEvictor::WasEvicted(const nsACString& aKey,
+                                         PRTime aLastModifiedTime,
                                          bool* aEvictedAsPinned,
                                          bool* aEvictedAsNonPinned) {
   LOG(("CacheFileContextEvictor::WasEvicted() [key=%s]",
@@ -231,15 +233,7 @@ void CacheFileContextEvictor::WasEvicted(const nsACString& aKey, nsIFile* aFile,
       continue;
     }
 
-    PRTime lastModifiedTime;
-    if (NS_FAILED(aFile->GetLastModifiedTime(&lastModifiedTime))) {
-      LOG(
-          ("CacheFileContextEvictor::WasEvicted() - Cannot get last modified "
-           "time, returning."));
-      return;
-    }
-
-    if (lastModifiedTime > entry->mTimeStamp) {
+    if (aLastModifiedTime > entry->mTimeStamp) {
       // File has been modified since context eviction.
       continue;
     }
@@ -247,7 +241,7 @@ void CacheFileContextEvictor::WasEvicted(const nsACString& aKey, nsIFile* aFile,
     LOG(
         ("CacheFileContextEvictor::WasEvicted() - evicted [pinning=%d, "
          "mTimeStamp=%" PRId64 ", lastModifiedTime=%" PRId64 "]",
-         entry->mPinned, entry->mTimeStamp, lastModifiedTime));
+         entry->mPinned, entry->mTimeStamp, aLastModifiedTime));
 
     if (entry->mPinned) {
       *aEvictedAsPinned = true;
@@ -687,13 +681,10 @@ void CacheFileContextEvictor::EvictEntries() {
     // Check whether we must filter by either base domain or by origin.
     if (!mEntries[0]->mBaseDomain.IsEmpty() ||
         !mEntries[0]->mOrigin.IsEmpty()) {
-      // Get and read metadata for the entry
-      nsCOMPtr<nsIFile> file;
-      CacheFileIOManager::gInstance->GetFile(&hash, getter_AddRefs(file));
-
-      // Read metadata from the file synchronously
+      // Read metadata for the entry synchronously
       RefPtr<CacheFileMetadata> metadata = new CacheFileMetadata();
-      rv = metadata->SyncReadMetadata(file);
+      rv = CacheFileIOManager::gInstance->SyncReadEntryMetadata(&hash,
+                                                                metadata);
       if (NS_WARN_IF(NS_FAILED(rv))) {
         continue;
       }
@@ -803,6 +794,13 @@ void CacheFileContextEvictor::EvictEntries() {
     if (NS_SUCCEEDED(rv)) {
       rv = file->GetLastModifiedTime(&lastModifiedTime);
     }
+    bool packed = false;
+    if (NS_FAILED(rv) && CacheFileIOManager::gInstance->mPackStore) {
+      // There is no file, but the entry may be packed.
+      rv = CacheFileIOManager::gInstance->mPackStore->GetLastModifiedTime(
+          hash, &lastModifiedTime);
+      packed = NS_SUCCEEDED(rv);
+    }
     if (NS_FAILED(rv)) {
       LOG(
           ("CacheFileContextEvictor::EvictEntries() - Cannot get last modified "
@@ -819,7 +817,11 @@ void CacheFileContextEvictor::EvictEntries() {
     }
 
     LOG(("CacheFileContextEvictor::EvictEntries - Removing entry."));
-    file->Remove(false);
+    if (packed) {
+      CacheFileIOManager::gInstance->RemovePackedEntry(&hash);
+    } else {
+      file->Remove(false);
+    }
     CacheIndex::RemoveEntry(&hash);
   }
 
@@ -52,10 +52,10 @@ class CacheFileContextEvictor {
   void CacheIndexStateChanged();
   // CacheFileIOManager calls this method to check whether an entry file should
   // be considered as evicted. It returns true when there is a matching context
-  // info to the given key and the last modified time of the entry file is
-  // earlier than the time stamp of the time when the context was added to the
-  // evictor.
-  void WasEvicted(const nsACString& aKey, nsIFile* aFile,
+  // info to the given key and the last modified time of the entry file (or of
+  // its pack store record) is earlier than the time stamp of the time when the
+  // context was added to the evictor.
+  void WasEvicted(const nsACString& aKey, PRTime aLastModifiedTime,
                   bool* aEvictedAsPinned, bool* aEvictedAsNonPinned);
 
  private:
@@ -16,6 +16,7 @@
 #include "CacheObserver.h"
 #include "nsIFile.h"
 #include "CacheFileContextEvictor.h"
+#include "CacheFilePackStore.h"
 #include "nsITimer.h"
 #include "nsIDirectoryEnumerator.h"
 #include "nsEffectiveTLDService.h"
@@ -123,6 +124,7 @@ CacheFileHandle::CacheFileHandle(const SHA1Sum::Hash* aHash, bool aPriority,
       mSpecialFile(false),
       mInvalid(false),
       mFileExists(false),
+      mPacked(false),
       mDoomWhenFoundPinned(false),
       mDoomWhenFoundNonPinned(false),
       mKilled(false),
@@ -148,6 +150,7 @@ CacheFileHandle::CacheFileHandle(const nsACString& aKey, bool aPriority,
       mSpecialFile(true),
       mInvalid(false),
       mFileExists(false),
+      mPacked(false),
       mDoomWhenFoundPinned(false),
       mDoomWhenFoundNonPinned(false),
       mKilled(false),
@@ -255,6 +258,7 @@ size_t CacheFileHandle::SizeOfExcludingThis(
 
   n += mallocSizeOf(mFD);
   n += mKey.SizeOfExcludingThisIfUnshared(mallocSizeOf);
+  n += mPackedData.ShallowSizeOfExcludingThis(mallocSizeOf);
   return n;
 }
 
@@ -1253,7 +1257,8 @@ void CacheFileIOManager::ShutdownInternal() {
     // Invalid files don't have metadata and thus won't load anyway
     // (hashes won't match).
 
-    if (!h->IsSpecialFile() && !h->mIsDoomed && !h->mFileExists) {
+    if (!h->IsSpecialFile() && !h->mIsDoomed && !h->mFileExists &&
+        !h->mPacked) {
       CacheIndex::RemoveEntry(h->Hash());
     }
 
@@ -1288,6 +1293,8 @@ void CacheFileIOManager::ShutdownInternal() {
     mContextEvictor->Shutdown();
     mContextEvictor = nullptr;
   }
+
+  mPackStore = nullptr;
 }
 
 // static
@@ -1372,6 +1379,22 @@ nsresult CacheFileIOManager::OnProfile() {
   return NS_OK;
 }
 
+// static
+nsresult CacheFileIOManager::InitForTesting(nsIFile* aCacheDirectory) {
+  LOG(("CacheFileIOManager::InitForTesting()"));
+
+  nsresult rv = Init();
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsCOMPtr<nsIFile> directory;
+  rv = aCacheDirectory->Clone(getter_AddRefs(directory));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  gInstance->mCacheDirectory.swap(directory);
+
+  return CacheIndex::InitForTesting(gInstance->mCacheDirectory);
+}
+
 static bool inBackgroundTask() {
   MOZ_ASSERT(NS_IsMainThread(), "backgroundtasks are main thread only");
 #if defined(MOZ_BACKGROUNDTASKS)
@@ -1727,6 +1750,13 @@ nsresult CacheFileIOManager::OpenFileInternal(const SHA1Sum::Hash* aHash,
              ". [rv=0x%08" PRIx32 "]",
              static_cast<uint32_t>(rv)));
       }
+    } else if (mPackStore && mPackStore->Contains(*aHash)) {
+      CacheIndex::RemoveEntry(aHash);
+
+      LOG(
+          ("CacheFileIOManager::OpenFileInternal() - Removing old record from "
+           "the pack store"));
+      RemovePackedEntry(aHash);
     }
 
     CacheIndex::AddEntry(aHash);
@@ -1743,27 +1773,47 @@ nsresult CacheFileIOManager::OpenFileInternal(const SHA1Sum::Hash* aHash,
   rv = file->Exists(&exists);
   NS_ENSURE_SUCCESS(rv, rv);
 
-  if (exists && mContextEvictor) {
+  bool packed = false;
+  uint32_t packedLength = 0;
+  if (mPackStore && mPackStore->Contains(*aHash, &packedLength)) {
+    if (exists) {
+      // The file was written after the record, which is stale now.
+      RemovePackedEntry(aHash);
+    } else {
+      packed = true;
+    }
+  }
+
+  if ((exists || packed) && mContextEvictor) {
     if (mContextEvictor->ContextsCount() == 0) {
       mContextEvictor = nullptr;
     } else {
-      mContextEvictor->WasEvicted(aKey, file, &evictedAsPinned,
-                                  &evictedAsNonPinned);
+      PRTime lastModifiedTime;
+      rv = packed ? mPackStore->GetLastModifiedTime(*aHash, &lastModifiedTime)
+                  : file->GetLastModifiedTime(&lastModifiedTime);
+      if (NS_SUCCEEDED(rv)) {
+        mContextEvictor->WasEvicted(aKey, lastModifiedTime, &evictedAsPinned,
+                                    &evictedAsNonPinned);
+      } else {
+        LOG(
+            ("CacheFileIOManager::OpenFileInternal() - Cannot get last "
+             "modified time, not checking context eviction."));
+      }
     }
   }
 
-  if (!exists && (aFlags & (OPEN | CREATE | CREATE_NEW)) == OPEN) {
+  if (!exists && !packed && (aFlags & (OPEN | CREATE | CREATE_NEW)) == OPEN) {
     return NS_ERROR_NOT_AVAILABLE;
   }
 
-  if (exists) {
+  if (exists || packed) {
     // For existing files we determine the pinning status later, after the
     // metadata gets parsed.
     pinning = CacheFileHandle::PinningStatus::UNKNOWN;
   }
 
   handle = mHandles.NewHandle(aHash, aFlags & PRIORITY, pinning);
-  if (exists) {
+  if (exists || packed) {
     // If this file has been found evicted through the context file evictor
     // above for any of pinned or non-pinned state, these calls ensure we doom
     // the handle ASAP we know the real pinning state after metadta has been
@@ -1778,12 +1828,17 @@ nsresult CacheFileIOManager::OpenFileInternal(const SHA1Sum::Hash* aHash,
       MOZ_ASSERT(!handle->IsDoomed() && NS_SUCCEEDED(rv));
     }
 
-    int64_t fileSize = -1;
-    rv = file->GetFileSize(&fileSize);
-    NS_ENSURE_SUCCESS(rv, rv);
+    if (packed) {
+      handle->mFileSize = packedLength;
+      handle->mPacked = true;
+    } else {
+      int64_t fileSize = -1;
+      rv = file->GetFileSize(&fileSize);
+      NS_ENSURE_SUCCESS(rv, rv);
 
-    handle->mFileSize = fileSize;
-    handle->mFileExists = true;
+      handle->mFileSize = fileSize;
+      handle->mFileExists = true;
+    }
 
     CacheIndex::EnsureEntryExists(aHash);
   } else {
@@ -1925,8 +1980,15 @@ void CacheFileIOManager::CloseHandleInternal(CacheFileHandle* aHandle) {
     }
   }
 
+  if (aHandle->mPacked && aHandle->mInvalid && !aHandle->mIsDoomed) {
+    RemovePackedEntry(aHandle->Hash());
+    aHandle->mPacked = false;
+  } else if (ShouldPack(aHandle)) {
+    PackFile(aHandle);
+  }
+
   if (!aHandle->IsSpecialFile() && !aHandle->mIsDoomed &&
-      (aHandle->mInvalid || !aHandle->mFileExists)) {
+      (aHandle->mInvalid || (!aHandle->mFileExists && !aHandle->mPacked))) {
     CacheIndex::RemoveEntry(aHandle->Hash());
   }
 
@@ -1988,6 +2050,21 @@ nsresult CacheFileIOManager::ReadInternal(CacheFileHandle* aHandle,
     return NS_ERROR_NOT_INITIALIZED;
   }
 
+  if (aHandle->mPacked) {
+    rv = LoadPackedData(aHandle);
+    if (NS_FAILED(rv)) {
+      return rv;
+    }
+
+    int64_t length = aHandle->mPackedData.Length();
+    if (aOffset < 0 || aCount < 0 || aOffset + aCount > length) {
+      return NS_ERROR_FAILURE;
+    }
+
+    memcpy(aBuf, aHandle->mPackedData.Elements() + aOffset, aCount);
+    return NS_OK;
+  }
+
   if (!aHandle->mFileExists) {
     NS_WARNING("Trying to read from non-existent file");
     return NS_ERROR_NOT_AVAILABLE;
@@ -2126,6 +2203,17 @@ nsresult CacheFileIOManager::WriteInternal(CacheFileHandle* aHandle,
 
   CacheIOThread::Cancelable cancelable(!aHandle->IsSpecialFile());
 
+  if (aHandle->mPacked) {
+    // The metadata at the end of the entry is rewritten whenever it changes,
+    // e.g. with the fetch count on every hit. That keeps the entry packed.
+    if (aValidate && aTruncate &&
+        NS_SUCCEEDED(RewritePackedEntry(aHandle, aOffset, aBuf, aCount))) {
+      return NS_OK;
+    }
+    rv = UnpackFile(aHandle, aHandle->mFileSize);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
   if (!aHandle->mFileExists) {
     rv = CreateFile(aHandle);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -2322,6 +2410,13 @@ nsresult CacheFileIOManager::DoomFileInternal(
       NS_ENSURE_SUCCESS(rv, rv);
       aHandle->mFile.swap(file);
     }
+  } else if (aHandle->mPacked) {
+    // A doomed entry can still be read by its current users, so keep the data
+    // in memory once the record is gone.
+    if (NS_FAILED(LoadPackedData(aHandle))) {
+      LOG(("  cannot load packed data, the entry will not be readable"));
+    }
+    RemovePackedEntry(aHandle->Hash());
   }
 
   if (!aHandle->IsSpecialFile()) {
@@ -2405,7 +2500,16 @@ nsresult CacheFileIOManager::DoomFileByKeyInternal(const SHA1Sum::Hash* aHash) {
   NS_ENSURE_SUCCESS(rv, rv);
 
   if (!exists) {
-    return NS_ERROR_NOT_AVAILABLE;
+    if (!mPackStore || !mPackStore->Contains(*aHash)) {
+      return NS_ERROR_NOT_AVAILABLE;
+    }
+
+    LOG(
+        ("CacheFileIOManager::DoomFileByKeyInternal() - Removing record from "
+         "the pack store"));
+    RemovePackedEntry(aHash);
+    CacheIndex::RemoveEntry(aHash);
+    return NS_OK;
   }
 
   LOG(
@@ -2600,13 +2704,9 @@ nsresult CacheFileIOManager::GetEntryInfo(
     // to synchrnously load metadata from a disk file.
   }
 
-  // Locate the actual file
-  nsCOMPtr<nsIFile> file;
-  ioMan->GetFile(aHash, getter_AddRefs(file));
-
-  // Read metadata from the file synchronously
+  // Read metadata from the file or the pack store synchronously
   RefPtr<CacheFileMetadata> metadata = new CacheFileMetadata();
-  rv = metadata->SyncReadMetadata(file);
+  rv = ioMan->SyncReadEntryMetadata(aHash, metadata);
   if (NS_FAILED(rv)) {
     return NS_OK;
   }
@@ -2671,6 +2771,12 @@ nsresult CacheFileIOManager::TruncateSeekSetEOFInternal(
 
   CacheIOThread::Cancelable cancelable(!aHandle->IsSpecialFile());
 
+  if (aHandle->mPacked) {
+    // Only what is kept by the truncation needs to be written out.
+    rv = UnpackFile(aHandle, aTruncatePos);
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
   if (!aHandle->mFileExists) {
     rv = CreateFile(aHandle);
     NS_ENSURE_SUCCESS(rv, rv);
@@ -3172,6 +3278,15 @@ nsresult CacheFileIOManager::EvictAllInternal() {
     return rv;
   }
 
+  if (mPackStore) {
+    rv = mPackStore->RemoveAll();
+    if (NS_WARN_IF(NS_FAILED(rv))) {
+      // Leave the packed entries alone from now on, the index forgets them
+      // below.
+      mPackStore = nullptr;
+    }
+  }
+
   // Files are now inaccessible in entries directory, notify observers.
   NS_DispatchToMainThread(r);
 
@@ -4039,6 +4154,8 @@ nsresult CacheFileIOManager::CreateCacheTree() {
   mTreeCreated = true;
   mTreeCreationFailed = false;
 
+  OpenPackStore();
+
   if (!mContextEvictor) {
     RefPtr<CacheFileContextEvictor> contextEvictor;
     contextEvictor = new CacheFileContextEvictor();
@@ -4148,6 +4265,319 @@ void CacheFileIOManager::NSPRHandleUsed(CacheFileHandle* aHandle) {
   mHandlesByLastUsed.AppendElement(aHandle);
 }
 
+nsresult CacheFileIOManager::OpenPackStore() {
+  MOZ_ASSERT(mIOThread->IsCurrentThread());
+
+  if (mPackStoreOpened) {
+    return mPackStore ? NS_OK : NS_ERROR_NOT_AVAILABLE;
+  }
+
+  if (!mCacheDirectory || mShuttingDown) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  mPackStoreOpened = true;
+
+  nsresult rv;
+  nsCOMPtr<nsIFile> dir;
+  rv = mCacheDirectory->Clone(getter_AddRefs(dir));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = dir->AppendNative(nsLiteralCString(PACKS_DIR));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // Entries packed before the pref was turned off stay readable until they
+  // are replaced or evicted, but nothing is created when it is off.
+  if (!StaticPrefs::network_cache_pack_small_entries()) {
+    bool exists = false;
+    if (NS_FAILED(dir->Exists(&exists)) || !exists) {
+      return NS_ERROR_NOT_AVAILABLE;
+    }
+  }
+
+  auto store = MakeUnique<CacheFilePackStore>(dir);
+  rv = store->Init();
+  if (NS_FAILED(rv)) {
+    LOG(
+        ("CacheFileIOManager::OpenPackStore() - Cannot open the pack store "
+         "[rv=0x%08" PRIx32 "]",
+         static_cast<uint32_t>(rv)));
+    return rv;
+  }
+
+  mPackStore = std::move(store);
+  MaybeCompactPackStore();
+  return NS_OK;
+}
+
+bool CacheFileIOManager::ShouldPack(CacheFileHandle* aHandle) const {
+  return mPackStore && StaticPrefs::network_cache_pack_small_entries() &&
+         !mShuttingDown && !CacheObserver::ShuttingDown() &&
+         !aHandle->IsSpecialFile() && !aHandle->mIsDoomed &&
+         !aHandle->mInvalid && !aHandle->mKilled && aHandle->mFileExists &&
+         !aHandle->mFD && aHandle->mFileSize > 0 &&
+         aHandle->mFileSize <=
+             StaticPrefs::network_cache_pack_entry_max_size();
+}
+
+void CacheFileIOManager::PackFile(CacheFileHandle* aHandle) {
+  LOG(("CacheFileIOManager::PackFile() [handle=%p]", aHandle));
+
+  MOZ_ASSERT(ShouldPack(aHandle));
+
+  nsresult rv;
+
+  nsTArray<uint8_t> data;
+  if (!data.SetLength(aHandle->mFileSize, fallible)) {
+    return;
+  }
+
+  PRFileDesc* fd;
+  rv = aHandle->mFile->OpenNSPRFileDesc(PR_RDONLY, 0600, &fd);
+  if (NS_FAILED(rv)) {
+    return;
+  }
+
+  int32_t bytesRead = PR_Read(fd, data.Elements(), data.Length());
+  PR_Close(fd);
+  if (bytesRead != static_cast<int32_t>(data.Length())) {
+    LOG(("  cannot read the file, leaving it alone"));
+    return;
+  }
+
+  rv = mPackStore->Put(*aHandle->Hash(), data);
+  if (NS_FAILED(rv)) {
+    LOG(("  cannot store the record [rv=0x%08" PRIx32 "]",
+         static_cast<uint32_t>(rv)));
+    return;
+  }
+
+  rv = aHandle->mFile->Remove(false);
+  if (NS_FAILED(rv)) {
+    // The file would shadow the record anyway.
+    LOG(("  cannot remove the file [rv=0x%08" PRIx32 "]",
+         static_cast<uint32_t>(rv)));
+    RemovePackedEntry(aHandle->Hash());
+    return;
+  }
+
+  aHandle->mFileExists = false;
+  aHandle->mPacked = true;
+
+  // The record may have replaced an older one.
+  MaybeCompactPackStore();
+}
+
+nsresult CacheFileIOManager::UnpackFile(CacheFileHandle* aHandle,
+                                        int64_t aLength) {
+  LOG(("CacheFileIOManager::UnpackFile() [handle=%p, length=%" PRId64 "]",
+       aHandle, aLength));
+
+  MOZ_ASSERT(aHandle->mPacked);
+  MOZ_ASSERT(!aHandle->mFileExists);
+
+  nsresult rv;
+
+  rv = LoadPackedData(aHandle);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  rv = CreateFile(aHandle);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  uint32_t length = aHandle->mPackedData.Length();
+  if (aLength >= 0 && aLength < length) {
+    length = static_cast<uint32_t>(aLength);
+  }
+
+  if (length) {
+    int32_t bytesWritten =
+        PR_Write(aHandle->mFD, aHandle->mPackedData.Elements(), length);
+    if (bytesWritten != static_cast<int32_t>(length)) {
+      return NS_ERROR_FAILURE;
+    }
+  }
+
+  // CreateFile() reset the size, but the index still accounts for the whole
+  // entry. The caller's write or truncation brings both up to date.
+  aHandle->mFileSize = aHandle->mPackedData.Length();
+
+  aHandle->mPacked = false;
+  aHandle->mPackedData.Clear();
+  aHandle->mPackedData.Compact();
+
+  // Doomed handles lost their record already.
+  if (!aHandle->mIsDoomed) {
+    RemovePackedEntry(aHandle->Hash());
+  }
+
+  return NS_OK;
+}
+
+nsresult CacheFileIOManager::RewritePackedEntry(CacheFileHandle* aHandle,
+                                                int64_t aOffset,
+                                                const char* aBuf,
+                                                int32_t aCount) {
+  LOG(("CacheFileIOManager::RewritePackedEntry() [handle=%p, offset=%" PRId64
+       ", count=%d]",
+       aHandle, aOffset, aCount));
+
+  MOZ_ASSERT(aHandle->mPacked);
+
+  if (!mPackStore || !StaticPrefs::network_cache_pack_small_entries() ||
+      aHandle->mIsDoomed || aOffset < 0 ||
+      aOffset + aCount > StaticPrefs::network_cache_pack_entry_max_size()) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  nsresult rv = LoadPackedData(aHandle);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  if (aOffset > aHandle->mPackedData.Length()) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  nsTArray<uint8_t> data;
+  if (!data.SetCapacity(aOffset + aCount, fallible)) {
+    return NS_ERROR_OUT_OF_MEMORY;
+  }
+  data.AppendElements(aHandle->mPackedData.Elements(), aOffset);
+  data.AppendElements(reinterpret_cast<const uint8_t*>(aBuf), aCount);
+
+  // On failure, the caller writes the data we still have to a file, which
+  // takes precedence over whatever record the store is left with.
+  rv = mPackStore->Put(*aHandle->Hash(), data);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  uint32_t oldSizeInK = aHandle->FileSizeInK();
+  aHandle->mPackedData = std::move(data);
+  aHandle->mFileSize = aHandle->mPackedData.Length();
+  uint32_t newSizeInK = aHandle->FileSizeInK();
+
+  if (oldSizeInK != newSizeInK) {
+    CacheIndex::UpdateEntry(aHandle->Hash(), nullptr, nullptr, nullptr,
+                            nullptr, nullptr, &newSizeInK);
+
+    if (oldSizeInK < newSizeInK) {
+      EvictIfOverLimitInternal();
+    }
+  }
+
+  CacheIndex::UpdateTotalBytesWritten(aCount);
+  aHandle->mInvalid = false;
+
+  // The record replaced an older one.
+  MaybeCompactPackStore();
+  return NS_OK;
+}
+
+nsresult CacheFileIOManager::LoadPackedData(CacheFileHandle* aHandle) {
+  MOZ_ASSERT(aHandle->mPacked);
+
+  if (!aHandle->mPackedData.IsEmpty()) {
+    return NS_OK;
+  }
+
+  if (!mPackStore) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  nsresult rv = mPackStore->Read(*aHandle->Hash(), aHandle->mPackedData);
+  if (NS_FAILED(rv)) {
+    LOG(
+        ("CacheFileIOManager::LoadPackedData() - Cannot read the record "
+         "[handle=%p, rv=0x%08" PRIx32 "]",
+         aHandle, static_cast<uint32_t>(rv)));
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  return NS_OK;
+}
+
+void CacheFileIOManager::RemovePackedEntry(const SHA1Sum::Hash* aHash) {
+  if (!mPackStore) {
+    return;
+  }
+
+  nsresult rv = mPackStore->Remove(*aHash);
+  if (NS_FAILED(rv)) {
+    // The record would come back with the next session, and might then be
+    // served in place of a newer entry. Better lose all packed entries.
+    LOG(
+        ("CacheFileIOManager::RemovePackedEntry() - Cannot log the removal, "
+         "removing all records [rv=0x%08" PRIx32 "]",
+         static_cast<uint32_t>(rv)));
+    if (NS_FAILED(mPackStore->RemoveAll())) {
+      mPackStore = nullptr;
+    }
+    return;
+  }
+
+  MaybeCompactPackStore();
+}
+
+void CacheFileIOManager::MaybeCompactPackStore() {
+  if (mPackStoreCompacting || !mPackStore ||
+      !mPackStore->NeedsCompaction()) {
+    return;
+  }
+
+  nsCOMPtr<nsIRunnable> ev;
+  ev = NewRunnableMethod("net::CacheFileIOManager::CompactPackStoreInternal",
+                         this, &CacheFileIOManager::CompactPackStoreInternal);
+
+  if (NS_SUCCEEDED(mIOThread->Dispatch(ev, CacheIOThread::EVICT))) {
+    mPackStoreCompacting = true;
+  }
+}
+
+nsresult CacheFileIOManager::CompactPackStoreInternal() {
+  LOG(("CacheFileIOManager::CompactPackStoreInternal()"));
+
+  MOZ_ASSERT(mIOThread->IsCurrentThread());
+
+  mPackStoreCompacting = false;
+
+  while (mPackStore && !mShuttingDown) {
+    if (CacheIOThread::YieldAndRerun()) {
+      LOG(
+          ("CacheFileIOManager::CompactPackStoreInternal() - Breaking loop for "
+           "higher level events."));
+      mPackStoreCompacting = true;
+      return NS_OK;
+    }
+
+    if (!mPackStore->Compact()) {
+      break;
+    }
+  }
+
+  return NS_OK;
+}
+
+nsresult CacheFileIOManager::SyncReadEntryMetadata(
+    const SHA1Sum::Hash* aHash, CacheFileMetadata* aMetadata) {
+  MOZ_ASSERT(mIOThread->IsCurrentThread());
+
+  nsresult rv;
+
+  nsCOMPtr<nsIFile> file;
+  rv = GetFile(aHash, getter_AddRefs(file));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  // A file takes precedence over a record, see OpenFileInternal().
+  bool exists = false;
+  if (!mPackStore || !mPackStore->Contains(*aHash) ||
+      (NS_SUCCEEDED(file->Exists(&exists)) && exists)) {
+    return aMetadata->SyncReadMetadata(file);
+  }
+
+  nsTArray<uint8_t> data;
+  rv = mPackStore->Read(*aHash, data);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  return aMetadata->SyncReadMetadata(data);
+}
+
 nsresult CacheFileIOManager::SyncRemoveDir(nsIFile* aFile, const char* aDir) {
   nsresult rv;
   nsCOMPtr<nsIFile> file;
@@ -4274,6 +4704,7 @@ void CacheFileIOManager::SyncRemoveAllCacheFiles() {
 
   SyncRemoveDir(mCacheDirectory, ENTRIES_DIR);
   SyncRemoveDir(mCacheDirectory, DOOMED_DIR);
+  SyncRemoveDir(mCacheDirectory, PACKS_DIR);
 
   // Clear any intermediate state of trash dir enumeration.
   mFailedTrashDirs.Clear();
@@ -4415,7 +4846,8 @@ class SizeOfHandlesRunnable : public Runnable {
   SizeOfHandlesRunnable(mozilla::MallocSizeOf mallocSizeOf,
                         CacheFileHandles const& handles,
                         nsTArray<CacheFileHandle*> const& specialHandles,
-                        nsCOMPtr<nsITimer> const& metadataWritesTimer)
+                        nsCOMPtr<nsITimer> const& metadataWritesTimer,
+                        UniquePtr<CacheFilePackStore> const& packStore)
       : Runnable("net::SizeOfHandlesRunnable"),
         mMonitor("SizeOfHandlesRunnable.mMonitor"),
         mMonitorNotified(false),
@@ -4423,6 +4855,7 @@ class SizeOfHandlesRunnable : public Runnable {
         mHandles(handles),
         mSpecialHandles(specialHandles),
         mMetadataWritesTimer(metadataWritesTimer),
+        mPackStore(packStore),
         mSize(0) {}
 
   size_t Get(CacheIOThread* thread) {
@@ -4458,6 +4891,9 @@ class SizeOfHandlesRunnable : public Runnable {
     if (sizeOf) {
       mSize += sizeOf->SizeOfIncludingThis(mMallocSizeOf);
     }
+    if (mPackStore) {
+      mSize += mPackStore->SizeOfIncludingThis(mMallocSizeOf);
+    }
 
     mMonitorNotified = true;
     mon.Notify();
@@ -4471,6 +4907,7 @@ class SizeOfHandlesRunnable : public Runnable {
   CacheFileHandles const& mHandles;
   nsTArray<CacheFileHandle*> const& mSpecialHandles;
   nsCOMPtr<nsITimer> const& mMetadataWritesTimer;
+  UniquePtr<CacheFilePackStore> const& mPackStore;
   size_t mSize;
 };
 
@@ -4484,11 +4921,11 @@ size_t CacheFileIOManager::SizeOfExcludingThisInternal(
   if (mIOThread) {
     n += mIOThread->SizeOfIncludingThis(mallocSizeOf);
 
-    // mHandles, mSpecialHandles and mMetadataWritesTimer must be accessed
-    // only on the I/O thread, must sync dispatch.
+    // mHandles, mSpecialHandles, mMetadataWritesTimer and mPackStore must be
+    // accessed only on the I/O thread, must sync dispatch.
     RefPtr<SizeOfHandlesRunnable> sizeOfHandlesRunnable =
         new SizeOfHandlesRunnable(mallocSizeOf, mHandles, mSpecialHandles,
-                                  mMetadataWritesTimer);
+                                  mMetadataWritesTimer, mPackStore);
     n += sizeOfHandlesRunnable->Get(mIOThread);
   }
 
@@ -16,6 +16,7 @@
 #include "mozilla/SHA1.h"
 #include "mozilla/StaticPtr.h"
 #include "mozilla/TimeStamp.h"
+#include "mozilla/UniquePtr.h"
 #include "nsTArray.h"
 #include "nsString.h"
 #include "nsTHashtable.h"
@@ -33,6 +34,8 @@ namespace net {
 
 class CacheFile;
 class CacheFileIOListener;
+class CacheFileMetadata;
+class CacheFilePackStore;
 
 #ifdef DEBUG_HANDLES
 class CacheFileHandlesEntry;
@@ -60,6 +63,7 @@ class CacheFileHandle final : public nsISupports {
   uint32_t FileSizeInK() const;
   bool IsPriority() const { return mPriority; }
   bool FileExists() const { return mFileExists; }
+  bool IsPacked() const { return mPacked; }
   bool IsClosed() const { return mClosed; }
   bool IsSpecialFile() const { return mSpecialFile; }
   nsCString& Key() { return mKey; }
@@ -96,7 +100,11 @@ class CacheFileHandle final : public nsISupports {
   bool mFileExists : 1;  // This means that the file should exists,
                          // but it can be still deleted by OS/user
                          // and then a subsequent OpenNSPRFileDesc()
-                         // will fail.
+                         // will fail. Never set together with mPacked.
+  // The entry's data is a record of the pack store rather than a file. It is
+  // read from mPackedData, and written back to a file before its data is
+  // changed. Rewrites of its metadata are kept in the store.
+  bool mPacked : 1;
 
   // Both initially false.  Can be raised to true only when this handle is to be
   // doomed during the period when the pinning status is unknown.  After the
@@ -125,6 +133,8 @@ class CacheFileHandle final : public nsISupports {
   Atomic<int64_t, Relaxed> mFileSize;
   PRFileDesc* mFD;  // if null then the file doesn't exists on the disk
   nsCString mKey;
+  // Loaded from the pack store on the first read of a packed entry.
+  nsTArray<uint8_t> mPackedData;
 };
 
 class CacheFileHandles {
@@ -261,6 +271,9 @@ class CacheFileIOManager final : public nsITimerCallback, public nsINamed {
   static nsresult Init();
   static nsresult Shutdown();
   static nsresult OnProfile();
+  // Init() and OnProfile() with aCacheDirectory in place of the profile's
+  // cache2 directory, for tests that run without the cache service.
+  static nsresult InitForTesting(nsIFile* aCacheDirectory);
   static nsresult OnDelayedStartupFinished();
   static nsresult OnIdleDaily();
   static already_AddRefed<nsIEventTarget> IOTarget();
@@ -424,6 +437,26 @@ class CacheFileIOManager final : public nsITimerCallback, public nsINamed {
   nsresult OpenNSPRHandle(CacheFileHandle* aHandle, bool aCreate = false);
   void NSPRHandleUsed(CacheFileHandle* aHandle);
 
+  // Small entries are stored in mPackStore when they are closed, and written
+  // back to a file before their data is changed. See CacheFilePackStore.h.
+  nsresult OpenPackStore();
+  bool ShouldPack(CacheFileHandle* aHandle) const;
+  void PackFile(CacheFileHandle* aHandle);
+  // Writes the first aLength bytes of the packed data to a new file.
+  nsresult UnpackFile(CacheFileHandle* aHandle, int64_t aLength);
+  // Replaces the data of a packed entry from aOffset on with aBuf, in the
+  // store. Fails if the result would not be packed, the caller unpacks the
+  // entry then.
+  nsresult RewritePackedEntry(CacheFileHandle* aHandle, int64_t aOffset,
+                              const char* aBuf, int32_t aCount);
+  nsresult LoadPackedData(CacheFileHandle* aHandle);
+  void RemovePackedEntry(const SHA1Sum::Hash* aHash);
+  void MaybeCompactPackStore();
+  nsresult CompactPackStoreInternal();
+  // Reads the metadata of an entry without a handle, from its file or record.
+  nsresult SyncReadEntryMetadata(const SHA1Sum::Hash* aHash,
+                                 CacheFileMetadata* aMetadata);
+
   // Removing all cache files during shutdown
   nsresult SyncRemoveDir(nsIFile* aFile, const char* aDir);
   void SyncRemoveAllCacheFiles();
@@ -486,6 +519,10 @@ class CacheFileIOManager final : public nsITimerCallback, public nsINamed {
   nsTArray<nsCString> mFailedTrashDirs;
   RefPtr<CacheFileContextEvictor> mContextEvictor;
   TimeStamp mLastSmartSizeTime;
+  UniquePtr<CacheFilePackStore> mPackStore;
+  // Set once opening the pack store was attempted.
+  bool mPackStoreOpened{false};
+  bool mPackStoreCompacting{false};
 };
 
 }  // namespace net
@@ -16,6 +16,7 @@
 #include "mozilla/ScopeExit.h"
 #include "mozilla/DebugOnly.h"
 #include "mozilla/IntegerPrintfMacros.h"
+#include "mozilla/IOBatch.h"
 #include "mozilla/glean/NetwerkMetrics.h"
 #include "prnetdb.h"
 
@@ -289,6 +290,15 @@ nsresult CacheFileMetadata::WriteMetadata(
 nsresult CacheFileMetadata::SyncReadMetadata(nsIFile* aFile) {
   LOG(("CacheFileMetadata::SyncReadMetadata() [this=%p]", this));
 
+  SyncReadRequest request{aFile, this};
+  SyncReadMetadataBatch(Span(&request, 1));
+  return request.mStatus;
+}
+
+nsresult CacheFileMetadata::SyncReadMetadata(Span<const uint8_t> aData) {
+  LOG(("CacheFileMetadata::SyncReadMetadata() [this=%p, length=%zu]", this,
+       aData.Length()));
+
   MOZ_ASSERT(!mListener);
   MOZ_ASSERT(!mHandle);
   MOZ_ASSERT(!mHashArray);
@@ -296,62 +306,141 @@ nsresult CacheFileMetadata::SyncReadMetadata(nsIFile* aFile) {
   MOZ_ASSERT(!mWriteBuf);
   MOZ_ASSERT(mKey.IsEmpty());
 
-  nsresult rv;
-
-  int64_t fileSize;
-  rv = aFile->GetFileSize(&fileSize);
-  if (NS_FAILED(rv)) {
-    // Don't bloat the console
-    return rv;
-  }
-
-  PRFileDesc* fd;
-  rv = aFile->OpenNSPRFileDesc(PR_RDONLY, 0600, &fd);
-  NS_ENSURE_SUCCESS(rv, rv);
-
-  int64_t offset = PR_Seek64(fd, fileSize - sizeof(uint32_t), PR_SEEK_SET);
-  if (offset == -1) {
-    PR_Close(fd);
+  if (aData.Length() < sizeof(uint32_t)) {
     return NS_ERROR_FAILURE;
   }
 
-  uint32_t metaOffset;
-  int32_t bytesRead = PR_Read(fd, &metaOffset, sizeof(uint32_t));
-  if (bytesRead != sizeof(uint32_t)) {
-    PR_Close(fd);
+  uint32_t metaOffset =
+      NetworkEndian::readUint32(aData.Elements() + aData.Length() -
+                                sizeof(uint32_t));
+  if (metaOffset > aData.Length()) {
     return NS_ERROR_FAILURE;
   }
 
-  metaOffset = NetworkEndian::readUint32(&metaOffset);
-  if (metaOffset > fileSize) {
-    PR_Close(fd);
-    return NS_ERROR_FAILURE;
-  }
-
-  mBuf = static_cast<char*>(malloc(fileSize - metaOffset));
+  mBuf = static_cast<char*>(malloc(aData.Length() - metaOffset));
   if (!mBuf) {
     return NS_ERROR_OUT_OF_MEMORY;
   }
-  mBufSize = fileSize - metaOffset;
+  mBufSize = aData.Length() - metaOffset;
+  memcpy(mBuf, aData.Elements() + metaOffset, mBufSize);
 
   DoMemoryReport(MemoryUsage());
 
-  offset = PR_Seek64(fd, metaOffset, PR_SEEK_SET);
-  if (offset == -1) {
-    PR_Close(fd);
-    return NS_ERROR_FAILURE;
+  return ParseMetadata(metaOffset, 0, false);
+}
+
+/* static */
+void CacheFileMetadata::SyncReadMetadataBatch(
+    Span<SyncReadRequest> aRequests) {
+  LOG(("CacheFileMetadata::SyncReadMetadataBatch() [count=%zu]",
+       aRequests.Length()));
+
+  AutoTArray<PRFileDesc*, 32> fds;
+  fds.SetLength(aRequests.Length());
+  AutoTArray<uint32_t, 32> metaOffsets;
+  metaOffsets.SetLength(aRequests.Length());
+
+  auto closeFD = [&](size_t aIndex) {
+    if (fds[aIndex]) {
+      PR_Close(fds[aIndex]);
+      fds[aIndex] = nullptr;
+    }
+  };
+
+  // The metadata starts at an offset stored in the last 4 bytes of the file.
+  // Read these first, for every file.
+  IOBatch batch;
+  for (size_t i = 0; i < aRequests.Length(); ++i) {
+    SyncReadRequest& request = aRequests[i];
+    CacheFileMetadata* metadata = request.mMetadata;
+    MOZ_ASSERT(!metadata->mListener);
+    MOZ_ASSERT(!metadata->mHandle);
+    MOZ_ASSERT(!metadata->mHashArray);
+    MOZ_ASSERT(!metadata->mBuf);
+    MOZ_ASSERT(!metadata->mWriteBuf);
+    MOZ_ASSERT(metadata->mKey.IsEmpty());
+
+    fds[i] = nullptr;
+
+    // Don't bloat the console if this fails.
+    request.mStatus = request.mFile->GetFileSize(&request.mFileSize);
+    if (NS_FAILED(request.mStatus)) {
+      continue;
+    }
+    if (request.mFileSize < static_cast<int64_t>(sizeof(uint32_t))) {
+      request.mStatus = NS_ERROR_FAILURE;
+      continue;
+    }
+
+    request.mStatus =
+        request.mFile->OpenNSPRFileDesc(PR_RDONLY, 0600, &fds[i]);
+    if (NS_FAILED(request.mStatus)) {
+      NS_WARNING("CacheFileMetadata::SyncReadMetadataBatch() - Cannot open");
+      fds[i] = nullptr;
+      continue;
+    }
+
+    batch.Read(fds[i], &metaOffsets[i], sizeof(uint32_t),
+               request.mFileSize - sizeof(uint32_t));
   }
+  batch.Run();
+
+  // Then read the metadata itself.
+  size_t batchIndex = 0;
+  IOBatch metadataBatch;
+  for (size_t i = 0; i < aRequests.Length(); ++i) {
+    if (!fds[i]) {
+      continue;
+    }
 
-  bytesRead = PR_Read(fd, mBuf, mBufSize);
-  PR_Close(fd);
-  if (bytesRead != static_cast<int32_t>(mBufSize)) {
-    return NS_ERROR_FAILURE;
+    SyncReadRequest& request = aRequests[i];
+    CacheFileMetadata* metadata = request.mMetadata;
+    if (batch.Result(batchIndex++) != sizeof(uint32_t)) {
+      request.mStatus = NS_ERROR_FAILURE;
+      closeFD(i);
+      continue;
+    }
+
+    uint32_t metaOffset = NetworkEndian::readUint32(&metaOffsets[i]);
+    if (metaOffset > request.mFileSize) {
+      request.mStatus = NS_ERROR_FAILURE;
+      closeFD(i);
+      continue;
+    }
+    metaOffsets[i] = metaOffset;
+
+    metadata->mBuf =
+        static_cast<char*>(malloc(request.mFileSize - metaOffset));
+    if (!metadata->mBuf) {
+      request.mStatus = NS_ERROR_OUT_OF_MEMORY;
+      closeFD(i);
+      continue;
+    }
+    metadata->mBufSize = request.mFileSize - metaOffset;
+
+    metadata->DoMemoryReport(metadata->MemoryUsage());
+
+    metadataBatch.Read(fds[i], metadata->mBuf, metadata->mBufSize, metaOffset);
   }
+  metadataBatch.Run();
 
-  rv = ParseMetadata(metaOffset, 0, false);
-  NS_ENSURE_SUCCESS(rv, rv);
+  batchIndex = 0;
+  for (size_t i = 0; i < aRequests.Length(); ++i) {
+    if (!fds[i]) {
+      continue;
+    }
+    closeFD(i);
+
+    SyncReadRequest& request = aRequests[i];
+    CacheFileMetadata* metadata = request.mMetadata;
+    if (metadataBatch.Result(batchIndex++) !=
+        static_cast<int32_t>(metadata->mBufSize)) {
+      request.mStatus = NS_ERROR_FAILURE;
+      continue;
+    }
 
-  return NS_OK;
+    request.mStatus = metadata->ParseMetadata(metaOffsets[i], 0, false);
+  }
 }
 
 void CacheFileMetadata::HandleCorruptMetaData() const {
@@ -808,7 +897,8 @@ void CacheFileMetadata::InitEmptyMetadata() {
     // be bypassed during shutdown (mainly dooming it, when a channel
     // is canceled by closing the window.)
     mHandle->SetInvalid();
-    if (mHandle->FileExists() && mHandle->FileSize()) {
+    if ((mHandle->FileExists() || mHandle->IsPacked()) &&
+        mHandle->FileSize()) {
       CacheFileIOManager::TruncateSeekSetEOF(mHandle, 0, 0, nullptr);
     }
   }
@@ -151,6 +151,22 @@ class CacheFileMetadata final : public CacheFileIOListener,
   nsresult WriteMetadata(uint32_t aOffset,
                          CacheFileMetadataListener* aListener);
   nsresult SyncReadMetadata(nsIFile* aFile);
+  // Same for an entry whose whole content is already in memory, like the
+  // records of CacheFilePackStore.
+  nsresult SyncReadMetadata(Span<const uint8_t> aData);
+
+  struct SyncReadRequest {
+    nsCOMPtr<nsIFile> mFile;
+    RefPtr<CacheFileMetadata> mMetadata;
+    // Set by SyncReadMetadataBatch().
+    int64_t mFileSize = 0;
+    nsresult mStatus = NS_OK;
+  };
+
+  // Like SyncReadMetadata() for several files, with their reads submitted
+  // together. This is much cheaper than reading the files one at a time when
+  // scanning a large cache directory.
+  static void SyncReadMetadataBatch(Span<SyncReadRequest> aRequests);
 
   bool IsAnonymous() const { return mAnonymous; }
   mozilla::OriginAttributes const& OriginAttributes() const {
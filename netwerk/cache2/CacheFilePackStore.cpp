@@ -0,0 +1,683 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "CacheLog.h"
+#include "CacheFilePackStore.h"
+
+#include "CacheHashUtils.h"
+#include "mozilla/BinarySearch.h"
+#include "mozilla/EndianUtils.h"
+#include "mozilla/IOBatch.h"
+#include "nsIDirectoryEnumerator.h"
+#include "nsIFile.h"
+#include "nsPrintfCString.h"
+#include "nsReadableUtils.h"
+#include "nsString.h"
+
+namespace mozilla::net {
+
+// The log of a segment starts with kLogMagic and kLogVersion, followed by
+// entries of kLogEntrySize bytes. All numbers are in network byte order.
+//
+//   hash             20 bytes
+//   offset           uint32_t  of the data in the data file
+//   length           uint32_t  of the data, kRemovedLength for a removal
+//   data checksum    uint32_t
+//   time             uint64_t  in milliseconds since the epoch
+//   entry checksum   uint32_t  of the 40 bytes above
+static const uint32_t kLogMagic = 0x4350414b;  // "CPAK"
+static const uint32_t kLogVersion = 1;
+static const uint32_t kLogHeaderSize = 2 * sizeof(uint32_t);
+static const uint32_t kLogEntrySize = 44;
+static const uint32_t kRemovedLength = UINT32_MAX;
+
+// The last segment is also sealed when its log reaches this size, so that the
+// logs stay cheap to load even when few records are written to a segment but
+// many are removed.
+static const uint32_t kMaxLogSize = 4 * 1024 * 1024;
+
+// Number of records Compact() moves per call.
+static const uint32_t kCompactRecordsPerStep = 64;
+
+struct CacheFilePackStore::LogEntry {
+  SHA1Sum::Hash mHash;
+  uint32_t mOffset = 0;
+  uint32_t mLength = 0;
+  uint32_t mChecksum = 0;
+  PRTime mTime = 0;
+
+  void Write(uint8_t* aBuf) const {
+    memcpy(aBuf, mHash, sizeof(SHA1Sum::Hash));
+    NetworkEndian::writeUint32(aBuf + 20, mOffset);
+    NetworkEndian::writeUint32(aBuf + 24, mLength);
+    NetworkEndian::writeUint32(aBuf + 28, mChecksum);
+    NetworkEndian::writeUint64(aBuf + 32, mTime);
+    NetworkEndian::writeUint32(
+        aBuf + 40, CacheHash::Hash(reinterpret_cast<const char*>(aBuf), 40));
+  }
+
+  // Returns false if the entry was not completely written.
+  bool Read(const uint8_t* aBuf) {
+    if (NetworkEndian::readUint32(aBuf + 40) !=
+        CacheHash::Hash(reinterpret_cast<const char*>(aBuf), 40)) {
+      return false;
+    }
+    memcpy(mHash, aBuf, sizeof(SHA1Sum::Hash));
+    mOffset = NetworkEndian::readUint32(aBuf + 20);
+    mLength = NetworkEndian::readUint32(aBuf + 24);
+    mChecksum = NetworkEndian::readUint32(aBuf + 28);
+    mTime = static_cast<PRTime>(NetworkEndian::readUint64(aBuf + 32));
+    return true;
+  }
+};
+
+static uint32_t DataChecksum(Span<const uint8_t> aData) {
+  return CacheHash::Hash(reinterpret_cast<const char*>(aData.Elements()),
+                         aData.Length());
+}
+
+CacheFilePackStore::CacheFilePackStore(nsIFile* aDirectory,
+                                       uint32_t aSegmentSize)
+    : mDirectory(aDirectory), mSegmentSize(aSegmentSize) {
+  LOG(("CacheFilePackStore::CacheFilePackStore() [this=%p]", this));
+}
+
+CacheFilePackStore::~CacheFilePackStore() {
+  LOG(("CacheFilePackStore::~CacheFilePackStore() [this=%p]", this));
+
+  for (Segment& segment : mSegments) {
+    CloseSegment(segment);
+  }
+}
+
+nsresult CacheFilePackStore::Init() {
+  LOG(("CacheFilePackStore::Init() [this=%p]", this));
+
+  nsresult rv = mDirectory->Create(nsIFile::DIRECTORY_TYPE, 0700);
+  if (NS_FAILED(rv) && rv != NS_ERROR_FILE_ALREADY_EXISTS) {
+    return rv;
+  }
+
+  nsCOMPtr<nsIDirectoryEnumerator> iter;
+  rv = mDirectory->GetDirectoryEntries(getter_AddRefs(iter));
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  nsTArray<uint32_t> ids;
+  nsCOMPtr<nsIFile> file;
+  while (NS_SUCCEEDED(iter->GetNextFile(getter_AddRefs(file))) && file) {
+    nsAutoCString name;
+    if (NS_FAILED(file->GetNativeLeafName(name))) {
+      continue;
+    }
+    if (StringEndsWith(name, ".log"_ns)) {
+      name.Truncate(name.Length() - 4);
+    }
+
+    nsresult rv2;
+    int64_t id = name.ToInteger64(&rv2);
+    if (NS_FAILED(rv2) || id <= 0 || id > UINT32_MAX ||
+        !name.Equals(nsPrintfCString("%" PRId64, id))) {
+      LOG(("CacheFilePackStore::Init() - Removing unexpected file [name=%s]",
+           name.get()));
+      file->Remove(false);
+      continue;
+    }
+
+    if (!ids.Contains(uint32_t(id))) {
+      ids.AppendElement(uint32_t(id));
+    }
+  }
+  iter->Close();
+
+  ids.Sort();
+  for (uint32_t id : ids) {
+    rv = OpenSegment(id, false);
+    if (rv == NS_ERROR_FILE_NOT_FOUND) {
+      // Never got a log entry, e.g. because of a crash right after it was
+      // created.
+      LOG(("CacheFilePackStore::Init() - Removing empty segment [id=%u]", id));
+      nsCOMPtr<nsIFile> dataFile = SegmentFile(id, false);
+      nsCOMPtr<nsIFile> logFile = SegmentFile(id, true);
+      if (dataFile && logFile) {
+        dataFile->Remove(false);
+        logFile->Remove(false);
+      }
+    } else if (NS_FAILED(rv)) {
+      // The removal entries in its log may have been the only thing keeping
+      // the records of the older segments from coming back, so these have to
+      // go too.
+      LOG(("CacheFilePackStore::Init() - Cannot load segment, removing it "
+           "and the older ones [id=%u, rv=0x%08" PRIx32 "]",
+           id, static_cast<uint32_t>(rv)));
+      DeleteAllSegments();
+      nsCOMPtr<nsIFile> dataFile = SegmentFile(id, false);
+      nsCOMPtr<nsIFile> logFile = SegmentFile(id, true);
+      if (dataFile && logFile) {
+        dataFile->Remove(false);
+        logFile->Remove(false);
+      }
+    }
+  }
+
+  // Only the last segment is appended to.
+  for (uint32_t i = 0; i + 1 < mSegments.Length(); ++i) {
+    if (mSegments[i].mLogFD) {
+      PR_Close(mSegments[i].mLogFD);
+      mSegments[i].mLogFD = nullptr;
+    }
+  }
+
+  if (mSegments.IsEmpty() ||
+      mSegments.LastElement().mDataSize >= mSegmentSize ||
+      mSegments.LastElement().mLogSize >= kMaxLogSize) {
+    rv = AddSegment();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  LOG(("CacheFilePackStore::Init() - Loaded %u records from %zu segments",
+       mRecords.Count(), mSegments.Length()));
+
+  return NS_OK;
+}
+
+bool CacheFilePackStore::Contains(const SHA1Sum::Hash& aHash,
+                                  uint32_t* aLength) const {
+  const Record* record = mRecords.GetEntry(aHash);
+  if (!record) {
+    return false;
+  }
+  if (aLength) {
+    *aLength = record->mLength;
+  }
+  return true;
+}
+
+nsresult CacheFilePackStore::GetLastModifiedTime(const SHA1Sum::Hash& aHash,
+                                                 PRTime* aTime) const {
+  const Record* record = mRecords.GetEntry(aHash);
+  if (!record) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+  *aTime = record->mTime;
+  return NS_OK;
+}
+
+void CacheFilePackStore::GetHashes(nsTArray<PackedHash>& aHashes) const {
+  aHashes.SetCapacity(aHashes.Length() + mRecords.Count());
+  for (auto iter = mRecords.ConstIter(); !iter.Done(); iter.Next()) {
+    memcpy(aHashes.AppendElement()->mHash, iter.Get()->mHash,
+           sizeof(SHA1Sum::Hash));
+  }
+}
+
+nsresult CacheFilePackStore::Read(const SHA1Sum::Hash& aHash,
+                                  nsTArray<uint8_t>& aData) {
+  Record* record = mRecords.GetEntry(aHash);
+  if (!record) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+
+  if (!aData.SetLength(record->mLength, fallible)) {
+    return NS_ERROR_OUT_OF_MEMORY;
+  }
+
+  bool valid = true;
+  if (record->mLength) {
+    Segment* segment = GetSegment(record->mSegmentId);
+    MOZ_ASSERT(segment);
+
+    IOBatch batch;
+    batch.Read(segment->mDataFD, aData.Elements(), record->mLength,
+               record->mOffset);
+    batch.Run();
+    valid = batch.Result(0) == static_cast<int32_t>(record->mLength);
+  }
+
+  if (!valid || DataChecksum(aData) != record->mChecksum) {
+    LOG(("CacheFilePackStore::Read() - Record is corrupted, removing it "
+         "[hash=%08x%08x%08x%08x%08x]",
+         LOGSHA1(aHash)));
+    aData.Clear();
+    Remove(aHash);
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+
+  return NS_OK;
+}
+
+nsresult CacheFilePackStore::Put(const SHA1Sum::Hash& aHash,
+                                 Span<const uint8_t> aData) {
+  return PutInternal(aHash, aData, PR_Now() / PR_USEC_PER_MSEC);
+}
+
+nsresult CacheFilePackStore::PutInternal(const SHA1Sum::Hash& aHash,
+                                         Span<const uint8_t> aData,
+                                         PRTime aTime) {
+  if (aData.Length() > mSegmentSize) {
+    return NS_ERROR_INVALID_ARG;
+  }
+
+  LogEntry entry;
+  memcpy(entry.mHash, aHash, sizeof(SHA1Sum::Hash));
+  entry.mLength = aData.Length();
+  entry.mChecksum = DataChecksum(aData);
+  entry.mTime = aTime;
+
+  uint32_t segmentId;
+  nsresult rv = AppendLogEntry(entry, aData, &segmentId);
+  NS_ENSURE_SUCCESS(rv, rv);
+
+  Record* record = mRecords.GetEntry(aHash);
+  if (record) {
+    Forget(record);
+  } else {
+    record = mRecords.PutEntry(aHash);
+  }
+  record->mSegmentId = segmentId;
+  record->mOffset = entry.mOffset;
+  record->mLength = entry.mLength;
+  record->mChecksum = entry.mChecksum;
+  record->mTime = entry.mTime;
+
+  Segment* segment = GetSegment(segmentId);
+  segment->mLiveCount++;
+  segment->mLiveBytes += entry.mLength;
+
+  return NS_OK;
+}
+
+nsresult CacheFilePackStore::Remove(const SHA1Sum::Hash& aHash) {
+  Record* record = mRecords.GetEntry(aHash);
+  if (!record) {
+    return NS_OK;
+  }
+
+  Forget(record);
+  mRecords.RemoveEntry(record);
+
+  LogEntry entry;
+  memcpy(entry.mHash, aHash, sizeof(SHA1Sum::Hash));
+  entry.mLength = kRemovedLength;
+  entry.mTime = PR_Now() / PR_USEC_PER_MSEC;
+
+  uint32_t segmentId;
+  return AppendLogEntry(entry, Span<const uint8_t>(), &segmentId);
+}
+
+nsresult CacheFilePackStore::RemoveAll() {
+  LOG(("CacheFilePackStore::RemoveAll() [this=%p]", this));
+
+  mCompactQueue.Clear();
+  mCompacting = false;
+  DeleteAllSegments();
+
+  return AddSegment();
+}
+
+bool CacheFilePackStore::NeedsCompaction() const {
+  if (mSegments.Length() < 2) {
+    return false;
+  }
+
+  if (mSegments[0].mLiveCount == 0) {
+    // Nothing to move, the segment can simply go.
+    return true;
+  }
+
+  uint64_t size = 0;
+  uint64_t live = 0;
+  for (uint32_t i = 0; i + 1 < mSegments.Length(); ++i) {
+    size += mSegments[i].mDataSize;
+    live += mSegments[i].mLiveBytes;
+  }
+  return (size - live) * 2 > size;
+}
+
+bool CacheFilePackStore::Compact() {
+  if (!mCompacting) {
+    if (!NeedsCompaction()) {
+      return false;
+    }
+
+    LOG(("CacheFilePackStore::Compact() - Compacting segment [id=%u, "
+         "size=%u, liveBytes=%u]",
+         mSegments[0].mId, mSegments[0].mDataSize, mSegments[0].mLiveBytes));
+
+    mCompacting = true;
+    mCompactQueue.SetCapacity(mSegments[0].mLiveCount);
+    for (auto iter = mRecords.ConstIter(); !iter.Done(); iter.Next()) {
+      if (iter.Get()->mSegmentId == mSegments[0].mId) {
+        memcpy(mCompactQueue.AppendElement()->mHash, iter.Get()->mHash,
+               sizeof(SHA1Sum::Hash));
+      }
+    }
+  }
+
+  const uint32_t oldestId = mSegments[0].mId;
+  nsTArray<uint8_t> data;
+  for (uint32_t i = 0;
+       i < kCompactRecordsPerStep && !mCompactQueue.IsEmpty(); ++i) {
+    PackedHash hash = mCompactQueue.PopLastElement();
+    Record* record = mRecords.GetEntry(hash.mHash);
+    if (!record || record->mSegmentId != oldestId) {
+      // Removed or replaced since compaction started.
+      continue;
+    }
+
+    PRTime time = record->mTime;
+    nsresult rv = Read(hash.mHash, data);
+    if (NS_FAILED(rv)) {
+      // Corrupted records are removed by Read(); drop the ones that can't be
+      // read for another reason too, or the segment would never go away.
+      Remove(hash.mHash);
+      continue;
+    }
+
+    // Keep the time, it is what the record's age is judged by.
+    rv = PutInternal(hash.mHash, data, time);
+    if (NS_FAILED(rv)) {
+      LOG(("CacheFilePackStore::Compact() - Cannot move record, giving up "
+           "[rv=0x%08" PRIx32 "]",
+           static_cast<uint32_t>(rv)));
+      mCompactQueue.Clear();
+      mCompacting = false;
+      return false;
+    }
+  }
+
+  if (!mCompactQueue.IsEmpty()) {
+    return true;
+  }
+
+  mCompacting = false;
+  if (mSegments.Length() > 1 && mSegments[0].mId == oldestId &&
+      mSegments[0].mLiveCount == 0) {
+    LOG(("CacheFilePackStore::Compact() - Deleting segment [id=%u]",
+         oldestId));
+    DeleteSegment(0);
+  }
+
+  return NeedsCompaction();
+}
+
+size_t CacheFilePackStore::SizeOfIncludingThis(
+    mozilla::MallocSizeOf mallocSizeOf) const {
+  return mallocSizeOf(this) +
+         mSegments.ShallowSizeOfExcludingThis(mallocSizeOf) +
+         mRecords.ShallowSizeOfExcludingThis(mallocSizeOf) +
+         mCompactQueue.ShallowSizeOfExcludingThis(mallocSizeOf);
+}
+
+already_AddRefed<nsIFile> CacheFilePackStore::SegmentFile(uint32_t aId,
+                                                          bool aLog) const {
+  nsCOMPtr<nsIFile> file;
+  nsresult rv = mDirectory->Clone(getter_AddRefs(file));
+  if (NS_FAILED(rv)) {
+    return nullptr;
+  }
+
+  rv = file->AppendNative(
+      aLog ? nsPrintfCString("%u.log", aId) : nsPrintfCString("%u", aId));
+  if (NS_FAILED(rv)) {
+    return nullptr;
+  }
+
+  return file.forget();
+}
+
+nsresult CacheFilePackStore::OpenSegment(uint32_t aId, bool aCreate) {
+  nsCOMPtr<nsIFile> dataFile = SegmentFile(aId, false);
+  nsCOMPtr<nsIFile> logFile = SegmentFile(aId, true);
+  if (!dataFile || !logFile) {
+    return NS_ERROR_FAILURE;
+  }
+
+  Segment segment{aId, nullptr, nullptr, 0, 0, 0, 0};
+  int32_t flags = PR_RDWR | (aCreate ? PR_CREATE_FILE | PR_TRUNCATE : 0);
+  nsresult rv = dataFile->OpenNSPRFileDesc(flags, 0600, &segment.mDataFD);
+  if (rv == NS_ERROR_FILE_NOT_FOUND) {
+    // The data file is created first, a segment without one is not empty.
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+  NS_ENSURE_SUCCESS(rv, rv);
+  rv = logFile->OpenNSPRFileDesc(flags, 0600, &segment.mLogFD);
+  if (NS_FAILED(rv)) {
+    CloseSegment(segment);
+    return rv;
+  }
+
+  if (aCreate) {
+    uint8_t header[kLogHeaderSize];
+    NetworkEndian::writeUint32(header, kLogMagic);
+    NetworkEndian::writeUint32(header + sizeof(uint32_t), kLogVersion);
+
+    IOBatch batch;
+    batch.Write(segment.mLogFD, header, kLogHeaderSize, 0);
+    batch.Run();
+    if (batch.Result(0) != static_cast<int32_t>(kLogHeaderSize)) {
+      CloseSegment(segment);
+      return NS_ERROR_FAILURE;
+    }
+    segment.mLogSize = kLogHeaderSize;
+    mSegments.AppendElement(segment);
+    return NS_OK;
+  }
+
+  mSegments.AppendElement(segment);
+  rv = LoadLog(mSegments.LastElement());
+  if (NS_FAILED(rv)) {
+    CloseSegment(mSegments.LastElement());
+    mSegments.RemoveLastElement();
+    return rv;
+  }
+
+  return NS_OK;
+}
+
+nsresult CacheFilePackStore::LoadLog(Segment& aSegment) {
+  PRFileInfo64 info;
+  if (PR_GetOpenFileInfo64(aSegment.mDataFD, &info) != PR_SUCCESS) {
+    return NS_ERROR_FAILURE;
+  }
+  if (info.size > UINT32_MAX) {
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+  aSegment.mDataSize = static_cast<uint32_t>(info.size);
+
+  if (PR_GetOpenFileInfo64(aSegment.mLogFD, &info) != PR_SUCCESS) {
+    return NS_ERROR_FAILURE;
+  }
+  if (info.size < kLogHeaderSize) {
+    return NS_ERROR_FILE_NOT_FOUND;
+  }
+  if (info.size > 2 * kMaxLogSize) {
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+
+  nsTArray<uint8_t> log;
+  if (!log.SetLength(info.size, fallible)) {
+    return NS_ERROR_OUT_OF_MEMORY;
+  }
+
+  IOBatch batch;
+  batch.Read(aSegment.mLogFD, log.Elements(), log.Length(), 0);
+  batch.Run();
+  if (batch.Result(0) != static_cast<int32_t>(log.Length())) {
+    return NS_ERROR_FAILURE;
+  }
+
+  if (NetworkEndian::readUint32(log.Elements()) != kLogMagic ||
+      NetworkEndian::readUint32(log.Elements() + sizeof(uint32_t)) !=
+          kLogVersion) {
+    return NS_ERROR_FILE_CORRUPTED;
+  }
+
+  uint32_t offset = kLogHeaderSize;
+  for (; offset + kLogEntrySize <= log.Length(); offset += kLogEntrySize) {
+    LogEntry entry;
+    if (!entry.Read(log.Elements() + offset)) {
+      LOG(("CacheFilePackStore::LoadLog() - Log ends with an incomplete "
+           "entry [id=%u, offset=%u]",
+           aSegment.mId, offset));
+      break;
+    }
+    ApplyLogEntry(aSegment.mId, entry);
+  }
+
+  // Anything past a torn entry is overwritten by the next one.
+  aSegment.mLogSize = offset;
+  return NS_OK;
+}
+
+void CacheFilePackStore::ApplyLogEntry(uint32_t aSegmentId,
+                                       const LogEntry& aEntry) {
+  Record* record = mRecords.GetEntry(aEntry.mHash);
+  if (record) {
+    Forget(record);
+  }
+
+  Segment* segment = GetSegment(aSegmentId);
+  if (aEntry.mLength == kRemovedLength ||
+      uint64_t(aEntry.mOffset) + aEntry.mLength > segment->mDataSize) {
+    // A removal, or a record whose data never made it to the disk.
+    if (record) {
+      mRecords.RemoveEntry(record);
+    }
+    return;
+  }
+
+  if (!record) {
+    record = mRecords.PutEntry(aEntry.mHash);
+  }
+  record->mSegmentId = aSegmentId;
+  record->mOffset = aEntry.mOffset;
+  record->mLength = aEntry.mLength;
+  record->mChecksum = aEntry.mChecksum;
+  record->mTime = aEntry.mTime;
+  segment->mLiveCount++;
+  segment->mLiveBytes += aEntry.mLength;
+}
+
+nsresult CacheFilePackStore::AddSegment() {
+  uint32_t id = 1;
+  if (!mSegments.IsEmpty()) {
+    Segment& last = mSegments.LastElement();
+    id = last.mId + 1;
+    if (last.mLogFD) {
+      PR_Close(last.mLogFD);
+      last.mLogFD = nullptr;
+    }
+  }
+
+  LOG(("CacheFilePackStore::AddSegment() [id=%u]", id));
+  return OpenSegment(id, true);
+}
+
+void CacheFilePackStore::CloseSegment(Segment& aSegment) {
+  if (aSegment.mDataFD) {
+    PR_Close(aSegment.mDataFD);
+    aSegment.mDataFD = nullptr;
+  }
+  if (aSegment.mLogFD) {
+    PR_Close(aSegment.mLogFD);
+    aSegment.mLogFD = nullptr;
+  }
+}
+
+void CacheFilePackStore::DeleteSegment(uint32_t aIndex) {
+  Segment& segment = mSegments[aIndex];
+  MOZ_ASSERT(segment.mLiveCount == 0);
+
+  CloseSegment(segment);
+
+  nsCOMPtr<nsIFile> dataFile = SegmentFile(segment.mId, false);
+  nsCOMPtr<nsIFile> logFile = SegmentFile(segment.mId, true);
+  if (dataFile && logFile) {
+    dataFile->Remove(false);
+    logFile->Remove(false);
+  }
+
+  mSegments.RemoveElementAt(aIndex);
+}
+
+void CacheFilePackStore::DeleteAllSegments() {
+  mRecords.Clear();
+  while (!mSegments.IsEmpty()) {
+    mSegments.LastElement().mLiveCount = 0;
+    mSegments.LastElement().mLiveBytes = 0;
+    DeleteSegment(mSegments.Length() - 1);
+  }
+}
+
+CacheFilePackStore::Segment* CacheFilePackStore::GetSegment(uint32_t aId) {
+  size_t index;
+  if (!BinarySearchIf(
+          mSegments, 0, mSegments.Length(),
+          [aId](const Segment& aSegment) {
+            return aId < aSegment.mId ? -1 : aId > aSegment.mId ? 1 : 0;
+          },
+          &index)) {
+    return nullptr;
+  }
+  return &mSegments[index];
+}
+
+nsresult CacheFilePackStore::AppendLogEntry(LogEntry& aEntry,
+                                            Span<const uint8_t> aData,
+                                            uint32_t* aSegmentId) {
+  if (mSegments.IsEmpty() || !mSegments.LastElement().mLogFD ||
+      (mSegments.LastElement().mDataSize &&
+       uint64_t(mSegments.LastElement().mDataSize) + aData.Length() >
+           mSegmentSize) ||
+      mSegments.LastElement().mLogSize + kLogEntrySize > kMaxLogSize) {
+    nsresult rv = AddSegment();
+    NS_ENSURE_SUCCESS(rv, rv);
+  }
+
+  Segment& segment = mSegments.LastElement();
+  if (aEntry.mLength != kRemovedLength) {
+    aEntry.mOffset = segment.mDataSize;
+  }
+
+  uint8_t buf[kLogEntrySize];
+  aEntry.Write(buf);
+
+  // The data and its log entry are written together. Should only the log
+  // entry make it to the disk, the data checksum catches it when it is read.
+  IOBatch batch;
+  if (!aData.IsEmpty()) {
+    batch.Write(segment.mDataFD, aData.Elements(), aData.Length(),
+                segment.mDataSize);
+  }
+  size_t logIndex = batch.Write(segment.mLogFD, buf, kLogEntrySize,
+                                segment.mLogSize);
+  batch.Run();
+
+  // Whatever happened, the data region is not reused.
+  segment.mDataSize += aData.Length();
+
+  if ((!aData.IsEmpty() &&
+       batch.Result(0) != static_cast<int32_t>(aData.Length())) ||
+      batch.Result(logIndex) != static_cast<int32_t>(kLogEntrySize)) {
+    LOG(("CacheFilePackStore::AppendLogEntry() - Write failed [id=%u]",
+         segment.mId));
+    return NS_ERROR_FAILURE;
+  }
+
+  segment.mLogSize += kLogEntrySize;
+  *aSegmentId = segment.mId;
+  return NS_OK;
+}
+
+void CacheFilePackStore::Forget(Record* aRecord) {
+  Segment* segment = GetSegment(aRecord->mSegmentId);
+  MOZ_ASSERT(segment);
+  MOZ_ASSERT(segment->mLiveCount > 0);
+  MOZ_ASSERT(segment->mLiveBytes >= aRecord->mLength);
+
+  segment->mLiveCount--;
+  segment->mLiveBytes -= aRecord->mLength;
+}
+
+}  // namespace mozilla::net
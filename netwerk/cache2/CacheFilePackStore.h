@@ -0,0 +1,173 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef CacheFilePackStore__h__
+#define CacheFilePackStore__h__
+
+#include "mozilla/MemoryReporting.h"
+#include "mozilla/SHA1.h"
+#include "mozilla/Span.h"
+#include "nsCOMPtr.h"
+#include "nsTArray.h"
+#include "nsTHashtable.h"
+#include "prio.h"
+#include "prtime.h"
+
+class nsIFile;
+
+namespace mozilla {
+namespace net {
+
+#define PACKS_DIR "packs"
+
+// Stores the data of small cache entries as records of a few large segment
+// files, instead of one file per entry, to save the inodes and the open,
+// close and unlink calls that caches full of tiny resources otherwise cost.
+//
+// Each segment is a data file, which record data is appended to, and a log
+// file, with a fixed size entry for every record that was written or removed.
+// Only the log files are read when the store is opened; the data is checked
+// against the checksum kept in the log when it is read. A record that was
+// only partly written before a crash therefore either has no log entry, or
+// fails the check and is dropped.
+//
+// Records are only ever appended to the last segment. Replaced and removed
+// records leave garbage in the older ones, which Compact() reclaims by moving
+// the live records of the oldest segment to the last one and deleting it.
+// Because only the oldest segment is ever deleted, the removal entries in the
+// logs never have to outlive the records they remove.
+//
+// CacheFileIOManager packs an entry when its handle is closed, by reading the
+// file the entry was written to and putting its content here. The data of a
+// packed entry is therefore written twice, once to its own file and once to a
+// segment, plus once for every compaction that moves it, and the extra read
+// is usually served from the page cache. What packing saves is the per-file
+// cost of the entries that are kept: the inodes, and the opens of later reads
+// and evictions. The PackOnClose benchmark in TestCacheFilePackStore.cpp
+// measures the writing side against one file per entry.
+//
+// A hit on an entry only changes the metadata at its end. CacheFileIOManager
+// puts the record again with the new metadata, rather than unpacking the
+// entry; the TestCacheFilePackStoreHitBench benchmarks measure that.
+//
+// Used on the cache IO thread only.
+class CacheFilePackStore final {
+ public:
+  // Size at which the last segment is sealed and a new one started.
+  static const uint32_t kDefaultSegmentSize = 32 * 1024 * 1024;
+
+  struct PackedHash {
+    SHA1Sum::Hash mHash;
+  };
+
+  explicit CacheFilePackStore(nsIFile* aDirectory,
+                              uint32_t aSegmentSize = kDefaultSegmentSize);
+  ~CacheFilePackStore();
+
+  // Creates the directory if needed and loads the logs of the segments found
+  // in it.
+  nsresult Init();
+
+  uint32_t Count() const { return mRecords.Count(); }
+  // Whether there is a record for aHash, and if so the length of its data.
+  bool Contains(const SHA1Sum::Hash& aHash, uint32_t* aLength = nullptr) const;
+  // The time the record for aHash was written, in milliseconds like
+  // nsIFile::GetLastModifiedTime().
+  nsresult GetLastModifiedTime(const SHA1Sum::Hash& aHash,
+                               PRTime* aTime) const;
+  void GetHashes(nsTArray<PackedHash>& aHashes) const;
+
+  // Reads the data of the record for aHash. A record whose data does not
+  // match its checksum is removed.
+  nsresult Read(const SHA1Sum::Hash& aHash, nsTArray<uint8_t>& aData);
+  // Stores aData for aHash, replacing any previous record.
+  nsresult Put(const SHA1Sum::Hash& aHash, Span<const uint8_t> aData);
+  // Removes the record for aHash, if there is one.
+  nsresult Remove(const SHA1Sum::Hash& aHash);
+  // Removes every record and segment.
+  nsresult RemoveAll();
+
+  // Whether enough of the sealed segments is garbage to be worth compacting.
+  bool NeedsCompaction() const;
+  // Moves a few live records out of the oldest segment, and deletes the
+  // segment once it has none left. Returns false once there is nothing left to
+  // compact, so that the caller can run it in steps between other work.
+  bool Compact();
+
+  size_t SizeOfIncludingThis(mozilla::MallocSizeOf mallocSizeOf) const;
+
+ private:
+  struct Segment {
+    uint32_t mId;
+    PRFileDesc* mDataFD;
+    // Only kept open for the last segment.
+    PRFileDesc* mLogFD;
+    uint32_t mDataSize;
+    uint32_t mLogSize;
+    // Number and total data length of the records still in mRecords.
+    uint32_t mLiveCount;
+    uint32_t mLiveBytes;
+  };
+
+  class Record : public PLDHashEntryHdr {
+   public:
+    using KeyType = const SHA1Sum::Hash&;
+    using KeyTypePointer = const SHA1Sum::Hash*;
+
+    explicit Record(KeyTypePointer aKey) {
+      memcpy(mHash, aKey, sizeof(SHA1Sum::Hash));
+    }
+    Record(Record&& aOther) = default;
+
+    bool KeyEquals(KeyTypePointer aKey) const {
+      return memcmp(mHash, aKey, sizeof(SHA1Sum::Hash)) == 0;
+    }
+    static KeyTypePointer KeyToPointer(KeyType aKey) { return &aKey; }
+    static PLDHashNumber HashKey(KeyTypePointer aKey) {
+      return (reinterpret_cast<const uint32_t*>(aKey))[0];
+    }
+
+    enum { ALLOW_MEMMOVE = true };
+
+    SHA1Sum::Hash mHash;
+    uint32_t mSegmentId = 0;
+    uint32_t mOffset = 0;
+    uint32_t mLength = 0;
+    uint32_t mChecksum = 0;
+    PRTime mTime = 0;
+  };
+
+  struct LogEntry;
+
+  nsresult PutInternal(const SHA1Sum::Hash& aHash, Span<const uint8_t> aData,
+                       PRTime aTime);
+  already_AddRefed<nsIFile> SegmentFile(uint32_t aId, bool aLog) const;
+  nsresult OpenSegment(uint32_t aId, bool aCreate);
+  nsresult LoadLog(Segment& aSegment);
+  void ApplyLogEntry(uint32_t aSegmentId, const LogEntry& aEntry);
+  nsresult AddSegment();
+  void CloseSegment(Segment& aSegment);
+  void DeleteSegment(uint32_t aIndex);
+  void DeleteAllSegments();
+  Segment* GetSegment(uint32_t aId);
+  // Appends aData and a log entry for it to the last segment, sealing it first
+  // if it is full. Sets the offset of aEntry and the id of the segment.
+  nsresult AppendLogEntry(LogEntry& aEntry, Span<const uint8_t> aData,
+                          uint32_t* aSegmentId);
+  void Forget(Record* aRecord);
+
+  nsCOMPtr<nsIFile> mDirectory;
+  const uint32_t mSegmentSize;
+  // Ordered by id, the last one is appended to.
+  nsTArray<Segment> mSegments;
+  nsTHashtable<Record> mRecords;
+  // Hashes left to move out of the oldest segment by Compact().
+  nsTArray<PackedHash> mCompactQueue;
+  bool mCompacting = false;
+};
+
+}  // namespace net
+}  // namespace mozilla
+
+#endif
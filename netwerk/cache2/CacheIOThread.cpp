@@ -15,6 +15,7 @@
 #include "nsThreadManager.h"
 #include "nsThreadUtils.h"
 #include "mozilla/EventQueue.h"
+#include "mozilla/IOBatch.h"
 #include "mozilla/IOInterposer.h"
 #include "mozilla/ProfilerLabels.h"
 #include "mozilla/ThreadEventQueue.h"
@@ -316,6 +317,8 @@ void CacheIOThread::ThreadFunc(void* aClosure) {
   RefPtr<CacheIOThread> thread =
       dont_AddRef(static_cast<CacheIOThread*>(aClosure));
   thread->ThreadFunc();
+  // The index rebuild runs IOBatches on this thread.
+  mozilla::IOBatch::ShutdownThread();
   mozilla::IOInterposer::UnregisterCurrentThread();
 }
 
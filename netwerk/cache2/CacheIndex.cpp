@@ -28,6 +28,8 @@
 #define kMaxBufSize 16384
 #define kIndexVersion 0x0000000A
 #define kUpdateIndexStartDelay 50000  // in milliseconds
+// Number of files whose metadata is read at once when building the index.
+#define kBuildIndexBatchSize 32
 #define kTelemetryReportBytesLimit (2U * 1024U * 1024U * 1024U)  // 2GB
 
 #define INDEX_NAME "index"
@@ -140,6 +142,7 @@ class MOZ_RAII CacheIndexEntryAutoManage {
   ~CacheIndexEntryAutoManage() MOZ_REQUIRES(CacheIndex::sLock) {
     const CacheIndexEntry* entry = FindEntry();
     mIndex->mIndexStats.AfterChange(entry);
+    mIndex->UpdateLookupTable(mHash, entry);
     if (!entry || !entry->IsInitialized() || entry->IsRemoved()) {
       entry = nullptr;
     }
@@ -281,6 +284,7 @@ NS_IMPL_ISUPPORTS(FileOpenHelper, CacheFileIOListener);
 
 StaticRefPtr<CacheIndex> CacheIndex::gInstance;
 StaticMutex CacheIndex::sLock;
+MOZ_CONSTINIT CacheIndexLookupTable CacheIndex::sLookupTable;
 
 NS_IMPL_ADDREF(CacheIndex)
 NS_IMPL_RELEASE(CacheIndex)
@@ -305,6 +309,18 @@ CacheIndex::~CacheIndex() {
 
 // static
 nsresult CacheIndex::Init(nsIFile* aCacheDirectory) {
+  return Init(aCacheDirectory, TimeStamp::NowLoRes());
+}
+
+// static
+nsresult CacheIndex::InitForTesting(nsIFile* aCacheDirectory) {
+  return Init(aCacheDirectory,
+              TimeStamp::NowLoRes() -
+                  TimeDuration::FromMilliseconds(kUpdateIndexStartDelay));
+}
+
+// static
+nsresult CacheIndex::Init(nsIFile* aCacheDirectory, TimeStamp aStartTime) {
   LOG(("CacheIndex::Init()"));
 
   MOZ_ASSERT(NS_IsMainThread());
@@ -316,8 +332,9 @@ nsresult CacheIndex::Init(nsIFile* aCacheDirectory) {
   }
 
   RefPtr<CacheIndex> idx = new CacheIndex();
+  sLookupTable.Clear();
 
-  nsresult rv = idx->InitInternal(aCacheDirectory, lock);
+  nsresult rv = idx->InitInternal(aCacheDirectory, aStartTime, lock);
   NS_ENSURE_SUCCESS(rv, rv);
 
   gInstance = std::move(idx);
@@ -325,6 +342,7 @@ nsresult CacheIndex::Init(nsIFile* aCacheDirectory) {
 }
 
 nsresult CacheIndex::InitInternal(nsIFile* aCacheDirectory,
+                                  TimeStamp aStartTime,
                                   const StaticMutexAutoLock& aProofOfLock) {
   nsresult rv;
   sLock.AssertCurrentThreadOwns();
@@ -332,7 +350,7 @@ nsresult CacheIndex::InitInternal(nsIFile* aCacheDirectory,
   rv = aCacheDirectory->Clone(getter_AddRefs(mCacheDirectory));
   NS_ENSURE_SUCCESS(rv, rv);
 
-  mStartTime = TimeStamp::NowLoRes();
+  mStartTime = aStartTime;
 
   ReadIndexFromDisk(aProofOfLock);
 
@@ -496,6 +514,8 @@ nsresult CacheIndex::Shutdown() {
     index->RemoveAllIndexFiles();
   }
 
+  sLookupTable.Shutdown();
+
   return NS_OK;
 }
 
@@ -1163,6 +1183,7 @@ nsresult CacheIndex::RemoveAll() {
     index->mIndexStats.Clear();
     index->mFrecencyArray.Clear(lock);
     index->mIndex.Clear();
+    sLookupTable.Clear();
 
     for (uint32_t i = 0; i < index->mIterators.Length();) {
       nsresult rv = index->mIterators[i]->CloseInternal(NS_ERROR_NOT_AVAILABLE);
@@ -1204,6 +1225,15 @@ nsresult CacheIndex::HasEntry(
 nsresult CacheIndex::HasEntry(
     const SHA1Sum::Hash& hash, EntryStatus* _retval,
     const std::function<void(const CacheIndexEntry*)>& aCB) {
+  // Callers that only want the status don't need the lock, unless the table
+  // can't answer (the index is not usable, or not populated yet).
+  uint8_t status;
+  if (!aCB && sLookupTable.Lookup(hash, &status)) {
+    *_retval = static_cast<EntryStatus>(status);
+    LOG(("CacheIndex::HasEntry() - result is %u", *_retval));
+    return NS_OK;
+  }
+
   StaticMutexAutoLock lock(sLock);
 
   RefPtr<CacheIndex> index = gInstance;
@@ -1235,31 +1265,37 @@ nsresult CacheIndex::HasEntry(
       MOZ_ASSERT(false, "Unexpected state!");
   }
 
-  if (!entry) {
-    if (index->mState == READY || index->mState == WRITING) {
-      *_retval = DOES_NOT_EXIST;
-    } else {
-      *_retval = DO_NOT_KNOW;
-    }
-  } else {
-    if (entry->IsRemoved()) {
-      if (entry->IsFresh()) {
-        *_retval = DOES_NOT_EXIST;
-      } else {
-        *_retval = DO_NOT_KNOW;
-      }
-    } else {
-      *_retval = EXISTS;
-      if (aCB) {
-        aCB(entry);
-      }
-    }
+  *_retval = StatusOfEntry(entry, index->mState);
+  if (*_retval == EXISTS && aCB) {
+    aCB(entry);
   }
 
   LOG(("CacheIndex::HasEntry() - result is %u", *_retval));
   return NS_OK;
 }
 
+// static
+CacheIndex::EntryStatus CacheIndex::StatusOfEntry(
+    const CacheIndexEntry* aEntry, EState aState) {
+  if (!aEntry) {
+    return aState == READY || aState == WRITING ? DOES_NOT_EXIST : DO_NOT_KNOW;
+  }
+  if (aEntry->IsRemoved()) {
+    return aEntry->IsFresh() ? DOES_NOT_EXIST : DO_NOT_KNOW;
+  }
+  return EXISTS;
+}
+
+void CacheIndex::UpdateLookupTable(const SHA1Sum::Hash* aHash,
+                                   const CacheIndexEntry* aEntry) {
+  sLock.AssertCurrentThreadOwns();
+  if (aEntry) {
+    sLookupTable.Set(*aHash, StatusOfEntry(aEntry, mState));
+  } else {
+    sLookupTable.Remove(*aHash);
+  }
+}
+
 // static
 nsresult CacheIndex::GetEntryForEviction(bool aIgnoreEmptyEntries,
                                          SHA1Sum::Hash* aHash, uint32_t* aCnt) {
@@ -2762,137 +2798,158 @@ void CacheIndex::BuildIndex(const StaticMutexAutoLock& aProofOfLock) {
       return;
     }
 
-    bool fileExists = false;
-    nsCOMPtr<nsIFile> file;
-    {
-      // Do not do IO under the lock.
-      nsCOMPtr<nsIDirectoryEnumerator> dirEnumerator(mDirEnumerator);
-      sLock.AssertCurrentThreadOwns();
-      StaticMutexAutoUnlock unlock(sLock);
-      rv = dirEnumerator->GetNextFile(getter_AddRefs(file));
+    // Collect the next files whose metadata has to be read, so that it can be
+    // read in one batch.
+    struct PendingFile {
+      nsCString mLeaf;
+      SHA1Sum::Hash mHash;
+    };
+    AutoTArray<PendingFile, kBuildIndexBatchSize> pending;
+    AutoTArray<CacheFileMetadata::SyncReadRequest, kBuildIndexBatchSize>
+        requests;
+    bool enumerationDone = false;
+
+    while (requests.Length() < kBuildIndexBatchSize) {
+      bool fileExists = false;
+      nsCOMPtr<nsIFile> file;
+      {
+        // Do not do IO under the lock.
+        nsCOMPtr<nsIDirectoryEnumerator> dirEnumerator(mDirEnumerator);
+        sLock.AssertCurrentThreadOwns();
+        StaticMutexAutoUnlock unlock(sLock);
+        rv = dirEnumerator->GetNextFile(getter_AddRefs(file));
 
-      if (file) {
-        file->Exists(&fileExists);
+        if (file) {
+          file->Exists(&fileExists);
+        }
+      }
+      if (mState == SHUTDOWN) {
+        return;
+      }
+      if (!file) {
+        enumerationDone = true;
+        break;
       }
-    }
-    if (mState == SHUTDOWN) {
-      return;
-    }
-    if (!file) {
-      FinishUpdate(NS_SUCCEEDED(rv), aProofOfLock);
-      return;
-    }
 
-    nsAutoCString leaf;
-    rv = file->GetNativeLeafName(leaf);
-    if (NS_FAILED(rv)) {
-      LOG(
-          ("CacheIndex::BuildIndex() - GetNativeLeafName() failed! Skipping "
-           "file."));
-      mDontMarkIndexClean = true;
-      continue;
-    }
+      nsAutoCString leaf;
+      rv = file->GetNativeLeafName(leaf);
+      if (NS_FAILED(rv)) {
+        LOG(
+            ("CacheIndex::BuildIndex() - GetNativeLeafName() failed! Skipping "
+             "file."));
+        mDontMarkIndexClean = true;
+        continue;
+      }
 
-    if (!fileExists) {
-      LOG(
-          ("CacheIndex::BuildIndex() - File returned by the iterator was "
-           "removed in the meantime [name=%s]",
-           leaf.get()));
-      continue;
-    }
+      if (!fileExists) {
+        LOG(
+            ("CacheIndex::BuildIndex() - File returned by the iterator was "
+             "removed in the meantime [name=%s]",
+             leaf.get()));
+        continue;
+      }
 
-    SHA1Sum::Hash hash;
-    rv = CacheFileIOManager::StrToHash(leaf, &hash);
-    if (NS_FAILED(rv)) {
-      LOG(
-          ("CacheIndex::BuildIndex() - Filename is not a hash, removing file. "
-           "[name=%s]",
-           leaf.get()));
-      file->Remove(false);
-      continue;
-    }
+      SHA1Sum::Hash hash;
+      rv = CacheFileIOManager::StrToHash(leaf, &hash);
+      if (NS_FAILED(rv)) {
+        LOG(
+            ("CacheIndex::BuildIndex() - Filename is not a hash, removing "
+             "file. [name=%s]",
+             leaf.get()));
+        file->Remove(false);
+        continue;
+      }
 
-    CacheIndexEntry* entry = mIndex.GetEntry(hash);
-    if (entry && entry->IsRemoved()) {
-      LOG(
-          ("CacheIndex::BuildIndex() - Found file that should not exist. "
-           "[name=%s]",
-           leaf.get()));
-      entry->Log();
-      MOZ_ASSERT(entry->IsFresh());
-      entry = nullptr;
-    }
+      CacheIndexEntry* entry = mIndex.GetEntry(hash);
+      if (entry && entry->IsRemoved()) {
+        LOG(
+            ("CacheIndex::BuildIndex() - Found file that should not exist. "
+             "[name=%s]",
+             leaf.get()));
+        entry->Log();
+        MOZ_ASSERT(entry->IsFresh());
+        entry = nullptr;
+      }
 
 #ifdef DEBUG
-    RefPtr<CacheFileHandle> handle;
-    CacheFileIOManager::gInstance->mHandles.GetHandle(&hash,
-                                                      getter_AddRefs(handle));
+      RefPtr<CacheFileHandle> handle;
+      CacheFileIOManager::gInstance->mHandles.GetHandle(&hash,
+                                                        getter_AddRefs(handle));
 #endif
 
-    if (entry) {
-      // the entry is up to date
-      LOG(
-          ("CacheIndex::BuildIndex() - Skipping file because the entry is up to"
-           " date. [name=%s]",
-           leaf.get()));
-      entry->Log();
-      MOZ_ASSERT(entry->IsFresh());  // The entry must be from this session
-      // there must be an active CacheFile if the entry is not initialized
-      MOZ_ASSERT(entry->IsInitialized() || handle);
-      continue;
-    }
+      if (entry) {
+        // the entry is up to date
+        LOG(
+            ("CacheIndex::BuildIndex() - Skipping file because the entry is up "
+             "to date. [name=%s]",
+             leaf.get()));
+        entry->Log();
+        MOZ_ASSERT(entry->IsFresh());  // The entry must be from this session
+        // there must be an active CacheFile if the entry is not initialized
+        MOZ_ASSERT(entry->IsInitialized() || handle);
+        continue;
+      }
 
-    MOZ_ASSERT(!handle);
+      MOZ_ASSERT(!handle);
 
-    RefPtr<CacheFileMetadata> meta = new CacheFileMetadata();
-    int64_t size = 0;
+      PendingFile* pendingFile = pending.AppendElement();
+      pendingFile->mLeaf = leaf;
+      memcpy(pendingFile->mHash, hash, sizeof(SHA1Sum::Hash));
+      requests.AppendElement(CacheFileMetadata::SyncReadRequest{
+          std::move(file), new CacheFileMetadata()});
+    }
 
-    {
+    if (!requests.IsEmpty()) {
       // Do not do IO under the lock.
       StaticMutexAutoUnlock unlock(sLock);
-      rv = meta->SyncReadMetadata(file);
-
-      if (NS_SUCCEEDED(rv)) {
-        rv = file->GetFileSize(&size);
-        if (NS_FAILED(rv)) {
-          LOG(
-              ("CacheIndex::BuildIndex() - Cannot get filesize of file that was"
-               " successfully parsed. [name=%s]",
-               leaf.get()));
-        }
-      }
+      CacheFileMetadata::SyncReadMetadataBatch(requests);
     }
     if (mState == SHUTDOWN) {
       return;
     }
 
-    // Nobody could add the entry while the lock was released since we modify
-    // the index only on IO thread and this loop is executed on IO thread too.
-    entry = mIndex.GetEntry(hash);
-    MOZ_ASSERT(!entry || entry->IsRemoved());
+    for (size_t i = 0; i < requests.Length(); ++i) {
+      const CacheFileMetadata::SyncReadRequest& request = requests[i];
+      const nsCString& leaf = pending[i].mLeaf;
+      const SHA1Sum::Hash& hash = pending[i].mHash;
 
-    if (NS_FAILED(rv)) {
-      LOG(
-          ("CacheIndex::BuildIndex() - CacheFileMetadata::SyncReadMetadata() "
-           "failed, removing file. [name=%s]",
-           leaf.get()));
-      file->Remove(false);
-    } else {
-      CacheIndexEntryAutoManage entryMng(&hash, this, aProofOfLock);
-      entry = mIndex.PutEntry(hash);
-      if (NS_FAILED(InitEntryFromDiskData(entry, meta, size))) {
+      // Nobody could add the entry while the lock was released since we modify
+      // the index only on IO thread and this loop is executed on IO thread too.
+      CacheIndexEntry* entry = mIndex.GetEntry(hash);
+      MOZ_ASSERT(!entry || entry->IsRemoved());
+
+      if (NS_FAILED(request.mStatus)) {
         LOG(
-            ("CacheIndex::BuildIndex() - CacheFile::InitEntryFromDiskData() "
+            ("CacheIndex::BuildIndex() - CacheFileMetadata::SyncReadMetadata() "
              "failed, removing file. [name=%s]",
              leaf.get()));
-        file->Remove(false);
-        entry->MarkRemoved();
+        request.mFile->Remove(false);
       } else {
-        LOG(("CacheIndex::BuildIndex() - Added entry to index. [name=%s]",
-             leaf.get()));
-        entry->Log();
+        CacheIndexEntryAutoManage entryMng(&hash, this, aProofOfLock);
+        entry = mIndex.PutEntry(hash);
+        if (NS_FAILED(InitEntryFromDiskData(entry, request.mMetadata,
+                                            request.mFileSize))) {
+          LOG(
+              ("CacheIndex::BuildIndex() - CacheFile::InitEntryFromDiskData() "
+               "failed, removing file. [name=%s]",
+               leaf.get()));
+          request.mFile->Remove(false);
+          entry->MarkRemoved();
+        } else {
+          LOG(("CacheIndex::BuildIndex() - Added entry to index. [name=%s]",
+               leaf.get()));
+          entry->Log();
+        }
       }
     }
+
+    if (enumerationDone) {
+      if (!ProcessPackedEntries(aProofOfLock)) {
+        return;
+      }
+      FinishUpdate(NS_SUCCEEDED(rv), aProofOfLock);
+      return;
+    }
   }
 
   MOZ_ASSERT_UNREACHABLE("We should never get here");
@@ -3021,6 +3078,9 @@ void CacheIndex::UpdateIndex(const StaticMutexAutoLock& aProofOfLock) {
       return;
     }
     if (!file) {
+      if (!ProcessPackedEntries(aProofOfLock)) {
+        return;
+      }
       FinishUpdate(NS_SUCCEEDED(rv), aProofOfLock);
       return;
     }
@@ -3182,6 +3242,154 @@ void CacheIndex::UpdateIndex(const StaticMutexAutoLock& aProofOfLock) {
   MOZ_ASSERT_UNREACHABLE("We should never get here");
 }
 
+bool CacheIndex::ProcessPackedEntries(
+    const StaticMutexAutoLock& aProofOfLock) {
+  sLock.AssertCurrentThreadOwns();
+  LOG(("CacheIndex::ProcessPackedEntries()"));
+
+  RefPtr<CacheFileIOManager> ioMan = CacheFileIOManager::gInstance;
+  if (!ioMan) {
+    return true;
+  }
+
+  nsresult rv;
+
+  if (!mPackedHashesTaken) {
+    nsTArray<CacheFilePackStore::PackedHash> hashes;
+    {
+      // Do not do IO under the lock, opening the store reads its logs.
+      StaticMutexAutoUnlock unlock(sLock);
+      if (NS_SUCCEEDED(ioMan->OpenPackStore())) {
+        ioMan->mPackStore->GetHashes(hashes);
+      }
+    }
+    if (mState == SHUTDOWN) {
+      return false;
+    }
+
+    mPackedHashes = std::move(hashes);
+    mPackedHashesTaken = true;
+  }
+
+  while (!mPackedHashes.IsEmpty()) {
+    if (CacheIOThread::YieldAndRerun()) {
+      LOG(
+          ("CacheIndex::ProcessPackedEntries() - Breaking loop for higher "
+           "level events."));
+      mUpdateEventPending = true;
+      return false;
+    }
+
+    CacheFilePackStore::PackedHash packedHash = mPackedHashes.PopLastElement();
+    const SHA1Sum::Hash& hash = packedHash.mHash;
+
+    CacheFilePackStore* store = ioMan->mPackStore.get();
+    if (!store) {
+      // All records were dropped, e.g. by EvictAll().
+      mPackedHashes.Clear();
+      break;
+    }
+
+    if (!store->Contains(hash)) {
+      // Removed, or written back to a file, since the hashes were taken.
+      continue;
+    }
+
+    CacheIndexEntry* entry = mIndex.GetEntry(hash);
+    if (entry && entry->IsRemoved()) {
+      if (entry->IsFresh()) {
+        LOG(
+            ("CacheIndex::ProcessPackedEntries() - Found record that should "
+             "not exist. [hash=%08x%08x%08x%08x%08x]",
+             LOGSHA1(&hash)));
+        entry->Log();
+      }
+      entry = nullptr;
+    }
+
+    if (entry && entry->IsFresh()) {
+      // Either the entry is up to date or there is a file for it, which
+      // takes precedence over the record.
+      continue;
+    }
+
+    if (entry) {
+      MOZ_ASSERT(mState == UPDATING);
+
+      PRTime lastModifiedTime;
+      if (NS_SUCCEEDED(store->GetLastModifiedTime(hash, &lastModifiedTime)) &&
+          mIndexTimeStamp > (lastModifiedTime / PR_MSEC_PER_SEC)) {
+        LOG(
+            ("CacheIndex::ProcessPackedEntries() - Skipping record because of "
+             "last modified time. [hash=%08x%08x%08x%08x%08x]",
+             LOGSHA1(&hash)));
+
+        CacheIndexEntryAutoManage entryMng(&hash, this, aProofOfLock);
+        entry->MarkFresh();
+        continue;
+      }
+    }
+
+    RefPtr<CacheFileMetadata> meta = new CacheFileMetadata();
+    nsTArray<uint8_t> data;
+
+    {
+      // Do not do IO under the lock.
+      StaticMutexAutoUnlock unlock(sLock);
+      rv = store->Read(hash, data);
+      if (NS_SUCCEEDED(rv)) {
+        rv = meta->SyncReadMetadata(data);
+      }
+    }
+    if (mState == SHUTDOWN) {
+      return false;
+    }
+
+    // Nobody could add the entry while the lock was released since we modify
+    // the index only on IO thread and this loop is executed on IO thread too.
+    entry = mIndex.GetEntry(hash);
+    MOZ_ASSERT(!entry || !entry->IsFresh());
+
+    {
+      CacheIndexEntryAutoManage entryMng(&hash, this, aProofOfLock);
+
+      if (NS_SUCCEEDED(rv)) {
+        entry = mIndex.PutEntry(hash);
+        rv = InitEntryFromDiskData(entry, meta, data.Length());
+      }
+
+      if (NS_FAILED(rv)) {
+        LOG(
+            ("CacheIndex::ProcessPackedEntries() - Cannot read the record, "
+             "removing it. [hash=%08x%08x%08x%08x%08x]",
+             LOGSHA1(&hash)));
+        if (entry) {
+          entry->MarkRemoved();
+          entry->MarkFresh();
+          entry->MarkDirty();
+        }
+      } else {
+        LOG(("CacheIndex::ProcessPackedEntries() - Added/updated entry to/in "
+             "index."));
+        entry->Log();
+      }
+    }
+
+    if (NS_FAILED(rv)) {
+      {
+        // Do not do IO under the lock, the removal is logged by the store.
+        StaticMutexAutoUnlock unlock(sLock);
+        ioMan->RemovePackedEntry(&hash);
+      }
+      if (mState == SHUTDOWN) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
 void CacheIndex::FinishUpdate(bool aSucceeded,
                               const StaticMutexAutoLock& aProofOfLock) {
   LOG(("CacheIndex::FinishUpdate() [succeeded=%d]", aSucceeded));
@@ -3205,6 +3413,9 @@ void CacheIndex::FinishUpdate(bool aSucceeded,
     }
   }
 
+  mPackedHashes.Clear();
+  mPackedHashesTaken = false;
+
   if (!aSucceeded) {
     mDontMarkIndexClean = true;
   }
@@ -3303,6 +3514,15 @@ void CacheIndex::ChangeState(EState aNewState,
 
   mState = aNewState;
 
+  // Entries are only looked up in the pending updates while READING or
+  // WRITING, and there are none when the state changes, so only the answer
+  // for hashes that have no entry depends on the state.
+  if (mState == INITIAL || mState == SHUTDOWN) {
+    sLookupTable.SetAbsentStatus(-1);
+  } else {
+    sLookupTable.SetAbsentStatus(StatusOfEntry(nullptr, mState));
+  }
+
   if (mState != SHUTDOWN) {
     CacheFileIOManager::CacheIndexStateChanged();
   }
@@ -3813,6 +4033,7 @@ size_t CacheIndex::SizeOfExcludingThisInternal(
   n += mallocSizeOf(mRWHash);
 
   n += mIndex.SizeOfExcludingThis(mallocSizeOf);
+  n += sLookupTable.SizeOfExcludingThis(mallocSizeOf);
   n += mPendingUpdates.SizeOfExcludingThis(mallocSizeOf);
   n += mTmpJournal.SizeOfExcludingThis(mallocSizeOf);
 
@@ -7,8 +7,10 @@
 
 #include "CacheLog.h"
 #include "CacheFileIOManager.h"
+#include "CacheFilePackStore.h"
 #include "nsIRunnable.h"
 #include "CacheHashUtils.h"
+#include "CacheIndexLookupTable.h"
 #include "nsICacheStorageService.h"
 #include "nsICacheEntry.h"
 #include "nsILoadContextInfo.h"
@@ -703,6 +705,9 @@ class CacheIndex final : public CacheFileIOListener, public nsIRunnable {
   CacheIndex();
 
   static nsresult Init(nsIFile* aCacheDirectory);
+  // Like Init(), but an index that is missing or outdated is built or updated
+  // right away rather than after the usual delay from startup.
+  static nsresult InitForTesting(nsIFile* aCacheDirectory);
   static nsresult PreShutdown();
   static nsresult Shutdown();
 
@@ -833,7 +838,8 @@ class CacheIndex final : public CacheFileIOListener, public nsIRunnable {
   NS_IMETHOD OnEOFSet(CacheFileHandle* aHandle, nsresult aResult) override;
   NS_IMETHOD OnFileRenamed(CacheFileHandle* aHandle, nsresult aResult) override;
 
-  nsresult InitInternal(nsIFile* aCacheDirectory,
+  static nsresult Init(nsIFile* aCacheDirectory, TimeStamp aStartTime);
+  nsresult InitInternal(nsIFile* aCacheDirectory, TimeStamp aStartTime,
                         const StaticMutexAutoLock& aProofOfLock);
   void PreShutdownInternal();
 
@@ -990,6 +996,12 @@ class CacheIndex final : public CacheFileIOListener, public nsIRunnable {
   // during this session and theirs last modified time is newer than timestamp
   // in the index header. Parses the files and adds the entries to the index.
   void UpdateIndex(const StaticMutexAutoLock& aProofOfLock) MOZ_REQUIRES(sLock);
+  // Called by BuildIndex() and UpdateIndex() once the entries directory is
+  // done. Does the same for the entries in CacheFilePackStore, which have no
+  // file. Returns false when the update has to stop, because the loop yielded
+  // to higher level events or the index was shut down.
+  bool ProcessPackedEntries(const StaticMutexAutoLock& aProofOfLock)
+      MOZ_REQUIRES(sLock);
   // Finalizes update or build process.
   void FinishUpdate(bool aSucceeded, const StaticMutexAutoLock& aProofOfLock)
       MOZ_REQUIRES(sLock);
@@ -1081,6 +1093,16 @@ class CacheIndex final : public CacheFileIOListener, public nsIRunnable {
   // Also guards FileOpenHelper::mCanceled
   static StaticMutex sLock;
 
+  // What HasEntry() would answer, readable without sLock. Written under
+  // sLock, see CacheIndexLookupTable.
+  static CacheIndexLookupTable sLookupTable;
+
+  // Returns HasEntry()'s answer for a hash whose entry is aEntry.
+  static EntryStatus StatusOfEntry(const CacheIndexEntry* aEntry,
+                                   EState aState);
+  void UpdateLookupTable(const SHA1Sum::Hash* aHash,
+                         const CacheIndexEntry* aEntry) MOZ_REQUIRES(sLock);
+
   nsCOMPtr<nsIFile> mCacheDirectory;
 
   EState mState MOZ_GUARDED_BY(sLock){INITIAL};
@@ -1156,6 +1178,10 @@ class CacheIndex final : public CacheFileIOListener, public nsIRunnable {
 
   // Directory enumerator used when building and updating index.
   nsCOMPtr<nsIDirectoryEnumerator> mDirEnumerator MOZ_GUARDED_BY(sLock);
+  // Packed entries left to process by ProcessPackedEntries(), taken from the
+  // pack store once the directory enumeration is done.
+  nsTArray<CacheFilePackStore::PackedHash> mPackedHashes MOZ_GUARDED_BY(sLock);
+  bool mPackedHashesTaken MOZ_GUARDED_BY(sLock) = false;
 
   // Main index hashtable.
   nsTHashtable<CacheIndexEntry> mIndex MOZ_GUARDED_BY(sLock);
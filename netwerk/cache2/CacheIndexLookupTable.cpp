@@ -0,0 +1,194 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "CacheIndexLookupTable.h"
+
+#include <string.h>
+
+#include "mozilla/Assertions.h"
+#include "prthread.h"
+
+namespace mozilla {
+namespace net {
+
+CacheIndexLookupTable::Table::Table(uint32_t aCapacity)
+    : mMask(aCapacity - 1), mSlots(new Atomic<uint64_t>[aCapacity]) {
+  MOZ_ASSERT((aCapacity & mMask) == 0, "capacity must be a power of two");
+}
+
+CacheIndexLookupTable::Table::~Table() { delete[] mSlots; }
+
+// static
+uint64_t CacheIndexLookupTable::Key(const SHA1Sum::Hash& aHash) {
+  uint64_t key;
+  memcpy(&key, aHash, sizeof(key));
+  return key & ~kTagMask;
+}
+
+// static
+Atomic<uint64_t>* CacheIndexLookupTable::Find(const Table* aTable,
+                                              uint64_t aKey,
+                                              uint64_t* aValue) {
+  Atomic<uint64_t>* firstRemoved = nullptr;
+  uint32_t index = uint32_t(aKey >> 32) & aTable->mMask;
+  for (uint32_t i = 0; i <= aTable->mMask; ++i) {
+    Atomic<uint64_t>& slot = aTable->mSlots[index];
+    uint64_t value = slot;
+    if (value == kEmpty) {
+      *aValue = kEmpty;
+      return firstRemoved ? firstRemoved : &slot;
+    }
+    if (value == kRemoved) {
+      if (!firstRemoved) {
+        firstRemoved = &slot;
+      }
+    } else if ((value & ~kTagMask) == aKey) {
+      *aValue = value;
+      return &slot;
+    }
+    index = (index + 1) & aTable->mMask;
+  }
+  *aValue = kEmpty;
+  return firstRemoved;
+}
+
+bool CacheIndexLookupTable::Lookup(const SHA1Sum::Hash& aHash,
+                                   uint8_t* aStatus) const {
+  AutoReader reader(*this);
+
+  int32_t absentStatus = mAbsentStatus;
+  const Table* table = mTable;
+  if (absentStatus < 0 || !table) {
+    return false;
+  }
+
+  // Entries are only ever modified in place, so a reader racing with the
+  // writer sees a hash either before or after the change, never missing.
+  uint64_t value;
+  Find(table, Key(aHash), &value);
+  if (value < kFirstStatusTag) {
+    *aStatus = uint8_t(absentStatus);
+  } else {
+    *aStatus = uint8_t((value & kTagMask) - kFirstStatusTag);
+  }
+  return true;
+}
+
+void CacheIndexLookupTable::Set(const SHA1Sum::Hash& aHash, uint8_t aStatus) {
+  MOZ_ASSERT(aStatus + kFirstStatusTag <= kTagMask);
+
+  Reserve();
+  uint64_t key = Key(aHash);
+  uint64_t value;
+  Atomic<uint64_t>* slot = Find(mTable, key, &value);
+  if (value < kFirstStatusTag) {
+    if (*slot == kRemoved) {
+      --mRemovedCount;
+    }
+    ++mCount;
+  }
+  *slot = key | (aStatus + kFirstStatusTag);
+}
+
+void CacheIndexLookupTable::Remove(const SHA1Sum::Hash& aHash) {
+  Table* table = mTable;
+  if (!table) {
+    return;
+  }
+  uint64_t value;
+  Atomic<uint64_t>* slot = Find(table, Key(aHash), &value);
+  if (value >= kFirstStatusTag) {
+    *slot = kRemoved;
+    --mCount;
+    ++mRemovedCount;
+  }
+  FreeRetired();
+}
+
+void CacheIndexLookupTable::Reserve() {
+  Table* table = mTable;
+  if (table &&
+      uint64_t(mCount + mRemovedCount + 1) * 4 <=
+          uint64_t(table->mMask + 1) * 3) {
+    FreeRetired();
+    return;
+  }
+
+  // Rebuild at a load of at most one half, which also drops the removed
+  // slots.
+  uint32_t capacity = kMinCapacity;
+  while (capacity < (mCount + 1) * 2) {
+    capacity *= 2;
+  }
+  Table* newTable = new Table(capacity);
+  if (table) {
+    for (uint32_t i = 0; i <= table->mMask; ++i) {
+      uint64_t value = table->mSlots[i];
+      if (value >= kFirstStatusTag) {
+        uint64_t unused;
+        *Find(newTable, value & ~kTagMask, &unused) = value;
+      }
+    }
+  }
+  mRemovedCount = 0;
+  Publish(newTable);
+}
+
+void CacheIndexLookupTable::Clear() {
+  if (!mTable) {
+    return;
+  }
+  mCount = 0;
+  mRemovedCount = 0;
+  Publish(new Table(kMinCapacity));
+}
+
+void CacheIndexLookupTable::Publish(Table* aTable) {
+  Table* old = mTable;
+  mTable = aTable;
+  if (old) {
+    old->mNextRetired = mRetired;
+    mRetired = old;
+  }
+  FreeRetired();
+}
+
+void CacheIndexLookupTable::FreeRetired() {
+  // A reader registers itself before loading mTable, so once the replaced
+  // tables are unpublished no reader is left in them when the count is 0.
+  if (!mRetired || mReaders) {
+    return;
+  }
+  while (mRetired) {
+    Table* next = mRetired->mNextRetired;
+    delete mRetired;
+    mRetired = next;
+  }
+}
+
+void CacheIndexLookupTable::Shutdown() {
+  mAbsentStatus = -1;
+  Publish(nullptr);
+  while (mRetired) {
+    PR_Sleep(PR_INTERVAL_NO_WAIT);
+    FreeRetired();
+  }
+  mCount = 0;
+  mRemovedCount = 0;
+}
+
+size_t CacheIndexLookupTable::SizeOfExcludingThis(
+    MallocSizeOf aMallocSizeOf) const {
+  size_t n = 0;
+  if (const Table* table = mTable) {
+    n += aMallocSizeOf(table) + aMallocSizeOf(table->mSlots);
+  }
+  for (const Table* table = mRetired; table; table = table->mNextRetired) {
+    n += aMallocSizeOf(table) + aMallocSizeOf(table->mSlots);
+  }
+  return n;
+}
+
+}  // namespace net
+}  // namespace mozilla
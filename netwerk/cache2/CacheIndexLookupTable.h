@@ -0,0 +1,121 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef CacheIndexLookupTable__h__
+#define CacheIndexLookupTable__h__
+
+#include "mozilla/Atomics.h"
+#include "mozilla/MemoryReporting.h"
+#include "mozilla/SHA1.h"
+
+namespace mozilla {
+namespace net {
+
+// A mirror of what CacheIndex::HasEntry() answers for every hash, which can be
+// read from any thread without taking CacheIndex::sLock.
+//
+// CacheIndex keeps the table up to date from CacheIndexEntryAutoManage, which
+// sees every change to the entries HasEntry() looks at, and sets the answer
+// for hashes that are not in the table whenever its state changes. Lookups
+// then cost a few atomic loads, instead of contending with the IO thread
+// which holds sLock while it reads, writes or updates the index.
+//
+// The table is open addressed and stores one 64-bit word per entry: the first
+// 61 bits of the hash and the status. Two hashes sharing that prefix would
+// share a status; with a SHA-1 keyed index this is far less likely than the
+// entry file disappearing behind the index's back, which callers already
+// handle.
+//
+// Writers must be serialized by the caller. Readers never block; a table that
+// is outgrown is kept around until no reader can still be looking at it.
+//
+// The constructor is constexpr and there is no destructor, so that the table
+// can be a static without a static initializer. Shutdown() releases the
+// memory.
+class CacheIndexLookupTable final {
+ public:
+  constexpr CacheIndexLookupTable() = default;
+
+  // Any thread. Returns false if the table can't answer, otherwise sets
+  // aStatus to the status stored for aHash, or to the one set with
+  // SetAbsentStatus() if there is none.
+  bool Lookup(const SHA1Sum::Hash& aHash, uint8_t* aStatus) const;
+
+  // Writer only. Stores the status of aHash.
+  void Set(const SHA1Sum::Hash& aHash, uint8_t aStatus);
+  // Writer only. Forgets aHash, which then gets the absent status.
+  void Remove(const SHA1Sum::Hash& aHash);
+
+  // Writer only. The status of hashes that are not in the table, or -1 to
+  // make Lookup() fail.
+  void SetAbsentStatus(int32_t aStatus) { mAbsentStatus = aStatus; }
+
+  // Writer only. Removes all hashes.
+  void Clear();
+
+  // Writer only. Makes Lookup() fail and frees the memory, waiting for
+  // lookups in progress to finish.
+  void Shutdown();
+
+  size_t SizeOfExcludingThis(MallocSizeOf aMallocSizeOf) const;
+
+ private:
+  // Values of the slots. Stored entries are the hash prefix with the status
+  // plus kFirstStatusTag in the low bits.
+  static constexpr uint64_t kEmpty = 0;
+  static constexpr uint64_t kRemoved = 1;
+  static constexpr uint64_t kFirstStatusTag = 2;
+  static constexpr uint64_t kTagMask = 7;
+
+  static constexpr uint32_t kMinCapacity = 1024;
+
+  struct Table {
+    explicit Table(uint32_t aCapacity);
+    ~Table();
+
+    uint32_t mMask;
+    Atomic<uint64_t>* mSlots;
+    // Next table waiting to be freed.
+    Table* mNextRetired = nullptr;
+  };
+
+  // Increments mReaders for the lifetime of a lookup.
+  class MOZ_RAII AutoReader {
+   public:
+    explicit AutoReader(const CacheIndexLookupTable& aTable)
+        : mTable(aTable) {
+      ++mTable.mReaders;
+    }
+    ~AutoReader() { --mTable.mReaders; }
+
+   private:
+    const CacheIndexLookupTable& mTable;
+  };
+
+  static uint64_t Key(const SHA1Sum::Hash& aHash);
+
+  // Returns the slot holding aKey and the value read from it, or the slot it
+  // should be inserted at.
+  static Atomic<uint64_t>* Find(const Table* aTable, uint64_t aKey,
+                                uint64_t* aValue);
+
+  // Makes room for one more entry.
+  void Reserve();
+  void Publish(Table* aTable);
+  void FreeRetired();
+
+  Atomic<Table*> mTable{nullptr};
+  Atomic<int32_t> mAbsentStatus{-1};
+  mutable Atomic<uint32_t> mReaders{0};
+
+  // Writer only.
+  uint32_t mCount = 0;
+  uint32_t mRemovedCount = 0;
+  Table* mRetired = nullptr;
+};
+
+}  // namespace net
+}  // namespace mozilla
+
+#endif
@@ -23,6 +23,7 @@
 #include "nsICookieNotification.h"
 #include "nsIEffectiveTLDService.h"
 #include "nsILineInputStream.h"
+#include "nsITimer.h"
 #include "nsIURIMutator.h"
 #include "nsNetUtil.h"
 #include "nsVariant.h"
@@ -112,6 +113,36 @@ void BindCookieParameters(mozIStorageBindingParamsArray* aParamsArray,
   MOZ_ASSERT(NS_SUCCEEDED(rv));
 }
 
+void BindCookieLastAccessed(mozIStorageBindingParamsArray* aParamsArray,
+                            const Cookie* aCookie, int64_t aLastAccessed) {
+  // Create our params holder.
+  nsCOMPtr<mozIStorageBindingParams> params;
+  aParamsArray->NewBindingParams(getter_AddRefs(params));
+
+  // Bind our parameters.
+  DebugOnly<nsresult> rv =
+      params->BindInt64ByName("lastAccessed"_ns, aLastAccessed);
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+
+  rv = params->BindUTF8StringByName("name"_ns, aCookie->Name());
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+
+  rv = params->BindUTF8StringByName("host"_ns, aCookie->Host());
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+
+  rv = params->BindUTF8StringByName("path"_ns, aCookie->Path());
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+
+  nsAutoCString suffix;
+  aCookie->OriginAttributesRef().CreateSuffix(suffix);
+  rv = params->BindUTF8StringByName("originAttributes"_ns, suffix);
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+
+  // Add our bound parameters to the array.
+  rv = aParamsArray->AddParams(params);
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+}
+
 class ConvertAppIdToOriginAttrsSQLFunction final : public mozIStorageFunction {
   ~ConvertAppIdToOriginAttrsSQLFunction() = default;
 
@@ -497,6 +528,18 @@ already_AddRefed<CookiePersistentStorage> CookiePersistentStorage::Create() {
   return storage.forget();
 }
 
+// static
+already_AddRefed<CookiePersistentStorage>
+CookiePersistentStorage::CreateForTesting(nsIFile* aCookieFile) {
+  MOZ_ASSERT(aCookieFile);
+
+  RefPtr<CookiePersistentStorage> storage = new CookiePersistentStorage();
+  storage->Init();
+  storage->Activate(aCookieFile);
+
+  return storage.forget();
+}
+
 CookiePersistentStorage::CookiePersistentStorage()
     : mMonitor("CookiePersistentStorage"),
       mInitialized(false),
@@ -531,6 +574,9 @@ void CookiePersistentStorage::NotifyChangedInternal(
 }
 
 void CookiePersistentStorage::RemoveAllInternal() {
+  // Whatever was still to be written is deleted anyway.
+  DropPendingWrites();
+
   // clear the cookie file
   if (mDBConn) {
     nsCOMPtr<mozIStorageAsyncStatement> stmt;
@@ -555,6 +601,10 @@ void CookiePersistentStorage::HandleCorruptDB() {
                    ("HandleCorruptDB(): CookieStorage %p has mCorruptFlag %u",
                     this, mCorruptFlag));
 
+  // The database is rebuilt from the cookies in memory, which the pending
+  // writes are already part of.
+  DropPendingWrites();
+
   // Mark the database corrupt, so the close listener can begin reconstructing
   // it.
   switch (mCorruptFlag) {
@@ -619,6 +669,18 @@ void CookiePersistentStorage::RemoveCookieFromDB(const Cookie& aCookie) {
     return;
   }
 
+  if (ShouldBatchWrites()) {
+    PendingWrite& write = PendingWriteFor(aCookie);
+    // The cookie is not changed, only kept alive until the flush.
+    write.mCookie = const_cast<Cookie*>(&aCookie);
+    write.mDelete = true;
+    write.mInsert = false;
+    write.mUpdateLastAccessed = false;
+    return;
+  }
+
+  FlushPendingWrites();
+
   nsCOMPtr<mozIStorageBindingParamsArray> paramsArray;
   mStmtDelete->NewBindingParamsArray(getter_AddRefs(paramsArray));
 
@@ -693,6 +755,8 @@ void CookiePersistentStorage::CleanupDBConnection() {
 }
 
 void CookiePersistentStorage::Close() {
+  FlushPendingWrites();
+
   if (mThread) {
     mThread->Shutdown();
     mThread = nullptr;
@@ -721,6 +785,16 @@ void CookiePersistentStorage::StoreCookie(
     return;
   }
 
+  if (ShouldBatchWrites()) {
+    PendingWrite& write = PendingWriteFor(*aCookie);
+    write.mCookie = aCookie;
+    write.mBaseDomain = aBaseDomain;
+    write.mOriginAttributes = aOriginAttributes;
+    write.mInsert = true;
+    write.mUpdateLastAccessed = false;
+    return;
+  }
+
   nsCOMPtr<mozIStorageBindingParamsArray> paramsArray;
   mStmtInsert->NewBindingParamsArray(getter_AddRefs(paramsArray));
 
@@ -742,6 +816,8 @@ void CookiePersistentStorage::MaybeStoreCookiesToDB(
     return;
   }
 
+  FlushPendingWrites();
+
   DebugOnly<nsresult> rv = mStmtInsert->BindParameters(aParamsArray);
   MOZ_ASSERT(NS_SUCCEEDED(rv));
 
@@ -752,6 +828,27 @@ void CookiePersistentStorage::MaybeStoreCookiesToDB(
 
 void CookiePersistentStorage::StaleCookies(
     const nsTArray<RefPtr<Cookie>>& aCookieList, int64_t aCurrentTimeInUsec) {
+  if (ShouldBatchWrites()) {
+    for (Cookie* cookie : aCookieList) {
+      if (!cookie->IsStale()) {
+        continue;
+      }
+
+      UpdateCookieInList(cookie, aCurrentTimeInUsec, nullptr);
+      if (cookie->IsSession()) {
+        continue;
+      }
+
+      PendingWrite& write = PendingWriteFor(*cookie);
+      if (!write.mCookie) {
+        write.mCookie = cookie;
+      }
+      // A pending insert writes the new time already.
+      write.mUpdateLastAccessed = !write.mInsert;
+    }
+    return;
+  }
+
   // Create an array of parameters to bind to our update statement. Batching
   // is OK here since we're updating cookies with no interleaved operations.
   nsCOMPtr<mozIStorageBindingParamsArray> paramsArray;
@@ -773,6 +870,8 @@ void CookiePersistentStorage::StaleCookies(
     uint32_t length;
     paramsArray->GetLength(&length);
     if (length) {
+      FlushPendingWrites();
+
       DebugOnly<nsresult> rv = stmt->BindParameters(paramsArray);
       MOZ_ASSERT(NS_SUCCEEDED(rv));
 
@@ -793,32 +892,7 @@ void CookiePersistentStorage::UpdateCookieInList(
 
   // if it's a non-session cookie, update it in the db too
   if (!aCookie->IsSession() && aParamsArray) {
-    // Create our params holder.
-    nsCOMPtr<mozIStorageBindingParams> params;
-    aParamsArray->NewBindingParams(getter_AddRefs(params));
-
-    // Bind our parameters.
-    DebugOnly<nsresult> rv =
-        params->BindInt64ByName("lastAccessed"_ns, aLastAccessed);
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
-
-    rv = params->BindUTF8StringByName("name"_ns, aCookie->Name());
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
-
-    rv = params->BindUTF8StringByName("host"_ns, aCookie->Host());
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
-
-    rv = params->BindUTF8StringByName("path"_ns, aCookie->Path());
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
-
-    nsAutoCString suffix;
-    aCookie->OriginAttributesRef().CreateSuffix(suffix);
-    rv = params->BindUTF8StringByName("originAttributes"_ns, suffix);
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
-
-    // Add our bound parameters to the array.
-    rv = aParamsArray->AddParams(params);
-    MOZ_ASSERT(NS_SUCCEEDED(rv));
+    BindCookieLastAccessed(aParamsArray, aCookie, aLastAccessed);
   }
 }
 
@@ -827,6 +901,8 @@ void CookiePersistentStorage::DeleteFromDB(
   uint32_t length;
   aParamsArray->GetLength(&length);
   if (length) {
+    FlushPendingWrites();
+
     DebugOnly<nsresult> rv = mStmtDelete->BindParameters(aParamsArray);
     MOZ_ASSERT(NS_SUCCEEDED(rv));
 
@@ -836,7 +912,133 @@ void CookiePersistentStorage::DeleteFromDB(
   }
 }
 
-void CookiePersistentStorage::Activate() {
+bool CookiePersistentStorage::ShouldBatchWrites() const {
+  return mDBConn && !mInTransaction &&
+         StaticPrefs::network_cookie_db_write_batch_window_ms();
+}
+
+CookiePersistentStorage::PendingWrite& CookiePersistentStorage::PendingWriteFor(
+    const Cookie& aCookie) {
+  nsAutoCString suffix;
+  aCookie.OriginAttributesRef().CreateSuffix(suffix);
+
+  // Length prefixed, so that no two cookies share a key.
+  nsAutoCString key;
+  auto appendPart = [&key](const nsACString& aPart) {
+    key.AppendInt(aPart.Length());
+    key.Append(':');
+    key.Append(aPart);
+  };
+  appendPart(aCookie.Name());
+  appendPart(aCookie.Host());
+  appendPart(aCookie.Path());
+  appendPart(suffix);
+
+  if (!mFlushTimer) {
+    RefPtr<CookiePersistentStorage> self = this;
+    DebugOnly<nsresult> rv = NS_NewTimerWithCallback(
+        getter_AddRefs(mFlushTimer),
+        [self](nsITimer*) { self->FlushPendingWrites(); },
+        StaticPrefs::network_cookie_db_write_batch_window_ms(),
+        nsITimer::TYPE_ONE_SHOT, "CookiePersistentStorage::FlushPendingWrites");
+    // Without a timer the writes wait for the next flush or Close().
+    NS_WARNING_ASSERTION(NS_SUCCEEDED(rv), "Failed to create the flush timer");
+  }
+
+  return mPendingWrites.LookupOrInsert(key);
+}
+
+void CookiePersistentStorage::FlushPendingWrites() {
+  if (mFlushTimer) {
+    mFlushTimer->Cancel();
+    mFlushTimer = nullptr;
+  }
+
+  if (mPendingWrites.IsEmpty()) {
+    return;
+  }
+
+  if (!mDBConn) {
+    mPendingWrites.Clear();
+    return;
+  }
+
+  nsCOMPtr<mozIStorageBindingParamsArray> deletes;
+  nsCOMPtr<mozIStorageBindingParamsArray> inserts;
+  nsCOMPtr<mozIStorageBindingParamsArray> updates;
+  mStmtDelete->NewBindingParamsArray(getter_AddRefs(deletes));
+  mStmtInsert->NewBindingParamsArray(getter_AddRefs(inserts));
+  mStmtUpdate->NewBindingParamsArray(getter_AddRefs(updates));
+
+  for (const PendingWrite& write : mPendingWrites.Values()) {
+    if (write.mDelete) {
+      PrepareCookieRemoval(*write.mCookie, deletes);
+    }
+    if (write.mInsert) {
+      BindCookieParameters(
+          inserts, CookieKey(write.mBaseDomain, write.mOriginAttributes),
+          write.mCookie);
+    } else if (write.mUpdateLastAccessed && !write.mDelete) {
+      BindCookieLastAccessed(updates, write.mCookie,
+                             write.mCookie->LastAccessed());
+    }
+  }
+  mPendingWrites.Clear();
+
+  // The statements run in one transaction, in this order. Any error makes the
+  // listener rebuild the database, and the insert listener also tells the
+  // tests that cookies were saved.
+  nsTArray<RefPtr<mozIStorageBaseStatement>> statements;
+  mozIStorageStatementCallback* listener = nullptr;
+  auto addStatement = [&](mozIStorageAsyncStatement* aStmt,
+                          mozIStorageBindingParamsArray* aParamsArray,
+                          mozIStorageStatementCallback* aListener) {
+    uint32_t length;
+    aParamsArray->GetLength(&length);
+    if (!length) {
+      return;
+    }
+
+    DebugOnly<nsresult> rv = aStmt->BindParameters(aParamsArray);
+    MOZ_ASSERT(NS_SUCCEEDED(rv));
+    statements.AppendElement(aStmt);
+    if (!listener || aListener == mInsertListener) {
+      listener = aListener;
+    }
+  };
+  addStatement(mStmtDelete, deletes, mRemoveListener);
+  addStatement(mStmtInsert, inserts, mInsertListener);
+  addStatement(mStmtUpdate, updates, mUpdateListener);
+
+  if (statements.IsEmpty()) {
+    return;
+  }
+
+  nsCOMPtr<mozIStoragePendingStatement> handle;
+  DebugOnly<nsresult> rv =
+      mDBConn->ExecuteAsync(statements, listener, getter_AddRefs(handle));
+  MOZ_ASSERT(NS_SUCCEEDED(rv));
+}
+
+void CookiePersistentStorage::DropPendingWrites() {
+  if (mFlushTimer) {
+    mFlushTimer->Cancel();
+    mFlushTimer = nullptr;
+  }
+  mPendingWrites.Clear();
+}
+
+nsresult CookiePersistentStorage::SyncForTesting(
+    mozIStorageStatementCallback* aCallback) {
+  NS_ENSURE_TRUE(mDBConn, NS_ERROR_NOT_AVAILABLE);
+
+  // The statements of a connection run in the order they were executed in.
+  nsCOMPtr<mozIStoragePendingStatement> handle;
+  return mDBConn->ExecuteSimpleSQLAsync("SELECT 1"_ns, aCallback,
+                                        getter_AddRefs(handle));
+}
+
+void CookiePersistentStorage::Activate(nsIFile* aCookieFile) {
   MOZ_ASSERT(!mThread, "already have a cookie thread");
 
   mStorageService = do_GetService("@mozilla.org/storage/service;1");
@@ -846,8 +1048,16 @@ void CookiePersistentStorage::Activate() {
   MOZ_ASSERT(mTLDService);
 
   // Get our cookie file.
-  nsresult rv = NS_GetSpecialDirectory(NS_APP_USER_PROFILE_50_DIR,
-                                       getter_AddRefs(mCookieFile));
+  nsresult rv;
+  if (aCookieFile) {
+    rv = aCookieFile->Clone(getter_AddRefs(mCookieFile));
+  } else {
+    rv = NS_GetSpecialDirectory(NS_APP_USER_PROFILE_50_DIR,
+                                getter_AddRefs(mCookieFile));
+    if (NS_SUCCEEDED(rv)) {
+      mCookieFile->AppendNative(nsLiteralCString(COOKIES_FILE));
+    }
+  }
   if (NS_FAILED(rv)) {
     // We've already set up our CookieStorages appropriately; nothing more to
     // do.
@@ -859,8 +1069,6 @@ void CookiePersistentStorage::Activate() {
     return;
   }
 
-  mCookieFile->AppendNative(nsLiteralCString(COOKIES_FILE));
-
   NS_ENSURE_SUCCESS_VOID(NS_NewNamedThread("Cookie", getter_AddRefs(mThread)));
 
   RefPtr<CookiePersistentStorage> self = this;
@@ -2311,6 +2519,11 @@ nsresult CookiePersistentStorage::RunInTransaction(
     return NS_ERROR_NOT_AVAILABLE;
   }
 
+  // Everything written by the callback has to be part of the transaction.
+  FlushPendingWrites();
+  mInTransaction = true;
+  auto inTransaction = MakeScopeExit([&] { mInTransaction = false; });
+
   mozStorageTransaction transaction(mDBConn, true);
 
   // XXX Handle the error, bug 1696130.
@@ -11,6 +11,7 @@
 #include "mozilla/Atomics.h"
 #include "mozilla/Monitor.h"
 #include "mozilla/net/NeckoChannelParams.h"
+#include "nsTHashMap.h"
 #include "mozIStorageBindingParamsArray.h"
 #include "mozIStorageCompletionCallback.h"
 #include "mozIStorageStatement.h"
@@ -20,6 +21,7 @@ class mozIStorageAsyncStatement;
 class mozIStorageService;
 class nsICookieTransactionCallback;
 class nsIEffectiveTLDService;
+class nsITimer;
 
 namespace mozilla {
 namespace net {
@@ -31,6 +33,11 @@ class CookiePersistentStorage final : public CookieStorage {
 
   static already_AddRefed<CookiePersistentStorage> Create();
 
+  // For tests. Uses aCookieFile as the database instead of the one in the
+  // profile.
+  static already_AddRefed<CookiePersistentStorage> CreateForTesting(
+      nsIFile* aCookieFile);
+
   void HandleCorruptDB();
 
   void RemoveCookiesWithOriginAttributes(
@@ -51,7 +58,8 @@ class CookiePersistentStorage final : public CookieStorage {
   void CleanupCachedStatements();
   void CleanupDBConnection();
 
-  void Activate();
+  // Opens aCookieFile, or the database of the profile if it is null.
+  void Activate(nsIFile* aCookieFile = nullptr);
 
   void RebuildCorruptDB();
   void HandleDBClosed();
@@ -69,6 +77,13 @@ class CookiePersistentStorage final : public CookieStorage {
 
   void SetCorruptFlag(CorruptFlag aFlag) { mCorruptFlag = aFlag; }
 
+  // For tests. Writes the pending changes now rather than at the end of the
+  // batch window.
+  void FlushPendingWritesForTesting() { FlushPendingWrites(); }
+
+  // For tests. Calls aCallback once the statements executed so far are done.
+  nsresult SyncForTesting(mozIStorageStatementCallback* aCallback);
+
  protected:
   const char* NotificationTopic() const override { return "cookie-changed"; }
 
@@ -118,6 +133,17 @@ class CookiePersistentStorage final : public CookieStorage {
 
   void MaybeStoreCookiesToDB(mozIStorageBindingParamsArray* aParamsArray);
 
+  // With network.cookie.db_write_batch_window_ms set, the inserts, removals
+  // and lastAccessed updates of single cookies are collected for that long and
+  // then executed in one transaction. Only the last state of each cookie is
+  // written.
+  bool ShouldBatchWrites() const;
+  // Returns the pending write for aCookie, and arms the flush timer.
+  struct PendingWrite;
+  PendingWrite& PendingWriteFor(const Cookie& aCookie);
+  void FlushPendingWrites();
+  void DropPendingWrites();
+
   nsCOMPtr<nsIThread> mThread;
   nsCOMPtr<mozIStorageService> mStorageService;
   nsCOMPtr<nsIEffectiveTLDService> mTLDService;
@@ -150,6 +176,26 @@ class CookiePersistentStorage final : public CookieStorage {
   // while the background read is taking place.
   nsCOMPtr<mozIStorageConnection> mSyncConn;
 
+  // What has to be written for a cookie at the next flush. The row of the
+  // cookie is removed before the new one is inserted.
+  struct PendingWrite {
+    RefPtr<Cookie> mCookie;
+    // The key StoreCookie() was called with, for the insert.
+    nsCString mBaseDomain;
+    OriginAttributes mOriginAttributes;
+    bool mDelete = false;
+    bool mInsert = false;
+    bool mUpdateLastAccessed = false;
+  };
+
+  // Keyed by the name, host, path and origin attributes of the cookie, the
+  // unique key of the table.
+  nsTHashMap<nsCStringHashKey, PendingWrite> mPendingWrites;
+  nsCOMPtr<nsITimer> mFlushTimer;
+  // Set while RunInTransaction() runs its callback, whose writes have to be
+  // part of its transaction.
+  bool mInTransaction = false;
+
   // DB completion handlers.
   nsCOMPtr<mozIStorageStatementCallback> mInsertListener;
   nsCOMPtr<mozIStorageStatementCallback> mUpdateListener;
@@ -934,6 +934,10 @@ void CookieService::GetCookiesForURI(
   nsCOMPtr<nsILoadInfo> loadInfo = aChannel ? aChannel->LoadInfo() : nullptr;
   const bool on3pcdException = loadInfo && loadInfo->GetIsOn3PCBExceptionList();
 
+  // Each entry hands out its cookies already sorted, so the result only needs
+  // sorting when cookies from more than one of them end up in it.
+  uint32_t entriesWithCookies = aCookieList.IsEmpty() ? 0 : 1;
+
   for (const auto& attrs : aOriginAttrsList) {
     CookieStorage* storage = PickStorage(attrs);
 
@@ -1015,9 +1019,9 @@ void CookieService::GetCookiesForURI(
     int64_t currentTime = currentTimeInUsec / PR_USEC_PER_MSEC;
     bool stale = false;
 
-    nsTArray<RefPtr<Cookie>> cookies;
-    storage->GetCookiesFromHost(baseDomain, attrs, cookies);
-    if (cookies.IsEmpty()) {
+    const CookieEntry::ArrayType* cookies =
+        storage->GetSortedCookiesFromHost(baseDomain, attrs);
+    if (!cookies || cookies->IsEmpty()) {
       continue;
     }
 
@@ -1026,8 +1030,10 @@ void CookieService::GetCookiesForURI(
         !nsContentUtils::IsURIInPrefList(
             aHostURI, "network.cookie.sameSite.laxByDefault.disabledHosts");
 
-    // iterate the cookies!
-    for (Cookie* cookie : cookies) {
+    // iterate the cookies! Nothing in this loop may change the cookies of the
+    // entry, the array is not ours.
+    uint32_t previousLength = aCookieList.Length();
+    for (Cookie* cookie : *cookies) {
       // check the host, since the base domain lookup is conservative.
       if (!CookieCommons::DomainMatches(cookie, hostFromURI)) {
         continue;
@@ -1100,9 +1106,10 @@ void CookieService::GetCookiesForURI(
       }
     }
 
-    if (aCookieList.IsEmpty()) {
+    if (aCookieList.Length() == previousLength) {
       continue;
     }
+    ++entriesWithCookies;
 
     // update lastAccessed timestamps. we only do this if the timestamp is stale
     // by a certain amount, to avoid thrashing the db during pageload.
@@ -1122,7 +1129,9 @@ void CookieService::GetCookiesForURI(
   // return cookies in order of path length; longest to shortest.
   // this is required per RFC2109.  if cookies match in length,
   // then sort by creation time (see bug 236772).
-  aCookieList.Sort(CompareCookiesForSending());
+  if (entriesWithCookies > 1) {
+    aCookieList.Sort(CompareCookiesForSending());
+  }
 }
 
 /******************************************************************************
@@ -116,10 +116,29 @@ size_t CookieEntry::SizeOfExcludingThis(MallocSizeOf aMallocSizeOf) const {
   for (uint32_t i = 0; i < mCookies.Length(); ++i) {
     amount += mCookies[i]->SizeOfIncludingThis(aMallocSizeOf);
   }
+  amount += mSortedCookies.ShallowSizeOfExcludingThis(aMallocSizeOf);
 
   return amount;
 }
 
+const CookieEntry::ArrayType& CookieEntry::GetSortedCookies() {
+  if (mSortedCookies.IsEmpty() && !mCookies.IsEmpty()) {
+    mSortedCookies = mCookies.Clone();
+    mSortedCookies.Sort(CompareCookiesForSending());
+  }
+  return mSortedCookies;
+}
+
+void CookieEntry::AppendCookie(Cookie* aCookie) {
+  mCookies.AppendElement(aCookie);
+  mSortedCookies.Clear();
+}
+
+void CookieEntry::RemoveCookieAt(IndexType aIndex) {
+  mCookies.RemoveElementAt(aIndex);
+  mSortedCookies.Clear();
+}
+
 bool CookieEntry::IsPartitioned() const {
   return !mOriginAttributes.mPartitionKey.IsEmpty();
 }
@@ -292,6 +311,13 @@ void CookieStorage::GetCookiesFromHost(
   aCookies = entry->GetCookies().Clone();
 }
 
+const CookieEntry::ArrayType* CookieStorage::GetSortedCookiesFromHost(
+    const nsACString& aBaseDomain, const OriginAttributes& aOriginAttributes) {
+  CookieEntry* entry =
+      mHostTable.GetEntry(CookieKey(aBaseDomain, aOriginAttributes));
+  return entry ? &entry->GetSortedCookies() : nullptr;
+}
+
 void CookieStorage::GetCookiesWithOriginAttributes(
     const OriginAttributesPattern& aPattern, const nsACString& aBaseDomain,
     bool aSorted, nsTArray<RefPtr<nsICookie>>& aResult) {
@@ -899,7 +925,7 @@ void CookieStorage::AddCookieToList(const nsACString& aBaseDomain,
   CookieEntry* entry = mHostTable.PutEntry(key);
   NS_ASSERTION(entry, "can't insert element into a null entry!");
 
-  entry->GetCookies().AppendElement(aCookie);
+  entry->AppendCookie(aCookie);
   ++mCookieCount;
 
   // keep track of the oldest cookie, for when it comes time to purge
@@ -1095,7 +1121,7 @@ void CookieStorage::RemoveCookieFromListInternal(const CookieListIter& aIter) {
 
   } else {
     // just remove the element from the list
-    aIter.entry->GetCookies().RemoveElementAt(aIter.index);
+    aIter.entry->RemoveCookieAt(aIter.index);
   }
 
   --mCookieCount;
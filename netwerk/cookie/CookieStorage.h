@@ -44,15 +44,25 @@ class CookieEntry : public CookieKey {
 
   ~CookieEntry() = default;
 
-  inline ArrayType& GetCookies() { return mCookies; }
   inline const ArrayType& GetCookies() const { return mCookies; }
 
+  // The cookies in the order they are sent to a server, see
+  // CompareCookiesForSending. Built on first use and dropped whenever a
+  // cookie is added or removed, so that building the cookie header for the
+  // many requests to a host does not sort the same list again every time.
+  const ArrayType& GetSortedCookies();
+
+  void AppendCookie(Cookie* aCookie);
+  void RemoveCookieAt(IndexType aIndex);
+
   size_t SizeOfExcludingThis(MallocSizeOf aMallocSizeOf) const;
 
   bool IsPartitioned() const;
 
  private:
   ArrayType mCookies;
+  // Empty while it has to be rebuilt from mCookies.
+  ArrayType mSortedCookies;
 };
 
 // stores the CookieEntry entryclass and an index into the cookie array within
@@ -102,6 +112,11 @@ class CookieStorage : public nsIObserver, public nsSupportsWeakReference {
                           const OriginAttributes& aOriginAttributes,
                           nsTArray<RefPtr<Cookie>>& aCookies);
 
+  // The cookies of the entry in sending order, or null if there is none. The
+  // array is owned by the entry and only valid until its cookies change.
+  const CookieEntry::ArrayType* GetSortedCookiesFromHost(
+      const nsACString& aBaseDomain, const OriginAttributes& aOriginAttributes);
+
   void GetCookiesWithOriginAttributes(const OriginAttributesPattern& aPattern,
                                       const nsACString& aBaseDomain,
                                       bool aSorted,
@@ -16,6 +16,8 @@ void HostRecordQueue::InsertRecord(nsHostRecord* aRec,
   if (aRec->isInList()) {
     MOZ_DIAGNOSTIC_ASSERT(!mEvictionQ.contains(aRec),
                           "Already in eviction queue");
+    MOZ_DIAGNOSTIC_ASSERT(!mNegativeQ.contains(aRec),
+                          "Already in negative queue");
     MOZ_DIAGNOSTIC_ASSERT(!mHighQ.contains(aRec), "Already in high queue");
     MOZ_DIAGNOSTIC_ASSERT(!mMediumQ.contains(aRec), "Already in med queue");
     MOZ_DIAGNOSTIC_ASSERT(!mLowQ.contains(aRec), "Already in low queue");
@@ -40,11 +42,14 @@ void HostRecordQueue::InsertRecord(nsHostRecord* aRec,
 
 void HostRecordQueue::AddToEvictionQ(
     nsHostRecord* aRec, uint32_t aMaxCacheEntries,
+    uint32_t aMaxNegativeCacheEntries,
     nsRefPtrHashtable<nsGenericHashKey<nsHostKey>, nsHostRecord>& aDB,
     const MutexAutoLock& aProofOfLock) {
   if (aRec->isInList()) {
     bool inEvictionQ = mEvictionQ.contains(aRec);
     MOZ_DIAGNOSTIC_ASSERT(!inEvictionQ, "Already in eviction queue");
+    bool inNegativeQ = mNegativeQ.contains(aRec);
+    MOZ_DIAGNOSTIC_ASSERT(!inNegativeQ, "Already in negative queue");
     bool inHighQ = mHighQ.contains(aRec);
     MOZ_DIAGNOSTIC_ASSERT(!inHighQ, "Already in high queue");
     bool inMediumQ = mMediumQ.contains(aRec);
@@ -59,11 +64,27 @@ void HostRecordQueue::AddToEvictionQ(
     if (inEvictionQ) {
       MOZ_DIAGNOSTIC_ASSERT(mEvictionQSize > 0);
       mEvictionQSize--;
+    } else if (inNegativeQ) {
+      MOZ_DIAGNOSTIC_ASSERT(mNegativeQSize > 0);
+      mNegativeQSize--;
     } else if (inHighQ || inMediumQ || inLowQ) {
       MOZ_DIAGNOSTIC_ASSERT(mPendingCount > 0);
       mPendingCount--;
     }
   }
+
+  if (aRec->negative) {
+    mNegativeQ.insertBack(aRec);
+    if (mNegativeQSize < aMaxNegativeCacheEntries) {
+      mNegativeQSize++;
+    } else {
+      // remove first element on mNegativeQ
+      RefPtr<nsHostRecord> head = mNegativeQ.popFirst();
+      aDB.Remove(*static_cast<nsHostKey*>(head.get()));
+    }
+    return;
+  }
+
   mEvictionQ.insertBack(aRec);
   if (mEvictionQSize < aMaxCacheEntries) {
     mEvictionQSize++;
@@ -99,7 +120,9 @@ void HostRecordQueue::MaybeRenewHostRecord(nsHostRecord* aRec,
   }
 
   bool inEvictionQ = mEvictionQ.contains(aRec);
-  MOZ_DIAGNOSTIC_ASSERT(inEvictionQ, "Should be in eviction queue");
+  bool inNegativeQ = !inEvictionQ && mNegativeQ.contains(aRec);
+  MOZ_DIAGNOSTIC_ASSERT(inEvictionQ || inNegativeQ,
+                        "Should be in eviction queue");
   bool inHighQ = mHighQ.contains(aRec);
   MOZ_DIAGNOSTIC_ASSERT(!inHighQ, "Already in high queue");
   bool inMediumQ = mMediumQ.contains(aRec);
@@ -112,6 +135,9 @@ void HostRecordQueue::MaybeRenewHostRecord(nsHostRecord* aRec,
   if (inEvictionQ) {
     MOZ_DIAGNOSTIC_ASSERT(mEvictionQSize > 0);
     mEvictionQSize--;
+  } else if (inNegativeQ) {
+    MOZ_DIAGNOSTIC_ASSERT(mNegativeQSize > 0);
+    mNegativeQSize--;
   } else if (inHighQ || inMediumQ || inLowQ) {
     MOZ_DIAGNOSTIC_ASSERT(mPendingCount > 0);
     mPendingCount--;
@@ -122,16 +148,22 @@ void HostRecordQueue::FlushEvictionQ(
     nsRefPtrHashtable<nsGenericHashKey<nsHostKey>, nsHostRecord>& aDB,
     const MutexAutoLock& aProofOfLock) {
   mEvictionQSize = 0;
+  mNegativeQSize = 0;
 
-  // Clear the evictionQ and remove all its corresponding entries from
+  // Clear the eviction queues and remove all their corresponding entries from
   // the cache first
-  if (!mEvictionQ.isEmpty()) {
-    for (const RefPtr<nsHostRecord>& rec : mEvictionQ) {
+  auto flush = [&](LinkedList<RefPtr<nsHostRecord>>& aQ) {
+    if (aQ.isEmpty()) {
+      return;
+    }
+    for (const RefPtr<nsHostRecord>& rec : aQ) {
       rec->Cancel();
       aDB.Remove(*static_cast<nsHostKey*>(rec));
     }
-    mEvictionQ.clear();
-  }
+    aQ.clear();
+  };
+  flush(mEvictionQ);
+  flush(mNegativeQ);
 }
 
 void HostRecordQueue::MaybeRemoveFromQ(nsHostRecord* aRec,
@@ -145,6 +177,8 @@ void HostRecordQueue::MaybeRemoveFromQ(nsHostRecord* aRec,
     mPendingCount--;
   } else if (mEvictionQ.contains(aRec)) {
     mEvictionQSize--;
+  } else if (mNegativeQ.contains(aRec)) {
+    mNegativeQSize--;
   } else {
     MOZ_ASSERT(false, "record is in other queue");
   }
@@ -210,13 +244,16 @@ void HostRecordQueue::ClearAll(
   clearPendingQ(mLowQ);
 
   mEvictionQSize = 0;
-  if (!mEvictionQ.isEmpty()) {
-    for (const RefPtr<nsHostRecord>& rec : mEvictionQ) {
-      rec->Cancel();
-    }
+  mNegativeQSize = 0;
+  for (const RefPtr<nsHostRecord>& rec : mEvictionQ) {
+    rec->Cancel();
+  }
+  for (const RefPtr<nsHostRecord>& rec : mNegativeQ) {
+    rec->Cancel();
   }
 
   mEvictionQ.clear();
+  mNegativeQ.clear();
 }
 
 }  // namespace net
@@ -23,22 +23,26 @@ class HostRecordQueue final {
 
   uint32_t PendingCount() const { return mPendingCount; }
   uint32_t EvictionQSize() const { return mEvictionQSize; }
+  uint32_t NegativeQSize() const { return mNegativeQSize; }
 
   // Insert the record to mHighQ or mMediumQ or mLowQ based on the record's
   // priority.
   void InsertRecord(nsHostRecord* aRec, nsIDNSService::DNSFlags aFlags,
                     const MutexAutoLock& aProofOfLock);
-  // Insert the record to mEvictionQ. In theory, this function should be called
-  // when the record is not in any queue.
+  // Insert the record to mEvictionQ, or to mNegativeQ if it is negative. Each
+  // queue evicts its oldest record when it is full. In theory, this function
+  // should be called when the record is not in any queue.
   void AddToEvictionQ(
       nsHostRecord* aRec, uint32_t aMaxCacheEntries,
+      uint32_t aMaxNegativeCacheEntries,
       nsRefPtrHashtable<nsGenericHashKey<nsHostKey>, nsHostRecord>& aDB,
       const MutexAutoLock& aProofOfLock);
-  // Called for removing the record from mEvictionQ. When this function is
-  // called, the record should be either in mEvictionQ or not in any queue.
+  // Called for removing the record from mEvictionQ or mNegativeQ. When this
+  // function is called, the record should be either in one of them or not in
+  // any queue.
   void MaybeRenewHostRecord(nsHostRecord* aRec,
                             const MutexAutoLock& aProofOfLock);
-  // Called for clearing mEvictionQ.
+  // Called for clearing mEvictionQ and mNegativeQ.
   void FlushEvictionQ(
       nsRefPtrHashtable<nsGenericHashKey<nsHostKey>, nsHostRecord>& aDB,
       const MutexAutoLock& aProofOfLock);
@@ -60,10 +64,13 @@ class HostRecordQueue final {
  private:
   Atomic<uint32_t> mPendingCount{0};
   Atomic<uint32_t> mEvictionQSize{0};
+  Atomic<uint32_t> mNegativeQSize{0};
   LinkedList<RefPtr<nsHostRecord>> mHighQ;
   LinkedList<RefPtr<nsHostRecord>> mMediumQ;
   LinkedList<RefPtr<nsHostRecord>> mLowQ;
   LinkedList<RefPtr<nsHostRecord>> mEvictionQ;
+  // Resolved records that are negative, bounded separately from mEvictionQ.
+  LinkedList<RefPtr<nsHostRecord>> mNegativeQ;
 };
 
 }  // namespace net
@@ -167,6 +167,15 @@ AddrHostRecord::~AddrHostRecord() {
   glean::dns::blocklist_count.AccumulateSingleSample(mUnusableCount);
 }
 
+// static
+already_AddRefed<AddrHostRecord> AddrHostRecord::CreateForTesting(
+    const nsHostKey& aKey, bool aNegative) {
+  RefPtr<AddrHostRecord> rec = new AddrHostRecord(aKey);
+  rec->negative = aNegative;
+  rec->SetExpiration(TimeStamp::NowLoRes(), 60, 0);
+  return rec.forget();
+}
+
 bool AddrHostRecord::Blocklisted(const NetAddr* aQuery) {
   addr_info_lock.AssertCurrentThreadOwns();
   LOG(("Checking unusable list for host [%s], host record [%p].\n", host.get(),
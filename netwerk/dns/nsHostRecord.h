@@ -307,6 +307,11 @@ class AddrHostRecord final : public nsHostRecord {
   nsresult GetTtl(uint32_t* aResult);
   nsresult GetLastUpdate(mozilla::TimeStamp* aLastUpdate);
 
+  // For tests. Returns a record for aKey as a lookup that just finished
+  // leaves it, which failed if aNegative is true.
+  static already_AddRefed<AddrHostRecord> CreateForTesting(
+      const nsHostKey& aKey, bool aNegative);
+
  private:
   friend class nsHostResolver;
   friend class mozilla::net::HostRecordQueue;
@@ -63,23 +63,23 @@
 using namespace mozilla;
 using namespace mozilla::net;
 
-// None of our implementations expose a TTL for negative responses, so we use a
-// constant always.
-static const unsigned int NEGATIVE_RECORD_LIFETIME = 60;
-
 //----------------------------------------------------------------------------
 
 // Use a persistent thread pool in order to avoid spinning up new threads all
 // the time. In particular, thread creation results in a res_init() call from
 // libc which is quite expensive.
 //
-// The pool dynamically grows between 0 and MaxResolverThreads() in size. New
-// requests go first to an idle thread. If that cannot be found and there are
-// fewer than MaxResolverThreads() currently in the pool a new thread is created
-// for high priority requests. If the new request is at a lower priority a new
-// thread will only be created if there are fewer than
-// MaxResolverThreadsAnyPriority() currently outstanding. If a thread cannot be
-// created or an idle thread located for the request it is queued.
+// The pool dynamically grows between 0 and MaxResolverPoolThreads() in size.
+// New requests go first to an idle thread. If that cannot be found and there
+// are fewer than ResolverThreadsHighPriority() currently in the pool a new
+// thread is created for high priority requests. If the new request is at a
+// lower priority a new thread will only be created if there are fewer than
+// ResolverThreadsAnyPriority() currently outstanding, which is
+// MaxResolverThreadsAnyPriority() plus up to
+// MaxResolverThreadsExtraAnyPriority() more while lookups are queued. The high
+// priority bound stays MaxResolverThreadsHighPriority() above that. If a
+// thread cannot be created or an idle thread located for the request it is
+// queued.
 //
 // When the pool is greater than MaxResolverThreadsAnyPriority() in size a
 // thread will be destroyed after ShortIdleTimeoutSeconds of idle time. Smaller
@@ -87,7 +87,7 @@ static const unsigned int NEGATIVE_RECORD_LIFETIME = 60;
 
 // for threads 1 -> MaxResolverThreadsAnyPriority()
 #define LongIdleTimeoutSeconds 300
-// for threads MaxResolverThreadsAnyPriority() + 1 -> MaxResolverThreads()
+// for threads MaxResolverThreadsAnyPriority() + 1 -> MaxResolverPoolThreads()
 #define ShortIdleTimeoutSeconds 60
 
 using namespace mozilla;
@@ -226,7 +226,7 @@ nsresult nsHostResolver::Init() MOZ_NO_THREAD_SAFETY_ANALYSIS {
   // wait for events logic as the pool offers, maybe we could simplify this
   // a bit, see bug 1478732 for a previous attempt.
   nsCOMPtr<nsIThreadPool> threadPool = new nsThreadPool();
-  MOZ_ALWAYS_SUCCEEDS(threadPool->SetThreadLimit(MaxResolverThreads()));
+  MOZ_ALWAYS_SUCCEEDS(threadPool->SetThreadLimit(MaxResolverPoolThreads()));
   MOZ_ALWAYS_SUCCEEDS(threadPool->SetIdleThreadLimit(
       std::max(MaxResolverThreads() / 4, (uint32_t)1)));
   MOZ_ALWAYS_SUCCEEDS(threadPool->SetIdleThreadMaximumTimeout(poolTimeoutMs));
@@ -873,9 +873,11 @@ nsresult nsHostResolver::ConditionallyCreateThread(nsHostRecord* rec) {
   if (mNumIdleTasks) {
     // wake up idle tasks to process this lookup
     mIdleTaskCV.Notify();
-  } else if ((mActiveTaskCount < MaxResolverThreadsAnyPriority()) ||
+  } else if ((mActiveTaskCount <
+              ResolverThreadsAnyPriority(mQueue.PendingCount())) ||
              (IsHighPriority(rec->flags) &&
-              mActiveTaskCount < MaxResolverThreads())) {
+              mActiveTaskCount <
+                  ResolverThreadsHighPriority(mQueue.PendingCount()))) {
     nsCOMPtr<nsIRunnable> event = mozilla::NewRunnableMethod(
         "nsHostResolver::ThreadFunc", this, &nsHostResolver::ThreadFunc);
     mActiveTaskCount++;
@@ -1275,7 +1277,8 @@ bool nsHostResolver::GetHostToLookup(nsHostRecord** result) {
       return true;
     }
 
-    if (mActiveAnyThreadCount < MaxResolverThreadsAnyPriority()) {
+    if (mActiveAnyThreadCount <
+        ResolverThreadsAnyPriority(mQueue.PendingCount())) {
       rec = mQueue.Dequeue(false, lock);
       if (rec) {
         MOZ_ASSERT(IsMediumPriority(rec->flags) || IsLowPriority(rec->flags));
@@ -1326,9 +1329,10 @@ void nsHostResolver::PrepareRecordExpirationAddrRecord(
   MOZ_ASSERT(((bool)rec->addr_info) != rec->negative);
   mLock.AssertCurrentThreadOwns();
   if (!rec->addr_info) {
-    rec->SetExpiration(TimeStamp::NowLoRes(), NEGATIVE_RECORD_LIFETIME, 0);
+    uint32_t lifetime = StaticPrefs::network_dns_negative_ttl_for_addr_record();
+    rec->SetExpiration(TimeStamp::NowLoRes(), lifetime, 0);
     LOG(("Caching host [%s] negative record for %u seconds.\n", rec->host.get(),
-         NEGATIVE_RECORD_LIFETIME));
+         lifetime));
     return;
   }
 
@@ -1380,8 +1384,9 @@ static bool different_rrset(AddrInfo* rrset1, AddrInfo* rrset2) {
 
 void nsHostResolver::AddToEvictionQ(nsHostRecord* rec,
                                     const MutexAutoLock& aLock) {
-  mQueue.AddToEvictionQ(rec, StaticPrefs::network_dnsCacheEntries(), mRecordDB,
-                        aLock);
+  mQueue.AddToEvictionQ(rec, StaticPrefs::network_dnsCacheEntries(),
+                        StaticPrefs::network_dns_negative_cache_entries(),
+                        mRecordDB, aLock);
 }
 
 // After a first lookup attempt with TRR in mode 2, we may:
@@ -6,6 +6,8 @@
 #ifndef nsHostResolver_h__
 #define nsHostResolver_h__
 
+#include <algorithm>
+
 #include "nscore.h"
 #include "prnetdb.h"
 #include "PLDHashTable.h"
@@ -42,10 +44,36 @@ static inline uint32_t MaxResolverThreadsHighPriority() {
   return StaticPrefs::network_dns_max_high_priority_threads();
 }
 
+static inline uint32_t MaxResolverThreadsExtraAnyPriority() {
+  return StaticPrefs::network_dns_max_extra_any_priority_threads();
+}
+
 static inline uint32_t MaxResolverThreads() {
   return MaxResolverThreadsAnyPriority() + MaxResolverThreadsHighPriority();
 }
 
+// The number of threads medium and low priority lookups may use, which grows
+// with the number of lookups waiting for a thread.
+static inline uint32_t ResolverThreadsAnyPriority(uint32_t aPendingCount) {
+  uint32_t perThread =
+      std::max(StaticPrefs::network_dns_queued_lookups_per_extra_thread(), 1u);
+  return MaxResolverThreadsAnyPriority() +
+         std::min(MaxResolverThreadsExtraAnyPriority(),
+                  aPendingCount / perThread);
+}
+
+// The number of threads high priority lookups may use, which keeps the same
+// headroom above the medium and low priority ones when those grow.
+static inline uint32_t ResolverThreadsHighPriority(uint32_t aPendingCount) {
+  return ResolverThreadsAnyPriority(aPendingCount) +
+         MaxResolverThreadsHighPriority();
+}
+
+// The hard limit of the resolver thread pool.
+static inline uint32_t MaxResolverPoolThreads() {
+  return MaxResolverThreads() + MaxResolverThreadsExtraAnyPriority();
+}
+
 }  // namespace net
 }  // namespace mozilla
 
@@ -16,6 +16,7 @@
 #include "Http2Compression.h"
 #include "Http2HuffmanIncoming.h"
 #include "Http2HuffmanOutgoing.h"
+#include "mozilla/HashFunctions.h"
 #include "mozilla/StaticPtr.h"
 #include "mozilla/glean/NetwerkProtocolHttpMetrics.h"
 #include "nsCharSeparatedTokenizer.h"
@@ -187,14 +188,14 @@ nvFIFO::nvFIFO() { InitializeStaticHeaders(); }
 
 nvFIFO::~nvFIFO() { Clear(); }
 
-void nvFIFO::AddElement(const nsCString& name, const nsCString& value) {
+void nvFIFO::AddElement(const nsACString& name, const nsACString& value) {
   nvPair* pair = new nvPair(name, value);
   mByteCount += pair->Size();
   MutexAutoLock lock(mMutex);
   mTable.PushFront(pair);
 }
 
-void nvFIFO::AddElement(const nsCString& name) { AddElement(name, ""_ns); }
+void nvFIFO::AddElement(const nsACString& name) { AddElement(name, ""_ns); }
 
 void nvFIFO::RemoveElement() {
   nvPair* pair = nullptr;
@@ -1070,6 +1071,10 @@ nsresult Http2Compressor::EncodeHeaderBlock(
   mSetInitialMaxBufferSizeAllowed = false;
   mOutput = &output;
   output.Truncate();
+  // The encoded block is rarely larger than its HTTP/1 form, so reserve that
+  // once instead of growing the output header by header.
+  output.SetCapacity(nvInput.Length() + method.Length() + path.Length() +
+                     host.Length() + scheme.Length() + protocol.Length());
   mParsedContentLength = -1;
 
   bool isWebsocket = (!simpleConnectForm && !protocol.IsEmpty());
@@ -1085,16 +1090,16 @@ nsresult Http2Compressor::EncodeHeaderBlock(
 
   // colon headers first
   if (!simpleConnectForm) {
-    ProcessHeader(nvPair(":method"_ns, method), false, false);
-    ProcessHeader(nvPair(":path"_ns, path), true, false);
-    ProcessHeader(nvPair(":authority"_ns, host), false, false);
-    ProcessHeader(nvPair(":scheme"_ns, scheme), false, false);
+    ProcessHeader(":method"_ns, method, false, false);
+    ProcessHeader(":path"_ns, path, true, false);
+    ProcessHeader(":authority"_ns, host, false, false);
+    ProcessHeader(":scheme"_ns, scheme, false, false);
     if (isWebsocket) {
-      ProcessHeader(nvPair(":protocol"_ns, protocol), false, false);
+      ProcessHeader(":protocol"_ns, protocol, false, false);
     }
   } else {
-    ProcessHeader(nvPair(":method"_ns, method), false, false);
-    ProcessHeader(nvPair(":authority"_ns, host), false, false);
+    ProcessHeader(":method"_ns, method, false, false);
+    ProcessHeader(":authority"_ns, host, false, false);
   }
 
   // now the non colon headers
@@ -1166,7 +1171,8 @@ nsresult Http2Compressor::EncodeHeaderBlock(
     }
 
     if (name.EqualsLiteral("cookie")) {
-      // cookie crumbling
+      // cookie crumbling (RFC 7540 section 8.1.2.5), so that the crumbs
+      // that do not change between requests can be sent as an index
       bool haveMoreCookies = true;
       int32_t nextCookie = valueIndex;
       while (haveMoreCookies) {
@@ -1179,13 +1185,14 @@ nsresult Http2Compressor::EncodeHeaderBlock(
         nsDependentCSubstring cookie =
             Substring(beginBuffer + nextCookie, beginBuffer + semiSpaceIndex);
         // cookies less than 20 bytes are not indexed
-        ProcessHeader(nvPair(name, cookie), false, cookie.Length() < 20);
+        if (!cookie.IsEmpty()) {
+          ProcessHeader(name, cookie, false, cookie.Length() < 20);
+        }
         nextCookie = semiSpaceIndex + 2;
       }
     } else {
       // allow indexing of every non-cookie except authorization
-      ProcessHeader(nvPair(name, value), false,
-                    name.EqualsLiteral("authorization"));
+      ProcessHeader(name, value, false, name.EqualsLiteral("authorization"));
     }
   }
 
@@ -1195,9 +1202,7 @@ nsresult Http2Compressor::EncodeHeaderBlock(
   // breakage just to add one header only to h2 connections.
   if (addTEHeader && !simpleConnectForm && !isWebsocket) {
     // Add in TE: trailers for regular requests
-    nsAutoCString te("te");
-    nsAutoCString trailers("trailers");
-    ProcessHeader(nvPair(te, trailers), false, false);
+    ProcessHeader("te"_ns, "trailers"_ns, false, false);
   }
 
   mOutput = nullptr;
@@ -1206,7 +1211,8 @@ nsresult Http2Compressor::EncodeHeaderBlock(
 }
 
 void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
-                               const class nvPair* pair, uint32_t index) {
+                               const nsACString& name, const nsACString& value,
+                               uint32_t index) {
   // start Byte needs to be calculated from the offset after
   // the opcode has been written out in case the output stream
   // buffer gets resized/relocated
@@ -1218,7 +1224,8 @@ void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
       LOG(
           ("HTTP compressor %p neverindex literal with name reference %u %s "
            "%s\n",
-           this, index, pair->mName.get(), pair->mValue.get()));
+           this, index, PromiseFlatCString(name).get(),
+           PromiseFlatCString(value).get()));
 
       // In this case, the index will have already been adjusted to be 1-based
       // instead of 0-based.
@@ -1228,15 +1235,16 @@ void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
       *startByte = (*startByte & 0x0f) | 0x10;
 
       if (!index) {
-        HuffmanAppend(pair->mName);
+        StringAppend(name);
       }
 
-      HuffmanAppend(pair->mValue);
+      StringAppend(value);
       break;
 
     case kPlainLiteral:
       LOG(("HTTP compressor %p noindex literal with name reference %u %s %s\n",
-           this, index, pair->mName.get(), pair->mValue.get()));
+           this, index, PromiseFlatCString(name).get(),
+           PromiseFlatCString(value).get()));
 
       // In this case, the index will have already been adjusted to be 1-based
       // instead of 0-based.
@@ -1246,15 +1254,16 @@ void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
       *startByte = *startByte & 0x0f;
 
       if (!index) {
-        HuffmanAppend(pair->mName);
+        StringAppend(name);
       }
 
-      HuffmanAppend(pair->mValue);
+      StringAppend(value);
       break;
 
     case kIndexedLiteral:
       LOG(("HTTP compressor %p literal with name reference %u %s %s\n", this,
-           index, pair->mName.get(), pair->mValue.get()));
+           index, PromiseFlatCString(name).get(),
+           PromiseFlatCString(value).get()));
 
       // In this case, the index will have already been adjusted to be 1-based
       // instead of 0-based.
@@ -1264,15 +1273,15 @@ void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
       *startByte = (*startByte & 0x3f) | 0x40;
 
       if (!index) {
-        HuffmanAppend(pair->mName);
+        StringAppend(name);
       }
 
-      HuffmanAppend(pair->mValue);
+      StringAppend(value);
       break;
 
     case kIndex:
       LOG(("HTTP compressor %p index %u %s %s\n", this, index,
-           pair->mName.get(), pair->mValue.get()));
+           PromiseFlatCString(name).get(), PromiseFlatCString(value).get()));
       // NWGH - make this plain old index instead of index + 1
       // In this case, we are passed the raw 0-based C index, and need to
       // increment to make it 1-based and comply with the spec
@@ -1287,126 +1296,127 @@ void Http2Compressor::DoOutput(Http2Compressor::outputCode code,
 // writes the encoded integer onto the output
 void Http2Compressor::EncodeInteger(uint32_t prefixLen, uint32_t val) {
   uint32_t mask = (1 << prefixLen) - 1;
-  uint8_t tmp;
+  // A 32 bit value needs at most 5 bytes on top of the prefix byte.
+  uint8_t buf[6];
+  uint32_t length = 0;
 
   if (val < mask) {
     // 1 byte encoding!
-    tmp = val;
-    mOutput->Append(reinterpret_cast<char*>(&tmp), 1);
+    buf[length++] = val;
+    mOutput->Append(reinterpret_cast<char*>(buf), length);
     return;
   }
 
   if (mask) {
     val -= mask;
-    tmp = mask;
-    mOutput->Append(reinterpret_cast<char*>(&tmp), 1);
+    buf[length++] = mask;
   }
 
   uint32_t q, r;
   do {
     q = val / 128;
     r = val % 128;
-    tmp = r;
+    buf[length] = r;
     if (q) {
-      tmp |= 0x80;  // chain bit
+      buf[length] |= 0x80;  // chain bit
     }
+    ++length;
     val = q;
-    mOutput->Append(reinterpret_cast<char*>(&tmp), 1);
   } while (q);
+
+  mOutput->Append(reinterpret_cast<char*>(buf), length);
 }
 
-void Http2Compressor::HuffmanAppend(const nsCString& value) {
-  nsAutoCString buf;
-  uint8_t bitsLeft = 8;
+// writes the string literal onto the output, huffman encoded when that makes
+// it shorter
+void Http2Compressor::StringAppend(const nsACString& value) {
   uint32_t length = value.Length();
-  uint32_t offset;
-  uint8_t* startByte;
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(value.BeginReading());
 
+  uint64_t huffBits = 0;
   for (uint32_t i = 0; i < length; ++i) {
-    uint8_t idx = static_cast<uint8_t>(value[i]);
-    uint8_t huffLength = HuffmanOutgoing[idx].mLength;
-    uint32_t huffValue = HuffmanOutgoing[idx].mValue;
-
-    if (bitsLeft < 8) {
-      // Fill in the least significant <bitsLeft> bits of the previous byte
-      // first
-      uint32_t val;
-      if (huffLength >= bitsLeft) {
-        val = huffValue & ~((1 << (huffLength - bitsLeft)) - 1);
-        val >>= (huffLength - bitsLeft);
-      } else {
-        val = huffValue << (bitsLeft - huffLength);
-      }
-      val &= ((1 << bitsLeft) - 1);
-      offset = buf.Length() - 1;
-      startByte = reinterpret_cast<unsigned char*>(buf.BeginWriting()) + offset;
-      *startByte = *startByte | static_cast<uint8_t>(val & 0xFF);
-      if (huffLength >= bitsLeft) {
-        huffLength -= bitsLeft;
-        bitsLeft = 8;
-      } else {
-        bitsLeft -= huffLength;
-        huffLength = 0;
-      }
-    }
+    huffBits += HuffmanOutgoing[data[i]].mLength;
+  }
+  uint32_t huffLength = static_cast<uint32_t>((huffBits + 7) / 8);
 
-    while (huffLength >= 8) {
-      uint32_t mask = ~((1 << (huffLength - 8)) - 1);
-      uint8_t val = ((huffValue & mask) >> (huffLength - 8)) & 0xFF;
-      buf.Append(reinterpret_cast<char*>(&val), 1);
-      huffLength -= 8;
-    }
+  // Strings with many rarely used characters, raw non-ASCII bytes in
+  // particular, get longer when huffman encoded. Send those as they are.
+  if (huffLength >= length) {
+    EncodeInteger(7, length);  // 0 1 bit prefix
+    mOutput->Append(value);
+    LOG(("Http2Compressor::StringAppend %p sent %u bytes unencoded.\n", this,
+         length));
+    return;
+  }
+
+  uint32_t offset = mOutput->Length();
+  EncodeInteger(7, huffLength);
+  uint8_t* startByte =
+      reinterpret_cast<unsigned char*>(mOutput->BeginWriting()) + offset;
+  *startByte = *startByte | 0x80;  // 1 1 bit prefix
 
-    if (huffLength) {
-      // Fill in the most significant <huffLength> bits of the next byte
-      bitsLeft = 8 - huffLength;
-      uint8_t val = (huffValue & ((1 << huffLength) - 1)) << bitsLeft;
-      buf.Append(reinterpret_cast<char*>(&val), 1);
+  // Now that we know how long the encoded string is, encode it right into the
+  // output. Codes are at most 30 bits long and fewer than 8 bits are left over
+  // from the previous ones, so the pending bits always fit in 64.
+  offset = mOutput->Length();
+  mOutput->SetLength(offset + huffLength);
+  uint8_t* out = reinterpret_cast<uint8_t*>(mOutput->BeginWriting()) + offset;
+  uint64_t bits = 0;
+  uint32_t bitCount = 0;
+  for (uint32_t i = 0; i < length; ++i) {
+    const HuffmanOutgoingEntry& entry = HuffmanOutgoing[data[i]];
+    bits = (bits << entry.mLength) | entry.mValue;
+    bitCount += entry.mLength;
+    while (bitCount >= 8) {
+      bitCount -= 8;
+      *out++ = static_cast<uint8_t>(bits >> bitCount);
     }
   }
 
-  if (bitsLeft != 8) {
-    // Pad the last <bitsLeft> bits with ones, which corresponds to the EOS
-    // encoding
-    uint8_t val = (1 << bitsLeft) - 1;
-    offset = buf.Length() - 1;
-    startByte = reinterpret_cast<unsigned char*>(buf.BeginWriting()) + offset;
-    *startByte = *startByte | val;
+  if (bitCount) {
+    // Pad the last bits with ones, which corresponds to the EOS encoding
+    uint8_t padding = 8 - bitCount;
+    *out++ = static_cast<uint8_t>((bits << padding) | ((1 << padding) - 1));
   }
+  MOZ_ASSERT(out == reinterpret_cast<uint8_t*>(mOutput->BeginWriting()) +
+                        mOutput->Length());
 
-  // Now we know how long our encoded string is, we can fill in our length
-  uint32_t bufLength = buf.Length();
-  offset = mOutput->Length();
-  EncodeInteger(7, bufLength);
-  startByte =
-      reinterpret_cast<unsigned char*>(mOutput->BeginWriting()) + offset;
-  *startByte = *startByte | 0x80;
-
-  // Finally, we can add our REAL data!
-  mOutput->Append(buf);
   LOG(
-      ("Http2Compressor::HuffmanAppend %p encoded %d byte original on %d "
+      ("Http2Compressor::StringAppend %p encoded %u byte original on %u "
        "bytes.\n",
-       this, length, bufLength));
+       this, length, huffLength));
+}
+
+bool Http2Compressor::SeenRecently(const nsACString& name,
+                                   const nsACString& value) {
+  HashNumber hash =
+      AddToHash(HashString(name.BeginReading(), name.Length()),
+                HashString(value.BeginReading(), value.Length()));
+  uint32_t& slot = mRecentHeaders[hash % kRecentHeaders];
+  bool seen = slot == hash;
+  slot = hash;
+  return seen;
 }
 
-void Http2Compressor::ProcessHeader(const nvPair inputPair, bool noLocalIndex,
+void Http2Compressor::ProcessHeader(const nsACString& name,
+                                    const nsACString& value, bool noLocalIndex,
                                     bool neverIndex) {
-  uint32_t newSize = inputPair.Size();
+  // Same as nvPair::Size()
+  uint32_t newSize = name.Length() + value.Length() + 32;
   uint32_t headerTableSize = mHeaderTable.Length();
   uint32_t matchedIndex = 0u;
   uint32_t nameReference = 0u;
   bool match = false;
 
-  LOG(("Http2Compressor::ProcessHeader %s %s", inputPair.mName.get(),
-       inputPair.mValue.get()));
+  LOG(("Http2Compressor::ProcessHeader %s %s", PromiseFlatCString(name).get(),
+       PromiseFlatCString(value).get()));
 
   // NWGH - make this index = 1; index <= headerTableSize; ++index
   for (uint32_t index = 0; index < headerTableSize; ++index) {
-    if (mHeaderTable[index]->mName.Equals(inputPair.mName)) {
+    if (mHeaderTable[index]->mName.Equals(name)) {
       // NWGH - make this nameReference = index
       nameReference = index + 1;
-      if (mHeaderTable[index]->mValue.Equals(inputPair.mValue)) {
+      if (mHeaderTable[index]->mValue.Equals(value)) {
         match = true;
         matchedIndex = index;
         break;
@@ -1417,13 +1427,22 @@ void Http2Compressor::ProcessHeader(const nvPair inputPair, bool noLocalIndex,
   // We need to emit a new literal
   if (!match || noLocalIndex || neverIndex) {
     if (neverIndex) {
-      DoOutput(kNeverIndexedLiteral, &inputPair, nameReference);
+      DoOutput(kNeverIndexedLiteral, name, value, nameReference);
       DumpState("Compressor state after literal never index");
       return;
     }
 
     if (noLocalIndex || (newSize > (mMaxBuffer / 2)) || (mMaxBuffer < 128)) {
-      DoOutput(kPlainLiteral, &inputPair, nameReference);
+      DoOutput(kPlainLiteral, name, value, nameReference);
+      DumpState("Compressor state after literal without index");
+      return;
+    }
+
+    // Large headers are often only sent once (a referer, a cookie set for
+    // one request), and indexing them would evict the entries that do get
+    // reused. Only index them once they turn out to recur.
+    if ((newSize > (mMaxBuffer / 8)) && !SeenRecently(name, value)) {
+      DoOutput(kPlainLiteral, name, value, nameReference);
       DumpState("Compressor state after literal without index");
       return;
     }
@@ -1431,16 +1450,16 @@ void Http2Compressor::ProcessHeader(const nvPair inputPair, bool noLocalIndex,
     // make sure to makeroom() first so that any implied items
     // get preserved.
     MakeRoom(newSize, "compressor");
-    DoOutput(kIndexedLiteral, &inputPair, nameReference);
+    DoOutput(kIndexedLiteral, name, value, nameReference);
 
-    mHeaderTable.AddElement(inputPair.mName, inputPair.mValue);
+    mHeaderTable.AddElement(name, value);
     LOG(("HTTP compressor %p new literal placed at index 0\n", this));
     DumpState("Compressor state after literal with index");
     return;
   }
 
   // emit an index
-  DoOutput(kIndex, &inputPair, matchedIndex);
+  DoOutput(kIndex, name, value, matchedIndex);
 
   DumpState("Compressor state after index");
 }
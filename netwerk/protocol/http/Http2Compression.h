@@ -38,8 +38,8 @@ class nvFIFO {
  public:
   nvFIFO();
   ~nvFIFO();
-  void AddElement(const nsCString& name, const nsCString& value);
-  void AddElement(const nsCString& name);
+  void AddElement(const nsACString& name, const nsACString& value);
+  void AddElement(const nsACString& name);
   void RemoveElement();
   uint32_t ByteCount() const;
   uint32_t Length() const;
@@ -178,17 +178,25 @@ class Http2Compressor final : public Http2BaseCompressor {
     kIndex
   };
 
-  void DoOutput(Http2Compressor::outputCode code, const class nvPair* pair,
-                uint32_t index);
+  void DoOutput(Http2Compressor::outputCode code, const nsACString& name,
+                const nsACString& value, uint32_t index);
   void EncodeInteger(uint32_t prefixLen, uint32_t val);
-  void ProcessHeader(const nvPair inputPair, bool noLocalIndex,
-                     bool neverIndex);
-  void HuffmanAppend(const nsCString& value);
+  void ProcessHeader(const nsACString& name, const nsACString& value,
+                     bool noLocalIndex, bool neverIndex);
+  void StringAppend(const nsACString& value);
   void EncodeTableSizeChange(uint32_t newMaxSize);
+  // Whether a large header with this name and value was recently sent as a
+  // literal on this connection. Remembers it for next time.
+  bool SeenRecently(const nsACString& name, const nsACString& value);
 
   int64_t mParsedContentLength{-1};
   bool mBufferSizeChangeWaiting{false};
   uint32_t mLowestBufferSizeWaiting{0};
+
+  // Hashes of the large headers recently sent as literals, see SeenRecently().
+  // Collisions only cost an indexing decision.
+  static const uint32_t kRecentHeaders = 256;
+  uint32_t mRecentHeaders[kRecentHeaders]{};
 };
 
 }  // namespace net
@@ -74,6 +74,23 @@ Http3Session::Http3Session() {
   mCurrentBrowserId = gHttpHandler->ConnMgr()->CurrentBrowserId();
 }
 
+static Http3BatchBuffers* sBatchBuffers = nullptr;
+
+// static
+already_AddRefed<Http3BatchBuffers> Http3BatchBuffers::Get() {
+  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  if (!sBatchBuffers) {
+    sBatchBuffers = new Http3BatchBuffers();
+  }
+  return do_AddRef(sBatchBuffers);
+}
+
+Http3BatchBuffers::~Http3BatchBuffers() {
+  MOZ_ASSERT(OnSocketThread(), "not on socket thread");
+  MOZ_ASSERT(sBatchBuffers == this);
+  sBatchBuffers = nullptr;
+}
+
 static nsresult RawBytesToNetAddr(uint16_t aFamily, const uint8_t* aRemoteAddr,
                                   uint16_t remotePort, NetAddr* netAddr) {
   if (aFamily == AF_INET) {
@@ -139,6 +156,11 @@ nsresult Http3Session::Init(const nsHttpConnectionInfo* aConnInfo,
           : 0;
 
   mUseNSPRForIO = StaticPrefs::network_http_http3_use_nspr_for_io();
+  mUseBatchIO =
+      mUseNSPRForIO && StaticPrefs::network_http_http3_batch_udp_io();
+  if (mUseBatchIO) {
+    mBatchBuffers = Http3BatchBuffers::Get();
+  }
 
   uint32_t idleTimeout =
       mConnInfo->GetIsTrrServiceChannel()
@@ -410,6 +432,10 @@ nsresult Http3Session::ProcessInput(nsIUDPSocket* socket) {
   LOG(("Http3Session::ProcessInput writer=%p [this=%p state=%d]",
        mUdpConn.get(), this, mState));
 
+  if (mUseBatchIO) {
+    return ProcessInputBatched(socket);
+  }
+
   if (mUseNSPRForIO) {
     while (true) {
       nsTArray<uint8_t> data;
@@ -449,6 +475,40 @@ nsresult Http3Session::ProcessInput(nsIUDPSocket* socket) {
   return NS_OK;
 }
 
+nsresult Http3Session::ProcessInputBatched(nsIUDPSocket* socket) {
+  UDPDatagramBatch& batch = mBatchBuffers->mRecvBatch;
+  nsTArray<uint8_t>& packet = mBatchBuffers->mRecvPacket;
+  // The buffers are shared with the other sessions; leave them empty.
+  auto clearBatch = MakeScopeExit([&] { batch.Clear(); });
+
+  while (true) {
+    nsresult rv = socket->RecvBatch(batch);
+    MOZ_ALWAYS_SUCCEEDS(rv);
+    if (NS_FAILED(rv) || batch.IsEmpty()) {
+      break;
+    }
+    LOG(("Http3Session::ProcessInputBatched received %u datagrams, %" PRIu64
+         " bytes",
+         batch.Length(), batch.TotalBytes()));
+    for (uint32_t i = 0; i < batch.Length(); ++i) {
+      Span<const uint8_t> data = batch.Data(i);
+      packet.ClearAndRetainStorage();
+      if (!packet.AppendElements(data.Elements(), data.Length(), fallible)) {
+        return NS_ERROR_OUT_OF_MEMORY;
+      }
+      rv = mHttp3Connection->ProcessInputUseNSPRForIO(batch.Addr(i), packet);
+      MOZ_ALWAYS_SUCCEEDS(rv);
+      if (NS_FAILED(rv)) {
+        return NS_OK;
+      }
+      // Like ProcessInput, count what neqo has processed, one datagram at a
+      // time, so that a failure part way through a batch is accounted for.
+      mTotalBytesRead += static_cast<int64_t>(data.Length());
+    }
+  }
+  return NS_OK;
+}
+
 nsresult Http3Session::ProcessTransactionRead(uint64_t stream_id) {
   RefPtr<Http3StreamBase> stream = mStreamIdHash.Get(stream_id);
   if (!stream) {
@@ -939,6 +999,10 @@ nsresult Http3Session::ProcessOutput(nsIUDPSocket* socket) {
   LOG(("Http3Session::ProcessOutput reader=%p, [this=%p]", mUdpConn.get(),
        this));
 
+  if (mUseBatchIO) {
+    return ProcessOutputBatched(socket);
+  }
+
   if (mUseNSPRForIO) {
     mSocket = socket;
     nsresult rv = mHttp3Connection->ProcessOutputAndSendUseNSPRForIO(
@@ -1008,6 +1072,72 @@ nsresult Http3Session::ProcessOutput(nsIUDPSocket* socket) {
   return NS_OK;
 }
 
+// Number of datagrams produced by neqo that are queued before being handed to
+// the socket. Bounds the memory used by the shared send batch.
+static const uint32_t kMaxQueuedDatagrams = 64;
+
+nsresult Http3Session::ProcessOutputBatched(nsIUDPSocket* socket) {
+  mSocket = socket;
+  nsresult rv = mHttp3Connection->ProcessOutputAndSendUseNSPRForIO(
+      this,
+      [](void* aContext, uint16_t aFamily, const uint8_t* aAddr,
+         uint16_t aPort, const uint8_t* aData, uint32_t aLength) {
+        Http3Session* self = (Http3Session*)aContext;
+
+        NetAddr addr;
+        if (NS_FAILED(RawBytesToNetAddr(aFamily, aAddr, aPort, &addr))) {
+          return NS_OK;
+        }
+        UDPDatagramBatch& batch = self->mBatchBuffers->mSendBatch;
+        if (!batch.Append(addr, aData, aLength)) {
+          return NS_ERROR_OUT_OF_MEMORY;
+        }
+        if (batch.Length() < kMaxQueuedDatagrams) {
+          return NS_OK;
+        }
+        return self->FlushSendBatch();
+      },
+      [](void* aContext, uint64_t timeout) {
+        Http3Session* self = (Http3Session*)aContext;
+        self->SetupTimer(timeout);
+      });
+  if (NS_SUCCEEDED(rv)) {
+    rv = FlushSendBatch();
+  }
+  // The batch is shared with the other sessions; leave it empty.
+  mBatchBuffers->mSendBatch.Clear();
+  mSocket = nullptr;
+  return rv;
+}
+
+nsresult Http3Session::FlushSendBatch() {
+  UDPDatagramBatch& batch = mBatchBuffers->mSendBatch;
+  if (batch.IsEmpty()) {
+    return NS_OK;
+  }
+
+  uint32_t count = batch.Length();
+  uint64_t written = 0;
+  nsresult rv = mSocket->SendBatch(batch, &written);
+  LOG3(("Http3Session::FlushSendBatch sent %u of %u datagrams, %" PRIu64
+        " bytes, rv=%" PRIx32 " [this=%p].",
+        count - batch.Length(), count, written,
+        static_cast<uint32_t>(rv), this));
+  if (NS_FAILED(rv)) {
+    mSocketError = rv;
+    // We do not need to set a timer, because we will close the connection.
+    return rv;
+  }
+  // Like ProcessOutput, drop what didn't fit in the socket buffer; QUIC
+  // loss recovery takes care of it.
+  batch.Clear();
+  if (written) {
+    mTotalBytesWritten += static_cast<int64_t>(written);
+    mLastWriteTime = PR_IntervalNow();
+  }
+  return NS_OK;
+}
+
 // This is only called when timer expires.
 // It is called by HttpConnectionUDP::OnQuicTimeout.
 // If tihs function returns an error OnQuicTimeout will handle the error
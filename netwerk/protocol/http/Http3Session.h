@@ -11,6 +11,7 @@
 #include "mozilla/UniquePtr.h"
 #include "mozilla/WeakPtr.h"
 #include "mozilla/net/NeqoHttp3Conn.h"
+#include "mozilla/net/UDPDatagramBatch.h"
 #include "nsAHttpConnection.h"
 #include "nsDeque.h"
 #include "nsISupportsImpl.h"
@@ -107,6 +108,26 @@ class QuicSocketControl;
 class Http3WebTransportSession;
 class Http3WebTransportStream;
 
+// The datagrams of a batched read or write only live for the duration of one
+// Http3Session::ProcessInputBatched or ProcessOutputBatched call, so all the
+// sessions of the socket thread share these buffers rather than each keeping
+// a few hundred KiB. They are freed once no session uses batched IO anymore.
+class Http3BatchBuffers final {
+ public:
+  NS_INLINE_DECL_REFCOUNTING(Http3BatchBuffers)
+
+  static already_AddRefed<Http3BatchBuffers> Get();
+
+  UDPDatagramBatch mRecvBatch;
+  UDPDatagramBatch mSendBatch;
+  // neqo takes each datagram as an array; this one is reused for all of them.
+  nsTArray<uint8_t> mRecvPacket;
+
+ private:
+  Http3BatchBuffers() = default;
+  ~Http3BatchBuffers();
+};
+
 // IID for the Http3Session interface
 #define NS_HTTP3SESSION_IID \
   {0x8fc82aaf, 0xc4ef, 0x46ed, {0x89, 0x41, 0x93, 0x95, 0x8f, 0xac, 0x4f, 0x21}}
@@ -244,6 +265,10 @@ class Http3Session final : public nsAHttpTransaction, public nsAHttpConnection {
 
   nsresult ProcessOutput(nsIUDPSocket* socket);
   nsresult ProcessInput(nsIUDPSocket* socket);
+  // The NSPR IO paths of the above when mUseBatchIO is set.
+  nsresult ProcessOutputBatched(nsIUDPSocket* socket);
+  nsresult ProcessInputBatched(nsIUDPSocket* socket);
+  nsresult FlushSendBatch();
   nsresult ProcessEvents();
 
   nsresult ProcessTransactionRead(uint64_t stream_id);
@@ -327,6 +352,11 @@ class Http3Session final : public nsAHttpTransaction, public nsAHttpConnection {
 
   // True if this http3 session uses NSPR for UDP IO.
   bool mUseNSPRForIO{true};
+  // True if, on top of that, datagrams are read and written in batches
+  // through nsIUDPSocket::RecvBatch/SendBatch.
+  bool mUseBatchIO{false};
+  // Set when mUseBatchIO is.
+  RefPtr<Http3BatchBuffers> mBatchBuffers;
 
   RefPtr<HttpConnectionUDP> mUdpConn;
 
@@ -0,0 +1,899 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "CacheFileIOManager.h"
+#include "CacheFileMetadata.h"
+#include "CacheFilePackStore.h"
+#include "CacheFileUtils.h"
+#include "CacheHashUtils.h"
+#include "CacheIndex.h"
+#include "CacheIOThread.h"
+#include "mozilla/Monitor.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/UniquePtr.h"
+#include "nsAppDirectoryServiceDefs.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsIDirectoryEnumerator.h"
+#include "nsIFile.h"
+#include "nsPrintfCString.h"
+#include "nsTArray.h"
+#include "nsThreadUtils.h"
+#include "prthread.h"
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+class AutoTempDir {
+ public:
+  AutoTempDir() {
+    MOZ_ALWAYS_SUCCEEDS(
+        NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(mDir)));
+    MOZ_ALWAYS_SUCCEEDS(mDir->AppendNative("TestCacheFilePackStore"_ns));
+    MOZ_ALWAYS_SUCCEEDS(mDir->CreateUnique(nsIFile::DIRECTORY_TYPE, 0700));
+  }
+  ~AutoTempDir() { mDir->Remove(true); }
+
+  nsIFile* Dir() const { return mDir; }
+
+  already_AddRefed<nsIFile> File(const nsACString& aName) const {
+    nsCOMPtr<nsIFile> file;
+    MOZ_ALWAYS_SUCCEEDS(mDir->Clone(getter_AddRefs(file)));
+    MOZ_ALWAYS_SUCCEEDS(file->AppendNative(aName));
+    return file.forget();
+  }
+
+  uint32_t FileCount() const {
+    nsCOMPtr<nsIDirectoryEnumerator> iter;
+    MOZ_ALWAYS_SUCCEEDS(mDir->GetDirectoryEntries(getter_AddRefs(iter)));
+    uint32_t count = 0;
+    nsCOMPtr<nsIFile> file;
+    while (NS_SUCCEEDED(iter->GetNextFile(getter_AddRefs(file))) && file) {
+      ++count;
+    }
+    iter->Close();
+    return count;
+  }
+
+ private:
+  nsCOMPtr<nsIFile> mDir;
+};
+
+struct TestHash {
+  SHA1Sum::Hash mValue;
+};
+
+TestHash MakeHash(uint32_t aIndex) {
+  SHA1Sum sum;
+  sum.update(&aIndex, sizeof(aIndex));
+  TestHash hash;
+  sum.finish(hash.mValue);
+  return hash;
+}
+
+// 1 to 4 KB of data that depends on aIndex and aVersion.
+nsTArray<uint8_t> MakeData(uint32_t aIndex, uint32_t aVersion = 0) {
+  uint32_t length = 1024 + (aIndex * 7919) % 3073;
+  nsTArray<uint8_t> data;
+  data.SetLength(length);
+  for (uint32_t i = 0; i < length; ++i) {
+    data[i] = static_cast<uint8_t>(aIndex + aVersion * 31 + i);
+  }
+  return data;
+}
+
+void ExpectData(CacheFilePackStore& aStore, uint32_t aIndex,
+                uint32_t aVersion = 0) {
+  nsTArray<uint8_t> data;
+  ASSERT_EQ(NS_OK, aStore.Read(MakeHash(aIndex).mValue, data));
+  ASSERT_EQ(MakeData(aIndex, aVersion), data);
+}
+
+}  // namespace
+
+TEST(TestCacheFilePackStore, PutReadRemove)
+{
+  AutoTempDir dir;
+  CacheFilePackStore store(dir.Dir());
+  ASSERT_EQ(NS_OK, store.Init());
+  ASSERT_EQ(0u, store.Count());
+
+  for (uint32_t i = 0; i < 100; ++i) {
+    ASSERT_EQ(NS_OK, store.Put(MakeHash(i).mValue, MakeData(i)));
+  }
+  ASSERT_EQ(100u, store.Count());
+
+  uint32_t length = 0;
+  ASSERT_TRUE(store.Contains(MakeHash(5).mValue, &length));
+  ASSERT_EQ(MakeData(5).Length(), length);
+  ASSERT_FALSE(store.Contains(MakeHash(100).mValue));
+
+  PRTime time = 0;
+  ASSERT_EQ(NS_OK, store.GetLastModifiedTime(MakeHash(5).mValue, &time));
+  ASSERT_LT(0, time);
+
+  for (uint32_t i = 0; i < 100; ++i) {
+    ExpectData(store, i);
+  }
+
+  // Replacing keeps the count and returns the new data.
+  ASSERT_EQ(NS_OK, store.Put(MakeHash(7).mValue, MakeData(7, 1)));
+  ASSERT_EQ(100u, store.Count());
+  ExpectData(store, 7, 1);
+
+  ASSERT_EQ(NS_OK, store.Remove(MakeHash(7).mValue));
+  ASSERT_EQ(NS_OK, store.Remove(MakeHash(7).mValue));
+  ASSERT_EQ(99u, store.Count());
+  nsTArray<uint8_t> data;
+  ASSERT_EQ(NS_ERROR_NOT_AVAILABLE, store.Read(MakeHash(7).mValue, data));
+
+  nsTArray<CacheFilePackStore::PackedHash> hashes;
+  store.GetHashes(hashes);
+  ASSERT_EQ(99u, hashes.Length());
+
+  ASSERT_EQ(NS_OK, store.RemoveAll());
+  ASSERT_EQ(0u, store.Count());
+  ASSERT_FALSE(store.Contains(MakeHash(5).mValue));
+}
+
+TEST(TestCacheFilePackStore, Reload)
+{
+  AutoTempDir dir;
+  {
+    CacheFilePackStore store(dir.Dir(), 64 * 1024);
+    ASSERT_EQ(NS_OK, store.Init());
+    for (uint32_t i = 0; i < 100; ++i) {
+      ASSERT_EQ(NS_OK, store.Put(MakeHash(i).mValue, MakeData(i)));
+    }
+    for (uint32_t i = 0; i < 100; i += 3) {
+      ASSERT_EQ(NS_OK, store.Remove(MakeHash(i).mValue));
+    }
+    ASSERT_EQ(NS_OK, store.Put(MakeHash(1).mValue, MakeData(1, 1)));
+  }
+
+  // An entry torn by a crash at the end of the last log is ignored.
+  {
+    nsCOMPtr<nsIFile> last;
+    for (uint32_t id = 1;; ++id) {
+      nsCOMPtr<nsIFile> log = dir.File(nsPrintfCString("%u.log", id));
+      bool exists = false;
+      log->Exists(&exists);
+      if (!exists) {
+        break;
+      }
+      last = log;
+    }
+    ASSERT_TRUE(last);
+
+    PRFileDesc* fd;
+    ASSERT_EQ(NS_OK, last->OpenNSPRFileDesc(PR_WRONLY | PR_APPEND, 0600, &fd));
+    const uint8_t kGarbage[50] = {1, 2, 3};
+    ASSERT_EQ(50, PR_Write(fd, kGarbage, sizeof(kGarbage)));
+    PR_Close(fd);
+  }
+
+  {
+    CacheFilePackStore store(dir.Dir(), 64 * 1024);
+    ASSERT_EQ(NS_OK, store.Init());
+    ASSERT_EQ(66u, store.Count());
+    for (uint32_t i = 0; i < 100; ++i) {
+      if (i % 3 == 0) {
+        ASSERT_FALSE(store.Contains(MakeHash(i).mValue));
+      } else {
+        ExpectData(store, i, i == 1 ? 1 : 0);
+      }
+    }
+
+    // The torn entry is overwritten by the next one.
+    ASSERT_EQ(NS_OK, store.Put(MakeHash(0).mValue, MakeData(0)));
+  }
+
+  CacheFilePackStore reloaded(dir.Dir(), 64 * 1024);
+  ASSERT_EQ(NS_OK, reloaded.Init());
+  ASSERT_EQ(67u, reloaded.Count());
+  ExpectData(reloaded, 0);
+}
+
+TEST(TestCacheFilePackStore, CorruptedData)
+{
+  AutoTempDir dir;
+  CacheFilePackStore store(dir.Dir());
+  ASSERT_EQ(NS_OK, store.Init());
+  ASSERT_EQ(NS_OK, store.Put(MakeHash(0).mValue, MakeData(0)));
+  ASSERT_EQ(NS_OK, store.Put(MakeHash(1).mValue, MakeData(1)));
+
+  // Overwrite the start of the first record.
+  nsCOMPtr<nsIFile> data = dir.File("1"_ns);
+  PRFileDesc* fd;
+  ASSERT_EQ(NS_OK, data->OpenNSPRFileDesc(PR_WRONLY, 0600, &fd));
+  const uint8_t kGarbage[16] = {0xff};
+  ASSERT_EQ(16, PR_Write(fd, kGarbage, sizeof(kGarbage)));
+  PR_Close(fd);
+
+  nsTArray<uint8_t> read;
+  ASSERT_EQ(NS_ERROR_FILE_CORRUPTED, store.Read(MakeHash(0).mValue, read));
+  ASSERT_FALSE(store.Contains(MakeHash(0).mValue));
+  ExpectData(store, 1);
+}
+
+TEST(TestCacheFilePackStore, Compaction)
+{
+  const uint32_t kSegmentSize = 32 * 1024;
+  const uint32_t kCount = 200;
+
+  AutoTempDir dir;
+  CacheFilePackStore store(dir.Dir(), kSegmentSize);
+  ASSERT_EQ(NS_OK, store.Init());
+
+  for (uint32_t i = 0; i < kCount; ++i) {
+    ASSERT_EQ(NS_OK, store.Put(MakeHash(i).mValue, MakeData(i)));
+  }
+  ASSERT_FALSE(store.NeedsCompaction());
+  uint32_t filesBefore = dir.FileCount();
+  ASSERT_LT(4u, filesBefore);
+
+  // Leave every fourth record.
+  for (uint32_t i = 0; i < kCount; ++i) {
+    if (i % 4) {
+      ASSERT_EQ(NS_OK, store.Remove(MakeHash(i).mValue));
+    }
+  }
+  ASSERT_TRUE(store.NeedsCompaction());
+
+  uint32_t steps = 0;
+  while (store.Compact()) {
+    ASSERT_GT(1000u, ++steps);
+  }
+  ASSERT_FALSE(store.NeedsCompaction());
+  ASSERT_GT(filesBefore, dir.FileCount());
+
+  ASSERT_EQ(kCount / 4, store.Count());
+  for (uint32_t i = 0; i < kCount; i += 4) {
+    ExpectData(store, i);
+  }
+
+  // The moved records keep their data across a reload.
+  CacheFilePackStore reloaded(dir.Dir(), kSegmentSize);
+  ASSERT_EQ(NS_OK, reloaded.Init());
+  ASSERT_EQ(kCount / 4, reloaded.Count());
+  for (uint32_t i = 0; i < kCount; i += 4) {
+    ExpectData(reloaded, i);
+  }
+}
+
+
+namespace {
+
+// Waits for the events dispatched to the cache IO thread so far.
+void SyncPackTestIOThread() {
+  RefPtr<CacheIOThread> thread = CacheFileIOManager::IOThread();
+  Monitor monitor("SyncPackTestIOThread");
+  bool done = false;
+  MOZ_ALWAYS_SUCCEEDS(thread->Dispatch(
+      NS_NewRunnableFunction("SyncPackTestIOThread",
+                             [&] {
+                               MonitorAutoLock lock(monitor);
+                               done = true;
+                               lock.Notify();
+                             }),
+      CacheIOThread::EVICT));
+
+  MonitorAutoLock lock(monitor);
+  while (!done) {
+    lock.Wait();
+  }
+}
+
+// Waits for one CacheFileIOManager operation, whose callback comes on the IO
+// thread.
+class PackTestListener final : public CacheFileIOListener {
+ public:
+  NS_DECL_THREADSAFE_ISUPPORTS
+
+  nsresult Wait() {
+    MonitorAutoLock lock(mMonitor);
+    while (!mDone) {
+      lock.Wait();
+    }
+    return mResult;
+  }
+
+  already_AddRefed<CacheFileHandle> TakeHandle() {
+    MonitorAutoLock lock(mMonitor);
+    return mHandle.forget();
+  }
+
+  NS_IMETHOD OnFileOpened(CacheFileHandle* aHandle, nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    mHandle = aHandle;
+    return Done(aResult, lock);
+  }
+  NS_IMETHOD OnDataWritten(CacheFileHandle* aHandle, const char* aBuf,
+                           nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    return Done(aResult, lock);
+  }
+  NS_IMETHOD OnDataRead(CacheFileHandle* aHandle, char* aBuf,
+                        nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    return Done(aResult, lock);
+  }
+  NS_IMETHOD OnFileDoomed(CacheFileHandle* aHandle, nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    return Done(aResult, lock);
+  }
+  NS_IMETHOD OnEOFSet(CacheFileHandle* aHandle, nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    return Done(aResult, lock);
+  }
+  NS_IMETHOD OnFileRenamed(CacheFileHandle* aHandle,
+                           nsresult aResult) override {
+    MonitorAutoLock lock(mMonitor);
+    return Done(aResult, lock);
+  }
+
+ private:
+  ~PackTestListener() = default;
+
+  nsresult Done(nsresult aResult, MonitorAutoLock& aLock) {
+    mResult = aResult;
+    mDone = true;
+    aLock.Notify();
+    return NS_OK;
+  }
+
+  Monitor mMonitor{"PackTestListener::mMonitor"};
+  bool mDone MOZ_GUARDED_BY(mMonitor) = false;
+  nsresult mResult MOZ_GUARDED_BY(mMonitor) = NS_OK;
+  RefPtr<CacheFileHandle> mHandle MOZ_GUARDED_BY(mMonitor);
+};
+
+NS_IMPL_ISUPPORTS(PackTestListener, CacheFileIOListener)
+
+const char* const kPackTestKeys[] = {":http://example.com/packed/0",
+                                     ":http://example.com/packed/1",
+                                     ":http://example.com/packed/2"};
+
+nsCString MakePackTestData(uint32_t aIndex, uint32_t aLength) {
+  nsCString data;
+  data.SetLength(aLength);
+  char* chars = data.BeginWriting();
+  for (uint32_t i = 0; i < aLength; ++i) {
+    chars[i] = char('a' + (aIndex * 7 + i) % 26);
+  }
+  return data;
+}
+
+}  // namespace
+
+// Runs CacheFileIOManager on a cache directory of its own, with packing
+// enabled, and drives it the way CacheFile does. "Restarting" shuts it down
+// and initializes it again on the same directory.
+class TestCacheFilePacking : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (CacheFileIOManager::IOThread()) {
+      GTEST_SKIP() << "The disk cache is already running";
+    }
+
+    ASSERT_EQ(NS_OK,
+              Preferences::SetBool("network.cache.pack_small_entries", true));
+    mDir = MakeUnique<AutoTempDir>();
+    Start();
+  }
+
+  void TearDown() override {
+    if (mStarted) {
+      Stop();
+    }
+    Preferences::ClearUser("network.cache.pack_small_entries");
+    mDir = nullptr;
+  }
+
+  void Start() {
+    ASSERT_EQ(NS_OK, CacheFileIOManager::InitForTesting(mDir->Dir()));
+    mStarted = true;
+  }
+
+  void Stop() {
+    SyncPackTestIOThread();
+    ASSERT_EQ(NS_OK, CacheFileIOManager::Shutdown());
+    mStarted = false;
+    // Let go of what the shut down instance left for the main thread.
+    NS_ProcessPendingEvents(nullptr);
+  }
+
+  void Restart() {
+    Stop();
+    Start();
+  }
+
+  static nsresult Open(const char* aKey, uint32_t aFlags,
+                       RefPtr<CacheFileHandle>& aHandle) {
+    RefPtr<PackTestListener> listener = new PackTestListener();
+    nsresult rv = CacheFileIOManager::OpenFile(nsDependentCString(aKey),
+                                               aFlags, listener);
+    if (NS_SUCCEEDED(rv)) {
+      rv = listener->Wait();
+    }
+    aHandle = listener->TakeHandle();
+    return rv;
+  }
+
+  static nsresult Write(CacheFileHandle* aHandle, int64_t aOffset,
+                        const nsACString& aData, bool aValidate) {
+    RefPtr<PackTestListener> listener = new PackTestListener();
+    nsresult rv = CacheFileIOManager::Write(aHandle, aOffset,
+                                            aData.BeginReading(),
+                                            aData.Length(), aValidate,
+                                            /* aTruncate */ false, listener);
+    return NS_SUCCEEDED(rv) ? listener->Wait() : rv;
+  }
+
+  static nsresult Read(CacheFileHandle* aHandle, int64_t aOffset,
+                       uint32_t aCount, nsACString& aData) {
+    aData.SetLength(aCount);
+    RefPtr<PackTestListener> listener = new PackTestListener();
+    nsresult rv = CacheFileIOManager::Read(aHandle, aOffset,
+                                           aData.BeginWriting(), aCount,
+                                           listener);
+    return NS_SUCCEEDED(rv) ? listener->Wait() : rv;
+  }
+
+  static nsresult Truncate(CacheFileHandle* aHandle, int64_t aLength) {
+    RefPtr<PackTestListener> listener = new PackTestListener();
+    nsresult rv = CacheFileIOManager::TruncateSeekSetEOF(aHandle, aLength,
+                                                         aLength, listener);
+    return NS_SUCCEEDED(rv) ? listener->Wait() : rv;
+  }
+
+  static nsresult Doom(CacheFileHandle* aHandle) {
+    RefPtr<PackTestListener> listener = new PackTestListener();
+    nsresult rv = CacheFileIOManager::DoomFile(aHandle, listener);
+    return NS_SUCCEEDED(rv) ? listener->Wait() : rv;
+  }
+
+  // Writes a complete entry, aData followed by its metadata, and closes it.
+  static void Create(const char* aKey, const nsACString& aData) {
+    RefPtr<CacheFileHandle> handle;
+    ASSERT_EQ(NS_OK, Open(aKey, CacheFileIOManager::CREATE, handle));
+    ASSERT_EQ(NS_OK,
+              CacheFileIOManager::InitIndexEntry(handle, 0, false, false));
+    ASSERT_EQ(NS_OK, Write(handle, 0, aData, /* aValidate */ false));
+    ASSERT_NO_FATAL_FAILURE(WriteMetadata(handle, aKey, aData, 0));
+
+    handle = nullptr;
+    SyncPackTestIOThread();
+  }
+
+  // Writes the metadata of an entry that holds aData after it, as CacheFile
+  // does once the data is written and again on every hit.
+  static void WriteMetadata(CacheFileHandle* aHandle, const char* aKey,
+                            const nsACString& aData, uint32_t aFetchCount) {
+    RefPtr<CacheFileUtils::CacheFileLock> lock =
+        new CacheFileUtils::CacheFileLock();
+    RefPtr<CacheFileMetadata> metadata = new CacheFileMetadata(
+        false, false, nsDependentCString(aKey), WrapNotNull(lock.get()));
+    metadata->SetHandle(aHandle);
+    CacheHash::Hash16_t hash =
+        CacheHash::Hash16(aData.BeginReading(), aData.Length());
+    {
+      MutexAutoLock guard(lock->Lock());
+      ASSERT_EQ(NS_OK, metadata->SetHash(0, hash));
+    }
+    for (uint32_t i = 0; i < aFetchCount; ++i) {
+      metadata->OnFetched();
+    }
+    ASSERT_EQ(NS_OK, metadata->WriteMetadata(aData.Length(), nullptr));
+  }
+
+  bool EntryFileExists(const char* aKey) const {
+    SHA1Sum sum;
+    sum.update(aKey, strlen(aKey));
+    SHA1Sum::Hash hash;
+    sum.finish(hash);
+
+    nsCOMPtr<nsIFile> file = mDir->File("entries"_ns);
+    MOZ_ALWAYS_SUCCEEDS(file->AppendNative(
+        nsPrintfCString("%08X%08X%08X%08X%08X", LOGSHA1(hash))));
+    bool exists = false;
+    MOZ_ALWAYS_SUCCEEDS(file->Exists(&exists));
+    return exists;
+  }
+
+  UniquePtr<AutoTempDir> mDir;
+  bool mStarted = false;
+};
+
+TEST_F(TestCacheFilePacking, PackOnCloseThenReopen)
+{
+  nsCString small = MakePackTestData(0, 2000);
+  nsCString large = MakePackTestData(1, 20000);
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[0], small));
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[1], large));
+
+  // Only the entry under network.cache.pack_entry_max_size left its file.
+  EXPECT_FALSE(EntryFileExists(kPackTestKeys[0]));
+  EXPECT_TRUE(EntryFileExists(kPackTestKeys[1]));
+
+  Restart();
+
+  RefPtr<CacheFileHandle> handle;
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  EXPECT_TRUE(handle->IsPacked());
+  EXPECT_FALSE(handle->FileExists());
+  EXPECT_LT(int64_t(small.Length()), handle->FileSize());
+
+  nsCString data;
+  ASSERT_EQ(NS_OK, Read(handle, 0, small.Length(), data));
+  EXPECT_TRUE(data.Equals(small));
+
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[1], CacheFileIOManager::OPEN, handle));
+  EXPECT_FALSE(handle->IsPacked());
+  ASSERT_EQ(NS_OK, Read(handle, 0, large.Length(), data));
+  EXPECT_TRUE(data.Equals(large));
+}
+
+TEST_F(TestCacheFilePacking, WriteAndTruncateUnpack)
+{
+  nsCString first = MakePackTestData(0, 3000);
+  nsCString second = MakePackTestData(1, 3000);
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[0], first));
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[1], second));
+
+  RefPtr<CacheFileHandle> handle;
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  ASSERT_TRUE(handle->IsPacked());
+
+  // A write goes to a file that has the packed data around it.
+  ASSERT_EQ(NS_OK, Write(handle, 10, "changed"_ns, /* aValidate */ false));
+  EXPECT_FALSE(handle->IsPacked());
+  EXPECT_TRUE(handle->FileExists());
+  EXPECT_TRUE(EntryFileExists(kPackTestKeys[0]));
+
+  nsCString expected(first);
+  expected.Replace(10, 7, "changed"_ns);
+  nsCString data;
+  ASSERT_EQ(NS_OK, Read(handle, 0, first.Length(), data));
+  EXPECT_TRUE(data.Equals(expected));
+
+  RefPtr<CacheFileHandle> truncated;
+  ASSERT_EQ(NS_OK,
+            Open(kPackTestKeys[1], CacheFileIOManager::OPEN, truncated));
+  ASSERT_TRUE(truncated->IsPacked());
+
+  // A truncation keeps only the start of the packed data.
+  ASSERT_EQ(NS_OK, Truncate(truncated, 1000));
+  EXPECT_FALSE(truncated->IsPacked());
+  EXPECT_TRUE(truncated->FileExists());
+  EXPECT_EQ(1000, truncated->FileSize());
+  ASSERT_EQ(NS_OK, Read(truncated, 0, 1000, data));
+  EXPECT_TRUE(data.Equals(Substring(second, 0, 1000)));
+
+  // The entries were left invalid and their files are removed on close. The
+  // records they were unpacked from don't come back.
+  handle = nullptr;
+  truncated = nullptr;
+  Restart();
+  EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+            Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+            Open(kPackTestKeys[1], CacheFileIOManager::OPEN, handle));
+}
+
+TEST_F(TestCacheFilePacking, HitKeepsEntryPacked)
+{
+  nsCString expected = MakePackTestData(0, 2000);
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[0], expected));
+
+  RefPtr<CacheFileHandle> handle;
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  ASSERT_TRUE(handle->IsPacked());
+
+  // The rewritten metadata goes to the record rather than to a file.
+  ASSERT_NO_FATAL_FAILURE(
+      WriteMetadata(handle, kPackTestKeys[0], expected, 2));
+  SyncPackTestIOThread();
+  EXPECT_TRUE(handle->IsPacked());
+  EXPECT_FALSE(handle->FileExists());
+  EXPECT_FALSE(EntryFileExists(kPackTestKeys[0]));
+
+  handle = nullptr;
+  Restart();
+
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  ASSERT_TRUE(handle->IsPacked());
+  nsCString data;
+  ASSERT_EQ(NS_OK, Read(handle, 0, uint32_t(handle->FileSize()), data));
+  EXPECT_TRUE(Substring(data, 0, expected.Length()).Equals(expected));
+
+  RefPtr<CacheFileMetadata> metadata = new CacheFileMetadata();
+  ASSERT_EQ(NS_OK, metadata->SyncReadMetadata(Span(
+                       reinterpret_cast<const uint8_t*>(data.BeginReading()),
+                       data.Length())));
+  EXPECT_EQ(2u, metadata->GetFetchCount());
+}
+
+TEST_F(TestCacheFilePacking, DoomWithLiveReader)
+{
+  nsCString expected = MakePackTestData(0, 2000);
+  ASSERT_NO_FATAL_FAILURE(Create(kPackTestKeys[0], expected));
+
+  RefPtr<CacheFileHandle> handle;
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  ASSERT_TRUE(handle->IsPacked());
+  ASSERT_EQ(NS_OK, Doom(handle));
+
+  // The entry is gone for new users, but the handle that was open still
+  // reads it.
+  RefPtr<CacheFileHandle> other;
+  EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+            Open(kPackTestKeys[0], CacheFileIOManager::OPEN, other));
+  nsCString data;
+  ASSERT_EQ(NS_OK, Read(handle, 0, expected.Length(), data));
+  EXPECT_TRUE(data.Equals(expected));
+
+  handle = nullptr;
+  Restart();
+  EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+            Open(kPackTestKeys[0], CacheFileIOManager::OPEN, other));
+}
+
+TEST_F(TestCacheFilePacking, EvictAll)
+{
+  for (uint32_t i = 0; i < std::size(kPackTestKeys); ++i) {
+    ASSERT_NO_FATAL_FAILURE(
+        Create(kPackTestKeys[i], MakePackTestData(i, 1000 + i * 500)));
+  }
+
+  ASSERT_EQ(NS_OK, CacheFileIOManager::EvictAll());
+  SyncPackTestIOThread();
+
+  RefPtr<CacheFileHandle> handle;
+  for (const char* key : kPackTestKeys) {
+    EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+              Open(key, CacheFileIOManager::OPEN, handle));
+  }
+
+  Restart();
+  for (const char* key : kPackTestKeys) {
+    EXPECT_EQ(NS_ERROR_NOT_AVAILABLE,
+              Open(key, CacheFileIOManager::OPEN, handle));
+  }
+
+  // Entries written afterwards are packed again.
+  ASSERT_NO_FATAL_FAILURE(
+      Create(kPackTestKeys[0], MakePackTestData(0, 1000)));
+  ASSERT_EQ(NS_OK, Open(kPackTestKeys[0], CacheFileIOManager::OPEN, handle));
+  EXPECT_TRUE(handle->IsPacked());
+}
+
+TEST_F(TestCacheFilePacking, IndexRebuildFindsPackedEntries)
+{
+  for (uint32_t i = 0; i < 2; ++i) {
+    ASSERT_NO_FATAL_FAILURE(
+        Create(kPackTestKeys[i], MakePackTestData(i, 1000 + i * 500)));
+  }
+
+  // Without an index file, the index is built from the entries directory and
+  // the pack store.
+  Stop();
+  for (const char* name : {"index", "index.log", "index.tmp"}) {
+    nsCOMPtr<nsIFile> file = mDir->File(nsDependentCString(name));
+    file->Remove(false);
+  }
+  Start();
+
+  bool upToDate = false;
+  for (uint32_t i = 0; i < 1000 && !upToDate; ++i) {
+    PR_Sleep(PR_MillisecondsToInterval(10));
+    ASSERT_EQ(NS_OK, CacheIndex::IsUpToDate(&upToDate));
+  }
+  ASSERT_TRUE(upToDate);
+
+  CacheIndex::EntryStatus status;
+  for (uint32_t i = 0; i < 2; ++i) {
+    ASSERT_EQ(NS_OK, CacheIndex::HasEntry(
+                         nsDependentCString(kPackTestKeys[i]), &status));
+    EXPECT_EQ(CacheIndex::EXISTS, status) << kPackTestKeys[i];
+  }
+  ASSERT_EQ(NS_OK, CacheIndex::HasEntry(
+                       nsDependentCString(kPackTestKeys[2]), &status));
+  EXPECT_EQ(CacheIndex::DOES_NOT_EXIST, status);
+}
+
+// Writing, reading back and removing the data of entries of 1 to 4 KB: as
+// packed records, as one file per entry like the disk cache does without the
+// pack store, and as CacheFileIOManager packs them, through a file that is
+// read back and removed once the entry is complete.
+template <uint32_t Entries>
+class PackStoreBench : public ::testing::Test {
+ protected:
+  static const uint32_t kEntries = Entries;
+  // Size of the metadata that a hit rewrites at the end of an entry.
+  static const uint32_t kMetadataSize = 200;
+
+  void SetUp() override {
+    mData.SetCapacity(kEntries);
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      mHashes.AppendElement(MakeHash(i));
+      mData.AppendElement(MakeData(i));
+    }
+  }
+
+  already_AddRefed<nsIFile> EntryFile(const AutoTempDir& aDir,
+                                      uint32_t aIndex) const {
+    return aDir.File(nsPrintfCString("%08X%08X%08X%08X%08X",
+                                     LOGSHA1(mHashes[aIndex].mValue)));
+  }
+
+  void WriteEntryFile(nsIFile* aFile, uint32_t aIndex) const {
+    PRFileDesc* fd;
+    ASSERT_EQ(NS_OK, aFile->OpenNSPRFileDesc(
+                         PR_RDWR | PR_CREATE_FILE | PR_TRUNCATE, 0600, &fd));
+    ASSERT_EQ(static_cast<int32_t>(mData[aIndex].Length()),
+              PR_Write(fd, mData[aIndex].Elements(), mData[aIndex].Length()));
+    PR_Close(fd);
+  }
+
+  static void ReadEntryFile(nsIFile* aFile, nsTArray<uint8_t>& aData) {
+    int64_t size;
+    ASSERT_EQ(NS_OK, aFile->GetFileSize(&size));
+    aData.SetLength(size);
+    PRFileDesc* fd;
+    ASSERT_EQ(NS_OK, aFile->OpenNSPRFileDesc(PR_RDONLY, 0600, &fd));
+    ASSERT_EQ(static_cast<int32_t>(size),
+              PR_Read(fd, aData.Elements(), aData.Length()));
+    PR_Close(fd);
+  }
+
+  void ReadAndRemovePacked(CacheFilePackStore& aStore) const {
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      ASSERT_EQ(NS_OK, aStore.Read(mHashes[i].mValue, data));
+      ASSERT_EQ(mData[i].Length(), data.Length());
+    }
+
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      ASSERT_EQ(NS_OK, aStore.Remove(mHashes[i].mValue));
+    }
+    while (aStore.Compact()) {
+    }
+  }
+
+  void PackStore() const {
+    AutoTempDir dir;
+    CacheFilePackStore store(dir.Dir());
+    ASSERT_EQ(NS_OK, store.Init());
+
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      ASSERT_EQ(NS_OK, store.Put(mHashes[i].mValue, mData[i]));
+    }
+
+    ReadAndRemovePacked(store);
+  }
+
+  void PackOnClose() const {
+    AutoTempDir dir;
+    CacheFilePackStore store(dir.File("packs"_ns));
+    ASSERT_EQ(NS_OK, store.Init());
+
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      nsCOMPtr<nsIFile> entry = EntryFile(dir, i);
+      WriteEntryFile(entry, i);
+      ReadEntryFile(entry, data);
+      ASSERT_EQ(NS_OK, store.Put(mHashes[i].mValue, data));
+      ASSERT_EQ(NS_OK, entry->Remove(false));
+    }
+
+    ReadAndRemovePacked(store);
+  }
+
+  void FilePerEntry() const {
+    AutoTempDir dir;
+
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      nsCOMPtr<nsIFile> entry = EntryFile(dir, i);
+      WriteEntryFile(entry, i);
+    }
+
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      nsCOMPtr<nsIFile> entry = EntryFile(dir, i);
+      ReadEntryFile(entry, data);
+      ASSERT_EQ(mData[i].Length(), data.Length());
+    }
+
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      nsCOMPtr<nsIFile> entry = EntryFile(dir, i);
+      ASSERT_EQ(NS_OK, entry->Remove(false));
+    }
+  }
+
+  nsTArray<TestHash> mHashes;
+  nsTArray<nsTArray<uint8_t>> mData;
+};
+
+using TestCacheFilePackStoreBench = PackStoreBench<10000>;
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench, PackStore,
+                  [this] { PackStore(); });
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench, PackOnClose,
+                  [this] { PackOnClose(); });
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench, FilePerEntry,
+                  [this] { FilePerEntry(); });
+
+// The same with 100k entries, which is what a full disk cache of small
+// entries has. Too slow for every run, run them with
+// --gtest_also_run_disabled_tests.
+using TestCacheFilePackStoreBench100k = PackStoreBench<100000>;
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench100k, DISABLED_PackStore,
+                  [this] { PackStore(); });
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench100k, DISABLED_PackOnClose,
+                  [this] { PackOnClose(); });
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreBench100k, DISABLED_FilePerEntry,
+                  [this] { FilePerEntry(); });
+
+// Hits on 10k entries that are already stored: the data is read and the
+// metadata at its end rewritten, once the fetch count has changed. Packed, the
+// record is read and put again; otherwise, the entry's file is opened, read,
+// and its end rewritten in place.
+class TestCacheFilePackStoreHitBench : public PackStoreBench<10000> {
+ protected:
+  void SetUp() override {
+    PackStoreBench::SetUp();
+    mStore = MakeUnique<CacheFilePackStore>(mDir.File("packs"_ns));
+    ASSERT_EQ(NS_OK, mStore->Init());
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      ASSERT_EQ(NS_OK, mStore->Put(mHashes[i].mValue, mData[i]));
+      nsCOMPtr<nsIFile> entry = EntryFile(mDir, i);
+      WriteEntryFile(entry, i);
+    }
+  }
+
+  void TearDown() override { mStore = nullptr; }
+
+  AutoTempDir mDir;
+  UniquePtr<CacheFilePackStore> mStore;
+};
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreHitBench, Packed, [this] {
+  nsTArray<uint8_t> data;
+  for (uint32_t i = 0; i < kEntries; ++i) {
+    ASSERT_EQ(NS_OK, mStore->Read(mHashes[i].mValue, data));
+    data[data.Length() - kMetadataSize]++;
+    ASSERT_EQ(NS_OK, mStore->Put(mHashes[i].mValue, data));
+  }
+  while (mStore->Compact()) {
+  }
+});
+
+MOZ_GTEST_BENCH_F(TestCacheFilePackStoreHitBench, FilePerEntry, [this] {
+  nsTArray<uint8_t> data;
+  for (uint32_t i = 0; i < kEntries; ++i) {
+    nsCOMPtr<nsIFile> entry = EntryFile(mDir, i);
+    PRFileDesc* fd;
+    ASSERT_EQ(NS_OK, entry->OpenNSPRFileDesc(PR_RDWR, 0600, &fd));
+    data.SetLength(mData[i].Length());
+    ASSERT_EQ(static_cast<int32_t>(data.Length()),
+              PR_Read(fd, data.Elements(), data.Length()));
+    int64_t offset = data.Length() - kMetadataSize;
+    data[offset]++;
+    ASSERT_EQ(offset, PR_Seek64(fd, offset, PR_SEEK_SET));
+    ASSERT_EQ(static_cast<int32_t>(kMetadataSize),
+              PR_Write(fd, data.Elements() + offset, kMetadataSize));
+    PR_Close(fd);
+  }
+});
@@ -0,0 +1,185 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <string.h>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "CacheIndexLookupTable.h"
+#include "mozilla/Atomics.h"
+#include "mozilla/Mutex.h"
+#include "nsHashKeys.h"
+#include "nsTArray.h"
+#include "nsTHashMap.h"
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+// Same values as CacheIndex::EntryStatus.
+const uint8_t kExists = 0;
+const uint8_t kDoesNotExist = 1;
+const uint8_t kDoNotKnow = 2;
+
+struct TestHash {
+  SHA1Sum::Hash mValue;
+};
+
+TestHash MakeHash(uint32_t aIndex) {
+  SHA1Sum sum;
+  sum.update(&aIndex, sizeof(aIndex));
+  TestHash hash;
+  sum.finish(hash.mValue);
+  return hash;
+}
+
+}  // namespace
+
+TEST(TestCacheIndexLookupTable, SetRemoveLookup)
+{
+  CacheIndexLookupTable table;
+  TestHash hash = MakeHash(0);
+  uint8_t status;
+
+  // Not usable until the absent status is set.
+  table.Set(hash.mValue, kExists);
+  ASSERT_FALSE(table.Lookup(hash.mValue, &status));
+  table.SetAbsentStatus(kDoesNotExist);
+  ASSERT_TRUE(table.Lookup(hash.mValue, &status));
+  ASSERT_EQ(kExists, status);
+
+  // Enough hashes to grow the table a few times.
+  const uint32_t kCount = 20000;
+  for (uint32_t i = 0; i < kCount; ++i) {
+    table.Set(MakeHash(i).mValue, i % 3 ? kExists : kDoNotKnow);
+  }
+  for (uint32_t i = 0; i < kCount; i += 2) {
+    table.Remove(MakeHash(i).mValue);
+  }
+  for (uint32_t i = 0; i < kCount; ++i) {
+    ASSERT_TRUE(table.Lookup(MakeHash(i).mValue, &status));
+    uint8_t expected = i % 2 ? (i % 3 ? kExists : kDoNotKnow) : kDoesNotExist;
+    ASSERT_EQ(expected, status);
+  }
+
+  // Updates happen in place.
+  table.Set(MakeHash(1).mValue, kDoesNotExist);
+  ASSERT_TRUE(table.Lookup(MakeHash(1).mValue, &status));
+  ASSERT_EQ(kDoesNotExist, status);
+
+  // The answer for absent hashes follows the index state.
+  table.SetAbsentStatus(kDoNotKnow);
+  ASSERT_TRUE(table.Lookup(MakeHash(kCount).mValue, &status));
+  ASSERT_EQ(kDoNotKnow, status);
+
+  table.Clear();
+  ASSERT_TRUE(table.Lookup(MakeHash(3).mValue, &status));
+  ASSERT_EQ(kDoNotKnow, status);
+
+  table.Shutdown();
+  ASSERT_FALSE(table.Lookup(MakeHash(3).mValue, &status));
+}
+
+// Lookups on several threads while another one keeps adding and removing
+// entries, like HasEntry() calls from the main thread and the cache2 consumers
+// while the IO thread updates the index.
+class TestCacheIndexLookupTableBench : public ::testing::Test {
+ protected:
+  static const uint32_t kEntries = 50000;
+  static const uint32_t kReaders = 3;
+  static const uint32_t kLookupsPerReader = 1000000;
+
+  void SetUp() override {
+    for (uint32_t i = 0; i < 2 * kEntries; ++i) {
+      mHashes.AppendElement(MakeHash(i));
+    }
+  }
+
+  // Runs the readers against aLookup while the writer applies aUpdate (which
+  // gets the index of a hash and whether to add or remove it) until they are
+  // done, keeping about two thirds of the hashes present. The writer makes
+  // its changes in runs under the lock, as the index does when it processes
+  // the journal or pending updates.
+  template <typename Lookup, typename Update>
+  void Run(Lookup&& aLookup, Update&& aUpdate) {
+    for (uint32_t i = 0; i < kEntries; ++i) {
+      aUpdate(i, true);
+    }
+
+    Atomic<bool> done{false};
+    std::thread writer([&] {
+      uint32_t next = 0;
+      while (!done) {
+        MutexAutoLock lock(mWriterLock);
+        for (uint32_t i = 0; i < 64; ++i, ++next) {
+          aUpdate(next % (2 * kEntries), next % 3 != 0);
+        }
+      }
+    });
+
+    nsTArray<std::thread> readers;
+    for (uint32_t r = 0; r < kReaders; ++r) {
+      readers.AppendElement(std::thread([&, r] {
+        uint32_t found = 0;
+        for (uint32_t i = 0; i < kLookupsPerReader; ++i) {
+          found += aLookup((i * 7919 + r) % (2 * kEntries)) == kExists;
+        }
+        EXPECT_LT(0u, found);
+      }));
+    }
+    for (std::thread& reader : readers) {
+      reader.join();
+    }
+    done = true;
+    writer.join();
+  }
+
+  nsTArray<TestHash> mHashes;
+  Mutex mWriterLock{"TestCacheIndexLookupTableBench.mWriterLock"};
+};
+
+MOZ_GTEST_BENCH_F(TestCacheIndexLookupTableBench, Lookups_LookupTable, [this] {
+  CacheIndexLookupTable table;
+  table.SetAbsentStatus(kDoesNotExist);
+  Run(
+      [&](uint32_t aIndex) {
+        uint8_t status = kDoNotKnow;
+        table.Lookup(mHashes[aIndex].mValue, &status);
+        return status;
+      },
+      [&](uint32_t aIndex, bool aAdd) {
+        if (aAdd) {
+          table.Set(mHashes[aIndex].mValue, kExists);
+        } else {
+          table.Remove(mHashes[aIndex].mValue);
+        }
+      });
+  table.Shutdown();
+});
+
+// The same with every lookup taking the writer's lock, as HasEntry() used to.
+MOZ_GTEST_BENCH_F(TestCacheIndexLookupTableBench, Lookups_Locked, [this] {
+  nsTHashMap<nsUint64HashKey, uint8_t> map;
+  auto key = [&](uint32_t aIndex) {
+    uint64_t key;
+    memcpy(&key, mHashes[aIndex].mValue, sizeof(key));
+    return key;
+  };
+  Run(
+      [&](uint32_t aIndex) {
+        MutexAutoLock lock(mWriterLock);
+        return map.MaybeGet(key(aIndex)).valueOr(kDoesNotExist);
+      },
+      [&](uint32_t aIndex, bool aAdd) {
+        if (aAdd) {
+          map.InsertOrUpdate(key(aIndex), kExists);
+        } else {
+          map.Remove(key(aIndex));
+        }
+      });
+});
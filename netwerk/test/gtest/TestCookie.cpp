@@ -1225,3 +1225,52 @@ TEST(TestCookie, MaxAgeParser)
   GetACookie(cookieService, "http://maxage.net/", cookieStr);
   EXPECT_TRUE(CheckResult(cookieStr.get(), MUST_EQUAL, ""));
 }
+
+// The cookies of a host are kept sorted between requests; the order has to
+// follow every cookie that is added, replaced or removed.
+TEST(TestCookie, SortedCookiesFollowChanges)
+{
+  nsresult rv;
+  nsCOMPtr<nsICookieManager> cookieMgr =
+      do_GetService(NS_COOKIEMANAGER_CONTRACTID, &rv);
+  ASSERT_NS_SUCCEEDED(rv);
+
+  EXPECT_NS_SUCCEEDED(cookieMgr->RemoveAll());
+
+  nsCOMPtr<nsICookieService> cookieService =
+      do_GetService(kCookieServiceCID, &rv);
+  ASSERT_NS_SUCCEEDED(rv);
+
+  nsCString cookie;
+  SetACookie(cookieService, "http://sorted.com/a/b/", "short=1; path=/");
+  SetACookie(cookieService, "http://sorted.com/a/b/", "long=1; path=/a/b");
+  SetACookie(cookieService, "http://sorted.com/a/b/", "older=1; path=/a");
+  SetACookie(cookieService, "http://sorted.com/a/b/", "newer=1; path=/a");
+  GetACookie(cookieService, "http://sorted.com/a/b/", cookie);
+  EXPECT_TRUE(CheckResult(cookie.get(), MUST_EQUAL,
+                          "long=1; older=1; newer=1; short=1"));
+
+  // Only the path filter changes for another path of the host.
+  GetACookie(cookieService, "http://sorted.com/a/", cookie);
+  EXPECT_TRUE(
+      CheckResult(cookie.get(), MUST_EQUAL, "older=1; newer=1; short=1"));
+
+  // A replaced cookie keeps its creation time, and so its place.
+  SetACookie(cookieService, "http://sorted.com/a/b/", "older=2; path=/a");
+  SetACookie(cookieService, "http://sorted.com/a/b/", "longer=1; path=/a/b/");
+  GetACookie(cookieService, "http://sorted.com/a/b/", cookie);
+  EXPECT_TRUE(CheckResult(cookie.get(), MUST_EQUAL,
+                          "longer=1; long=1; older=2; newer=1; short=1"));
+
+  SetACookie(cookieService, "http://sorted.com/a/b/",
+             "long=1; path=/a/b; max-age=-1");
+  SetACookie(cookieService, "http://sorted.com/a/b/",
+             "short=1; path=/; max-age=-1");
+  GetACookie(cookieService, "http://sorted.com/a/b/", cookie);
+  EXPECT_TRUE(
+      CheckResult(cookie.get(), MUST_EQUAL, "longer=1; older=2; newer=1"));
+
+  EXPECT_NS_SUCCEEDED(cookieMgr->RemoveAll());
+  GetACookie(cookieService, "http://sorted.com/a/b/", cookie);
+  EXPECT_TRUE(CheckResult(cookie.get(), MUST_EQUAL, ""));
+}
@@ -0,0 +1,301 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+
+#include "Cookie.h"
+#include "CookiePersistentStorage.h"
+#include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/Services.h"
+#include "mozilla/SpinEventLoopUntil.h"
+#include "mozIStorageConnection.h"
+#include "mozIStorageService.h"
+#include "mozIStorageStatement.h"
+#include "mozIStorageStatementCallback.h"
+#include "nsDirectoryServiceDefs.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsICookieService.h"
+#include "nsIFile.h"
+#include "nsIObserver.h"
+#include "nsIObserverService.h"
+#include "nsServiceManagerUtils.h"
+#include "nsString.h"
+#include "prtime.h"
+
+#include <functional>
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+const char kBatchWindowPref[] = "network.cookie.db_write_batch_window_ms";
+
+const int64_t kBatchTestHour = 60 * 60 * PR_USEC_PER_SEC;
+
+RefPtr<Cookie> MakeBatchTestCookie(const char* aName, const char* aValue,
+                                   int64_t aLastAccessed) {
+  int64_t now = PR_Now();
+  CookieStruct cookieData(
+      nsCString(aName), nsCString(aValue), "batch.example.com"_ns, "/"_ns,
+      (now + kBatchTestHour) / PR_USEC_PER_MSEC, aLastAccessed,
+      Cookie::GenerateUniqueCreationTime(now), false, false, false, false,
+      nsICookie::SAMESITE_LAX, nsICookie::SCHEME_HTTPS);
+  return Cookie::Create(cookieData, OriginAttributes());
+}
+
+// Returns the "name=value" pairs of the cookies in the database, by name.
+nsCString ReadBatchTestDB(nsIFile* aFile) {
+  nsCOMPtr<mozIStorageService> service =
+      do_GetService("@mozilla.org/storage/service;1");
+  nsCOMPtr<mozIStorageConnection> conn;
+  MOZ_ALWAYS_SUCCEEDS(service->OpenUnsharedDatabase(
+      aFile, mozIStorageService::CONNECTION_DEFAULT, getter_AddRefs(conn)));
+
+  nsCOMPtr<mozIStorageStatement> stmt;
+  MOZ_ALWAYS_SUCCEEDS(conn->CreateStatement(
+      "SELECT name, value FROM moz_cookies ORDER BY name"_ns,
+      getter_AddRefs(stmt)));
+
+  nsCString rows;
+  bool hasRow;
+  while (NS_SUCCEEDED(stmt->ExecuteStep(&hasRow)) && hasRow) {
+    nsAutoCString name, value;
+    MOZ_ALWAYS_SUCCEEDS(stmt->GetUTF8String(0, name));
+    MOZ_ALWAYS_SUCCEEDS(stmt->GetUTF8String(1, value));
+    if (!rows.IsEmpty()) {
+      rows.AppendLiteral("; ");
+    }
+    rows.Append(name + "="_ns + value);
+  }
+
+  stmt->Finalize();
+  conn->Close();
+  return rows;
+}
+
+int64_t ReadBatchTestLastAccessed(nsIFile* aFile, const char* aName) {
+  nsCOMPtr<mozIStorageService> service =
+      do_GetService("@mozilla.org/storage/service;1");
+  nsCOMPtr<mozIStorageConnection> conn;
+  MOZ_ALWAYS_SUCCEEDS(service->OpenUnsharedDatabase(
+      aFile, mozIStorageService::CONNECTION_DEFAULT, getter_AddRefs(conn)));
+
+  nsCOMPtr<mozIStorageStatement> stmt;
+  MOZ_ALWAYS_SUCCEEDS(conn->CreateStatement(
+      "SELECT lastAccessed FROM moz_cookies WHERE name = :name"_ns,
+      getter_AddRefs(stmt)));
+  MOZ_ALWAYS_SUCCEEDS(
+      stmt->BindUTF8StringByName("name"_ns, nsDependentCString(aName)));
+
+  int64_t lastAccessed = -1;
+  bool hasRow;
+  if (NS_SUCCEEDED(stmt->ExecuteStep(&hasRow)) && hasRow) {
+    lastAccessed = stmt->AsInt64(0);
+  }
+
+  stmt->Finalize();
+  conn->Close();
+  return lastAccessed;
+}
+
+class CookieBatchTestSync final : public mozIStorageStatementCallback {
+ public:
+  NS_DECL_ISUPPORTS
+
+  NS_IMETHOD HandleResult(mozIStorageResultSet*) override { return NS_OK; }
+  NS_IMETHOD HandleError(mozIStorageError*) override { return NS_OK; }
+  NS_IMETHOD HandleCompletion(uint16_t) override {
+    mDone = true;
+    return NS_OK;
+  }
+
+  bool mDone = false;
+
+ private:
+  ~CookieBatchTestSync() = default;
+};
+
+NS_IMPL_ISUPPORTS(CookieBatchTestSync, mozIStorageStatementCallback)
+
+class CookieBatchTestCloseObserver final : public nsIObserver {
+ public:
+  NS_DECL_ISUPPORTS
+
+  NS_IMETHOD Observe(nsISupports*, const char*, const char16_t*) override {
+    mClosed = true;
+    return NS_OK;
+  }
+
+  bool mClosed = false;
+
+ private:
+  ~CookieBatchTestCloseObserver() = default;
+};
+
+NS_IMPL_ISUPPORTS(CookieBatchTestCloseObserver, nsIObserver)
+
+class CookieBatchTestTransaction final : public nsICookieTransactionCallback {
+ public:
+  NS_DECL_ISUPPORTS
+
+  explicit CookieBatchTestTransaction(std::function<void()>&& aCallback)
+      : mCallback(std::move(aCallback)) {}
+
+  NS_IMETHOD Callback() override {
+    mCallback();
+    return NS_OK;
+  }
+
+ private:
+  ~CookieBatchTestTransaction() = default;
+
+  std::function<void()> mCallback;
+};
+
+NS_IMPL_ISUPPORTS(CookieBatchTestTransaction, nsICookieTransactionCallback)
+
+}  // namespace
+
+// Keeps a CookiePersistentStorage on a database of its own, with a batch
+// window long enough that only the test flushes it.
+class TestCookieBatchedWrites : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_NS_SUCCEEDED(Preferences::SetUint(kBatchWindowPref, 60 * 1000));
+
+    ASSERT_NS_SUCCEEDED(
+        NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(mDir)));
+    ASSERT_NS_SUCCEEDED(mDir->AppendNative("TestCookieBatchedWrites"_ns));
+    ASSERT_NS_SUCCEEDED(mDir->CreateUnique(nsIFile::DIRECTORY_TYPE, 0700));
+    ASSERT_NS_SUCCEEDED(mDir->Clone(getter_AddRefs(mFile)));
+    ASSERT_NS_SUCCEEDED(mFile->AppendNative("cookies.sqlite"_ns));
+
+    mStorage = CookiePersistentStorage::CreateForTesting(mFile);
+    mStorage->EnsureInitialized();
+  }
+
+  void TearDown() override {
+    if (mStorage) {
+      Close();
+    }
+    Preferences::ClearUser(kBatchWindowPref);
+    mDir->Remove(true);
+  }
+
+  void Add(const RefPtr<Cookie>& aCookie) {
+    mStorage->AddCookie(nullptr, "example.com"_ns, OriginAttributes(), aCookie,
+                        PR_Now(), nullptr, ""_ns, true, false, nullptr);
+  }
+
+  void Remove(const char* aName) {
+    mStorage->RemoveCookie("example.com"_ns, OriginAttributes(),
+                           "batch.example.com"_ns, nsDependentCString(aName),
+                           "/"_ns, true, nullptr);
+  }
+
+  // Waits for the statements executed so far, without flushing.
+  void Sync() {
+    RefPtr<CookieBatchTestSync> sync = new CookieBatchTestSync();
+    ASSERT_NS_SUCCEEDED(mStorage->SyncForTesting(sync));
+    SpinEventLoopUntil("TestCookieBatchedWrites::Sync"_ns,
+                       [&] { return sync->mDone; });
+  }
+
+  void Flush() {
+    mStorage->FlushPendingWritesForTesting();
+    Sync();
+  }
+
+  void Close() {
+    nsCOMPtr<nsIObserverService> os = services::GetObserverService();
+    RefPtr<CookieBatchTestCloseObserver> observer =
+        new CookieBatchTestCloseObserver();
+    ASSERT_NS_SUCCEEDED(os->AddObserver(observer, "cookie-db-closed", false));
+
+    mStorage->Close();
+    SpinEventLoopUntil("TestCookieBatchedWrites::Close"_ns,
+                       [&] { return observer->mClosed; });
+    os->RemoveObserver(observer, "cookie-db-closed");
+    mStorage = nullptr;
+  }
+
+  nsCOMPtr<nsIFile> mDir;
+  nsCOMPtr<nsIFile> mFile;
+  RefPtr<CookiePersistentStorage> mStorage;
+};
+
+TEST_F(TestCookieBatchedWrites, OneWindow)
+{
+  int64_t old = PR_Now() - kBatchTestHour;
+  Add(MakeBatchTestCookie("a", "1", PR_Now()));
+  Add(MakeBatchTestCookie("c", "3", old));
+  Sync();
+  EXPECT_TRUE(ReadBatchTestDB(mFile).IsEmpty());
+
+  Flush();
+  EXPECT_STREQ("a=1; c=3", ReadBatchTestDB(mFile).get());
+  EXPECT_EQ(old, ReadBatchTestLastAccessed(mFile, "c"));
+
+  // Only the last state of each cookie is written.
+  Add(MakeBatchTestCookie("a", "2", PR_Now()));
+  Add(MakeBatchTestCookie("b", "2", PR_Now()));
+  Remove("b");
+  nsTArray<RefPtr<Cookie>> cookies;
+  mStorage->GetCookiesFromHost("example.com"_ns, OriginAttributes(), cookies);
+  int64_t now = PR_Now();
+  mStorage->StaleCookies(cookies, now);
+  Sync();
+  EXPECT_STREQ("a=1; c=3", ReadBatchTestDB(mFile).get());
+  EXPECT_EQ(old, ReadBatchTestLastAccessed(mFile, "c"));
+
+  Flush();
+  EXPECT_STREQ("a=2; c=3", ReadBatchTestDB(mFile).get());
+  EXPECT_EQ(now, ReadBatchTestLastAccessed(mFile, "c"));
+}
+
+TEST_F(TestCookieBatchedWrites, RunInTransaction)
+{
+  Add(MakeBatchTestCookie("a", "1", PR_Now()));
+
+  // What was queued is written first, and what the callback writes is part of
+  // the transaction rather than queued.
+  RefPtr<CookieBatchTestTransaction> transaction =
+      new CookieBatchTestTransaction(
+          [&] { Add(MakeBatchTestCookie("b", "2", PR_Now())); });
+  ASSERT_NS_SUCCEEDED(mStorage->RunInTransaction(transaction));
+  Sync();
+  EXPECT_STREQ("a=1; b=2", ReadBatchTestDB(mFile).get());
+
+  // Writes are queued again afterwards.
+  Add(MakeBatchTestCookie("c", "3", PR_Now()));
+  Sync();
+  EXPECT_STREQ("a=1; b=2", ReadBatchTestDB(mFile).get());
+}
+
+TEST_F(TestCookieBatchedWrites, RemoveAllDropsQueue)
+{
+  Add(MakeBatchTestCookie("a", "1", PR_Now()));
+  Flush();
+  EXPECT_STREQ("a=1", ReadBatchTestDB(mFile).get());
+
+  Add(MakeBatchTestCookie("b", "2", PR_Now()));
+  mStorage->RemoveAll();
+  Flush();
+  EXPECT_TRUE(ReadBatchTestDB(mFile).IsEmpty());
+}
+
+TEST_F(TestCookieBatchedWrites, CloseFlushes)
+{
+  Add(MakeBatchTestCookie("a", "1", PR_Now()));
+  Remove("a");
+  Add(MakeBatchTestCookie("b", "2", PR_Now()));
+  Sync();
+  EXPECT_TRUE(ReadBatchTestDB(mFile).IsEmpty());
+
+  Close();
+  EXPECT_STREQ("b=2", ReadBatchTestDB(mFile).get());
+}
@@ -0,0 +1,230 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim:set ts=2 sw=2 sts=2 et cindent: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <sys/resource.h>
+#include <utility>
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "EpollSocketPoller.h"
+#include "nsTArray.h"
+#include "prio.h"
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+// Connected loopback TCP sockets, the poll list watching the "server" end of
+// each of them, and the "client" ends used to make them readable.
+class LoopbackSockets {
+ public:
+  bool Open(uint32_t aCount) {
+    PRPollDesc empty = {nullptr, 0, 0};
+    for (uint32_t i = 0; i < aCount; ++i) {
+      PRFileDesc* fds[2];
+      if (PR_NewTCPSocketPair(fds) != PR_SUCCESS) {
+        return false;
+      }
+      PRSocketOptionData opt;
+      opt.option = PR_SockOpt_Nonblocking;
+      opt.value.non_blocking = true;
+      PR_SetSocketOption(fds[0], &opt);
+      mPollList.AppendElement(empty);
+      mPollList.LastElement().fd = fds[0];
+      mPollList.LastElement().in_flags = PR_POLL_READ;
+      mClients.AppendElement(fds[1]);
+    }
+    return true;
+  }
+
+  ~LoopbackSockets() {
+    for (PRPollDesc& desc : mPollList) {
+      if (desc.fd) {
+        PR_Close(desc.fd);
+      }
+    }
+    for (PRFileDesc* fd : mClients) {
+      PR_Close(fd);
+    }
+  }
+
+  void Send(uint32_t aIndex) {
+    char byte = 'x';
+    ASSERT_EQ(1, PR_Write(mClients[aIndex], &byte, 1));
+  }
+
+  // Consume whatever the ready sockets received, so that they stop being
+  // readable.
+  void Drain() {
+    for (PRPollDesc& desc : mPollList) {
+      if (desc.out_flags & PR_POLL_READ) {
+        char buf[64];
+        ASSERT_LT(0, PR_Read(desc.fd, buf, sizeof(buf)));
+      }
+    }
+  }
+
+  nsTArray<PRPollDesc> mPollList;
+  nsTArray<PRFileDesc*> mClients;
+};
+
+// Raises the soft limit on open files, and restores it when going out of
+// scope.
+class ScopedFileLimit {
+ public:
+  // Returns false if the hard limit is below aWanted.
+  bool Raise(rlim_t aWanted) {
+    if (getrlimit(RLIMIT_NOFILE, &mOldLimit) != 0 ||
+        mOldLimit.rlim_max < aWanted) {
+      return false;
+    }
+    if (mOldLimit.rlim_cur >= aWanted) {
+      return true;
+    }
+    struct rlimit limit = mOldLimit;
+    limit.rlim_cur = aWanted;
+    mRaised = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+    return mRaised;
+  }
+
+  ~ScopedFileLimit() {
+    if (mRaised) {
+      setrlimit(RLIMIT_NOFILE, &mOldLimit);
+    }
+  }
+
+ private:
+  struct rlimit mOldLimit = {};
+  bool mRaised = false;
+};
+
+static uint32_t CountReadable(const nsTArray<PRPollDesc>& aPollList) {
+  uint32_t count = 0;
+  for (const PRPollDesc& desc : aPollList) {
+    if (desc.out_flags & PR_POLL_READ) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+TEST(TestEpollSocketPoller, Readiness)
+{
+  UniquePtr<EpollSocketPoller> poller = EpollSocketPoller::Create();
+  ASSERT_TRUE(poller);
+
+  LoopbackSockets sockets;
+  ASSERT_TRUE(sockets.Open(8));
+  nsTArray<PRPollDesc>& list = sockets.mPollList;
+
+  ASSERT_EQ(0, poller->Poll(list.Elements(), list.Length(),
+                            PR_INTERVAL_NO_WAIT));
+
+  sockets.Send(2);
+  sockets.Send(5);
+  ASSERT_EQ(2, poller->Poll(list.Elements(), list.Length(),
+                            PR_MillisecondsToInterval(1000)));
+  ASSERT_EQ(PR_POLL_READ, list[2].out_flags);
+  ASSERT_EQ(PR_POLL_READ, list[5].out_flags);
+  ASSERT_EQ(2u, CountReadable(list));
+
+  // Level-triggered: still ready until the data is consumed.
+  ASSERT_EQ(2, poller->Poll(list.Elements(), list.Length(),
+                            PR_INTERVAL_NO_WAIT));
+  sockets.Drain();
+  ASSERT_EQ(0, poller->Poll(list.Elements(), list.Length(),
+                            PR_INTERVAL_NO_WAIT));
+
+  // Interest changes are picked up from the list.
+  list[3].in_flags = PR_POLL_WRITE;
+  ASSERT_EQ(1, poller->Poll(list.Elements(), list.Length(),
+                            PR_INTERVAL_NO_WAIT));
+  ASSERT_EQ(PR_POLL_WRITE, list[3].out_flags);
+  list[3].in_flags = PR_POLL_READ;
+
+  // Entries may be reordered between calls.
+  std::swap(list[0], list[7]);
+  sockets.Send(0);
+  ASSERT_EQ(1, poller->Poll(list.Elements(), list.Length(),
+                            PR_MillisecondsToInterval(1000)));
+  ASSERT_EQ(PR_POLL_READ, list[7].out_flags);
+  sockets.Drain();
+
+  // A socket that is removed and closed, and whose OS handle is reused by a
+  // new socket, must be registered again.
+  poller->Remove(list[4].fd);
+  PR_Close(list[4].fd);
+  list[4].fd = nullptr;
+  ASSERT_EQ(0, poller->Poll(list.Elements(), list.Length(),
+                            PR_INTERVAL_NO_WAIT));
+  PRFileDesc* fds[2];
+  ASSERT_EQ(PR_SUCCESS, PR_NewTCPSocketPair(fds));
+  list[4].fd = fds[0];
+  char byte = 'x';
+  ASSERT_EQ(1, PR_Write(fds[1], &byte, 1));
+  ASSERT_EQ(1, poller->Poll(list.Elements(), list.Length(),
+                            PR_MillisecondsToInterval(1000)));
+  ASSERT_EQ(PR_POLL_READ, list[4].out_flags);
+  sockets.Drain();
+
+  // The peer going away is reported as well.
+  PR_Close(fds[1]);
+  ASSERT_EQ(1, poller->Poll(list.Elements(), list.Length(),
+                            PR_MillisecondsToInterval(1000)));
+  ASSERT_TRUE(list[4].out_flags & PR_POLL_READ);
+}
+
+// Many mostly idle connections, a few of which receive data on each wakeup:
+// what the socket thread looks like with lots of WebSockets, long-polls or
+// HTTP/2 sessions open.
+class EpollSocketPollerBench : public ::testing::Test {
+ protected:
+  static const uint32_t kSocketCount = 500;
+  static const uint32_t kReadyPerWakeup = 8;
+  static const uint32_t kWakeups = 2000;
+
+  void SetUp() override {
+    // Each connection takes two descriptors.
+    if (!mFileLimit.Raise(2 * kSocketCount + 256)) {
+      GTEST_SKIP() << "Not allowed to open enough files";
+    }
+    ASSERT_TRUE(mSockets.Open(kSocketCount));
+    mPoller = EpollSocketPoller::Create();
+    ASSERT_TRUE(mPoller);
+  }
+
+  void PollRounds(bool aUseEpoll) {
+    nsTArray<PRPollDesc>& list = mSockets.mPollList;
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < kWakeups; ++i) {
+      for (uint32_t j = 0; j < kReadyPerWakeup; ++j) {
+        mSockets.Send(next);
+        next = (next + 7919) % kSocketCount;
+      }
+      int32_t n =
+          aUseEpoll ? mPoller->Poll(list.Elements(), list.Length(),
+                                    PR_MillisecondsToInterval(1000))
+                    : PR_Poll(list.Elements(), list.Length(),
+                              PR_MillisecondsToInterval(1000));
+      ASSERT_LT(0, n);
+      mSockets.Drain();
+    }
+  }
+
+  // Declared first, so that the sockets are closed before it is restored.
+  ScopedFileLimit mFileLimit;
+  LoopbackSockets mSockets;
+  UniquePtr<EpollSocketPoller> mPoller;
+};
+
+MOZ_GTEST_BENCH_F(EpollSocketPollerBench, Poll_500Sockets_Epoll,
+                  [this] { PollRounds(true); });
+
+MOZ_GTEST_BENCH_F(EpollSocketPollerBench, Poll_500Sockets_PRPoll,
+                  [this] { PollRounds(false); });
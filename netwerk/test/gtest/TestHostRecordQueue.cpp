@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+
+#include "HostRecordQueue.h"
+#include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/Mutex.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/ScopeExit.h"
+#include "nsHostRecord.h"
+#include "nsHostResolver.h"
+#include "nsPrintfCString.h"
+#include "nsRefPtrHashtable.h"
+#include "prio.h"
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+const uint32_t kQueueTestMaxEntries = 4;
+const uint32_t kQueueTestMaxNegativeEntries = 2;
+
+nsHostKey MakeQueueTestKey(const char* aHost) {
+  return nsHostKey(nsDependentCString(aHost), ""_ns,
+                   nsIDNSService::RESOLVE_TYPE_DEFAULT,
+                   nsIDNSService::RESOLVE_DEFAULT_FLAGS, PR_AF_UNSPEC, false,
+                   ""_ns);
+}
+
+}  // namespace
+
+class TestHostRecordQueue : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    MutexAutoLock lock(mLock);
+    mQueue.ClearAll([](nsHostRecord*) {}, lock);
+  }
+
+  // Adds a resolved record to the cache, as the resolver does when a lookup
+  // completes.
+  RefPtr<nsHostRecord> Add(const char* aHost, bool aNegative) {
+    RefPtr<nsHostRecord> rec =
+        AddrHostRecord::CreateForTesting(MakeQueueTestKey(aHost), aNegative);
+    mDB.InsertOrUpdate(*rec, RefPtr{rec});
+    MutexAutoLock lock(mLock);
+    mQueue.AddToEvictionQ(rec, kQueueTestMaxEntries,
+                          kQueueTestMaxNegativeEntries, mDB, lock);
+    return rec;
+  }
+
+  void Renew(nsHostRecord* aRec) {
+    MutexAutoLock lock(mLock);
+    mQueue.MaybeRenewHostRecord(aRec, lock);
+  }
+
+  void Flush() {
+    MutexAutoLock lock(mLock);
+    mQueue.FlushEvictionQ(mDB, lock);
+  }
+
+  bool Cached(const char* aHost) {
+    return mDB.Contains(MakeQueueTestKey(aHost));
+  }
+
+  Mutex mLock{"TestHostRecordQueue::mLock"};
+  HostRecordQueue mQueue;
+  nsRefPtrHashtable<nsGenericHashKey<nsHostKey>, nsHostRecord> mDB;
+};
+
+TEST_F(TestHostRecordQueue, NegativeEvictsOnlyNegative)
+{
+  Add("a.example.com", false);
+  Add("b.example.com", false);
+  Add("x.example.com", true);
+  Add("y.example.com", true);
+  EXPECT_EQ(2u, mQueue.EvictionQSize());
+  EXPECT_EQ(2u, mQueue.NegativeQSize());
+
+  // The oldest failed lookup makes room, the resolved hosts stay.
+  Add("z.example.com", true);
+  EXPECT_EQ(2u, mQueue.EvictionQSize());
+  EXPECT_EQ(2u, mQueue.NegativeQSize());
+  EXPECT_FALSE(Cached("x.example.com"));
+  EXPECT_TRUE(Cached("y.example.com"));
+  EXPECT_TRUE(Cached("z.example.com"));
+  EXPECT_TRUE(Cached("a.example.com"));
+  EXPECT_TRUE(Cached("b.example.com"));
+
+  // And the other way around.
+  Add("c.example.com", false);
+  Add("d.example.com", false);
+  Add("e.example.com", false);
+  EXPECT_EQ(kQueueTestMaxEntries, mQueue.EvictionQSize());
+  EXPECT_EQ(2u, mQueue.NegativeQSize());
+  EXPECT_FALSE(Cached("a.example.com"));
+  EXPECT_TRUE(Cached("b.example.com"));
+  EXPECT_TRUE(Cached("y.example.com"));
+  EXPECT_TRUE(Cached("z.example.com"));
+}
+
+TEST_F(TestHostRecordQueue, RenewAndFlushKeepSizes)
+{
+  RefPtr<nsHostRecord> positive = Add("a.example.com", false);
+  Add("b.example.com", false);
+  RefPtr<nsHostRecord> negative = Add("x.example.com", true);
+  Add("y.example.com", true);
+
+  // A renewed record leaves its queue, and only that queue's size changes.
+  Renew(negative);
+  EXPECT_FALSE(negative->isInList());
+  EXPECT_EQ(2u, mQueue.EvictionQSize());
+  EXPECT_EQ(1u, mQueue.NegativeQSize());
+
+  Renew(positive);
+  EXPECT_FALSE(positive->isInList());
+  EXPECT_EQ(1u, mQueue.EvictionQSize());
+  EXPECT_EQ(1u, mQueue.NegativeQSize());
+
+  // Renewing a record that is in no queue changes nothing.
+  Renew(negative);
+  EXPECT_EQ(1u, mQueue.EvictionQSize());
+  EXPECT_EQ(1u, mQueue.NegativeQSize());
+
+  // The freed slot is used without evicting anything.
+  Add("z.example.com", true);
+  EXPECT_EQ(2u, mQueue.NegativeQSize());
+  EXPECT_TRUE(Cached("y.example.com"));
+
+  {
+    MutexAutoLock lock(mLock);
+    mQueue.AddToEvictionQ(negative, kQueueTestMaxEntries,
+                          kQueueTestMaxNegativeEntries, mDB, lock);
+  }
+  EXPECT_EQ(2u, mQueue.NegativeQSize());
+  EXPECT_FALSE(Cached("y.example.com"));
+
+  Flush();
+  EXPECT_EQ(0u, mQueue.EvictionQSize());
+  EXPECT_EQ(0u, mQueue.NegativeQSize());
+  EXPECT_EQ(0u, mQueue.PendingCount());
+  EXPECT_FALSE(negative->isInList());
+  EXPECT_FALSE(Cached("b.example.com"));
+  EXPECT_FALSE(Cached("z.example.com"));
+  // A renewed record is being resolved again, and stays in the cache.
+  EXPECT_TRUE(Cached("a.example.com"));
+
+  // Both queues start over at their full capacity.
+  for (uint32_t i = 0; i < kQueueTestMaxEntries + 1; ++i) {
+    Add(nsPrintfCString("p%u.example.com", i).get(), false);
+    Add(nsPrintfCString("n%u.example.com", i).get(), true);
+  }
+  EXPECT_EQ(kQueueTestMaxEntries, mQueue.EvictionQSize());
+  EXPECT_EQ(kQueueTestMaxNegativeEntries, mQueue.NegativeQSize());
+  EXPECT_EQ(kQueueTestMaxEntries + kQueueTestMaxNegativeEntries + 1,
+            mDB.Count());
+}
+
+TEST(TestHostResolverThreads, AnyPriorityCap)
+{
+  ASSERT_NS_SUCCEEDED(
+      Preferences::SetUint("network.dns.max_any_priority_threads", 3));
+  ASSERT_NS_SUCCEEDED(
+      Preferences::SetUint("network.dns.max_extra_any_priority_threads", 2));
+  ASSERT_NS_SUCCEEDED(
+      Preferences::SetUint("network.dns.queued_lookups_per_extra_thread", 4));
+  auto restore = MakeScopeExit([] {
+    Preferences::ClearUser("network.dns.max_any_priority_threads");
+    Preferences::ClearUser("network.dns.max_extra_any_priority_threads");
+    Preferences::ClearUser("network.dns.queued_lookups_per_extra_thread");
+  });
+
+  EXPECT_EQ(3u, ResolverThreadsAnyPriority(0));
+  EXPECT_EQ(3u, ResolverThreadsAnyPriority(3));
+  EXPECT_EQ(4u, ResolverThreadsAnyPriority(4));
+  EXPECT_EQ(5u, ResolverThreadsAnyPriority(8));
+  EXPECT_EQ(5u, ResolverThreadsAnyPriority(1000));
+
+  // High priority lookups keep their headroom above the others, and only the
+  // pool's hard limit grows with the extra threads.
+  EXPECT_EQ(MaxResolverThreadsHighPriority() + 3, MaxResolverThreads());
+  EXPECT_EQ(MaxResolverThreadsHighPriority() + 3,
+            ResolverThreadsHighPriority(0));
+  EXPECT_EQ(MaxResolverThreadsHighPriority() + 5,
+            ResolverThreadsHighPriority(1000));
+  EXPECT_EQ(MaxResolverThreadsHighPriority() + 5, MaxResolverPoolThreads());
+
+  ASSERT_NS_SUCCEEDED(
+      Preferences::SetUint("network.dns.queued_lookups_per_extra_thread", 0));
+  EXPECT_EQ(4u, ResolverThreadsAnyPriority(1));
+
+  ASSERT_NS_SUCCEEDED(
+      Preferences::SetUint("network.dns.max_extra_any_priority_threads", 0));
+  EXPECT_EQ(3u, ResolverThreadsAnyPriority(1000));
+}
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "Http2Compression.h"
+#include "nsString.h"
+#include "nsTArray.h"
+
+using namespace mozilla;
+using namespace mozilla::net;
+
+namespace {
+
+struct HpackTestHeader {
+  const char* mName;
+  nsCString mValue;
+};
+
+// One of the requests of a page load that fetches many subresources over the
+// same connection: the same few headers with varying paths and accept values,
+// a large cookie with a crumb that changes for every request, and a large
+// header that is unique to each request.
+void MakeHpackTestRequest(uint32_t aIndex, nsACString& aPath,
+                          nsACString& aInput, nsACString& aExpected) {
+  static const char* const kAccepts[] = {
+      "image/avif,image/webp,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5",
+      "text/css,*/*;q=0.1", "*/*"};
+
+  aPath.Truncate();
+  aPath.AppendPrintf("/assets/%u/resource-%u.bin", aIndex % 7, aIndex);
+
+  nsAutoCString consent;
+  nsAutoCString requestId;
+  for (uint32_t i = 0; i < 80; ++i) {
+    consent.AppendPrintf("%08x", i * 2654435761u);
+    requestId.AppendPrintf("%08x", (aIndex * 80 + i) * 2246822519u);
+  }
+
+  nsAutoCString cookie;
+  cookie.AppendPrintf(
+      "sid=4f2a9c0e7b1d4e8f9a3c5b7d1e0f2a4c; theme=dark; consent=%s; "
+      "last=%u",
+      consent.get(), aIndex);
+
+  HpackTestHeader headers[] = {
+      {"Host", "www.example.com"_ns},
+      {"User-Agent",
+       "Mozilla/5.0 (X11; Linux x86_64; rv:140.0) Gecko/20100101 "
+       "Firefox/140.0"_ns},
+      {"Accept", nsDependentCString(kAccepts[aIndex % 3])},
+      {"Accept-Language", "en-US,en;q=0.5"_ns},
+      {"Accept-Encoding", "gzip, deflate, br, zstd"_ns},
+      {"Referer", "https://www.example.com/articles/2025/a-long-title"_ns},
+      {"Cookie", cookie},
+      {"X-Request-Id", requestId},
+  };
+
+  aInput.Truncate();
+  aInput.AppendPrintf("GET %s HTTP/1.1\r\n", PromiseFlatCString(aPath).get());
+  aExpected.Truncate();
+  for (const HpackTestHeader& header : headers) {
+    aInput.AppendPrintf("%s: %s\r\n", header.mName, header.mValue.get());
+
+    nsAutoCString name(header.mName);
+    ToLowerCase(name);
+    if (name.EqualsLiteral("host")) {
+      continue;
+    }
+    if (name.EqualsLiteral("cookie")) {
+      for (const nsACString& crumb : header.mValue.Split(';')) {
+        aExpected.AppendPrintf(
+            "cookie: %s\r\n",
+            PromiseFlatCString(Substring(crumb, crumb[0] == ' ')).get());
+      }
+      continue;
+    }
+    aExpected.AppendPrintf("%s: %s\r\n", name.get(), header.mValue.get());
+  }
+  aInput.AppendLiteral("\r\n");
+  aExpected.AppendLiteral("te: trailers\r\n");
+}
+
+nsresult EncodeHpackTestRequest(Http2Compressor& aCompressor,
+                                const nsCString& aInput,
+                                const nsACString& aPath,
+                                nsACString& aOutput) {
+  return aCompressor.EncodeHeaderBlock(aInput, "GET"_ns, aPath,
+                                       "www.example.com"_ns, "https"_ns,
+                                       ""_ns, false, aOutput, true);
+}
+
+nsresult DecodeHpackTestBlock(Http2Decompressor& aDecompressor,
+                              const nsACString& aBlock, nsACString& aOutput) {
+  return aDecompressor.DecodeHeaderBlock(
+      reinterpret_cast<const uint8_t*>(aBlock.BeginReading()),
+      aBlock.Length(), aOutput, true);
+}
+
+}  // namespace
+
+TEST(TestHttp2Compression, RoundTrip)
+{
+  Http2Compressor compressor;
+  Http2Decompressor decompressor;
+
+  for (uint32_t i = 0; i < 50; ++i) {
+    nsAutoCString path, input, expected, encoded, decoded;
+    MakeHpackTestRequest(i, path, input, expected);
+    ASSERT_EQ(NS_OK,
+              EncodeHpackTestRequest(compressor, input, path, encoded));
+    ASSERT_EQ(NS_OK, DecodeHpackTestBlock(decompressor, encoded, decoded));
+    ASSERT_TRUE(decoded.Equals(expected)) << decoded.get();
+
+    nsAutoCString decodedPath;
+    decompressor.GetPath(decodedPath);
+    ASSERT_TRUE(decodedPath.Equals(path));
+  }
+}
+
+TEST(TestHttp2Compression, RawLiterals)
+{
+  Http2Compressor compressor;
+  Http2Decompressor decompressor;
+
+  // Bytes that take more than 8 bits each when huffman encoded.
+  nsAutoCString value;
+  for (uint32_t i = 0; i < 200; ++i) {
+    value.Append(static_cast<char>(0x80 + (i % 0x7f)));
+  }
+  nsAutoCString input("GET / HTTP/1.1\r\nX-Binary: "_ns);
+  input.Append(value);
+  input.AppendLiteral("\r\n\r\n");
+
+  nsAutoCString encoded, decoded;
+  ASSERT_EQ(NS_OK, EncodeHpackTestRequest(compressor, input, "/"_ns, encoded));
+  ASSERT_LT(encoded.Length(), value.Length() + 64);
+
+  ASSERT_EQ(NS_OK, DecodeHpackTestBlock(decompressor, encoded, decoded));
+  nsAutoCString expected("x-binary: "_ns);
+  expected.Append(value);
+  expected.AppendLiteral("\r\nte: trailers\r\n");
+  ASSERT_TRUE(decoded.Equals(expected));
+}
+
+TEST(TestHttp2Compression, IndexesRecurringLargeHeaders)
+{
+  Http2Compressor compressor;
+  Http2Decompressor decompressor;
+
+  nsAutoCString large;
+  for (uint32_t i = 0; i < 100; ++i) {
+    large.AppendLiteral("abcdefgh");
+  }
+  nsAutoCString input("GET / HTTP/1.1\r\nX-Large: "_ns);
+  input.Append(large);
+  input.AppendLiteral("\r\n\r\n");
+
+  // Sent as a literal until it has been seen once, then as an index.
+  nsTArray<uint32_t> lengths;
+  for (uint32_t i = 0; i < 3; ++i) {
+    nsAutoCString encoded, decoded;
+    ASSERT_EQ(NS_OK,
+              EncodeHpackTestRequest(compressor, input, "/"_ns, encoded));
+    ASSERT_EQ(NS_OK, DecodeHpackTestBlock(decompressor, encoded, decoded));
+    ASSERT_TRUE(StringBeginsWith(decoded, "x-large: abcdefgh"_ns));
+    lengths.AppendElement(encoded.Length());
+  }
+  ASSERT_LT(large.Length() / 2, lengths[0]);
+  ASSERT_LT(large.Length() / 2, lengths[1]);
+  ASSERT_GT(16u, lengths[2]);
+}
+
+// Encodes the headers of a page load with many subresources, each time on a
+// new connection.
+class TestHttp2CompressionBench : public ::testing::Test {
+ protected:
+  static const uint32_t kRequests = 200;
+  static const uint32_t kConnections = 50;
+
+  void SetUp() override {
+    for (uint32_t i = 0; i < kRequests; ++i) {
+      nsAutoCString expected;
+      MakeHpackTestRequest(i, *mPaths.AppendElement(),
+                           *mInputs.AppendElement(), expected);
+    }
+  }
+
+  nsTArray<nsCString> mPaths;
+  nsTArray<nsCString> mInputs;
+};
+
+MOZ_GTEST_BENCH_F(TestHttp2CompressionBench, EncodePageLoad, [this] {
+  uint64_t bytes = 0;
+  for (uint32_t c = 0; c < kConnections; ++c) {
+    Http2Compressor compressor;
+    nsAutoCString encoded;
+    for (uint32_t i = 0; i < kRequests; ++i) {
+      ASSERT_EQ(NS_OK, EncodeHpackTestRequest(compressor, mInputs[i],
+                                              mPaths[i], encoded));
+      bytes += encoded.Length();
+    }
+  }
+  ASSERT_LT(0u, bytes);
+});
@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 
+#include "mozilla/Monitor.h"
 #include "nsCOMPtr.h"
 #include "nsISocketTransport.h"
 #include "nsString.h"
@@ -133,6 +134,78 @@ TEST(TestSocketTransportService, PortRemappingPreferenceReading)
       }));
 }
 
+TEST(TestSocketTransportService, SocketThreadLoad)
+{
+  nsCOMPtr<nsISocketTransportService> service =
+      do_GetService("@mozilla.org/network/socket-transport-service;1");
+  ASSERT_TRUE(service);
+
+  auto* sts = gSocketTransportService;
+  ASSERT_TRUE(sts);
+  ASSERT_EQ(0u, sts->ShardIndex());
+
+  // Make sure the socket thread is up and running.
+  NS_DispatchAndSpinEventLoopUntilComplete(
+      "test"_ns, sts, NS_NewRunnableFunction("test", [] {}));
+
+  nsTArray<SocketThreadInfo> threads;
+  sts->GetSocketThreadLoad(&threads);
+  ASSERT_LE(1u, threads.Length());
+  ASSERT_EQ(0u, threads[0].index);
+  for (const SocketThreadInfo& info : threads) {
+    ASSERT_LE(info.busy, info.uptime);
+  }
+
+  RefPtr<nsSocketTransportService> shard =
+      nsSocketTransportService::PickShard();
+  ASSERT_TRUE(shard);
+  ASSERT_LT(shard->ShardIndex(), threads.Length());
+}
+
+// The pollable event of a shard is signalled from the other socket threads,
+// and only a signal from the shard's own thread can be skipped.
+TEST(TestSocketTransportService, CrossShardDispatch)
+{
+  nsCOMPtr<nsISocketTransportService> service =
+      do_GetService("@mozilla.org/network/socket-transport-service;1");
+  ASSERT_TRUE(service);
+
+  RefPtr<nsSocketTransportService> sts = gSocketTransportService;
+  ASSERT_TRUE(sts);
+  RefPtr<nsSocketTransportService> shard =
+      nsSocketTransportService::StartShardForTesting(1);
+  ASSERT_TRUE(shard);
+
+  // Let the shard go back to poll() with nothing to do.
+  NS_DispatchAndSpinEventLoopUntilComplete(
+      "test"_ns, shard, NS_NewRunnableFunction("test", [] {}));
+
+  Monitor monitor("CrossShardDispatch");
+  bool ran = false;
+  sts->Dispatch(NS_NewRunnableFunction("test", [&] {
+    EXPECT_TRUE(sts->IsOnCurrentThreadInfallible());
+    EXPECT_FALSE(shard->IsOnCurrentThreadInfallible());
+    shard->Dispatch(NS_NewRunnableFunction("test", [&] {
+      EXPECT_TRUE(shard->IsOnCurrentThreadInfallible());
+      EXPECT_FALSE(OnSocketThread());
+      MonitorAutoLock lock(monitor);
+      ran = true;
+      lock.Notify();
+    }));
+  }));
+
+  {
+    MonitorAutoLock lock(monitor);
+    TimeStamp deadline = TimeStamp::Now() + TimeDuration::FromSeconds(10);
+    while (!ran && TimeStamp::Now() < deadline) {
+      lock.Wait(TimeDuration::FromSeconds(1));
+    }
+    EXPECT_TRUE(ran);
+  }
+
+  shard->Shutdown(false);
+}
+
 TEST(TestSocketTransportService, StatusValues)
 {
   static_assert(static_cast<nsresult>(nsISocketTransport::STATUS_RESOLVING) ==
@@ -10,11 +10,20 @@
 #include "nsComponentManagerUtils.h"
 #include "nsIURIMutator.h"
 #include "mozilla/ipc/URIUtils.h"
+#include "mozilla/Atomics.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/ScopeExit.h"
+#include "mozilla/Services.h"
+#include "mozilla/StaticPrefs_network.h"
 #include "mozilla/Unused.h"
 #include "nsSerializationHelper.h"
 #include "mozilla/Base64.h"
 #include "nsEscape.h"
 #include "nsURLHelper.h"
+#include "nsIObserverService.h"
+#include "nsNetUtil.h"
+#include "nsStandardURL.h"
+#include "nsThreadUtils.h"
 #include "IPv4Parser.h"
 
 using namespace mozilla;
@@ -587,3 +596,158 @@ TEST(TestStandardURL, bug1911529)
   ASSERT_EQ(uri->Equals(uri2, &equals), NS_OK);
   ASSERT_TRUE(equals);
 }
+
+TEST(TestStandardURL, ParseCache)
+{
+  bool enabled = StaticPrefs::network_url_parse_cache_enabled();
+  Preferences::SetBool("network.url.parse_cache.enabled", true);
+  auto restorePref = MakeScopeExit([&] {
+    Preferences::SetBool("network.url.parse_cache.enabled", enabled);
+  });
+
+  uint32_t hits, misses;
+  net::nsStandardURL::GetParseCacheStats(&hits, &misses);
+
+  nsCOMPtr<nsIURI> base;
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(base),
+                      "https://parse-cache.example.com/dir/page.html"_ns),
+            NS_OK);
+
+  // The same spec resolved against the same base gives the same URL.
+  nsCOMPtr<nsIURI> uri1, uri2;
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri1), "img/a.png"_ns, nullptr, base),
+            NS_OK);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri2), "img/a.png"_ns, nullptr, base),
+            NS_OK);
+  ASSERT_EQ(uri1.get(), uri2.get());
+
+  nsAutoCString spec;
+  ASSERT_EQ(uri1->GetSpec(spec), NS_OK);
+  ASSERT_EQ(spec, "https://parse-cache.example.com/dir/img/a.png"_ns);
+
+  uint32_t newHits, newMisses;
+  net::nsStandardURL::GetParseCacheStats(&newHits, &newMisses);
+  ASSERT_LE(hits + 1, newHits);
+  ASSERT_LE(misses + 2, newMisses);
+
+  // Mutating the shared URL leaves the cached one alone.
+  nsCOMPtr<nsIURI> mutated;
+  ASSERT_EQ(NS_MutateURI(uri1).SetRef("top"_ns).Finalize(mutated), NS_OK);
+  ASSERT_NE(mutated.get(), uri1.get());
+  ASSERT_EQ(uri2->GetSpec(spec), NS_OK);
+  ASSERT_EQ(spec, "https://parse-cache.example.com/dir/img/a.png"_ns);
+
+  // Another base or charset is another entry.
+  nsCOMPtr<nsIURI> otherBase, uri3;
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(otherBase),
+                      "https://parse-cache.example.com/other/page.html"_ns),
+            NS_OK);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri3), "img/a.png"_ns, nullptr,
+                      otherBase),
+            NS_OK);
+  ASSERT_NE(uri3.get(), uri1.get());
+  ASSERT_EQ(uri3->GetSpec(spec), NS_OK);
+  ASSERT_EQ(spec, "https://parse-cache.example.com/other/img/a.png"_ns);
+
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri3), "img/a.png"_ns, "windows-1252",
+                      base),
+            NS_OK);
+  ASSERT_NE(uri3.get(), uri1.get());
+
+  // Nor with a long base spec.
+  nsAutoCString longSpec("https://parse-cache.example.com/"_ns);
+  for (uint32_t i = 0; i < 2000; ++i) {
+    longSpec.Append('a');
+  }
+  nsCOMPtr<nsIURI> longBase, uri4;
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(longBase), longSpec), NS_OK);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri3), "img/a.png"_ns, nullptr, longBase),
+            NS_OK);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri4), "img/a.png"_ns, nullptr, longBase),
+            NS_OK);
+  ASSERT_NE(uri3.get(), uri4.get());
+
+  // The cache is cleared once private browsing ends.
+  nsCOMPtr<nsIObserverService> os = services::GetObserverService();
+  ASSERT_TRUE(os);
+  os->NotifyObservers(nullptr, "last-pb-context-exited", nullptr);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri3), "img/a.png"_ns, nullptr, base),
+            NS_OK);
+  ASSERT_NE(uri3.get(), uri1.get());
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri4), "img/a.png"_ns, nullptr, base),
+            NS_OK);
+  ASSERT_EQ(uri3.get(), uri4.get());
+
+  // Nothing is shared when the cache is disabled.
+  Preferences::SetBool("network.url.parse_cache.enabled", false);
+  ASSERT_EQ(NS_NewURI(getter_AddRefs(uri3), "img/a.png"_ns, nullptr, base),
+            NS_OK);
+  ASSERT_NE(uri3.get(), uri4.get());
+}
+
+namespace {
+
+// Resolves the relative URLs of a page against its base, the way a document
+// does: three in five are the same few images and stylesheets, over and over,
+// and the others are links that only show up once.
+void ResolveParseCacheBenchURLs(uint32_t aThread) {
+  static Atomic<uint32_t> sRun;
+  uint32_t run = sRun++;
+
+  nsCOMPtr<nsIURI> base;
+  MOZ_ALWAYS_SUCCEEDS(
+      NS_NewURI(getter_AddRefs(base),
+                "https://parse-cache.example.com/articles/2024/page.html"_ns));
+
+  nsAutoCString spec;
+  nsCOMPtr<nsIURI> uri;
+  for (uint32_t i = 0; i < 20000; ++i) {
+    spec.Truncate();
+    if (i % 5 < 3) {
+      spec.AppendPrintf("/static/img/%u.png", i % 64);
+    } else {
+      spec.AppendPrintf("../comments/%u-%u-%u.html", run, aThread, i);
+    }
+    MOZ_ALWAYS_SUCCEEDS(NS_NewURI(getter_AddRefs(uri), spec, nullptr, base));
+  }
+}
+
+void BenchParseCache(bool aEnabled, uint32_t aThreads) {
+  bool enabled = StaticPrefs::network_url_parse_cache_enabled();
+  Preferences::SetBool("network.url.parse_cache.enabled", aEnabled);
+  auto restorePref = MakeScopeExit([&] {
+    Preferences::SetBool("network.url.parse_cache.enabled", enabled);
+  });
+
+  if (aThreads == 1) {
+    ResolveParseCacheBenchURLs(0);
+    return;
+  }
+
+  nsTArray<nsCOMPtr<nsIThread>> threads;
+  for (uint32_t t = 0; t < aThreads; ++t) {
+    nsCOMPtr<nsIThread> thread;
+    MOZ_ALWAYS_SUCCEEDS(
+        NS_NewNamedThread("ParseCacheBench", getter_AddRefs(thread)));
+    MOZ_ALWAYS_SUCCEEDS(thread->Dispatch(NS_NewRunnableFunction(
+        "ParseCacheBench", [t] { ResolveParseCacheBenchURLs(t); })));
+    threads.AppendElement(std::move(thread));
+  }
+  for (nsIThread* thread : threads) {
+    thread->Shutdown();
+  }
+}
+
+}  // namespace
+
+MOZ_GTEST_BENCH(TestStandardURL, ParseCache_Enabled,
+                [] { BenchParseCache(true, 1); });
+
+MOZ_GTEST_BENCH(TestStandardURL, ParseCache_Disabled,
+                [] { BenchParseCache(false, 1); });
+
+MOZ_GTEST_BENCH(TestStandardURL, ParseCache_Enabled4Threads,
+                [] { BenchParseCache(true, 4); });
+
+MOZ_GTEST_BENCH(TestStandardURL, ParseCache_Disabled4Threads,
+                [] { BenchParseCache(false, 4); });
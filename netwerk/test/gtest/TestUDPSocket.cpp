@@ -4,6 +4,7 @@
 
 #include "TestCommon.h"
 #include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
 #include "nsIUDPSocket.h"
 #include "nsISocketTransport.h"
 #include "nsIOutputStream.h"
@@ -12,8 +13,11 @@
 #include "nsContentUtils.h"
 #include "mozilla/gtest/MozAssertions.h"
 #include "mozilla/net/DNS.h"
+#include "mozilla/net/UDPDatagramBatch.h"
 #include "prerror.h"
 #include "nsComponentManagerUtils.h"
+#include "nsServiceManagerUtils.h"
+#include "nsThreadUtils.h"
 
 #define REQUEST 0x68656c6f
 #define RESPONSE 0x6f6c6568
@@ -408,3 +412,227 @@ close:
   // Wait for client and server to see closing
   waiter->Wait(2);
 }
+
+/**** Batched IO ****/
+
+using mozilla::Span;
+using mozilla::net::NetAddr;
+using mozilla::net::UDPDatagramBatch;
+
+// Datagrams sent from a client socket to a server socket over loopback, the
+// way Http3Session exchanges them with neqo: full-sized packets followed by a
+// shorter one.
+class TestUDPSocketBatch : public ::testing::Test {
+ protected:
+  static const uint32_t kDatagrams = 64;
+  static const uint32_t kDatagramSize = 1200;
+  static const uint32_t kRounds = 500;
+  static const uint32_t kAckSize = 40;
+
+  void SetUp() override {
+    nsCOMPtr<nsIPrincipal> systemPrincipal =
+        nsContentUtils::GetSystemPrincipal();
+    mServer = do_CreateInstance("@mozilla.org/network/udp-socket;1");
+    mClient = do_CreateInstance("@mozilla.org/network/udp-socket;1");
+    ASSERT_TRUE(mServer && mClient);
+    ASSERT_NS_SUCCEEDED(mServer->Init(0, true, systemPrincipal, true, 0));
+    ASSERT_NS_SUCCEEDED(mClient->Init(0, true, systemPrincipal, true, 0));
+    ASSERT_NS_SUCCEEDED(mServer->GetAddress(&mServerAddr));
+    ASSERT_NS_SUCCEEDED(mClient->GetAddress(&mClientAddr));
+    mSts = do_GetService("@mozilla.org/network/socket-transport-service;1");
+    ASSERT_TRUE(mSts);
+  }
+
+  void TearDown() override {
+    mServer->Close();
+    mClient->Close();
+  }
+
+  // RecvBatch() and SendBatch() must be called on the socket thread.
+  template <typename F>
+  void OnSocketThread(F&& aFunc) {
+    NS_DispatchAndSpinEventLoopUntilComplete(
+        "TestUDPSocketBatch"_ns, mSts,
+        NS_NewRunnableFunction("TestUDPSocketBatch", std::forward<F>(aFunc)));
+  }
+
+  uint32_t DatagramSize(uint32_t aIndex) const {
+    return aIndex == kDatagrams - 1 ? kDatagramSize / 2 : kDatagramSize;
+  }
+
+  void FillDatagram(uint32_t aIndex, nsTArray<uint8_t>& aData) const {
+    aData.ClearAndRetainStorage();
+    aData.AppendElements(DatagramSize(aIndex));
+    memset(aData.Elements(), int(aIndex), aData.Length());
+  }
+
+  void ExchangeBatched(bool aCheck, bool aSendOneByOne = false) {
+    UDPDatagramBatch batch;
+    nsTArray<uint8_t> data;
+    if (aSendOneByOne) {
+      SendOneByOne();
+    } else {
+      for (uint32_t i = 0; i < kDatagrams; ++i) {
+        FillDatagram(i, data);
+        ASSERT_TRUE(
+            batch.Append(mServerAddr, data.Elements(), data.Length()));
+      }
+      uint64_t total = batch.TotalBytes();
+      uint64_t written = 0;
+      ASSERT_NS_SUCCEEDED(mClient->SendBatch(batch, &written));
+      ASSERT_TRUE(batch.IsEmpty());
+      ASSERT_EQ(total, written);
+    }
+
+    uint32_t received = 0;
+    while (received < kDatagrams) {
+      ASSERT_NS_SUCCEEDED(mServer->RecvBatch(batch));
+      ASSERT_FALSE(batch.IsEmpty());
+      for (uint32_t i = 0; aCheck && i < batch.Length(); ++i) {
+        FillDatagram(received + i, data);
+        ASSERT_EQ(Span<const uint8_t>(data), batch.Data(i));
+      }
+      received += batch.Length();
+    }
+    ASSERT_EQ(kDatagrams, received);
+  }
+
+  void SendOneByOne() {
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kDatagrams; ++i) {
+      FillDatagram(i, data);
+      uint32_t written = 0;
+      ASSERT_NS_SUCCEEDED(mClient->SendWithAddress(
+          &mServerAddr, data.Elements(), data.Length(), &written));
+      ASSERT_EQ(data.Length(), written);
+    }
+  }
+
+  void ExchangeOneByOne() {
+    SendOneByOne();
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kDatagrams; ++i) {
+      NetAddr from;
+      data.Clear();
+      ASSERT_NS_SUCCEEDED(mServer->RecvWithAddr(&from, data));
+      ASSERT_EQ(DatagramSize(i), data.Length());
+    }
+  }
+
+  // A QUIC bulk transfer, as Http3Session sees it: each datagram received is
+  // copied into the array neqo takes, and every other one is acknowledged
+  // with a short datagram that the peer reads back.
+  void TransferBatched() {
+    UDPDatagramBatch batch;
+    UDPDatagramBatch acks;
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kDatagrams; ++i) {
+      FillDatagram(i, data);
+      ASSERT_TRUE(batch.Append(mServerAddr, data.Elements(), data.Length()));
+    }
+    uint64_t written = 0;
+    ASSERT_NS_SUCCEEDED(mClient->SendBatch(batch, &written));
+
+    uint8_t ack[kAckSize] = {};
+    uint32_t received = 0;
+    while (received < kDatagrams) {
+      ASSERT_NS_SUCCEEDED(mServer->RecvBatch(batch));
+      ASSERT_FALSE(batch.IsEmpty());
+      for (uint32_t i = 0; i < batch.Length(); ++i) {
+        Span<const uint8_t> datagram = batch.Data(i);
+        data.ClearAndRetainStorage();
+        data.AppendElements(datagram.Elements(), datagram.Length());
+        if (++received % 2 == 0) {
+          ASSERT_TRUE(acks.Append(mClientAddr, ack, sizeof(ack)));
+        }
+      }
+      ASSERT_NS_SUCCEEDED(mServer->SendBatch(acks, &written));
+      ASSERT_TRUE(acks.IsEmpty());
+    }
+
+    uint32_t acked = 0;
+    while (acked < kDatagrams / 2) {
+      ASSERT_NS_SUCCEEDED(mClient->RecvBatch(batch));
+      ASSERT_FALSE(batch.IsEmpty());
+      acked += batch.Length();
+    }
+  }
+
+  void TransferOneByOne() {
+    SendOneByOne();
+
+    uint8_t ack[kAckSize] = {};
+    nsTArray<uint8_t> data;
+    for (uint32_t i = 0; i < kDatagrams; ++i) {
+      NetAddr from;
+      data.Clear();
+      ASSERT_NS_SUCCEEDED(mServer->RecvWithAddr(&from, data));
+      ASSERT_EQ(DatagramSize(i), data.Length());
+      if (i % 2 == 1) {
+        uint32_t written = 0;
+        ASSERT_NS_SUCCEEDED(
+            mServer->SendWithAddress(&mClientAddr, ack, sizeof(ack), &written));
+      }
+    }
+
+    for (uint32_t i = 0; i < kDatagrams / 2; ++i) {
+      NetAddr from;
+      data.Clear();
+      ASSERT_NS_SUCCEEDED(mClient->RecvWithAddr(&from, data));
+      ASSERT_EQ(kAckSize, data.Length());
+    }
+  }
+
+  nsCOMPtr<nsIUDPSocket> mServer;
+  nsCOMPtr<nsIUDPSocket> mClient;
+  NetAddr mServerAddr;
+  NetAddr mClientAddr;
+  nsCOMPtr<nsIEventTarget> mSts;
+};
+
+TEST_F(TestUDPSocketBatch, SendRecv)
+{
+  OnSocketThread([this] {
+    ExchangeBatched(true);
+
+    // Nothing left to read.
+    UDPDatagramBatch batch;
+    ASSERT_NS_SUCCEEDED(mServer->RecvBatch(batch));
+    ASSERT_TRUE(batch.IsEmpty());
+
+    // Datagrams sent one at a time are received in batches too.
+    ExchangeBatched(true, /* aSendOneByOne */ true);
+  });
+}
+
+MOZ_GTEST_BENCH_F(TestUDPSocketBatch, Loopback_Batched, [this] {
+  OnSocketThread([this] {
+    for (uint32_t i = 0; i < kRounds; ++i) {
+      ExchangeBatched(false);
+    }
+  });
+});
+
+MOZ_GTEST_BENCH_F(TestUDPSocketBatch, Loopback_OneByOne, [this] {
+  OnSocketThread([this] {
+    for (uint32_t i = 0; i < kRounds; ++i) {
+      ExchangeOneByOne();
+    }
+  });
+});
+
+MOZ_GTEST_BENCH_F(TestUDPSocketBatch, Transfer_Batched, [this] {
+  OnSocketThread([this] {
+    for (uint32_t i = 0; i < kRounds; ++i) {
+      TransferBatched();
+    }
+  });
+});
+
+MOZ_GTEST_BENCH_F(TestUDPSocketBatch, Transfer_OneByOne, [this] {
+  OnSocketThread([this] {
+    for (uint32_t i = 0; i < kRounds; ++i) {
+      TransferOneByOne();
+    }
+  });
+});
@@ -0,0 +1,326 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+
+#include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/Monitor.h"
+#include "mozilla/Preferences.h"
+#include "mozilla/ScopeExit.h"
+#include "nsIThread.h"
+#include "nsString.h"
+#include "nsTArray.h"
+#include "nsTHashMap.h"
+#include "nsThreadUtils.h"
+#include "nsZipArchive.h"
+#include "zlib.h"
+
+using namespace mozilla;
+
+namespace {
+
+const uint32_t kZipEntrySize = 64 * 1024;
+const uint32_t kZipBigEntrySize = 4 * 1024 * 1024;
+
+void AppendZipUint16(nsTArray<uint8_t>& aOut, uint16_t aValue) {
+  aOut.AppendElement(aValue & 0xff);
+  aOut.AppendElement(aValue >> 8);
+}
+
+void AppendZipUint32(nsTArray<uint8_t>& aOut, uint32_t aValue) {
+  AppendZipUint16(aOut, aValue & 0xffff);
+  AppendZipUint16(aOut, aValue >> 16);
+}
+
+struct ZipTestEntry {
+  nsCString mName;
+  nsCString mData;
+};
+
+// Builds a zip archive in which every entry is deflated.
+nsTArray<uint8_t> MakeTestZip(const nsTArray<ZipTestEntry>& aEntries) {
+  nsTArray<uint8_t> zip;
+  nsTArray<uint8_t> central;
+
+  for (const ZipTestEntry& entry : aEntries) {
+    uint32_t size = entry.mData.Length();
+    const Bytef* data = reinterpret_cast<const Bytef*>(entry.mData.get());
+    uint32_t crc = crc32(crc32(0L, Z_NULL, 0), data, size);
+
+    nsTArray<uint8_t> deflated;
+    deflated.SetLength(compressBound(size));
+    z_stream zs{};
+    MOZ_RELEASE_ASSERT(deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS,
+                                    8, Z_DEFAULT_STRATEGY) == Z_OK);
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.avail_in = size;
+    zs.next_out = deflated.Elements();
+    zs.avail_out = deflated.Length();
+    MOZ_RELEASE_ASSERT(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+    deflated.SetLength(zs.total_out);
+    deflateEnd(&zs);
+
+    uint32_t localOffset = zip.Length();
+    AppendZipUint32(zip, 0x04034b50);
+    AppendZipUint16(zip, 20);  // version needed
+    AppendZipUint16(zip, 0);   // flags
+    AppendZipUint16(zip, Z_DEFLATED);
+    AppendZipUint32(zip, 0);  // time and date
+    AppendZipUint32(zip, crc);
+    AppendZipUint32(zip, deflated.Length());
+    AppendZipUint32(zip, size);
+    AppendZipUint16(zip, entry.mName.Length());
+    AppendZipUint16(zip, 0);  // extra field length
+    zip.AppendElements(entry.mName.get(), entry.mName.Length());
+    zip.AppendElements(deflated);
+
+    AppendZipUint32(central, 0x02014b50);
+    AppendZipUint16(central, 20);  // version made by
+    AppendZipUint16(central, 20);  // version needed
+    AppendZipUint16(central, 0);   // flags
+    AppendZipUint16(central, Z_DEFLATED);
+    AppendZipUint32(central, 0);  // time and date
+    AppendZipUint32(central, crc);
+    AppendZipUint32(central, deflated.Length());
+    AppendZipUint32(central, size);
+    AppendZipUint16(central, entry.mName.Length());
+    AppendZipUint16(central, 0);  // extra field length
+    AppendZipUint16(central, 0);  // comment length
+    AppendZipUint16(central, 0);  // disk number
+    AppendZipUint16(central, 0);  // internal attributes
+    AppendZipUint32(central, 0);  // external attributes
+    AppendZipUint32(central, localOffset);
+    central.AppendElements(entry.mName.get(), entry.mName.Length());
+  }
+
+  uint32_t centralOffset = zip.Length();
+  zip.AppendElements(central);
+  AppendZipUint32(zip, 0x06054b50);
+  AppendZipUint16(zip, 0);  // disk number
+  AppendZipUint16(zip, 0);  // disk with the central directory
+  AppendZipUint16(zip, aEntries.Length());
+  AppendZipUint16(zip, aEntries.Length());
+  AppendZipUint32(zip, central.Length());
+  AppendZipUint32(zip, centralOffset);
+  AppendZipUint16(zip, 0);  // comment length
+  return zip;
+}
+
+nsCString MakeZipTestData(uint32_t aSize, uint32_t aSeed) {
+  nsCString data;
+  data.SetLength(aSize);
+  char* chars = data.BeginWriting();
+  for (uint32_t i = 0; i < aSize; ++i) {
+    chars[i] = char('a' + (i * 7 + aSeed + i / 4096) % 26);
+  }
+  return data;
+}
+
+MozExternalRefCountType ZipHandleRefCount(nsZipHandle* aHandle) {
+  aHandle->AddRef();
+  return aHandle->Release();
+}
+
+}  // namespace
+
+class TestZipPrefetch : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    nsTArray<ZipTestEntry> entries;
+    uint32_t seed = 0;
+    for (const char* name : {"a", "b", "c", "d"}) {
+      entries.AppendElement(ZipTestEntry{
+          nsCString(name), MakeZipTestData(kZipEntrySize, seed++)});
+    }
+    entries.AppendElement(
+        ZipTestEntry{"big"_ns, MakeZipTestData(kZipBigEntrySize, seed++)});
+    for (const ZipTestEntry& entry : entries) {
+      mExpected.InsertOrUpdate(entry.mName, entry.mData);
+    }
+
+    mZipData = MakeTestZip(entries);
+    ASSERT_NS_SUCCEEDED(nsZipHandle::Init(
+        mZipData.Elements(), mZipData.Length(), getter_AddRefs(mHandle)));
+    mZip = nsZipArchive::OpenArchive(mHandle);
+    ASSERT_TRUE(mZip);
+
+    ASSERT_NS_SUCCEEDED(
+        NS_NewNamedThread("TestZipPrefetch", getter_AddRefs(mThread)));
+  }
+
+  void TearDown() override {
+    Unblock();
+    mThread->Shutdown();
+    mZip = nullptr;
+  }
+
+  // Keeps the prefetches dispatched to mThread queued until Unblock().
+  void Block() {
+    {
+      MonitorAutoLock lock(mMonitor);
+      mBlocked = true;
+    }
+    mThread->Dispatch(NS_NewRunnableFunction("TestZipPrefetch::Block", [this] {
+      MonitorAutoLock lock(mMonitor);
+      while (mBlocked) {
+        lock.Wait();
+      }
+    }));
+  }
+
+  void Unblock() {
+    MonitorAutoLock lock(mMonitor);
+    mBlocked = false;
+    lock.NotifyAll();
+  }
+
+  // Waits for the prefetches dispatched to mThread so far.
+  void Sync() {
+    NS_DispatchAndSpinEventLoopUntilComplete(
+        "TestZipPrefetch::Sync"_ns, mThread,
+        NS_NewRunnableFunction("TestZipPrefetch::Sync", [] {}));
+  }
+
+  void Prefetch(std::initializer_list<const char*> aNames) {
+    nsTArray<nsCString> names;
+    for (const char* name : aNames) {
+      names.AppendElement(name);
+    }
+    mZip->Prefetch(names, mThread);
+  }
+
+  void ExpectRead(const char* aName) {
+    nsZipItemPtr<char> item(mZip, nsDependentCString(aName), true);
+    const nsCString& expected = mExpected.Get(nsDependentCString(aName));
+    ASSERT_TRUE(item.Buffer());
+    ASSERT_EQ(item.Length(), expected.Length());
+    ASSERT_EQ(0, memcmp(item.Buffer(), expected.get(), expected.Length()));
+  }
+
+  nsTArray<uint8_t> mZipData;
+  nsTHashMap<nsCStringHashKey, nsCString> mExpected;
+  RefPtr<nsZipHandle> mHandle;
+  RefPtr<nsZipArchive> mZip;
+  nsCOMPtr<nsIThread> mThread;
+  Monitor mMonitor{"TestZipPrefetch::mMonitor"};
+  bool mBlocked MOZ_GUARDED_BY(mMonitor) = false;
+};
+
+TEST_F(TestZipPrefetch, PrefetchThenRead)
+{
+  Prefetch({"a", "b"});
+  Sync();
+  EXPECT_EQ(2 * kZipEntrySize, mZip->PrefetchedSize());
+
+  ExpectRead("a");
+  EXPECT_EQ(kZipEntrySize, mZip->PrefetchedSize());
+  ExpectRead("b");
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+
+  // Prefetched contents are handed out once, later reads inflate again.
+  ExpectRead("a");
+}
+
+TEST_F(TestZipPrefetch, ReadCancelsQueuedPrefetch)
+{
+  Block();
+  Prefetch({"a"});
+  EXPECT_EQ(kZipEntrySize, mZip->PrefetchedSize());
+
+  ExpectRead("a");
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+
+  // The cancelled prefetch finds nothing to do.
+  Unblock();
+  Sync();
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+}
+
+TEST_F(TestZipPrefetch, ReadRacingInflate)
+{
+  // Depending on timing, the read cancels the prefetch, waits for the
+  // inflate in progress, or takes its result. It gets the same data in each
+  // case.
+  for (uint32_t i = 0; i < 10; ++i) {
+    Block();
+    Prefetch({"big"});
+    Unblock();
+    ExpectRead("big");
+    Sync();
+    EXPECT_EQ(0u, mZip->PrefetchedSize());
+  }
+}
+
+TEST_F(TestZipPrefetch, Budget)
+{
+  ASSERT_NS_SUCCEEDED(Preferences::SetUint(
+      "network.jar.prefetch_max_size", 2 * kZipEntrySize + kZipEntrySize / 2));
+  auto restore = MakeScopeExit(
+      [] { Preferences::ClearUser("network.jar.prefetch_max_size"); });
+
+  // Only what fits in the budget is prefetched.
+  Prefetch({"a", "b", "c", "big"});
+  Sync();
+  EXPECT_EQ(2 * kZipEntrySize, mZip->PrefetchedSize());
+
+  // Reads give the budget back.
+  ExpectRead("a");
+  Prefetch({"c"});
+  Sync();
+  EXPECT_EQ(2 * kZipEntrySize, mZip->PrefetchedSize());
+  ExpectRead("b");
+  ExpectRead("c");
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+
+  // Lowering the budget below what is already prefetched stops prefetching,
+  // rather than wrapping around.
+  Prefetch({"a", "b"});
+  Sync();
+  ASSERT_NS_SUCCEEDED(Preferences::SetUint("network.jar.prefetch_max_size",
+                                           kZipEntrySize / 2));
+  Prefetch({"c", "d"});
+  Sync();
+  EXPECT_EQ(2 * kZipEntrySize, mZip->PrefetchedSize());
+  ExpectRead("a");
+  ExpectRead("b");
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+
+  ASSERT_NS_SUCCEEDED(Preferences::SetUint("network.jar.prefetch_max_size", 0));
+  Prefetch({"d"});
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+}
+
+TEST_F(TestZipPrefetch, ArchiveClosedWithPendingPrefetches)
+{
+  Block();
+  Prefetch({"a", "b", "big"});
+  EXPECT_EQ(2u, ZipHandleRefCount(mHandle));
+
+  // The pending prefetches keep the archive alive until they are done, and
+  // then release it along with what they inflated.
+  mZip = nullptr;
+  Unblock();
+  Sync();
+  EXPECT_EQ(1u, ZipHandleRefCount(mHandle));
+}
+
+TEST_F(TestZipPrefetch, EvictAfterMissWindow)
+{
+  Prefetch({"a", "b"});
+  Sync();
+  EXPECT_EQ(2 * kZipEntrySize, mZip->PrefetchedSize());
+
+  // A hit restarts the window.
+  ExpectRead("a");
+  for (uint32_t i = 0; i < nsZipArchive::kPrefetchMissWindow - 1; ++i) {
+    ExpectRead("c");
+  }
+  EXPECT_EQ(kZipEntrySize, mZip->PrefetchedSize());
+
+  ExpectRead("c");
+  EXPECT_EQ(0u, mZip->PrefetchedSize());
+  ExpectRead("b");
+}
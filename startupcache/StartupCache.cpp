@@ -69,7 +69,7 @@ StartupCache::CollectReports(nsIHandleReportCallback* aHandleReport,
   MutexAutoLock lock(mTableLock);
   MOZ_COLLECT_REPORT(
       "explicit/startup-cache/mapping", KIND_NONHEAP, UNITS_BYTES,
-      mCacheData.nonHeapSizeOfExcludingThis(),
+      MappingSize(),
       "Memory used to hold the mapping of the startup cache from file. "
       "This memory is likely to be swapped out shortly after start-up.");
 
@@ -78,10 +78,25 @@ StartupCache::CollectReports(nsIHandleReportCallback* aHandleReport,
                      "Memory used by the startup cache for things other than "
                      "the file mapping.");
 
+  size_t mapped = 0;
+  size_t heap = 0;
+  EntriesSize(&mapped, &heap);
+
+  MOZ_COLLECT_REPORT(
+      "startup-cache-entries/shared", KIND_OTHER, UNITS_BYTES, mapped,
+      "Size of the startup cache entries in use that are read straight from "
+      "the mapping of the cache file. This memory is shared with the file "
+      "system cache, and can be reclaimed by the OS.");
+
+  MOZ_COLLECT_REPORT(
+      "startup-cache-entries/private", KIND_OTHER, UNITS_BYTES, heap,
+      "Size of the startup cache entries in use that live in the heap, "
+      "because they were decompressed or added during this session.");
+
   return NS_OK;
 }
 
-static const uint8_t MAGIC[] = "startupcache0002";
+static const uint8_t MAGIC[] = "startupcache0003";
 // This is a heuristic value for how much to reserve for mTable to avoid
 // rehashing. This is not a hard limit in release builds, but it is in
 // debug builds as it should be stable. If we exceed this number we should
@@ -91,6 +106,15 @@ static const size_t STARTUP_CACHE_RESERVE_CAPACITY = 450;
 // have some bug causing runaway cache growth.
 static const size_t STARTUP_CACHE_MAX_CAPACITY = 5000;
 
+// Entries are only stored compressed if that makes them at least this many
+// times smaller. Others are stored as is, so that they can be used straight
+// from the mapping of the cache file.
+static const uint32_t STARTUP_CACHE_MIN_COMPRESSION_RATIO = 2;
+// Entries start at offsets that are multiples of this, so that stored entries
+// are as aligned in the mapping as they would be in the heap. Some consumers,
+// like the JS bytecode decoder, rely on that.
+static const size_t STARTUP_CACHE_ENTRY_ALIGNMENT = 16;
+
 // Not const because we change it for gtests.
 static uint8_t STARTUP_CACHE_WRITE_TIMEOUT = 60;
 
@@ -111,6 +135,11 @@ static inline Result<Ok, nsresult> Seek(PRFileDesc* fd, int32_t offset) {
   return Ok();
 }
 
+static inline size_t AlignEntryOffset(size_t aOffset) {
+  return (aOffset + STARTUP_CACHE_ENTRY_ALIGNMENT - 1) &
+         ~(STARTUP_CACHE_ENTRY_ALIGNMENT - 1);
+}
+
 static nsresult MapLZ4ErrorToNsresult(size_t aError) {
   return NS_ERROR_FAILURE;
 }
@@ -161,10 +190,12 @@ bool StartupCache::gFoundDiskCacheOnInit;
 NS_IMPL_ISUPPORTS(StartupCache, nsIMemoryReporter)
 
 StartupCache::StartupCache()
-    : mTableLock("StartupCache::mTableLock"),
+    : mCacheData(MakeUnique<loader::AutoMemMap>()),
+      mTableLock("StartupCache::mTableLock"),
       mDirty(false),
       mWrittenOnce(false),
       mCurTableReferenced(false),
+      mCurMappingReferenced(false),
       mRequestedCount(0),
       mCacheEntriesBaseOffset(0) {}
 
@@ -255,7 +286,7 @@ void StartupCache::StartPrefetchMemory() {
   }
   NS_DispatchBackgroundTask(NewRunnableMethod<uint8_t*, size_t>(
       "StartupCache::ThreadedPrefetch", this, &StartupCache::ThreadedPrefetch,
-      mCacheData.get<uint8_t>().get(), mCacheData.size()));
+      mCacheData->get<uint8_t>().get(), mCacheData->size()));
 }
 
 /**
@@ -265,8 +296,8 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
   MOZ_ASSERT(NS_IsMainThread(), "Can only load startup cache on main thread");
   if (gIgnoreDiskCache) return Err(NS_ERROR_FAILURE);
 
-  MOZ_TRY(mCacheData.init(mFile));
-  auto size = mCacheData.size();
+  MOZ_TRY(mCacheData->init(mFile));
+  auto size = mCacheData->size();
   if (CanPrefetchMemory()) {
     StartPrefetchMemory();
   }
@@ -276,7 +307,7 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
     return Err(NS_ERROR_UNEXPECTED);
   }
 
-  auto data = mCacheData.get<uint8_t>();
+  auto data = mCacheData->get<uint8_t>();
   auto end = data + size;
 
   MMAP_FAULT_HANDLER_BEGIN_BUFFER(data.get(), size)
@@ -295,9 +326,14 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
   }
 
   Range<const uint8_t> header(data, data + headerSize);
-  data += headerSize;
 
-  mCacheEntriesBaseOffset = sizeof(MAGIC) + sizeof(headerSize) + headerSize;
+  mCacheEntriesBaseOffset =
+      AlignEntryOffset(sizeof(MAGIC) + sizeof(headerSize) + headerSize);
+  if (mCacheEntriesBaseOffset > size) {
+    MOZ_ASSERT(false, "StartupCache file is corrupt.");
+    return Err(NS_ERROR_UNEXPECTED);
+  }
+  data = mCacheData->get<uint8_t>() + mCacheEntriesBaseOffset;
   {
     if (!mTable.reserve(STARTUP_CACHE_RESERVE_CAPACITY)) {
       return Err(NS_ERROR_UNEXPECTED);
@@ -306,7 +342,7 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
       mTableLock.AssertCurrentThreadOwns();
       WaitOnPrefetch();
       mTable.clear();
-      mCacheData.reset();
+      mCacheData->reset();
     });
     loader::InputBuffer buf(header);
 
@@ -315,10 +351,12 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
       uint32_t offset = 0;
       uint32_t compressedSize = 0;
       uint32_t uncompressedSize = 0;
+      uint8_t compressed = 0;
       nsCString key;
       buf.codeUint32(offset);
       buf.codeUint32(compressedSize);
       buf.codeUint32(uncompressedSize);
+      buf.codeUint8(compressed);
       buf.codeString(key);
 
       if (offset + compressedSize > end - data) {
@@ -326,8 +364,13 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
         return Err(NS_ERROR_UNEXPECTED);
       }
 
+      if (!compressed && compressedSize != uncompressedSize) {
+        return Err(NS_ERROR_UNEXPECTED);
+      }
+
       // Make sure offsets match what we'd expect based on script ordering and
       // size, as a basic sanity check.
+      currentOffset = AlignEntryOffset(currentOffset);
       if (offset != currentOffset) {
         return Err(NS_ERROR_UNEXPECTED);
       }
@@ -341,9 +384,9 @@ Result<Ok, nsresult> StartupCache::LoadArchive() {
         return Err(NS_ERROR_UNEXPECTED);
       }
 
-      if (!mTable.add(
-              p, key,
-              StartupCacheEntry(offset, compressedSize, uncompressedSize))) {
+      if (!mTable.add(p, key,
+                      StartupCacheEntry(offset, compressedSize,
+                                        uncompressedSize, !!compressed))) {
         return Err(NS_ERROR_UNEXPECTED);
       }
     }
@@ -370,7 +413,7 @@ bool StartupCache::HasEntry(const char* id) {
 }
 
 nsresult StartupCache::GetBuffer(const char* id, const char** outbuf,
-                                 uint32_t* length)
+                                 uint32_t* length, BufferMode aMode)
     MOZ_NO_THREAD_SAFETY_ANALYSIS {
   AUTO_PROFILER_LABEL("StartupCache::GetBuffer", OTHER);
 
@@ -388,14 +431,23 @@ nsresult StartupCache::GetBuffer(const char* id, const char** outbuf,
   }
 
   auto& value = p->value();
-  if (value.mData) {
+  if (value.mData || (value.mMapped && aMode == BufferMode::Mapped)) {
+    label = glean::startup_cache::RequestsLabel::eHitmemory;
+  } else if (value.mMapped) {
+    // The entry was handed out in place before, copy it out of the mapping
+    // for this caller.
+    value.mData = UniqueFreePtr<char[]>(
+        reinterpret_cast<char*>(malloc(value.mUncompressedSize)));
+    MMAP_FAULT_HANDLER_BEGIN_BUFFER(value.mMapped, value.mUncompressedSize)
+    memcpy(value.mData.get(), value.mMapped, value.mUncompressedSize);
+    MMAP_FAULT_HANDLER_CATCH(NS_ERROR_FAILURE)
     label = glean::startup_cache::RequestsLabel::eHitmemory;
   } else {
-    if (!mCacheData.initialized()) {
+    if (!mCacheData->initialized()) {
       return NS_ERROR_NOT_AVAILABLE;
     }
     // It is impossible for a write to be pending here. This is because
-    // we just checked mCacheData.initialized(), and this is reset before
+    // we just checked mCacheData->initialized(), and this is reset before
     // writing to the cache. It's not re-initialized unless we call
     // LoadArchive(), either from Init() (which must have already happened) or
     // InvalidateCache(). InvalidateCache() locks the mutex, so a write can't be
@@ -406,30 +458,47 @@ nsresult StartupCache::GetBuffer(const char* id, const char** outbuf,
     size_t totalRead = 0;
     size_t totalWritten = 0;
     Span<const char> compressed = Span(
-        mCacheData.get<char>().get() + mCacheEntriesBaseOffset + value.mOffset,
+        mCacheData->get<char>().get() + mCacheEntriesBaseOffset + value.mOffset,
         value.mCompressedSize);
-    value.mData = UniqueFreePtr<char[]>(reinterpret_cast<char*>(
-        malloc(sizeof(char) * value.mUncompressedSize)));
-    Span<char> uncompressed = Span(value.mData.get(), value.mUncompressedSize);
-    MMAP_FAULT_HANDLER_BEGIN_BUFFER(uncompressed.Elements(),
-                                    uncompressed.Length())
-    bool finished = false;
-    while (!finished) {
-      auto result = mDecompressionContext->Decompress(
-          uncompressed.From(totalWritten), compressed.From(totalRead));
-      if (NS_WARN_IF(result.isErr())) {
-        value.mData = nullptr;
-        MutexAutoUnlock unlock(mTableLock);
-        InvalidateCache();
-        return NS_ERROR_FAILURE;
+#ifndef XP_WIN
+    // Stored entries are used in place by callers that can handle faults. This
+    // isn't done on Windows, where the cache file can't be replaced while it
+    // is mapped: there the mapping has to go away before the cache is written
+    // again.
+    if (!value.mCompressed && aMode == BufferMode::Mapped) {
+      value.mMapped = compressed.Elements();
+      mCurMappingReferenced = true;
+    } else
+#endif
+    {
+      value.mData = UniqueFreePtr<char[]>(reinterpret_cast<char*>(
+          malloc(sizeof(char) * value.mUncompressedSize)));
+      Span<char> uncompressed =
+          Span(value.mData.get(), value.mUncompressedSize);
+      MMAP_FAULT_HANDLER_BEGIN_BUFFER(uncompressed.Elements(),
+                                      uncompressed.Length())
+      if (!value.mCompressed) {
+        memcpy(uncompressed.Elements(), compressed.Elements(),
+               uncompressed.Length());
+      }
+      bool finished = !value.mCompressed;
+      while (!finished) {
+        auto result = mDecompressionContext->Decompress(
+            uncompressed.From(totalWritten), compressed.From(totalRead));
+        if (NS_WARN_IF(result.isErr())) {
+          value.mData = nullptr;
+          MutexAutoUnlock unlock(mTableLock);
+          InvalidateCache();
+          return NS_ERROR_FAILURE;
+        }
+        auto decompressionResult = result.unwrap();
+        totalRead += decompressionResult.mSizeRead;
+        totalWritten += decompressionResult.mSizeWritten;
+        finished = decompressionResult.mFinished;
       }
-      auto decompressionResult = result.unwrap();
-      totalRead += decompressionResult.mSizeRead;
-      totalWritten += decompressionResult.mSizeWritten;
-      finished = decompressionResult.mFinished;
-    }
 
-    MMAP_FAULT_HANDLER_CATCH(NS_ERROR_FAILURE)
+      MMAP_FAULT_HANDLER_CATCH(NS_ERROR_FAILURE)
+    }
 
     label = glean::startup_cache::RequestsLabel::eHitdisk;
   }
@@ -445,7 +514,7 @@ nsresult StartupCache::GetBuffer(const char* id, const char** outbuf,
   // Track that something holds a reference into mTable, so we know to hold
   // onto it in case the cache is invalidated.
   mCurTableReferenced = true;
-  *outbuf = value.mData.get();
+  *outbuf = value.Data();
   *length = value.mUncompressedSize;
   return NS_OK;
 }
@@ -502,6 +571,77 @@ size_t StartupCache::HeapSizeOfIncludingThis(
   return n;
 }
 
+size_t StartupCache::MappingSize() const {
+  size_t n = mCacheData->size();
+  for (const auto& mapping : mOldMappings) {
+    n += mapping->size();
+  }
+  return n;
+}
+
+void StartupCache::EntriesSize(size_t* aMapped, size_t* aHeap) const {
+  auto addEntries = [&](const decltype(mTable)& aTable) {
+    for (auto iter = aTable.iter(); !iter.done(); iter.next()) {
+      const auto& value = iter.get().value();
+      if (value.mData) {
+        *aHeap += value.mUncompressedSize;
+      } else if (value.mMapped) {
+        *aMapped += value.mUncompressedSize;
+      }
+    }
+  };
+
+  addEntries(mTable);
+  for (const auto& table : mOldTables) {
+    addEntries(table);
+  }
+}
+
+void StartupCache::RetireMapping() {
+  if (mCurMappingReferenced) {
+    mOldMappings.AppendElement(std::move(mCacheData));
+    mCacheData = MakeUnique<loader::AutoMemMap>();
+    mCurMappingReferenced = false;
+  } else {
+    mCacheData->reset();
+  }
+}
+
+// Copies an entry that was used from a mapping into the heap. Returns false if
+// the mapping can't be read anymore.
+static bool CopyMappedEntry(StartupCacheEntry& aEntry) {
+  UniqueFreePtr<char[]> data(
+      reinterpret_cast<char*>(malloc(aEntry.mUncompressedSize)));
+  MMAP_FAULT_HANDLER_BEGIN_BUFFER(aEntry.mMapped, aEntry.mUncompressedSize)
+  memcpy(data.get(), aEntry.mMapped, aEntry.mUncompressedSize);
+  MMAP_FAULT_HANDLER_CATCH(false)
+  aEntry.mData = std::move(data);
+  return true;
+}
+
+void StartupCache::ReleaseOldMappings() {
+  if (mOldMappings.IsEmpty()) {
+    return;
+  }
+  MOZ_ASSERT(!mCurMappingReferenced);
+
+  // Entries of the current table can still be requested, and then get a copy.
+  // If the mapping can't be read anymore, they are treated as misses.
+  for (auto iter = mTable.iter(); !iter.done(); iter.next()) {
+    auto& value = iter.get().value();
+    if (value.mMapped && !value.mData) {
+      Unused << NS_WARN_IF(!CopyMappedEntry(value));
+    }
+    value.mMapped = nullptr;
+  }
+  for (auto& table : mOldTables) {
+    for (auto iter = table.iter(); !iter.done(); iter.next()) {
+      iter.get().value().mMapped = nullptr;
+    }
+  }
+  mOldMappings.Clear();
+}
+
 /**
  * WriteToDisk writes the cache out to disk. Callers of WriteToDisk need to call
  * WaitOnWriteComplete to make sure there isn't a write
@@ -513,15 +653,17 @@ Result<Ok, nsresult> StartupCache::WriteToDisk() {
     return Ok();
   }
 
+  // Entries used from the retired mappings are written out from them, and
+  // can't be used from them anymore once the cache has been written.
+  auto releaseMappings = MakeScopeExit([&]() {
+    mTableLock.AssertCurrentThreadOwns();
+    ReleaseOldMappings();
+  });
+
   if (!mFile) {
     return Err(NS_ERROR_UNEXPECTED);
   }
 
-  AutoFDClose raiiFd;
-  MOZ_TRY(mFile->OpenNSPRFileDesc(PR_WRONLY | PR_CREATE_FILE | PR_TRUNCATE,
-                                  0644, getter_Transfers(raiiFd)));
-  const auto fd = raiiFd.get();
-
   nsTArray<StartupCacheEntry::KeyValuePair> entries(mTable.count());
   for (auto iter = mTable.iter(); !iter.done(); iter.next()) {
     if (iter.get().value().mRequested) {
@@ -532,9 +674,22 @@ Result<Ok, nsresult> StartupCache::WriteToDisk() {
   }
 
   if (entries.IsEmpty()) {
+    // Nothing from the cache was used, so don't keep it around.
+    Unused << mFile->Remove(false);
     return Ok();
   }
 
+  // The new cache is written next to the current one, which then gets
+  // replaced. Entries handed out from the mapping of the current file stay
+  // valid that way.
+  nsAutoString leafName;
+  MOZ_TRY(mFile->GetLeafName(leafName));
+  nsAutoString tmpLeafName(leafName);
+  tmpLeafName.AppendLiteral(".tmp");
+  nsCOMPtr<nsIFile> tmpFile;
+  MOZ_TRY(mFile->Clone(getter_AddRefs(tmpFile)));
+  MOZ_TRY(tmpFile->SetLeafName(tmpLeafName));
+
   entries.Sort(StartupCacheEntry::Comparator());
   loader::OutputBuffer buf;
   for (auto& e : entries) {
@@ -543,68 +698,93 @@ Result<Ok, nsresult> StartupCache::WriteToDisk() {
     auto uncompressedSize = value->mUncompressedSize;
     // Set the mHeaderOffsetInFile so we can go back and edit the offset.
     value->mHeaderOffsetInFile = buf.cursor();
-    // Write a 0 offset/compressed size as a placeholder until we get the real
-    // offset after compressing.
+    // Write a 0 offset/compressed size/compressed flag as a placeholder until
+    // we get the real values after compressing.
     buf.codeUint32(0);
     buf.codeUint32(0);
     buf.codeUint32(uncompressedSize);
+    buf.codeUint8(0);
     buf.codeString(*key);
   }
 
-  uint8_t headerSize[4];
-  LittleEndian::writeUint32(headerSize, buf.cursor());
-
-  MOZ_TRY(Write(fd, MAGIC, sizeof(MAGIC)));
-  MOZ_TRY(Write(fd, headerSize, sizeof(headerSize)));
-  size_t headerStart = sizeof(MAGIC) + sizeof(headerSize);
-  size_t dataStart = headerStart + buf.cursor();
-  MOZ_TRY(Seek(fd, dataStart));
-
-  size_t offset = 0;
-
-  const size_t chunkSize = 1024 * 16;
-  LZ4FrameCompressionContext ctx(6,         /* aCompressionLevel */
-                                 chunkSize, /* aReadBufLen */
-                                 true,      /* aChecksum */
-                                 true);     /* aStableSrc */
-  size_t writeBufLen = ctx.GetRequiredWriteBufferLength();
-  auto writeBuffer = MakeUnique<char[]>(writeBufLen);
-  auto writeSpan = Span(writeBuffer.get(), writeBufLen);
+  {
+    AutoFDClose raiiFd;
+    MOZ_TRY(tmpFile->OpenNSPRFileDesc(PR_WRONLY | PR_CREATE_FILE | PR_TRUNCATE,
+                                      0644, getter_Transfers(raiiFd)));
+    const auto fd = raiiFd.get();
+
+    uint8_t headerSize[4];
+    LittleEndian::writeUint32(headerSize, buf.cursor());
+
+    MOZ_TRY(Write(fd, MAGIC, sizeof(MAGIC)));
+    MOZ_TRY(Write(fd, headerSize, sizeof(headerSize)));
+    size_t headerStart = sizeof(MAGIC) + sizeof(headerSize);
+    size_t dataStart = AlignEntryOffset(headerStart + buf.cursor());
+
+    size_t offset = 0;
+
+    const size_t chunkSize = 1024 * 16;
+    LZ4FrameCompressionContext ctx(6,         /* aCompressionLevel */
+                                   chunkSize, /* aReadBufLen */
+                                   true,      /* aChecksum */
+                                   true);     /* aStableSrc */
+    size_t writeBufLen = ctx.GetRequiredWriteBufferLength();
+    auto writeBuffer = MakeUnique<char[]>(writeBufLen);
+    auto writeSpan = Span(writeBuffer.get(), writeBufLen);
+    // Compressed entries are gathered here first, to find out whether they
+    // are worth storing compressed.
+    nsTArray<char> compressed;
+
+    for (auto& e : entries) {
+      auto value = e.second;
+      const char* data = value->Data();
+      compressed.ClearAndRetainStorage();
+
+      Span<const char> result;
+      MOZ_TRY_VAR(result, ctx.BeginCompressing(writeSpan).mapErr(
+                              MapLZ4ErrorToNsresult));
+      compressed.AppendElements(result.Elements(), result.Length());
+
+      for (size_t i = 0; i < value->mUncompressedSize; i += chunkSize) {
+        size_t size = std::min(chunkSize, value->mUncompressedSize - i);
+        MOZ_TRY_VAR(result, ctx.ContinueCompressing(Span(data + i, size))
+                                .mapErr(MapLZ4ErrorToNsresult));
+        compressed.AppendElements(result.Elements(), result.Length());
+      }
 
-  for (auto& e : entries) {
-    auto value = e.second;
-    value->mOffset = offset;
-    Span<const char> result;
-    MOZ_TRY_VAR(result,
-                ctx.BeginCompressing(writeSpan).mapErr(MapLZ4ErrorToNsresult));
-    MOZ_TRY(Write(fd, result.Elements(), result.Length()));
-    offset += result.Length();
-
-    for (size_t i = 0; i < value->mUncompressedSize; i += chunkSize) {
-      size_t size = std::min(chunkSize, value->mUncompressedSize - i);
-      char* uncompressed = value->mData.get() + i;
-      MOZ_TRY_VAR(result, ctx.ContinueCompressing(Span(uncompressed, size))
-                              .mapErr(MapLZ4ErrorToNsresult));
-      MOZ_TRY(Write(fd, result.Elements(), result.Length()));
-      offset += result.Length();
+      MOZ_TRY_VAR(result,
+                  ctx.EndCompressing().mapErr(MapLZ4ErrorToNsresult));
+      compressed.AppendElements(result.Elements(), result.Length());
+
+      value->mCompressed =
+          compressed.Length() <=
+          value->mUncompressedSize / STARTUP_CACHE_MIN_COMPRESSION_RATIO;
+      Span<const char> stored =
+          value->mCompressed ? Span<const char>(compressed)
+                             : Span(data, value->mUncompressedSize);
+
+      offset = AlignEntryOffset(offset);
+      MOZ_TRY(Seek(fd, dataStart + offset));
+      MOZ_TRY(Write(fd, stored.Elements(), stored.Length()));
+      value->mOffset = offset;
+      value->mCompressedSize = stored.Length();
+      offset += stored.Length();
     }
 
-    MOZ_TRY_VAR(result, ctx.EndCompressing().mapErr(MapLZ4ErrorToNsresult));
-    MOZ_TRY(Write(fd, result.Elements(), result.Length()));
-    offset += result.Length();
-    value->mCompressedSize = offset - value->mOffset;
-    MOZ_TRY(Seek(fd, dataStart + offset));
+    for (auto& e : entries) {
+      auto value = e.second;
+      uint8_t* headerEntry = buf.Get() + value->mHeaderOffsetInFile;
+      LittleEndian::writeUint32(headerEntry, value->mOffset);
+      LittleEndian::writeUint32(headerEntry + sizeof(value->mOffset),
+                                value->mCompressedSize);
+      headerEntry[sizeof(value->mOffset) + sizeof(value->mCompressedSize) +
+                  sizeof(value->mUncompressedSize)] = value->mCompressed;
+    }
+    MOZ_TRY(Seek(fd, headerStart));
+    MOZ_TRY(Write(fd, buf.Get(), buf.cursor()));
   }
 
-  for (auto& e : entries) {
-    auto value = e.second;
-    uint8_t* headerEntry = buf.Get() + value->mHeaderOffsetInFile;
-    LittleEndian::writeUint32(headerEntry, value->mOffset);
-    LittleEndian::writeUint32(headerEntry + sizeof(value->mOffset),
-                              value->mCompressedSize);
-  }
-  MOZ_TRY(Seek(fd, headerStart));
-  MOZ_TRY(Write(fd, buf.Get(), buf.cursor()));
+  MOZ_TRY(tmpFile->RenameTo(nullptr, leafName));
 
   mDirty = false;
   mWrittenOnce = true;
@@ -618,6 +798,7 @@ void StartupCache::InvalidateCache(bool memoryOnly) {
   MutexAutoLock lock(mTableLock);
 
   mWrittenOnce = false;
+  RetireMapping();
   if (memoryOnly) {
     // This should only be called in tests.
     auto writeResult = WriteToDisk();
@@ -646,7 +827,6 @@ void StartupCache::InvalidateCache(bool memoryOnly) {
   }
   mRequestedCount = 0;
   if (!memoryOnly) {
-    mCacheData.reset();
     nsresult rv = mFile->Remove(false);
     if (NS_FAILED(rv) && rv != NS_ERROR_FILE_NOT_FOUND) {
       gIgnoreDiskCache = true;
@@ -675,7 +855,7 @@ void StartupCache::EnsureShutdownWriteComplete() {
   MutexAutoLock lock(mTableLock);
   // If we've already written or there's nothing to write,
   // we don't need to do anything. This is the common case.
-  if (mWrittenOnce || (mCacheData.initialized() && !ShouldCompactCache())) {
+  if (mWrittenOnce || (mCacheData->initialized() && !ShouldCompactCache())) {
     return;
   }
   // Otherwise, ensure the write happens. The timer should have been cancelled
@@ -685,7 +865,7 @@ void StartupCache::EnsureShutdownWriteComplete() {
   // MaybeWriteOffMainThread:
   WaitOnPrefetch();
   mDirty = true;
-  mCacheData.reset();
+  RetireMapping();
   // Most of this should be redundant given MaybeWriteOffMainThread should
   // have run before now.
 
@@ -759,7 +939,8 @@ void StartupCache::WriteTimeout(nsITimer* aTimer, void* aClosure) {
 void StartupCache::MaybeWriteOffMainThread() {
   {
     MutexAutoLock lock(mTableLock);
-    if (mWrittenOnce || (mCacheData.initialized() && !ShouldCompactCache())) {
+    if (mWrittenOnce ||
+        (mCacheData->initialized() && !ShouldCompactCache())) {
       return;
     }
   }
@@ -768,7 +949,7 @@ void StartupCache::MaybeWriteOffMainThread() {
   {
     MutexAutoLock lock(mTableLock);
     mDirty = true;
-    mCacheData.reset();
+    RetireMapping();
   }
 
   RefPtr<StartupCache> self = this;
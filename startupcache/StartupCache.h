@@ -72,6 +72,13 @@
  * words, it should be used as a cache only, and not a reliable persistent
  * store.
  *
+ * On disk, every entry is compressed on its own, or stored as is when
+ * compression doesn't save enough. The cache file is mapped read-only, and
+ * compressed entries are decompressed into the heap the first time they are
+ * requested. Stored entries are copied into the heap, unless the caller asks
+ * for BufferMode::Mapped: they are then handed out straight from the mapping,
+ * so that they only cost shared, reclaimable page cache memory.
+ *
  * Some utility functions are provided in StartupCacheUtils. These functions
  * wrap the buffers into object streams, which may be useful for serializing
  * objects. Note the above caution about multiply-referenced objects, though --
@@ -85,33 +92,49 @@ namespace mozilla {
 namespace scache {
 
 struct StartupCacheEntry {
+  // The data of the entry, once it has been decompressed or copied out of the
+  // cache file, or when it was put in the cache during this session.
   UniqueFreePtr<char[]> mData;
+  // The data of the entry, when it is used straight from the mapping of the
+  // cache file. The mapping is kept alive until the cache is written again.
+  const char* mMapped;
   uint32_t mOffset;
+  // Size of the entry in the file. For stored entries (!mCompressed), this is
+  // the same as mUncompressedSize.
   uint32_t mCompressedSize;
   uint32_t mUncompressedSize;
   int32_t mHeaderOffsetInFile;
   int32_t mRequestedOrder;
   bool mRequested;
+  bool mCompressed;
 
-  MOZ_IMPLICIT StartupCacheEntry(uint32_t aOffset, uint32_t aCompressedSize,
-                                 uint32_t aUncompressedSize)
+  StartupCacheEntry(uint32_t aOffset, uint32_t aCompressedSize,
+                    uint32_t aUncompressedSize, bool aCompressed)
       : mData(nullptr),
+        mMapped(nullptr),
         mOffset(aOffset),
         mCompressedSize(aCompressedSize),
         mUncompressedSize(aUncompressedSize),
         mHeaderOffsetInFile(0),
         mRequestedOrder(0),
-        mRequested(false) {}
+        mRequested(false),
+        mCompressed(aCompressed) {}
 
   StartupCacheEntry(UniqueFreePtr<char[]> aData, size_t aLength,
                     int32_t aRequestedOrder)
       : mData(std::move(aData)),
+        mMapped(nullptr),
         mOffset(0),
         mCompressedSize(0),
         mUncompressedSize(aLength),
         mHeaderOffsetInFile(0),
         mRequestedOrder(0),
-        mRequested(true) {}
+        mRequested(true),
+        mCompressed(false) {}
+
+  // The uncompressed data, or null if the entry hasn't been read from the
+  // cache file yet.
+  const char* Data() const { return mData ? mData.get() : mMapped; }
 
   // std::pair is not trivially move assignable/constructible, so make our own.
   struct KeyValuePair {
@@ -156,8 +179,20 @@ class StartupCache : public nsIMemoryReporter {
   // true if the archive has an entry for the buffer or not.
   bool HasEntry(const char* id);
 
+  enum class BufferMode {
+    // The buffer lives in the heap.
+    Copy,
+    // The buffer may point into the mapping of the cache file. The caller must
+    // only read it under MMAP_FAULT_HANDLER, since an I/O error or a
+    // truncated file turns into a fault, and must be done with it before the
+    // cache is written again. Once it is, the entry is copied into the heap
+    // for later callers.
+    Mapped,
+  };
+
   // Returns a buffer that was previously stored, caller does not take ownership
-  nsresult GetBuffer(const char* id, const char** outbuf, uint32_t* length);
+  nsresult GetBuffer(const char* id, const char** outbuf, uint32_t* length,
+                     BufferMode aMode = BufferMode::Copy);
 
   // Stores a buffer. Caller yields ownership.
   nsresult PutBuffer(const char* id, UniqueFreePtr<char[]>&& inbuf,
@@ -197,6 +232,14 @@ class StartupCache : public nsIMemoryReporter {
   size_t HeapSizeOfIncludingThis(mozilla::MallocSizeOf mallocSizeOf) const
       MOZ_REQUIRES(mTableLock);
 
+  // The size of the mappings of the cache file that are still in use.
+  size_t MappingSize() const MOZ_REQUIRES(mTableLock);
+
+  // The size of the entries handed out, split between those that are used
+  // straight from a mapping and those that live in the heap.
+  void EntriesSize(size_t* aMapped, size_t* aHeap) const
+      MOZ_REQUIRES(mTableLock);
+
   bool ShouldCompactCache() MOZ_REQUIRES(mTableLock);
   nsresult ResetStartupWriteTimerCheckingReadCount();
   nsresult ResetStartupWriteTimerAndLock();
@@ -225,6 +268,14 @@ class StartupCache : public nsIMemoryReporter {
   void WaitOnPrefetch();
   void StartPrefetchMemory() MOZ_REQUIRES(mTableLock);
 
+  // Unmaps the cache file, or keeps the mapping alive if entries have been
+  // handed out from it. Must be called before the cache file is rewritten.
+  void RetireMapping() MOZ_REQUIRES(mTableLock);
+  // Unmaps the retired mappings once the cache has been written again. Entries
+  // of the current table that pointed into them are copied into the heap, and
+  // those of the old tables are forgotten.
+  void ReleaseOldMappings() MOZ_REQUIRES(mTableLock);
+
   static nsresult InitSingleton();
   static void WriteTimeout(nsITimer* aTimer, void* aClosure);
   void MaybeWriteOffMainThread();
@@ -244,7 +295,11 @@ class StartupCache : public nsIMemoryReporter {
   nsTArray<decltype(mTable)> mOldTables MOZ_GUARDED_BY(mTableLock);
   size_t mAllowedInvalidationsCount;
   nsCOMPtr<nsIFile> mFile;
-  mozilla::loader::AutoMemMap mCacheData MOZ_GUARDED_BY(mTableLock);
+  UniquePtr<mozilla::loader::AutoMemMap> mCacheData MOZ_GUARDED_BY(mTableLock);
+  // Previous mappings of the cache file, which entries of the tables above
+  // may still point to. These are released after the next write.
+  nsTArray<UniquePtr<mozilla::loader::AutoMemMap>> mOldMappings
+      MOZ_GUARDED_BY(mTableLock);
   Mutex mTableLock;
 
   nsCOMPtr<nsIObserverService> mObserverService;
@@ -254,6 +309,7 @@ class StartupCache : public nsIMemoryReporter {
   bool mDirty MOZ_GUARDED_BY(mTableLock);
   bool mWrittenOnce MOZ_GUARDED_BY(mTableLock);
   bool mCurTableReferenced MOZ_GUARDED_BY(mTableLock);
+  bool mCurMappingReferenced MOZ_GUARDED_BY(mTableLock);
 
   uint32_t mRequestedCount;
   size_t mCacheEntriesBaseOffset;
@@ -21,6 +21,7 @@
 #include "prprf.h"
 #include "mozilla/gtest/MozAssertions.h"
 #include "mozilla/Maybe.h"
+#include "mozilla/MmapFaultHandler.h"
 #include "mozilla/Printf.h"
 #include "mozilla/UniquePtr.h"
 #include "mozilla/UniquePtrExtensions.h"
@@ -186,3 +187,70 @@ TEST_F(TestStartupCache, WriteObject) {
   EXPECT_NS_SUCCEEDED(rv);
   ASSERT_TRUE(outSpec.Equals(spec));
 }
+
+static bool MappedEquals(const char* aMapped, const nsTArray<char>& aExpected) {
+  MMAP_FAULT_HANDLER_BEGIN_BUFFER(aMapped, aExpected.Length())
+  return memcmp(aMapped, aExpected.Elements(), aExpected.Length()) == 0;
+  MMAP_FAULT_HANDLER_CATCH(false)
+}
+
+TEST_F(TestStartupCache, StoredAndCompressedEntries) {
+  nsresult rv;
+  StartupCache* sc = StartupCache::GetSingleton();
+  ASSERT_TRUE(sc);
+
+  // One entry that compresses well, and one that doesn't and ends up stored
+  // as is in the cache file.
+  const uint32_t len = 64 * 1024;
+  mozilla::UniqueFreePtr<char[]> compressible(static_cast<char*>(malloc(len)));
+  mozilla::UniqueFreePtr<char[]> incompressible(
+      static_cast<char*>(malloc(len)));
+  uint32_t state = 0x12345678;
+  for (uint32_t i = 0; i < len; i++) {
+    compressible[i] = char('a' + i % 7);
+    state = state * 1103515245 + 12345;
+    incompressible[i] = char(state >> 24);
+  }
+  nsTArray<char> expectedCompressible;
+  expectedCompressible.AppendElements(compressible.get(), len);
+  nsTArray<char> expectedIncompressible;
+  expectedIncompressible.AppendElements(incompressible.get(), len);
+
+  rv = sc->PutBuffer("compressible", std::move(compressible), len);
+  EXPECT_NS_SUCCEEDED(rv);
+  rv = sc->PutBuffer("incompressible", std::move(incompressible), len);
+  EXPECT_NS_SUCCEEDED(rv);
+
+  // Write the cache out and load it back from disk.
+  sc->InvalidateCache(true);
+
+  const char* outbuf;
+  uint32_t outlen;
+  rv = sc->GetBuffer("compressible", &outbuf, &outlen);
+  EXPECT_NS_SUCCEEDED(rv);
+  ASSERT_EQ(outlen, len);
+  EXPECT_EQ(0, memcmp(outbuf, expectedCompressible.Elements(), len));
+
+  // Callers that handle faults can use stored entries from the mapping.
+  const char* mapped;
+  rv = sc->GetBuffer("incompressible", &mapped, &outlen,
+                     StartupCache::BufferMode::Mapped);
+  EXPECT_NS_SUCCEEDED(rv);
+  ASSERT_EQ(outlen, len);
+  EXPECT_TRUE(MappedEquals(mapped, expectedIncompressible));
+
+  // Others get a copy.
+  rv = sc->GetBuffer("incompressible", &outbuf, &outlen);
+  EXPECT_NS_SUCCEEDED(rv);
+  ASSERT_EQ(outlen, len);
+  EXPECT_EQ(0, memcmp(outbuf, expectedIncompressible.Elements(), len));
+#ifndef XP_WIN
+  EXPECT_NE(outbuf, mapped);
+#endif
+
+  // Copies survive the cache being written again.
+  rv = sc->ResetStartupWriteTimerAndLock();
+  EXPECT_NS_SUCCEEDED(rv);
+  sc->InvalidateCache(true);
+  EXPECT_EQ(0, memcmp(outbuf, expectedIncompressible.Elements(), len));
+}
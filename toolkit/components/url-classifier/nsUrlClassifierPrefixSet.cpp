@@ -277,22 +277,57 @@ nsUrlClassifierPrefixSet::GetPrefixes(uint32_t* aCount, uint32_t** aPrefixes) {
   return NS_OK;
 }
 
-uint32_t nsUrlClassifierPrefixSet::BinSearch(uint32_t start, uint32_t end,
-                                             uint32_t target) const {
+// Returns the index of the last element of mIndexPrefixes that is not greater
+// than aTarget, which must not be less than the first one.
+uint32_t nsUrlClassifierPrefixSet::FindIndexPrefix(uint32_t aTarget) const {
   mLock.AssertCurrentThreadOwns();
+  MOZ_ASSERT(!mIndexPrefixes.IsEmpty() && mIndexPrefixes[0] <= aTarget);
+
+  // A binary search that halves the range without a branch on the comparison,
+  // which the processor can not predict for the random prefixes we look up.
+  // The condition compiles to a conditional move. The range may keep an
+  // element too many when it shrinks to the lower half, but that element is
+  // greater than aTarget and so never picked.
+  const uint32_t* base = mIndexPrefixes.Elements();
+  uint32_t length = mIndexPrefixes.Length();
+  while (length > 1) {
+    uint32_t half = length / 2;
+    base = base[half] <= aTarget ? base + half : base;
+    length -= half;
+  }
+  return base - mIndexPrefixes.Elements();
+}
 
-  while (start != end && end >= start) {
-    uint32_t i = start + ((end - start) >> 1);
-    uint32_t value = mIndexPrefixes[i];
-    if (value < target) {
-      start = i + 1;
-    } else if (value > target) {
-      end = i - 1;
-    } else {
-      return i;
+// Whether one of the running sums of aDeltas is aDiff.
+// static
+bool nsUrlClassifierPrefixSet::DeltasReach(const nsTArray<uint16_t>& aDeltas,
+                                           uint32_t aDiff) {
+  const uint16_t* deltas = aDeltas.Elements();
+  uint32_t length = aDeltas.Length();
+  uint32_t i = 0;
+
+  // Skip the blocks of deltas that all sum up to less than aDiff. Unlike
+  // subtracting the deltas one at a time, the additions of a block do not
+  // depend on each other, and the compiler vectorizes them.
+  for (; i + DELTAS_BLOCK <= length; i += DELTAS_BLOCK) {
+    uint32_t sum = 0;
+    for (uint32_t j = 0; j < DELTAS_BLOCK; j++) {
+      sum += deltas[i + j];
+    }
+    if (sum >= aDiff) {
+      break;
+    }
+    aDiff -= sum;
+  }
+
+  for (; aDiff > 0 && i < length; i++) {
+    if (deltas[i] > aDiff) {
+      return false;
     }
+    aDiff -= deltas[i];
   }
-  return end;
+
+  return aDiff == 0;
 }
 
 NS_IMETHODIMP
@@ -307,40 +342,21 @@ nsUrlClassifierPrefixSet::Contains(uint32_t aPrefix, bool* aFound) {
 
   uint32_t target = aPrefix;
 
-  // We want to do a "Price is Right" binary search, that is, we want to find
-  // the index of the value either equal to the target or the closest value
-  // that is less than the target.
-  //
+  // We want to find the index of the value either equal to the target or the
+  // closest value that is less than the target.
   if (target < mIndexPrefixes[0]) {
     return NS_OK;
   }
 
-  // |binsearch| does not necessarily return the correct index (when the
-  // target is not found) but rather it returns an index at least one away
-  // from the correct index.
-  // Because of this, we need to check if the target lies before the beginning
-  // of the indices.
-
-  uint32_t i = BinSearch(0, mIndexPrefixes.Length() - 1, target);
-  if (mIndexPrefixes[i] > target && i > 0) {
-    i--;
-  }
+  uint32_t i = FindIndexPrefix(target);
 
   // Now search through the deltas for the target.
   uint32_t diff = target - mIndexPrefixes[i];
 
   if (!mIndexDeltas.IsEmpty()) {
-    uint32_t deltaSize = mIndexDeltas[i].Length();
-    uint32_t deltaIndex = 0;
-
-    while (diff > 0 && deltaIndex < deltaSize) {
-      diff -= mIndexDeltas[i][deltaIndex];
-      deltaIndex++;
-    }
-  }
-
-  if (diff == 0) {
-    *aFound = true;
+    *aFound = DeltasReach(mIndexDeltas[i], diff);
+  } else {
+    *aFound = diff == 0;
   }
 
   return NS_OK;
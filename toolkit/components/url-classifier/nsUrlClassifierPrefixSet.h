@@ -54,14 +54,16 @@ class nsUrlClassifierPrefixSet final : public nsIUrlClassifierPrefixSet {
   virtual ~nsUrlClassifierPrefixSet() MOZ_REQUIRES(mLock);
 
   static const uint32_t DELTAS_LIMIT = 120;
+  // Number of deltas DeltasReach() sums up at once to skip them.
+  static const uint32_t DELTAS_BLOCK = 8;
   static const uint32_t MAX_INDEX_DIFF = (1 << 16);
   static const uint32_t PREFIXSET_VERSION_MAGIC = 1;
 
   void Clear() MOZ_REQUIRES(mLock);
   nsresult MakePrefixSet(const uint32_t* aArray, uint32_t aLength)
       MOZ_REQUIRES(mLock);
-  uint32_t BinSearch(uint32_t start, uint32_t end, uint32_t target) const
-      MOZ_REQUIRES(mLock);
+  uint32_t FindIndexPrefix(uint32_t aTarget) const MOZ_REQUIRES(mLock);
+  static bool DeltasReach(const nsTArray<uint16_t>& aDeltas, uint32_t aDiff);
   bool IsEmptyInternal() const MOZ_REQUIRES(mLock);
 
   // Lock to prevent races between the url-classifier thread (which does most
@@ -3,6 +3,9 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
+
+#include "gtest/MozGTestBench.h"
 #include "mozilla/Preferences.h"
 #include "nsString.h"
 #include "nsUrlClassifierPrefixSet.h"
@@ -85,3 +88,92 @@ TEST(URLClassifierPrefixSet, GetTargetPrefixWithSmallSet)
 
   RunTest(1000);
 }
+
+// Prefixes spread like the hashes of real lists, without the quadratic
+// duplicate check of RandomPrefixes(), so that sets of a few million prefixes
+// can be built.
+static void SpreadPrefixes(uint32_t N, nsTArray<uint32_t>& array) {
+  array.Clear();
+  array.SetCapacity(N);
+
+  // Any odd multiplier visits every 32 bit value once.
+  for (uint32_t i = 0; i < N; i++) {
+    array.AppendElement(i * 2654435761u);
+  }
+  array.Sort();
+}
+
+static void CheckContains(uint32_t aTestSize) {
+  RefPtr<nsUrlClassifierPrefixSet> prefixSet = new nsUrlClassifierPrefixSet();
+  nsTArray<uint32_t> array;
+  SpreadPrefixes(aTestSize, array);
+
+  nsresult rv = prefixSet->SetPrefixes(array.Elements(), array.Length());
+  ASSERT_NS_SUCCEEDED(rv);
+
+  for (uint32_t i = 0; i < array.Length(); i++) {
+    bool found = false;
+    ASSERT_NS_SUCCEEDED(prefixSet->Contains(array[i], &found));
+    ASSERT_TRUE(found);
+
+    // The values around each prefix, including those past the end of a delta
+    // chunk and before the first prefix.
+    for (uint32_t probe : {array[i] - 1, array[i] + 1}) {
+      bool expected = std::binary_search(array.begin(), array.end(), probe);
+      ASSERT_NS_SUCCEEDED(prefixSet->Contains(probe, &found));
+      ASSERT_EQ(expected, found);
+    }
+  }
+}
+
+TEST(URLClassifierPrefixSet, ContainsWithLargeSet)
+{
+  static const char prefKey[] = "browser.safebrowsing.prefixset_max_array_size";
+  mozilla::Preferences::SetUint(prefKey, 10000);
+
+  CheckContains(200000);
+}
+
+TEST(URLClassifierPrefixSet, ContainsWithSmallSet)
+{
+  static const char prefKey[] = "browser.safebrowsing.prefixset_max_array_size";
+  mozilla::Preferences::SetUint(prefKey, 10000);
+
+  CheckContains(1000);
+}
+
+// Millions of lookups of random prefixes, most of which are not in the set, as
+// for the fragments of the URLs a page loads.
+static void BenchContains(uint32_t aSetSize) {
+  RefPtr<nsUrlClassifierPrefixSet> prefixSet = new nsUrlClassifierPrefixSet();
+  nsTArray<uint32_t> array;
+  SpreadPrefixes(aSetSize, array);
+  ASSERT_NS_SUCCEEDED(
+      prefixSet->SetPrefixes(array.Elements(), array.Length()));
+
+  uint32_t found = 0;
+  uint32_t probe = 1;
+  for (uint32_t i = 0; i < 4000000; i++) {
+    // xorshift32
+    probe ^= probe << 13;
+    probe ^= probe >> 17;
+    probe ^= probe << 5;
+    bool contains = false;
+    prefixSet->Contains(i % 16 ? probe : array[probe % array.Length()],
+                        &contains);
+    found += contains;
+  }
+  ASSERT_LE(4000000u / 16, found);
+}
+
+MOZ_GTEST_BENCH(URLClassifierPrefixSet, ContainsLargeSetBench, [] {
+  mozilla::Preferences::SetUint("browser.safebrowsing.prefixset_max_array_size",
+                                512 * 1024);
+  BenchContains(2000000);
+});
+
+MOZ_GTEST_BENCH(URLClassifierPrefixSet, ContainsSmallSetBench, [] {
+  mozilla::Preferences::SetUint("browser.safebrowsing.prefixset_max_array_size",
+                                512 * 1024);
+  BenchContains(100000);
+});
@@ -198,6 +198,9 @@ nsresult nsXREDirProvider::SetProfile(nsIFile* aDir, nsIFile* aLocalDir) {
 
   mProfileDir = aDir;
   mProfileLocalDir = aLocalDir;
+
+  // Get a head start on reading prefs.js, which InitializeUserPrefs() needs.
+  mozilla::Preferences::StartReadingUserPrefs();
   return NS_OK;
 }
 
@@ -92,6 +92,7 @@
 #include "mozilla/AvailableMemoryTracker.h"
 #include "mozilla/ClearOnShutdown.h"
 #include "mozilla/CountingAllocatorBase.h"
+#include "mozilla/IOBatch.h"
 #ifdef MOZ_PHC
 #  include "mozilla/PHCManager.h"
 #endif
@@ -273,6 +274,8 @@ NS_InitXPCOM(nsIServiceManager** aResult, nsIFile* aBinDirectory,
 
   NS_InitAtomTable();
 
+  mozilla::IOBatch::Startup();
+
   // We don't have the arguments by hand here.  If logging has already been
   // initialized by a previous call to LogModule::Init with the arguments
   // passed, passing (0, nullptr) is alright here.
@@ -527,6 +530,8 @@ NS_InitMinimalXPCOM() {
   NS_LogInit();
   NS_InitAtomTable();
 
+  mozilla::IOBatch::Startup();
+
   // We don't have the arguments by hand here.  If logging has already been
   // initialized by a previous call to LogModule::Init with the arguments
   // passed, passing (0, nullptr) is alright here.
@@ -807,6 +812,8 @@ nsresult ShutdownXPCOM(nsIServiceManager* aServMgr) {
 
   nsLanguageAtomService::Shutdown();
 
+  mozilla::IOBatch::ShutdownThread();
+
   GkRust_Shutdown();
 
 #ifdef NS_FREE_PERMANENT_DATA
@@ -75,6 +75,28 @@ class ArenaAllocator {
     return p;
   }
 
+  /**
+   * Tries to grow the allocation |aPtr| of |aOldSize| bytes to |aNewSize|
+   * bytes without moving it. This only succeeds if |aPtr| is the most recent
+   * allocation out of the current arena, and the arena has enough room left.
+   * Otherwise, nothing is changed and the caller needs to allocate anew.
+   */
+  bool TryGrowInPlace(void* aPtr, size_t aOldSize, size_t aNewSize) {
+    MOZ_ASSERT(aNewSize >= aOldSize);
+    if (!mCurrent ||
+        uintptr_t(aPtr) + AlignedSize(aOldSize) != mCurrent->header.offset) {
+      return false;
+    }
+    const size_t extra = AlignedSize(aNewSize) - AlignedSize(aOldSize);
+    if (extra > mCurrent->Available()) {
+      return false;
+    }
+    if (extra) {
+      mCurrent->Allocate(extra);
+    }
+    return true;
+  }
+
   /**
    * Frees all entries. The allocator can be reused after this is called.
    *
@@ -9,6 +9,7 @@
 
 #include "mozilla/ArenaAllocator.h"
 #include "mozilla/CheckedInt.h"
+#include "mozilla/Span.h"
 #include "nsAString.h"
 
 /**
@@ -50,6 +51,127 @@ T* ArenaStrdup(const detail::nsTStringRepr<T>& aStr,
   return detail::DuplicateString(aStr.BeginReading(), aStr.Length(), aArena);
 }
 
+/**
+ * Builds a null-terminated string out of an arena, for code that assembles
+ * many transient strings (serializers, parsers) and would otherwise malloc a
+ * string buffer for each of them. The characters live as long as the arena.
+ * A result that needs to outlive the arena has to be copied out with
+ * AssignTo(), which does a single, exactly sized heap allocation.
+ *
+ * Growing first tries to extend the buffer in place, which works as long as
+ * nothing else is allocated out of the arena while the string is being built.
+ * Otherwise the characters are copied to a new, twice as large, arena
+ * allocation, and the old one is only reclaimed with the arena.
+ *
+ * Example usage:
+ *
+ *   ArenaAllocator<4096, 8> arena;
+ *   for (...) {
+ *     ArenaStringBuilder<char16_t, 4096, 8> builder(arena);
+ *     builder.Append(u"<"_ns);
+ *     builder.Append(name);
+ *     ...
+ *     Consume(builder.AsSpan());
+ *   }
+ */
+template <typename T, size_t ArenaSize, size_t Alignment = 1>
+class ArenaStringBuilder {
+  static_assert(Alignment >= alignof(T),
+                "The arena must return allocations aligned for T");
+
+ public:
+  explicit ArenaStringBuilder(ArenaAllocator<ArenaSize, Alignment>& aArena)
+      : mArena(aArena) {}
+
+  ArenaStringBuilder(const ArenaStringBuilder&) = delete;
+  ArenaStringBuilder& operator=(const ArenaStringBuilder&) = delete;
+
+  void Append(const T* aChars, size_t aLength) {
+    if (!aLength) {
+      return;
+    }
+    EnsureCapacity(CheckedInt<size_t>(mLength) + aLength);
+    memcpy(mChars + mLength, aChars, aLength * sizeof(T));
+    mLength += aLength;
+    mChars[mLength] = T(0);
+  }
+
+  void Append(Span<const T> aChars) { Append(aChars.data(), aChars.size()); }
+
+  void Append(const detail::nsTStringRepr<T>& aStr) {
+    Append(aStr.BeginReading(), aStr.Length());
+  }
+
+  void Append(T aChar) { Append(&aChar, 1); }
+
+  void Truncate() {
+    mLength = 0;
+    if (mChars) {
+      mChars[0] = T(0);
+    }
+  }
+
+  size_t Length() const { return mLength; }
+  bool IsEmpty() const { return mLength == 0; }
+
+  /**
+   * The characters built so far. The returned span stays valid until the next
+   * call to Append(), or until the arena is cleared.
+   */
+  Span<const T> AsSpan() const { return Span<const T>(Data(), mLength); }
+
+  /**
+   * Like AsSpan(), but null-terminated.
+   */
+  const T* get() const { return Data(); }
+
+  /**
+   * Copies the string out of the arena, for results that need to outlive it.
+   */
+  void AssignTo(nsTSubstring<T>& aDest) const { aDest.Assign(Data(), mLength); }
+
+ private:
+  const T* Data() const {
+    static const T kEmpty = T(0);
+    return mChars ? mChars : &kEmpty;
+  }
+
+  void EnsureCapacity(const CheckedInt<size_t>& aLength) {
+    // Leave room for the null terminator.
+    const CheckedInt<size_t> needed = aLength + 1;
+    MOZ_RELEASE_ASSERT(needed.isValid());
+    if (needed.value() <= mCapacity) {
+      return;
+    }
+
+    const size_t newCapacity =
+        std::max(needed.value(), std::max(mCapacity * 2, kMinCapacity));
+    const CheckedInt<size_t> newBytes =
+        CheckedInt<size_t>(newCapacity) * sizeof(T);
+    MOZ_RELEASE_ASSERT(newBytes.isValid());
+
+    if (mChars && mArena.TryGrowInPlace(mChars, mCapacity * sizeof(T),
+                                        newBytes.value())) {
+      mCapacity = newCapacity;
+      return;
+    }
+
+    T* chars = static_cast<T*>(mArena.Allocate(newBytes.value()));
+    if (mChars) {
+      memcpy(chars, mChars, (mLength + 1) * sizeof(T));
+    }
+    mChars = chars;
+    mCapacity = newCapacity;
+  }
+
+  static constexpr size_t kMinCapacity = 16;
+
+  ArenaAllocator<ArenaSize, Alignment>& mArena;
+  T* mChars = nullptr;
+  size_t mLength = 0;
+  size_t mCapacity = 0;
+};
+
 /**
  * Copies the source string and adds a null terminator. Source string does not
  * have to be null terminated.
@@ -0,0 +1,713 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_CompactTArray_h
+#define mozilla_CompactTArray_h
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "mozilla/ArrayIterator.h"
+#include "mozilla/Assertions.h"
+#include "mozilla/Attributes.h"
+#include "mozilla/BinarySearch.h"
+#include "mozilla/MemoryReporting.h"
+#include "mozilla/NotNull.h"
+#include "mozilla/Span.h"
+#include "mozilla/mozalloc.h"
+#include "nsTArray.h"
+
+namespace mozilla {
+
+// CompactTArray<E, N> is an infallible array with room for N elements inside
+// the object, for the many short-lived arrays that hold a handful of elements.
+//
+// Unlike AutoTArray, the length and capacity live in the object rather than
+// in a header in front of the elements, so an array that stays within its
+// inline capacity never touches the heap, and the object is only 8 bytes
+// larger than its inline storage. Moving an array that has spilled to the
+// heap steals its buffer; moving an inline array relocates its (at most N)
+// elements. Either way a move never allocates.
+//
+// The element access, search, sorting and mutation methods have the same
+// names, comparator protocol and relocation rules as nsTArray's, so code can
+// switch between the two by changing the declaration. The array is not
+// copyable; use Clone().
+template <class E, size_t N>
+class MOZ_GSL_OWNER CompactTArray {
+  static_assert(N > 0, "Use nsTArray for arrays without inline storage");
+
+ public:
+  using self_type = CompactTArray<E, N>;
+  using value_type = E;
+  using elem_type = E;
+  using size_type = size_t;
+  using index_type = size_t;
+  using iterator = ArrayIterator<value_type&, self_type>;
+  using const_iterator = ArrayIterator<const value_type&, self_type>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  static const index_type NoIndex = index_type(-1);
+
+ private:
+  using elem_traits = nsTArrayElementTraits<value_type>;
+  using relocation_type = typename nsTArray_RelocationStrategy<E>::Type;
+
+  static constexpr size_type kMaxCapacity =
+      std::min<size_type>(std::numeric_limits<uint32_t>::max(),
+                          std::numeric_limits<size_type>::max() / sizeof(E));
+  static_assert(N <= kMaxCapacity, "Inline capacity is too large");
+
+ public:
+  CompactTArray() = default;
+
+  explicit CompactTArray(size_type aCapacity) { SetCapacity(aCapacity); }
+
+  MOZ_IMPLICIT CompactTArray(std::initializer_list<E> aIL) {
+    AppendElements(aIL.begin(), aIL.size());
+  }
+
+  CompactTArray(self_type&& aOther) noexcept { MoveFrom(aOther); }
+
+  self_type& operator=(self_type&& aOther) noexcept {
+    if (this != &aOther) {
+      Clear();
+      MoveFrom(aOther);
+    }
+    return *this;
+  }
+
+  CompactTArray(const self_type&) = delete;
+  self_type& operator=(const self_type&) = delete;
+
+  ~CompactTArray() {
+    DestructRange(0, mLength);
+    FreeHeapBuffer();
+  }
+
+  [[nodiscard]] self_type Clone() const {
+    self_type result;
+    result.AppendElements(Elements(), Length());
+    return result;
+  }
+
+  //
+  // Accessor methods
+  //
+
+  [[nodiscard]] size_type Length() const { return mLength; }
+  [[nodiscard]] bool IsEmpty() const { return mLength == 0; }
+  [[nodiscard]] size_type Capacity() const { return mCapacity; }
+
+  // Whether the elements are stored inside the object. Moving such an array
+  // relocates its elements rather than handing a buffer over.
+  [[nodiscard]] bool UsesInlineStorage() const { return mCapacity == N; }
+
+  [[nodiscard]] value_type* Elements() {
+    return UsesInlineStorage() ? InlineElements() : mHeap;
+  }
+  [[nodiscard]] const value_type* Elements() const {
+    return UsesInlineStorage() ? InlineElements() : mHeap;
+  }
+
+  [[nodiscard]] value_type& ElementAt(index_type aIndex) {
+    if (MOZ_UNLIKELY(aIndex >= Length())) {
+      detail::InvalidArrayIndex_CRASH(aIndex, Length());
+    }
+    return Elements()[aIndex];
+  }
+  [[nodiscard]] const value_type& ElementAt(index_type aIndex) const {
+    if (MOZ_UNLIKELY(aIndex >= Length())) {
+      detail::InvalidArrayIndex_CRASH(aIndex, Length());
+    }
+    return Elements()[aIndex];
+  }
+
+  [[nodiscard]] value_type& SafeElementAt(index_type aIndex, value_type& aDef) {
+    return aIndex < Length() ? Elements()[aIndex] : aDef;
+  }
+  [[nodiscard]] const value_type& SafeElementAt(index_type aIndex,
+                                                const value_type& aDef) const {
+    return aIndex < Length() ? Elements()[aIndex] : aDef;
+  }
+
+  [[nodiscard]] value_type& operator[](index_type aIndex) {
+    return ElementAt(aIndex);
+  }
+  [[nodiscard]] const value_type& operator[](index_type aIndex) const {
+    return ElementAt(aIndex);
+  }
+
+  [[nodiscard]] value_type& LastElement() { return ElementAt(Length() - 1); }
+  [[nodiscard]] const value_type& LastElement() const {
+    return ElementAt(Length() - 1);
+  }
+
+  [[nodiscard]] value_type& SafeLastElement(value_type& aDef) {
+    return SafeElementAt(Length() - 1, aDef);
+  }
+  [[nodiscard]] const value_type& SafeLastElement(
+      const value_type& aDef) const {
+    return SafeElementAt(Length() - 1, aDef);
+  }
+
+  [[nodiscard]] iterator begin() { return iterator(*this, 0); }
+  [[nodiscard]] const_iterator begin() const {
+    return const_iterator(*this, 0);
+  }
+  [[nodiscard]] const_iterator cbegin() const { return begin(); }
+  [[nodiscard]] iterator end() { return iterator(*this, Length()); }
+  [[nodiscard]] const_iterator end() const {
+    return const_iterator(*this, Length());
+  }
+  [[nodiscard]] const_iterator cend() const { return end(); }
+  [[nodiscard]] reverse_iterator rbegin() { return reverse_iterator(end()); }
+  [[nodiscard]] const_reverse_iterator rbegin() const {
+    return const_reverse_iterator(end());
+  }
+  [[nodiscard]] reverse_iterator rend() { return reverse_iterator(begin()); }
+  [[nodiscard]] const_reverse_iterator rend() const {
+    return const_reverse_iterator(begin());
+  }
+
+  [[nodiscard]] bool operator==(const self_type& aOther) const {
+    if (Length() != aOther.Length()) {
+      return false;
+    }
+    for (index_type i = 0; i < Length(); ++i) {
+      if (!(Elements()[i] == aOther.Elements()[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+  [[nodiscard]] bool operator!=(const self_type& aOther) const {
+    return !operator==(aOther);
+  }
+
+  //
+  // Search methods, with the same semantics as nsTArray's.
+  //
+
+  template <class Item, class Comparator>
+  [[nodiscard]] bool Contains(const Item& aItem,
+                              const Comparator& aComp) const {
+    return IndexOf(aItem, 0, aComp) != NoIndex;
+  }
+
+  template <class Item>
+  [[nodiscard]] bool Contains(const Item& aItem) const {
+    return IndexOf(aItem) != NoIndex;
+  }
+
+  template <class Item, class Comparator>
+  [[nodiscard]] bool ContainsSorted(const Item& aItem,
+                                    const Comparator& aComp) const {
+    return BinaryIndexOf(aItem, aComp) != NoIndex;
+  }
+
+  template <class Item>
+  [[nodiscard]] bool ContainsSorted(const Item& aItem) const {
+    return BinaryIndexOf(aItem) != NoIndex;
+  }
+
+  template <class Item, class Comparator>
+  [[nodiscard]] index_type IndexOf(const Item& aItem, index_type aStart,
+                                   const Comparator& aComp) const {
+    ::detail::CompareWrapper<Comparator, Item> comp(aComp);
+
+    const value_type* iter = Elements() + aStart;
+    const value_type* iend = Elements() + Length();
+    for (; iter < iend; ++iter) {
+      if (comp.Equals(*iter, aItem)) {
+        return index_type(iter - Elements());
+      }
+    }
+    return NoIndex;
+  }
+
+  template <class Item>
+  [[nodiscard]] index_type IndexOf(const Item& aItem,
+                                   index_type aStart = 0) const {
+    return IndexOf(aItem, aStart, nsDefaultComparator<value_type, Item>());
+  }
+
+  template <class Item, class Comparator>
+  [[nodiscard]] index_type LastIndexOf(const Item& aItem, index_type aStart,
+                                       const Comparator& aComp) const {
+    ::detail::CompareWrapper<Comparator, Item> comp(aComp);
+
+    size_type endOffset = aStart >= Length() ? Length() : aStart + 1;
+    for (index_type i = endOffset; i > 0; --i) {
+      if (comp.Equals(Elements()[i - 1], aItem)) {
+        return i - 1;
+      }
+    }
+    return NoIndex;
+  }
+
+  template <class Item>
+  [[nodiscard]] index_type LastIndexOf(const Item& aItem,
+                                       index_type aStart = NoIndex) const {
+    return LastIndexOf(aItem, aStart, nsDefaultComparator<value_type, Item>());
+  }
+
+  template <class Item, class Comparator>
+  [[nodiscard]] index_type BinaryIndexOf(const Item& aItem,
+                                         const Comparator& aComp) const {
+    ::detail::CompareWrapper<Comparator, Item> comp(aComp);
+
+    size_t index;
+    bool found = BinarySearchIf(
+        Elements(), 0, Length(),
+        // The Compare() arguments are reversed, as in nsTArray.
+        [&](const value_type& aElement) {
+          return -comp.Compare(aElement, aItem);
+        },
+        &index);
+    return found ? index : NoIndex;
+  }
+
+  template <class Item>
+  [[nodiscard]] index_type BinaryIndexOf(const Item& aItem) const {
+    return BinaryIndexOf(aItem, nsDefaultComparator<value_type, Item>());
+  }
+
+  template <class Item, class Comparator>
+  [[nodiscard]] index_type IndexOfFirstElementGt(
+      const Item& aItem, const Comparator& aComp) const {
+    ::detail::CompareWrapper<Comparator, Item> comp(aComp);
+
+    size_t index;
+    BinarySearchIf(
+        Elements(), 0, Length(),
+        [&](const value_type& aElement) {
+          return comp.Compare(aElement, aItem) <= 0 ? 1 : -1;
+        },
+        &index);
+    return index;
+  }
+
+  template <class Item>
+  [[nodiscard]] index_type IndexOfFirstElementGt(const Item& aItem) const {
+    return IndexOfFirstElementGt(aItem,
+                                 nsDefaultComparator<value_type, Item>());
+  }
+
+  //
+  // Mutation methods
+  //
+
+  template <class Item>
+  NotNull<value_type*> AppendElement(Item&& aItem) {
+    EnsureCapacity(CheckedLength(1));
+    value_type* elem = Elements() + mLength;
+    elem_traits::Construct(elem, std::forward<Item>(aItem));
+    ++mLength;
+    return WrapNotNullUnchecked(elem);
+  }
+
+  NotNull<value_type*> AppendElement() { return AppendElements(1); }
+
+  template <class... Args>
+  NotNull<value_type*> EmplaceBack(Args&&... aArgs) {
+    EnsureCapacity(CheckedLength(1));
+    value_type* elem = Elements() + mLength;
+    elem_traits::Emplace(elem, std::forward<Args>(aArgs)...);
+    ++mLength;
+    return WrapNotNullUnchecked(elem);
+  }
+
+  // Appends aCount default-constructed elements.
+  NotNull<value_type*> AppendElements(size_type aCount) {
+    EnsureCapacity(CheckedLength(aCount));
+    value_type* elems = Elements() + mLength;
+    for (size_type i = 0; i < aCount; ++i) {
+      elem_traits::Construct(elems + i);
+    }
+    mLength += aCount;
+    return WrapNotNullUnchecked(elems);
+  }
+
+  template <class Item>
+  NotNull<value_type*> AppendElements(const Item* aArray,
+                                      size_type aArrayLen) {
+    EnsureCapacity(CheckedLength(aArrayLen));
+    value_type* elems = Elements() + mLength;
+    for (size_type i = 0; i < aArrayLen; ++i) {
+      elem_traits::Construct(elems + i, aArray[i]);
+    }
+    mLength += aArrayLen;
+    return WrapNotNullUnchecked(elems);
+  }
+
+  template <class Item, size_t Extent>
+  NotNull<value_type*> AppendElements(Span<Item, Extent> aSpan) {
+    return AppendElements(aSpan.Elements(), aSpan.Length());
+  }
+
+  // Moves the elements of aOther to the end of this array, leaving aOther
+  // empty. Takes aOther's heap buffer when this array is empty.
+  template <size_t M>
+  NotNull<value_type*> AppendElements(CompactTArray<E, M>&& aOther) {
+    if constexpr (M == N) {
+      if (IsEmpty() && !aOther.UsesInlineStorage()) {
+        *this = std::move(aOther);
+        return WrapNotNullUnchecked(Elements());
+      }
+    }
+    size_type otherLen = aOther.Length();
+    EnsureCapacity(CheckedLength(otherLen));
+    value_type* elems = Elements() + mLength;
+    relocation_type::RelocateNonOverlappingRegion(elems, aOther.Elements(),
+                                                  otherLen, sizeof(E));
+    mLength += otherLen;
+    aOther.mLength = 0;
+    aOther.Clear();
+    return WrapNotNullUnchecked(elems);
+  }
+
+  template <class Item>
+  NotNull<value_type*> InsertElementAt(index_type aIndex, Item&& aItem) {
+    value_type* elem = MakeRoomAt(aIndex);
+    elem_traits::Construct(elem, std::forward<Item>(aItem));
+    return WrapNotNullUnchecked(elem);
+  }
+
+  NotNull<value_type*> InsertElementAt(index_type aIndex) {
+    value_type* elem = MakeRoomAt(aIndex);
+    elem_traits::Construct(elem);
+    return WrapNotNullUnchecked(elem);
+  }
+
+  // Inserts aItem so that a sorted array stays sorted, after any elements
+  // that are equal to it.
+  template <class Item, class Comparator>
+  NotNull<value_type*> InsertElementSorted(Item&& aItem,
+                                           const Comparator& aComp) {
+    index_type index = IndexOfFirstElementGt(aItem, aComp);
+    return InsertElementAt(index, std::forward<Item>(aItem));
+  }
+
+  template <class Item>
+  NotNull<value_type*> InsertElementSorted(Item&& aItem) {
+    return InsertElementSorted(std::forward<Item>(aItem),
+                               nsDefaultComparator<value_type, Item>());
+  }
+
+  template <class Item>
+  NotNull<value_type*> ReplaceElementAt(index_type aIndex, Item&& aItem) {
+    value_type* elem = &ElementAt(aIndex);
+    elem_traits::Destruct(elem);
+    elem_traits::Construct(elem, std::forward<Item>(aItem));
+    return WrapNotNullUnchecked(elem);
+  }
+
+  void RemoveElementsAt(index_type aStart, size_type aCount) {
+    if (MOZ_UNLIKELY(aStart > Length())) {
+      detail::InvalidArrayIndex_CRASH(aStart, Length());
+    }
+    if (MOZ_UNLIKELY(aCount > Length() - aStart)) {
+      detail::InvalidArrayIndex_CRASH(aStart + aCount, Length());
+    }
+    DestructRange(aStart, aCount);
+    value_type* elems = Elements();
+    relocation_type::RelocateOverlappingRegion(
+        elems + aStart, elems + aStart + aCount, mLength - aStart - aCount,
+        sizeof(E));
+    mLength -= aCount;
+  }
+
+  void RemoveElementAt(index_type aIndex) { RemoveElementsAt(aIndex, 1); }
+
+  void RemoveLastElement() { RemoveElementsAt(Length() - 1, 1); }
+
+  [[nodiscard]] value_type PopLastElement() {
+    MOZ_ASSERT(!IsEmpty());
+    if (MOZ_UNLIKELY(IsEmpty())) {
+      detail::InvalidArrayIndex_CRASH(1, 0);
+    }
+    value_type elem = std::move(Elements()[mLength - 1]);
+    DestructRange(mLength - 1, 1);
+    --mLength;
+    return elem;
+  }
+
+  template <class Item, class Comparator>
+  bool RemoveElement(const Item& aItem, const Comparator& aComp) {
+    index_type i = IndexOf(aItem, 0, aComp);
+    if (i == NoIndex) {
+      return false;
+    }
+    RemoveElementsAt(i, 1);
+    return true;
+  }
+
+  template <class Item>
+  bool RemoveElement(const Item& aItem) {
+    return RemoveElement(aItem, nsDefaultComparator<value_type, Item>());
+  }
+
+  // Removes the last element that is equal to aItem from a sorted array.
+  template <class Item, class Comparator>
+  bool RemoveElementSorted(const Item& aItem, const Comparator& aComp) {
+    index_type index = IndexOfFirstElementGt(aItem, aComp);
+    if (index > 0 && aComp.Equals(ElementAt(index - 1), aItem)) {
+      RemoveElementsAt(index - 1, 1);
+      return true;
+    }
+    return false;
+  }
+
+  template <class Item>
+  bool RemoveElementSorted(const Item& aItem) {
+    return RemoveElementSorted(aItem, nsDefaultComparator<value_type, Item>());
+  }
+
+  // Removes the elements for which aPredicate returns true, and returns how
+  // many were removed.
+  template <typename Predicate>
+  size_type RemoveElementsBy(Predicate aPredicate) {
+    index_type j = 0;
+    const index_type len = Length();
+    value_type* const elements = Elements();
+    for (index_type i = 0; i < len; ++i) {
+      const bool result = aPredicate(elements[i]);
+
+      // Check that the array has not been modified by the predicate.
+      MOZ_DIAGNOSTIC_ASSERT(len == mLength && elements == Elements());
+
+      if (result) {
+        elem_traits::Destruct(elements + i);
+      } else {
+        if (j < i) {
+          relocation_type::RelocateNonOverlappingRegion(
+              elements + j, elements + i, 1, sizeof(value_type));
+        }
+        ++j;
+      }
+    }
+
+    mLength = j;
+    return len - j;
+  }
+
+  // Removes every element and goes back to the inline storage.
+  void Clear() {
+    ClearAndRetainStorage();
+    FreeHeapBuffer();
+  }
+
+  void ClearAndRetainStorage() {
+    DestructRange(0, mLength);
+    mLength = 0;
+  }
+
+  void SetLength(size_type aNewLen) {
+    if (aNewLen > Length()) {
+      AppendElements(aNewLen - Length());
+    } else {
+      TruncateLength(aNewLen);
+    }
+  }
+
+  void TruncateLength(size_type aNewLen) {
+    if (MOZ_UNLIKELY(aNewLen > Length())) {
+      detail::InvalidArrayIndex_CRASH(aNewLen, Length());
+    }
+    DestructRange(aNewLen, mLength - aNewLen);
+    mLength = aNewLen;
+  }
+
+  void SetCapacity(size_type aCapacity) { EnsureCapacity(aCapacity); }
+
+  // Shrinks the heap buffer to the length, or gives it up when the elements
+  // fit inline again.
+  void Compact() {
+    if (UsesInlineStorage() || mLength == mCapacity) {
+      return;
+    }
+    if (mLength > N) {
+      ReallocateHeapBuffer(mLength);
+      return;
+    }
+    // The inline buffer overlaps mHeap.
+    value_type* heap = mHeap;
+    relocation_type::RelocateNonOverlappingRegion(InlineElements(), heap,
+                                                  mLength, sizeof(E));
+    mCapacity = N;
+    free(heap);
+  }
+
+  void SwapElements(self_type& aOther) {
+    self_type temp(std::move(aOther));
+    aOther = std::move(*this);
+    *this = std::move(temp);
+  }
+
+  //
+  // Sorting, with the same semantics as nsTArray's.
+  //
+
+  template <class Comparator>
+  void Sort(const Comparator& aComp) {
+    static_assert(std::is_move_assignable_v<value_type>);
+    static_assert(std::is_move_constructible_v<value_type>);
+
+    ::detail::CompareWrapper<Comparator, value_type> comp(aComp);
+    auto compFn = [&comp](const auto& left, const auto& right) {
+      return comp.LessThan(left, right);
+    };
+    std::sort(Elements(), Elements() + Length(), compFn);
+    ::detail::AssertStrictWeakOrder(Elements(), Elements() + Length(), compFn);
+  }
+
+  void Sort() { Sort(nsDefaultComparator<value_type, value_type>()); }
+
+  template <class Comparator>
+  void StableSort(const Comparator& aComp) {
+    static_assert(std::is_move_assignable_v<value_type>);
+    static_assert(std::is_move_constructible_v<value_type>);
+
+    const ::detail::CompareWrapper<Comparator, value_type> comp(aComp);
+    auto compFn = [&comp](const auto& lhs, const auto& rhs) {
+      return comp.LessThan(lhs, rhs);
+    };
+    std::stable_sort(Elements(), Elements() + Length(), compFn);
+    ::detail::AssertStrictWeakOrder(Elements(), Elements() + Length(), compFn);
+  }
+
+  void StableSort() {
+    StableSort(nsDefaultComparator<value_type, value_type>());
+  }
+
+  //
+  // Memory reporting
+  //
+
+  // @return The heap memory used by the elements' buffer, which is 0 as long
+  // as they fit inline. As with nsTArray, anything hanging off the elements
+  // must be measured separately.
+  [[nodiscard]] size_t ShallowSizeOfExcludingThis(
+      MallocSizeOf aMallocSizeOf) const {
+    return UsesInlineStorage() ? 0 : aMallocSizeOf(mHeap);
+  }
+
+  [[nodiscard]] size_t ShallowSizeOfIncludingThis(
+      MallocSizeOf aMallocSizeOf) const {
+    return aMallocSizeOf(this) + ShallowSizeOfExcludingThis(aMallocSizeOf);
+  }
+
+ private:
+  template <class, size_t>
+  friend class CompactTArray;
+
+  value_type* InlineElements() {
+    return reinterpret_cast<value_type*>(mInlineBuffer);
+  }
+  const value_type* InlineElements() const {
+    return reinterpret_cast<const value_type*>(mInlineBuffer);
+  }
+
+  // Takes aOther's elements, leaving it empty. This array must be empty and
+  // use its inline storage.
+  void MoveFrom(self_type& aOther) {
+    MOZ_ASSERT(IsEmpty() && UsesInlineStorage());
+    if (aOther.UsesInlineStorage()) {
+      relocation_type::RelocateNonOverlappingRegion(
+          InlineElements(), aOther.InlineElements(), aOther.mLength,
+          sizeof(E));
+    } else {
+      mHeap = aOther.mHeap;
+      mCapacity = aOther.mCapacity;
+      aOther.mCapacity = N;
+    }
+    mLength = aOther.mLength;
+    aOther.mLength = 0;
+  }
+
+  size_type CheckedLength(size_type aExtra) const {
+    if (MOZ_UNLIKELY(aExtra > kMaxCapacity - mLength)) {
+      MOZ_CRASH("Exceeded maximum CompactTArray size");
+    }
+    return mLength + aExtra;
+  }
+
+  void EnsureCapacity(size_type aCapacity) {
+    if (MOZ_LIKELY(aCapacity <= mCapacity)) {
+      return;
+    }
+    if (MOZ_UNLIKELY(aCapacity > kMaxCapacity)) {
+      MOZ_CRASH("Exceeded maximum CompactTArray size");
+    }
+    // Grow geometrically, as nsTArray does.
+    size_type newCapacity =
+        std::max(aCapacity, std::min(size_type(mCapacity) * 2, kMaxCapacity));
+    ReallocateHeapBuffer(newCapacity);
+  }
+
+  MOZ_NEVER_INLINE void ReallocateHeapBuffer(size_type aCapacity) {
+    MOZ_ASSERT(aCapacity > N && aCapacity >= mLength);
+    auto* newElements =
+        static_cast<value_type*>(moz_xmalloc(aCapacity * sizeof(E)));
+    relocation_type::RelocateNonOverlappingRegion(newElements, Elements(),
+                                                  mLength, sizeof(E));
+    FreeHeapBuffer();
+    mHeap = newElements;
+    mCapacity = uint32_t(aCapacity);
+  }
+
+  void FreeHeapBuffer() {
+    if (!UsesInlineStorage()) {
+      free(mHeap);
+      mCapacity = N;
+    }
+  }
+
+  // Opens a gap at aIndex and returns it, for the caller to construct an
+  // element in.
+  value_type* MakeRoomAt(index_type aIndex) {
+    if (MOZ_UNLIKELY(aIndex > Length())) {
+      detail::InvalidArrayIndex_CRASH(aIndex, Length());
+    }
+    EnsureCapacity(CheckedLength(1));
+    value_type* elems = Elements();
+    relocation_type::RelocateOverlappingRegion(
+        elems + aIndex + 1, elems + aIndex, mLength - aIndex, sizeof(E));
+    ++mLength;
+    return elems + aIndex;
+  }
+
+  void DestructRange(index_type aStart, size_type aCount) {
+    value_type* iter = Elements() + aStart;
+    value_type* iend = iter + aCount;
+    for (; iter != iend; ++iter) {
+      elem_traits::Destruct(iter);
+    }
+  }
+
+  uint32_t mLength = 0;
+  // N while the elements are inline, and larger than N once they are on the
+  // heap.
+  uint32_t mCapacity = N;
+  union {
+    value_type* mHeap;
+    alignas(E) unsigned char mInlineBuffer[N * sizeof(E)];
+  };
+};
+
+}  // namespace mozilla
+
+#endif  // mozilla_CompactTArray_h
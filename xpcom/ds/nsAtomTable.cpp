@@ -5,12 +5,14 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include "mozilla/Assertions.h"
+#include "mozilla/Atomics.h"
 #include "mozilla/Attributes.h"
 #include "mozilla/HashFunctions.h"
 #include "mozilla/MemoryReporting.h"
 #include "mozilla/MruCache.h"
 #include "mozilla/RWLock.h"
 #include "mozilla/TextUtils.h"
+#include "mozilla/ThreadLocal.h"
 #include "mozilla/AppShutdown.h"
 #include "nsHashKeys.h"
 #include "nsThreadUtils.h"
@@ -174,6 +176,41 @@ struct AtomTableEntry : public PLDHashEntryHdr {
   nsAtom* MOZ_NON_OWNING_REF mAtom;
 };
 
+// Returns true if aAtom's chars are equal to the UTF-16 or UTF-8 string in
+// aKey.
+static bool AtomMatchesKey(const nsAtom* aAtom, const AtomTableKey& aKey) {
+  if (!aKey.mUTF8String) {
+    return aAtom->Equals(aKey.mUTF16String, aKey.mLength);
+  }
+
+  // A UTF-8 string is never shorter than its UTF-16 equivalent, and only has
+  // the same length if it is entirely ASCII. That's by far the most common case
+  // (CSS identifiers from Stylo, for example), and we can check it without
+  // decoding: a SIMD ASCII check, followed by a widening comparison that the
+  // compiler can vectorize since it doesn't exit early.
+  const uint32_t length = aAtom->GetLength();
+  if (aKey.mLength < length) {
+    return false;
+  }
+  if (aKey.mLength == length) {
+    if (!IsAscii(Span<const char>(aKey.mUTF8String, length))) {
+      return false;
+    }
+    const char16_t* chars = aAtom->GetUTF16String();
+    bool differ = false;
+    for (uint32_t i = 0; i < length; ++i) {
+      differ |= chars[i] != static_cast<unsigned char>(aKey.mUTF8String[i]);
+    }
+    return !differ;
+  }
+
+  bool err = false;
+  return (CompareUTF8toUTF16(
+              nsDependentCSubstring(aKey.mUTF8String, aKey.mLength),
+              nsDependentAtomString(aAtom), &err) == 0) &&
+         !err;
+}
+
 struct AtomCache : public MruCache<AtomTableKey, nsAtom*, AtomCache> {
   static HashNumber Hash(const AtomTableKey& aKey) { return aKey.mHash; }
   static bool Match(const AtomTableKey& aKey, const nsAtom* aVal) {
@@ -186,6 +223,53 @@ struct AtomCache : public MruCache<AtomTableKey, nsAtom*, AtomCache> {
 static AtomCache sRecentlyUsedSmallMainThreadAtoms;
 static AtomCache sRecentlyUsedLargeMainThreadAtoms;
 
+// Off-main-thread atomization, such as Stylo's parallel CSS parsing, keeps
+// looking up the same static atoms (tag names, attribute names, keywords...),
+// which makes all the threads contend on the locks of the same few subtables.
+// Static atoms are immortal and never leave the table, so each thread can
+// remember the ones it recently looked up and return them without taking any
+// lock. Dynamic atoms can't be cached like this without holding a reference,
+// since the GC deletes them as soon as their refcount drops to zero. For the
+// same reason, and because the subtables' storage moves when they grow,
+// looking dynamic atoms up without the subtable lock would need a way to defer
+// freeing both until no reader can see them, which we don't have.
+struct StaticAtomCache
+    : public MruCache<AtomTableKey, nsStaticAtom*, StaticAtomCache> {
+  static HashNumber Hash(const AtomTableKey& aKey) { return aKey.mHash; }
+  static bool Match(const AtomTableKey& aKey, const nsStaticAtom* aVal) {
+    return (aVal->hash() == aKey.mHash) && AtomMatchesKey(aVal, aKey);
+  }
+};
+
+// Each thread's cache is allocated the first time it atomizes something, and
+// lives until the process exits, since other threads may still point to their
+// cache when the atom table is shut down. The caches only point to static
+// atoms, which live as long. sStaticAtomCaches keeps them reachable for leak
+// checkers, and caps their number to keep threads that come and go from
+// piling them up; threads past the cap simply go without one.
+static const uint32_t kMaxStaticAtomCaches = 128;
+static MOZ_THREAD_LOCAL(StaticAtomCache*) sRecentlyUsedStaticAtoms;
+static StaticAtomCache* sStaticAtomCaches[kMaxStaticAtomCaches];
+static Atomic<uint32_t> sStaticAtomCacheCount;
+
+static StaticAtomCache* RecentlyUsedStaticAtoms() {
+  StaticAtomCache* cache = sRecentlyUsedStaticAtoms.get();
+  if (MOZ_LIKELY(cache)) {
+    return cache;
+  }
+  if (sStaticAtomCacheCount >= kMaxStaticAtomCaches) {
+    return nullptr;
+  }
+  uint32_t index = sStaticAtomCacheCount++;
+  if (index >= kMaxStaticAtomCaches) {
+    return nullptr;
+  }
+  cache = new StaticAtomCache();
+  sStaticAtomCaches[index] = cache;
+  sRecentlyUsedStaticAtoms.set(cache);
+  return cache;
+}
+
 // In order to reduce locking contention for concurrent atomization, we segment
 // the atom table into N subtables, each with a separate lock. If the hash
 // values we use to select the subtable are evenly distributed, this reduces the
@@ -301,16 +385,7 @@ static PLDHashNumber AtomTableGetHash(const void* aKey) {
 static bool AtomTableMatchKey(const PLDHashEntryHdr* aEntry, const void* aKey) {
   const AtomTableEntry* he = static_cast<const AtomTableEntry*>(aEntry);
   const AtomTableKey* k = static_cast<const AtomTableKey*>(aKey);
-
-  if (k->mUTF8String) {
-    bool err = false;
-    return (CompareUTF8toUTF16(nsDependentCSubstring(
-                                   k->mUTF8String, k->mUTF8String + k->mLength),
-                               nsDependentAtomString(he->mAtom), &err) == 0) &&
-           !err;
-  }
-
-  return he->mAtom->Equals(k->mUTF16String, k->mLength);
+  return AtomMatchesKey(he->mAtom, *k);
 }
 
 void nsAtomTable::AtomTableClearEntry(PLDHashTable* aTable,
@@ -491,6 +566,10 @@ void NS_InitAtomTable() {
 
   // We register static atoms immediately so they're available for use as early
   // as possible.
+  if (!sRecentlyUsedStaticAtoms.init()) {
+    MOZ_CRASH();
+  }
+
   gAtomTable = new nsAtomTable();
   gAtomTable->RegisterStaticAtoms(nsGkAtoms::sAtoms, nsGkAtoms::sAtomsLen);
   gStaticAtomsDone = true;
@@ -577,10 +656,20 @@ already_AddRefed<nsAtom> nsAtomTable::Atomize(const nsACString& aUTF8String) {
     CopyUTF8toUTF16(aUTF8String, str);
     return Atomize(str, HashString(str));
   }
+  StaticAtomCache* staticAtoms = RecentlyUsedStaticAtoms();
+  if (staticAtoms) {
+    if (auto p = staticAtoms->Lookup(key)) {
+      return do_AddRef(p.Data());
+    }
+  }
+
   nsAtomSubTable& table = SelectSubTable(key);
   {
     AutoReadLock lock(table.mLock);
     if (AtomTableEntry* he = table.Search(key)) {
+      if (staticAtoms && he->mAtom->IsStatic()) {
+        staticAtoms->Put(key, static_cast<nsStaticAtom*>(he->mAtom));
+      }
       return do_AddRef(he->mAtom);
     }
   }
@@ -614,10 +703,20 @@ already_AddRefed<nsAtom> NS_Atomize(const char16_t* aUTF16String) {
 already_AddRefed<nsAtom> nsAtomTable::Atomize(const nsAString& aUTF16String,
                                               uint32_t aHash) {
   AtomTableKey key(aUTF16String.Data(), aUTF16String.Length(), aHash);
+  StaticAtomCache* staticAtoms = RecentlyUsedStaticAtoms();
+  if (staticAtoms) {
+    if (auto p = staticAtoms->Lookup(key)) {
+      return do_AddRef(p.Data());
+    }
+  }
+
   nsAtomSubTable& table = SelectSubTable(key);
   {
     AutoReadLock lock(table.mLock);
     if (AtomTableEntry* he = table.Search(key)) {
+      if (staticAtoms && he->mAtom->IsStatic()) {
+        staticAtoms->Put(key, static_cast<nsStaticAtom*>(he->mAtom));
+      }
       return do_AddRef(he->mAtom);
     }
   }
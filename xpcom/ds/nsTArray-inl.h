@@ -468,6 +468,15 @@ nsTArray_base<Alloc, RelocationStrategy>::SwapArrayElements(
   typename nsTArray_base<Allocator, RelocationStrategy>::IsAutoArrayRestorer
       otherAutoRestorer(aOther, aElemAlign);
 
+  // If one array uses malloc'ed storage and has an auto buffer which is big
+  // enough for the elements of the other array, which uses its auto buffer,
+  // hand the malloc'ed storage over and only relocate the auto-buffered
+  // elements. This neither allocates nor needs temporary storage.
+  if (SwapWithAutoArrayBufferOf(aOther, aElemSize, aElemAlign) ||
+      aOther.SwapWithAutoArrayBufferOf(*this, aElemSize, aElemAlign)) {
+    return ActualAlloc::SuccessResult();
+  }
+
   // If neither array uses an auto buffer which is big enough to store the
   // other array's elements, then ensure that both arrays use malloc'ed storage
   // and swap their mHdr pointers.
@@ -489,13 +498,6 @@ nsTArray_base<Alloc, RelocationStrategy>::SwapArrayElements(
   // Swap the two arrays by copying, since at least one is using an auto
   // buffer which is large enough to hold all of the aOther's elements.  We'll
   // copy the shorter array into temporary storage.
-  //
-  // (We could do better than this in some circumstances.  Suppose we're
-  // swapping arrays X and Y.  X has space for 2 elements in its auto buffer,
-  // but currently has length 4, so it's using malloc'ed storage.  Y has length
-  // 2.  When we swap X and Y, we don't need to use a temporary buffer; we can
-  // write Y straight into X's auto buffer, write X's malloc'ed buffer on top
-  // of Y, and then switch X to using its auto buffer.)
 
   if (!ActualAlloc::Successful(
           EnsureCapacity<ActualAlloc>(aOther.Length(), aElemSize)) ||
@@ -557,6 +559,40 @@ nsTArray_base<Alloc, RelocationStrategy>::SwapArrayElements(
   return ActualAlloc::SuccessResult();
 }
 
+template <class Alloc, class RelocationStrategy>
+template <class Allocator>
+bool nsTArray_base<Alloc, RelocationStrategy>::SwapWithAutoArrayBufferOf(
+    nsTArray_base<Allocator, RelocationStrategy>& aOther, size_type aElemSize,
+    size_t aElemAlign) {
+  // If aOther's auto buffer can hold our elements, SwapArrayElements swaps by
+  // copying without allocating anyway, so leave that case alone.
+  if (HasEmptyHeader() || !IsAutoArray() || UsesAutoArrayBuffer() ||
+      !aOther.UsesAutoArrayBuffer() || aOther.Capacity() >= Length()) {
+    return false;
+  }
+
+  // Suppose we're swapping arrays X (this) and Y (aOther).  X has space for 2
+  // elements in its auto buffer, but currently has length 4, so it's using
+  // malloc'ed storage.  Y has length 2.  We can write Y straight into X's auto
+  // buffer, give X's malloc'ed buffer to Y, and switch X to using its auto
+  // buffer.
+  Header* autoBuf = GetAutoArrayBuffer(aElemAlign);
+  if (autoBuf->mCapacity < aOther.Length()) {
+    return false;
+  }
+
+  RelocationStrategy::RelocateNonOverlappingRegion(
+      autoBuf + 1, aOther.mHdr + 1, aOther.Length(), aElemSize);
+  autoBuf->mLength = aOther.Length();
+
+  // Both arrays are auto arrays, so the malloc'ed header keeps its
+  // mIsAutoArray bit (the IsAutoArrayRestorers in SwapArrayElements take care
+  // of it anyway).
+  aOther.mHdr = mHdr;
+  mHdr = autoBuf;
+  return true;
+}
+
 template <class Alloc, class RelocationStrategy>
 template <class Allocator>
 void nsTArray_base<Alloc, RelocationStrategy>::MoveInit(
@@ -583,6 +583,18 @@ class nsTArray_base {
   template <typename ActualAlloc>
   bool EnsureNotUsingAutoArrayBuffer(size_type aElemSize);
 
+  // Helper function for SwapArrayElements. If this array is an AutoTArray
+  // using malloc'ed storage whose built-in buffer is large enough for
+  // aOther's elements, and aOther uses its own built-in buffer which is too
+  // small for our elements, swaps the two arrays without allocating: aOther
+  // takes over our malloc'ed buffer, and aOther's elements are relocated into
+  // our built-in buffer. Returns false, leaving both arrays untouched, if
+  // that's not the case.
+  template <class Allocator>
+  bool SwapWithAutoArrayBufferOf(
+      nsTArray_base<Allocator, RelocationStrategy>& aOther, size_type aElemSize,
+      size_t aElemAlign);
+
   // Returns true if this nsTArray is an AutoTArray with a built-in buffer.
   bool IsAutoArray() const { return mHdr->mIsAutoArray; }
 
@@ -0,0 +1,451 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "mozilla/IOBatch.h"
+
+#include <algorithm>
+#include "mozilla/Atomics.h"
+#include "mozilla/Logging.h"
+#include "mozilla/ThreadLocal.h"
+#include "mozilla/UniquePtr.h"
+#include "private/pprio.h"
+
+#if defined(XP_LINUX) && __has_include(<linux/io_uring.h>)
+#  include <errno.h>
+#  include <linux/io_uring.h>
+#  include <stdlib.h>
+#  include <string.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#  if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#    define MOZ_HAVE_IO_URING
+#  endif
+#endif
+
+namespace mozilla {
+
+static LazyLogModule gIOBatchLog("IOBatch");
+#define LOG(args) MOZ_LOG(gIOBatchLog, LogLevel::Debug, args)
+
+#ifdef MOZ_HAVE_IO_URING
+
+namespace {
+
+// Number of submission queue entries. Larger batches are submitted in several
+// rounds.
+static const uint32_t kIOUringEntries = 64;
+
+// Set once creating a ring failed for a reason that won't go away (no kernel
+// support, blocked by seccomp...), so that other threads don't try again.
+static Atomic<bool, Relaxed> sIOUringUnavailable(false);
+
+// The most a single io_uring write may transfer. Only lowered by tests, to
+// make the kernel return short writes.
+static Atomic<uint32_t, Relaxed> sIOUringMaxWrite(UINT32_MAX);
+
+// A minimal io_uring, used synchronously: every submission is waited for
+// before returning. This only relies on the kernel ABI, not on liburing.
+class IOUring final {
+ public:
+  static IOUring* ForCurrentThread();
+  static void ShutdownThread();
+
+  ~IOUring();
+
+  // Perform |aOps|, storing each result in the operation and marking it as
+  // completed. If the ring fails, some operations may be left uncompleted for
+  // the caller to perform some other way.
+  void Run(Span<IOBatch::Op> aOps);
+
+ private:
+  IOUring() = default;
+  bool Init();
+  // Add an entry for what is left of |aOp| to the submission queue, without
+  // publishing it to the kernel.
+  void Queue(const IOBatch::Op& aOp, uint64_t aUserData, uint32_t* aTail);
+  static bool IsTransientError(int aErrno);
+  // Record the results of the completed operations, and count the
+  // completions in |aReaped|. A short write is queued again for the rest of
+  // its buffer if |aResubmit| is true, and left uncompleted otherwise.
+  // Returns the number of entries queued again.
+  uint32_t ReapCompletions(Span<IOBatch::Op> aOps, uint32_t* aReaped,
+                           bool aResubmit);
+  // Block until |aSubmitted| entries have completed.
+  void WaitForCompletions(Span<IOBatch::Op> aOps, uint32_t aSubmitted,
+                          uint32_t* aReaped);
+
+  int mFd = -1;
+
+  void* mSqRing = MAP_FAILED;
+  size_t mSqRingSize = 0;
+  void* mCqRing = MAP_FAILED;
+  io_uring_sqe* mSqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t mSqesSize = 0;
+
+  uint32_t mSqEntries = 0;
+  uint32_t* mSqHead = nullptr;
+  uint32_t* mSqTail = nullptr;
+  uint32_t mSqMask = 0;
+  uint32_t* mSqArray = nullptr;
+
+  uint32_t* mCqHead = nullptr;
+  uint32_t* mCqTail = nullptr;
+  uint32_t mCqMask = 0;
+  io_uring_cqe* mCqes = nullptr;
+};
+
+// The ring of each thread that ran a batch, created on first use. A thread
+// that fails to create one keeps sIOUringInitialized set, so that it doesn't
+// try again on every batch.
+static MOZ_THREAD_LOCAL(IOUring*) sIOUring;
+static MOZ_THREAD_LOCAL(bool) sIOUringInitialized;
+
+/* static */
+IOUring* IOUring::ForCurrentThread() {
+  if (!sIOUringInitialized.get()) {
+    sIOUringInitialized.set(true);
+    if (sIOUringUnavailable) {
+      return nullptr;
+    }
+    if (getenv("MOZ_DISABLE_IO_URING")) {
+      sIOUringUnavailable = true;
+      return nullptr;
+    }
+    UniquePtr<IOUring> ring(new IOUring());
+    if (ring->Init()) {
+      sIOUring.set(ring.release());
+    }
+  }
+  return sIOUring.get();
+}
+
+/* static */
+void IOUring::ShutdownThread() {
+  delete sIOUring.get();
+  sIOUring.set(nullptr);
+  sIOUringInitialized.set(false);
+}
+
+bool IOUring::Init() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  mFd = syscall(__NR_io_uring_setup, kIOUringEntries, &params);
+  if (mFd < 0) {
+    LOG(("IOUring: io_uring_setup failed [errno=%d]", errno));
+    // Running out of memory or of file descriptors may be transient, anything
+    // else is not.
+    if (errno != ENOMEM && errno != EMFILE && errno != ENFILE) {
+      sIOUringUnavailable = true;
+    }
+    return false;
+  }
+
+  // IORING_OP_READ and IORING_OP_WRITE came along with
+  // IORING_FEAT_RW_CUR_POS, in Linux 5.6.
+  const uint32_t kRequiredFeatures =
+      IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+  if ((params.features & kRequiredFeatures) != kRequiredFeatures) {
+    LOG(("IOUring: kernel is too old [features=%x]", params.features));
+    sIOUringUnavailable = true;
+    return false;
+  }
+
+  mSqRingSize = std::max<size_t>(
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  mSqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, mFd, IORING_OFF_SQ_RING);
+  if (mSqRing == MAP_FAILED) {
+    return false;
+  }
+  // With IORING_FEAT_SINGLE_MMAP, both rings share the same mapping.
+  mCqRing = mSqRing;
+
+  mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  mSqes = static_cast<io_uring_sqe*>(mmap(nullptr, mSqesSize,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, mFd,
+                                          IORING_OFF_SQES));
+  if (mSqes == MAP_FAILED) {
+    return false;
+  }
+
+  char* sq = static_cast<char*>(mSqRing);
+  mSqEntries = params.sq_entries;
+  mSqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+  mSqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+  mSqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  mSqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+  char* cq = static_cast<char*>(mCqRing);
+  mCqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+  mCqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+  mCqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  mCqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  LOG(("IOUring: created [fd=%d entries=%u]", mFd, mSqEntries));
+  return true;
+}
+
+IOUring::~IOUring() {
+  if (mSqes != MAP_FAILED) {
+    munmap(mSqes, mSqesSize);
+  }
+  if (mSqRing != MAP_FAILED) {
+    munmap(mSqRing, mSqRingSize);
+  }
+  if (mFd >= 0) {
+    close(mFd);
+  }
+}
+
+void IOUring::Queue(const IOBatch::Op& aOp, uint64_t aUserData,
+                    uint32_t* aTail) {
+  uint32_t index = *aTail & mSqMask;
+  io_uring_sqe* sqe = &mSqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = PR_FileDesc2NativeHandle(aOp.mFD);
+  sqe->user_data = aUserData;
+  mSqArray[index] = index;
+  ++*aTail;
+
+  uint32_t count = aOp.mCount - aOp.mTransferred;
+  switch (aOp.mType) {
+    case IOBatch::Op::Type::Read:
+      sqe->opcode = IORING_OP_READ;
+      break;
+    case IOBatch::Op::Type::Write:
+      sqe->opcode = IORING_OP_WRITE;
+      count = std::min<uint32_t>(count, sIOUringMaxWrite);
+      break;
+    case IOBatch::Op::Type::Sync:
+      sqe->opcode = IORING_OP_FSYNC;
+      // Wait for every previously submitted operation.
+      sqe->flags = IOSQE_IO_DRAIN;
+      return;
+  }
+  sqe->addr =
+      reinterpret_cast<uintptr_t>(static_cast<char*>(aOp.mBuffer) +
+                                  aOp.mTransferred);
+  sqe->len = count;
+  sqe->off = aOp.mOffset + aOp.mTransferred;
+}
+
+/* static */
+bool IOUring::IsTransientError(int aErrno) {
+  return aErrno == EINTR || aErrno == EAGAIN || aErrno == EBUSY;
+}
+
+uint32_t IOUring::ReapCompletions(Span<IOBatch::Op> aOps, uint32_t* aReaped,
+                                  bool aResubmit) {
+  uint32_t requeued = 0;
+  // Entries queued again are only published by the next io_uring_enter.
+  uint32_t sqTail = *mSqTail;
+  uint32_t head = *mCqHead;
+  uint32_t cqTail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+  while (head != cqTail) {
+    const io_uring_cqe& cqe = mCqes[head & mCqMask];
+    IOBatch::Op& op = aOps[cqe.user_data];
+    ++head;
+    ++*aReaped;
+
+    if (cqe.res < 0) {
+      op.mResult = -1;
+      op.mCompleted = true;
+      continue;
+    }
+    op.mTransferred += cqe.res;
+    // Like write(2), IORING_OP_WRITE may write less than it was given. Write
+    // the rest, as PR_Write does, unless the kernel made no progress at all.
+    if (op.mType == IOBatch::Op::Type::Write && cqe.res > 0 &&
+        op.mTransferred < op.mCount) {
+      if (aResubmit) {
+        Queue(op, cqe.user_data, &sqTail);
+        ++requeued;
+      }
+      continue;
+    }
+    op.mResult = op.mTransferred;
+    op.mCompleted = true;
+  }
+  __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+  __atomic_store_n(mSqTail, sqTail, __ATOMIC_RELEASE);
+  return requeued;
+}
+
+void IOUring::WaitForCompletions(Span<IOBatch::Op> aOps, uint32_t aSubmitted,
+                                 uint32_t* aReaped) {
+  while (*aReaped < aSubmitted) {
+    int ret = syscall(__NR_io_uring_enter, mFd, 0, 1, IORING_ENTER_GETEVENTS,
+                      nullptr, 0);
+    if (ret < 0 && !IsTransientError(errno)) {
+      // Returning would let the kernel write into buffers that the caller
+      // is about to free.
+      MOZ_CRASH("IOUring: can't wait for operations in flight");
+    }
+    ReapCompletions(aOps, aReaped, /* aResubmit */ false);
+  }
+}
+
+void IOUring::Run(Span<IOBatch::Op> aOps) {
+  size_t done = 0;
+  while (done < aOps.Length()) {
+    // The rest of a short write is submitted after the first part completes,
+    // so IOSQE_IO_DRAIN alone wouldn't make a sync wait for it. Syncs start a
+    // new submission instead, once everything before them is done.
+    const uint32_t maxCount =
+        std::min<size_t>(aOps.Length() - done, mSqEntries);
+    uint32_t count = 1;
+    while (count < maxCount &&
+           aOps[done + count].mType != IOBatch::Op::Type::Sync) {
+      ++count;
+    }
+
+    // We are the only producer, so the tail can be read without a barrier.
+    // Each operation has at most one entry in the ring at a time, so entries
+    // queued again for short writes always fit.
+    uint32_t tail = *mSqTail;
+    for (uint32_t i = 0; i < count; ++i) {
+      Queue(aOps[done + i], done + i, &tail);
+    }
+    __atomic_store_n(mSqTail, tail, __ATOMIC_RELEASE);
+
+    uint32_t queued = count;
+    uint32_t submitted = 0;
+    uint32_t reaped = 0;
+    while (reaped < queued) {
+      int ret = syscall(__NR_io_uring_enter, mFd, queued - submitted, 1,
+                        IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (ret < 0) {
+        if (!IsTransientError(errno)) {
+          LOG(("IOUring: io_uring_enter failed [errno=%d]", errno));
+          // Operations that are in flight use the caller's buffers, wait for
+          // them without submitting anything else. Then take back the entries
+          // that the kernel did not consume and let the caller do the rest,
+          // short writes included.
+          WaitForCompletions(aOps, submitted, &reaped);
+          __atomic_store_n(mSqTail,
+                           __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE),
+                           __ATOMIC_RELEASE);
+          return;
+        }
+        // Reap whatever completed and try again.
+        ret = 0;
+      }
+      submitted += ret;
+      queued += ReapCompletions(aOps, &reaped, /* aResubmit */ true);
+    }
+
+    done += count;
+  }
+}
+
+}  // namespace
+
+#endif  // MOZ_HAVE_IO_URING
+
+size_t IOBatch::Append(Op::Type aType, PRFileDesc* aFD, void* aBuffer,
+                       uint32_t aCount, int64_t aOffset) {
+  MOZ_ASSERT(aFD);
+  MOZ_ASSERT(aCount <= INT32_MAX);
+  MOZ_ASSERT(aOffset >= 0);
+  MOZ_ASSERT(!mHasRun, "Clear() the batch before reusing it");
+  mOps.AppendElement(
+      Op{aType, aFD, aBuffer, aCount, aOffset, 0, -1, false});
+  return mOps.Length() - 1;
+}
+
+size_t IOBatch::Read(PRFileDesc* aFD, void* aBuffer, uint32_t aCount,
+                     int64_t aOffset) {
+  return Append(Op::Type::Read, aFD, aBuffer, aCount, aOffset);
+}
+
+size_t IOBatch::Write(PRFileDesc* aFD, const void* aBuffer, uint32_t aCount,
+                      int64_t aOffset) {
+  return Append(Op::Type::Write, aFD, const_cast<void*>(aBuffer), aCount,
+                aOffset);
+}
+
+size_t IOBatch::Sync(PRFileDesc* aFD) {
+  return Append(Op::Type::Sync, aFD, nullptr, 0, 0);
+}
+
+void IOBatch::Run(Backend aBackend) {
+  MOZ_ASSERT(!mHasRun);
+  mHasRun = true;
+
+#ifdef MOZ_HAVE_IO_URING
+  if (aBackend == Backend::Default) {
+    if (IOUring* ring = IOUring::ForCurrentThread()) {
+      ring->Run(mOps);
+    }
+  }
+#endif
+  RunWithNSPR(mOps);
+}
+
+/* static */
+void IOBatch::RunWithNSPR(Span<Op> aOps) {
+  for (Op& op : aOps) {
+    if (op.mCompleted) {
+      continue;
+    }
+    op.mCompleted = true;
+    if (op.mType == Op::Type::Sync) {
+      op.mResult = PR_Sync(op.mFD) == PR_SUCCESS ? 0 : -1;
+      continue;
+    }
+    // Pick up where io_uring left a short write.
+    const int64_t offset = op.mOffset + op.mTransferred;
+    if (PR_Seek64(op.mFD, offset, PR_SEEK_SET) != offset) {
+      op.mResult = -1;
+      continue;
+    }
+    char* buffer = static_cast<char*>(op.mBuffer) + op.mTransferred;
+    const int32_t count = int32_t(op.mCount - op.mTransferred);
+    const int32_t result = op.mType == Op::Type::Read
+                               ? PR_Read(op.mFD, buffer, count)
+                               : PR_Write(op.mFD, buffer, count);
+    op.mResult = result < 0 ? -1 : int32_t(op.mTransferred) + result;
+  }
+}
+
+/* static */
+void IOBatch::Startup() {
+#ifdef MOZ_HAVE_IO_URING
+  if (!sIOUring.init() || !sIOUringInitialized.init()) {
+    MOZ_CRASH("Could not initialize IOBatch thread-local storage");
+  }
+#endif
+}
+
+/* static */
+void IOBatch::ShutdownThread() {
+#ifdef MOZ_HAVE_IO_URING
+  IOUring::ShutdownThread();
+#endif
+}
+
+/* static */
+void IOBatch::SetMaxIOUringWriteForTesting(uint32_t aMax) {
+#ifdef MOZ_HAVE_IO_URING
+  sIOUringMaxWrite = aMax;
+#endif
+}
+
+/* static */
+bool IOBatch::IsIOUringAvailable() {
+#ifdef MOZ_HAVE_IO_URING
+  return !!IOUring::ForCurrentThread();
+#else
+  return false;
+#endif
+}
+
+}  // namespace mozilla
+
+#undef LOG
@@ -0,0 +1,115 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef mozilla_IOBatch_h
+#define mozilla_IOBatch_h
+
+#include <cstddef>
+#include <cstdint>
+#include "mozilla/Assertions.h"
+#include "mozilla/Span.h"
+#include "nsTArray.h"
+#include "prio.h"
+
+namespace mozilla {
+
+/**
+ * A set of positional file operations that are performed together.
+ *
+ * On Linux, the operations are handed to the kernel in a single io_uring
+ * submission when possible, which saves a system call (and a seek) per
+ * operation and lets the kernel work on several of them at once. Otherwise --
+ * on other platforms, on kernels without io_uring, when it is blocked by a
+ * sandbox, or when MOZ_DISABLE_IO_URING is set in the environment -- they are
+ * performed one after the other through NSPR.
+ *
+ * Operations are independent and may complete in any order, except that a
+ * sync operation only starts once every operation queued before it is done.
+ *
+ * An IOBatch must only be used on one thread. File descriptors and buffers
+ * passed to it must stay alive until Run() returns.
+ */
+class IOBatch final {
+ public:
+  enum class Backend {
+    // io_uring when available, NSPR otherwise.
+    Default,
+    // Always NSPR.
+    NSPR,
+  };
+
+  IOBatch() = default;
+  IOBatch(const IOBatch&) = delete;
+  IOBatch& operator=(const IOBatch&) = delete;
+
+  // Each of these queues an operation and returns its index, to be passed to
+  // Result() once the batch has run. |aCount| must not exceed INT32_MAX.
+  size_t Read(PRFileDesc* aFD, void* aBuffer, uint32_t aCount,
+              int64_t aOffset);
+  size_t Write(PRFileDesc* aFD, const void* aBuffer, uint32_t aCount,
+               int64_t aOffset);
+  size_t Sync(PRFileDesc* aFD);
+
+  // Perform every queued operation, blocking until they are all done. The
+  // file position of the descriptors is unspecified afterwards.
+  void Run(Backend aBackend = Backend::Default);
+
+  // The number of bytes transferred by a read or write, 0 for a successful
+  // sync, or -1 if the operation failed. Like read(2), a read can transfer
+  // fewer bytes than requested at the end of a file. Both backends keep
+  // writing until the whole buffer is written, like PR_Write, so a write only
+  // transfers fewer bytes than requested if the file stops accepting data.
+  int32_t Result(size_t aIndex) const {
+    MOZ_ASSERT(mHasRun);
+    return mOps[aIndex].mResult;
+  }
+
+  size_t Length() const { return mOps.Length(); }
+
+  void Clear() {
+    mOps.Clear();
+    mHasRun = false;
+  }
+
+  // Whether Run() can use io_uring on the current thread.
+  static bool IsIOUringAvailable();
+
+  // Make each io_uring write transfer at most |aMax| bytes, so that tests
+  // can exercise short writes. UINT32_MAX restores the default.
+  static void SetMaxIOUringWriteForTesting(uint32_t aMax);
+
+  // Called once during XPCOM startup, before any batch runs.
+  static void Startup();
+  // Release what Run() set up for the calling thread. Threads that run
+  // batches must call this before they exit.
+  static void ShutdownThread();
+
+  struct Op {
+    enum class Type : uint8_t { Read, Write, Sync };
+
+    Type mType;
+    PRFileDesc* mFD;
+    void* mBuffer;
+    uint32_t mCount;
+    int64_t mOffset;
+    // Bytes already transferred, when io_uring returned a short write.
+    uint32_t mTransferred;
+    int32_t mResult;
+    bool mCompleted;
+  };
+
+ private:
+  size_t Append(Op::Type aType, PRFileDesc* aFD, void* aBuffer,
+                uint32_t aCount, int64_t aOffset);
+  static void RunWithNSPR(Span<Op> aOps);
+
+  AutoTArray<Op, 8> mOps;
+  bool mHasRun = false;
+};
+
+}  // namespace mozilla
+
+#endif  // mozilla_IOBatch_h
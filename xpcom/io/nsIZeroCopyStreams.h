@@ -0,0 +1,82 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef nsIZeroCopyStreams_h
+#define nsIZeroCopyStreams_h
+
+#include "mozilla/RefPtr.h"
+#include "mozilla/Span.h"
+#include "mozilla/StreamBufferSource.h"
+#include "nsISupports.h"
+
+/**
+ * An input stream that can hand out its buffered data as refcounted,
+ * read-only views instead of copying it into a caller-provided buffer.
+ *
+ * This is a C++-only companion to nsIInputStream: both ways of reading can be
+ * mixed freely on the same stream.
+ */
+#define NS_IZEROCOPYINPUTSTREAM_IID \
+  {0xa5e7f431, 0x5c20, 0x476b, {0x9c, 0x7a, 0xe6, 0x82, 0xd3, 0x2e, 0xf9, 0xa0}}
+
+class NS_NO_VTABLE nsIZeroCopyInputStream : public nsISupports {
+ public:
+  NS_INLINE_DECL_STATIC_IID(NS_IZEROCOPYINPUTSTREAM_IID)
+
+  /**
+   * Consume the next contiguous chunk of buffered data and return it in
+   * |aView|. The view stays valid for as long as it is referenced, regardless
+   * of what happens to the stream afterwards. Whether the view shares memory
+   * with the stream or holds a copy is an implementation detail.
+   *
+   * Follows the nsIInputStream::Read conventions: returns
+   * NS_BASE_STREAM_WOULD_BLOCK if a non-blocking stream is empty, and NS_OK
+   * with a null |aView| at the end of the stream.
+   */
+  virtual nsresult ReadSegmentView(
+      RefPtr<mozilla::StreamBufferSource>* aView) = 0;
+
+ protected:
+  nsIZeroCopyInputStream() = default;
+  virtual ~nsIZeroCopyInputStream() = default;
+};
+
+/**
+ * An output stream that can lend its own storage to the writer, so that
+ * producers can fill it in place (for instance straight from a socket or a
+ * decoder) rather than filling a temporary buffer that is then copied.
+ */
+#define NS_IZEROCOPYOUTPUTSTREAM_IID \
+  {0x197c60a2, 0xd4ac, 0x4d4d, {0x92, 0x86, 0x6f, 0xff, 0x5a, 0x13, 0x8b, 0x1f}}
+
+class NS_NO_VTABLE nsIZeroCopyOutputStream : public nsISupports {
+ public:
+  NS_INLINE_DECL_STATIC_IID(NS_IZEROCOPYOUTPUTSTREAM_IID)
+
+  /**
+   * Lend a non-empty writable buffer to the caller in |aBuffer|. The buffer
+   * belongs to the caller until the matching EndWrite() call, which may happen
+   * later on, and on another thread. No other write may be made in between:
+   * those fail with NS_ERROR_IN_PROGRESS.
+   *
+   * Follows the nsIOutputStream::Write conventions: returns
+   * NS_BASE_STREAM_WOULD_BLOCK if a non-blocking stream is full, and the
+   * stream status if it has been closed.
+   */
+  virtual nsresult BeginWrite(mozilla::Span<char>* aBuffer) = 0;
+
+  /**
+   * Give back the buffer lent by BeginWrite(), committing its first
+   * |aWritten| bytes to the stream. |aWritten| may be zero.
+   */
+  virtual nsresult EndWrite(uint32_t aWritten) = 0;
+
+ protected:
+  nsIZeroCopyOutputStream() = default;
+  virtual ~nsIZeroCopyOutputStream() = default;
+};
+
+#endif  // nsIZeroCopyStreams_h
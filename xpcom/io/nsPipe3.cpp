@@ -26,7 +26,9 @@
 #include "nsIAsyncInputStream.h"
 #include "nsIAsyncOutputStream.h"
 #include "nsIInputStreamPriority.h"
+#include "nsIZeroCopyStreams.h"
 #include "nsThreadUtils.h"
+#include "mozilla/StreamBufferSourceImpl.h"
 
 using namespace mozilla;
 
@@ -150,6 +152,33 @@ class nsPipeEvents {
   AutoTArray<mozilla::UniqueFreePtr<char>, 4> mSegmentsToFree;
 };
 
+// A pipe segment that has been handed over to a reader by
+// nsIZeroCopyInputStream::ReadSegmentView(). The pipe no longer references it,
+// so it is freed once the last view goes away.
+class nsPipeSegmentSource final : public StreamBufferSource {
+ public:
+  nsPipeSegmentSource(mozilla::UniqueFreePtr<char> aSegment,
+                      const char* aData, uint32_t aLength)
+      : mSegment(std::move(aSegment)), mData(aData), mLength(aLength) {
+    MOZ_DIAGNOSTIC_ASSERT(mData >= mSegment.get());
+  }
+
+  Span<const char> Data() override {
+    return Span<const char>(mData, mLength);
+  }
+
+  bool Owning() override { return true; }
+
+  size_t SizeOfExcludingThisEvenIfShared(MallocSizeOf aMallocSizeOf) override {
+    return aMallocSizeOf(mSegment.get());
+  }
+
+ private:
+  const mozilla::UniqueFreePtr<char> mSegment;
+  const char* const mData;
+  const uint32_t mLength;
+};
+
 //-----------------------------------------------------------------------------
 
 // This class is used to maintain input stream state.  Its broken out from the
@@ -191,7 +220,8 @@ class nsPipeInputStream final : public nsIAsyncInputStream,
                                 public nsICloneableInputStream,
                                 public nsIClassInfo,
                                 public nsIBufferedInputStream,
-                                public nsIInputStreamPriority {
+                                public nsIInputStreamPriority,
+                                public nsIZeroCopyInputStream {
  public:
   NS_DECL_THREADSAFE_ISUPPORTS
   NS_DECL_NSIINPUTSTREAM
@@ -203,6 +233,8 @@ class nsPipeInputStream final : public nsIAsyncInputStream,
   NS_DECL_NSIBUFFEREDINPUTSTREAM
   NS_DECL_NSIINPUTSTREAMPRIORITY
 
+  nsresult ReadSegmentView(RefPtr<StreamBufferSource>* aView) override;
+
   explicit nsPipeInputStream(nsPipe* aPipe)
       : mPipe(aPipe),
         mLogicalOffset(0),
@@ -282,7 +314,9 @@ class nsPipeInputStream final : public nsIAsyncInputStream,
 //-----------------------------------------------------------------------------
 
 // the output end of a pipe (allocated as a member of the pipe).
-class nsPipeOutputStream : public nsIAsyncOutputStream, public nsIClassInfo {
+class nsPipeOutputStream : public nsIAsyncOutputStream,
+                           public nsIClassInfo,
+                           public nsIZeroCopyOutputStream {
  public:
   // since this class will be allocated as a member of the pipe, we do not
   // need our own ref count.  instead, we share the lifetime (the ref count)
@@ -295,11 +329,16 @@ class nsPipeOutputStream : public nsIAsyncOutputStream, public nsIClassInfo {
   NS_DECL_NSIASYNCOUTPUTSTREAM
   NS_DECL_NSICLASSINFO
 
+  nsresult BeginWrite(Span<char>* aBuffer) override;
+  nsresult EndWrite(uint32_t aWritten) override;
+
   explicit nsPipeOutputStream(nsPipe* aPipe)
       : mPipe(aPipe),
         mWriterRefCnt(0),
         mLogicalOffset(0),
         mBlocking(true),
+        mWriteLeased(false),
+        mLeasedLength(0),
         mBlocked(false),
         mWritable(true) {}
 
@@ -325,6 +364,12 @@ class nsPipeOutputStream : public nsIAsyncOutputStream, public nsIClassInfo {
   int64_t mLogicalOffset;
   bool mBlocking;
 
+  // Set between BeginWrite() and EndWrite(). Like the rest of the writer
+  // state, this is only touched by the (single) writer. The pipe itself never
+  // looks past mWriteCursor, so the lent buffer needs no other bookkeeping.
+  bool mWriteLeased;
+  uint32_t mLeasedLength;
+
   // these variables can only be accessed while inside the pipe's monitor
   bool mBlocked MOZ_GUARDED_BY(Monitor());
   bool mWritable MOZ_GUARDED_BY(Monitor());
@@ -358,9 +403,10 @@ class nsPipe final {
   void PeekSegment(const nsPipeReadState& aReadState, uint32_t aIndex,
                    char*& aCursor, char*& aLimit)
       MOZ_REQUIRES(mReentrantMonitor);
-  SegmentChangeResult AdvanceReadSegment(nsPipeReadState& aReadState,
-                                         nsPipeEvents& aEvents,
-                                         const ReentrantMonitorAutoEnter& ev)
+  SegmentChangeResult AdvanceReadSegment(
+      nsPipeReadState& aReadState, nsPipeEvents& aEvents,
+      const ReentrantMonitorAutoEnter& ev,
+      mozilla::UniqueFreePtr<char>* aTakeSegment = nullptr)
       MOZ_REQUIRES(mReentrantMonitor);
   bool ReadSegmentBeingWritten(nsPipeReadState& aReadState)
       MOZ_REQUIRES(mReentrantMonitor);
@@ -398,6 +444,12 @@ class nsPipe final {
   void ReleaseReadSegment(nsPipeReadState& aReadState, nsPipeEvents& aEvents);
   void AdvanceReadCursor(nsPipeReadState& aReadState, uint32_t aCount);
 
+  // Detach the segment being read by |aReadState| from the pipe and return a
+  // view of its unread data, if it can be done without anybody noticing.
+  // Returns nullptr otherwise, in which case the caller has to copy the data.
+  already_AddRefed<StreamBufferSource> TakeReadSegment(
+      nsPipeReadState& aReadState);
+
   // We can't inherit from both nsIInputStream and nsIOutputStream
   // because they collide on their Close method. Consequently we nest their
   // implementations to avoid the extra object allocation.
@@ -686,7 +738,8 @@ void nsPipe::AdvanceReadCursor(nsPipeReadState& aReadState,
 
 SegmentChangeResult nsPipe::AdvanceReadSegment(
     nsPipeReadState& aReadState, nsPipeEvents& aEvents,
-    const ReentrantMonitorAutoEnter& ev) {
+    const ReentrantMonitorAutoEnter& ev,
+    mozilla::UniqueFreePtr<char>* aTakeSegment) {
   // Calculate how many segments are buffered for this stream to start.
   uint32_t startBufferSegments = GetBufferSegmentCount(aReadState, ev);
 
@@ -714,9 +767,14 @@ SegmentChangeResult nsPipe::AdvanceReadSegment(
       mInputList[i]->ReadState().mSegment -= 1;
     }
 
-    // done with this segment
-    aEvents.FreeSegment(mBuffer.PopFirstSegment());
-    LOG(("III deleting first segment\n"));
+    // done with this segment, unless the caller wants to keep it.
+    if (aTakeSegment) {
+      *aTakeSegment = mBuffer.PopFirstSegment();
+      LOG(("III detaching first segment\n"));
+    } else {
+      aEvents.FreeSegment(mBuffer.PopFirstSegment());
+      LOG(("III deleting first segment\n"));
+    }
   }
 
   if (mWriteSegment < aReadState.mSegment) {
@@ -754,6 +812,51 @@ SegmentChangeResult nsPipe::AdvanceReadSegment(
   return SegmentNotChanged;
 }
 
+already_AddRefed<StreamBufferSource> nsPipe::TakeReadSegment(
+    nsPipeReadState& aReadState) {
+  RefPtr<StreamBufferSource> source;
+
+  nsPipeEvents events;
+  {
+    ReentrantMonitorAutoEnter mon(mReentrantMonitor);
+
+    MOZ_DIAGNOSTIC_ASSERT(!aReadState.mActiveRead);
+
+    // The segment can only be given away if nobody else will look at it
+    // again: this must be the only reader, reading the first segment, and the
+    // writer must be done with it.
+    if (aReadState.mSegment != 0 ||
+        aReadState.mReadCursor == aReadState.mReadLimit ||
+        mInputList.Length() != 1 ||
+        &mInputList[0]->ReadState() != &aReadState ||
+        ReadSegmentBeingWritten(aReadState)) {
+      return nullptr;
+    }
+
+    const char* data = aReadState.mReadCursor;
+    uint32_t length = aReadState.mReadLimit - aReadState.mReadCursor;
+    MOZ_DIAGNOSTIC_ASSERT(length <= aReadState.mAvailable);
+
+    LOG(("III taking read segment [length=%u]\n", length));
+
+    aReadState.mReadCursor = aReadState.mReadLimit;
+    aReadState.mAvailable -= length;
+
+    mozilla::UniqueFreePtr<char> segment;
+    mOutput.Monitor().AssertCurrentThreadIn();
+    if (AdvanceReadSegment(aReadState, events, mon, &segment) ==
+            SegmentAdvanceBufferRead &&
+        mOutput.OnOutputWritable(events) == NotifyMonitor) {
+      mon.NotifyAll();
+    }
+    MOZ_DIAGNOSTIC_ASSERT(segment);
+
+    source = new nsPipeSegmentSource(std::move(segment), data, length);
+  }
+
+  return source.forget();
+}
+
 void nsPipe::DrainInputStream(nsPipeReadState& aReadState,
                               nsPipeEvents& aEvents) {
   ReentrantMonitorAutoEnter mon(mReentrantMonitor);
@@ -1193,6 +1296,7 @@ NS_INTERFACE_TABLE_HEAD(nsPipeInputStream)
     NS_INTERFACE_TABLE_ENTRY(nsPipeInputStream, nsIBufferedInputStream)
     NS_INTERFACE_TABLE_ENTRY(nsPipeInputStream, nsIClassInfo)
     NS_INTERFACE_TABLE_ENTRY(nsPipeInputStream, nsIInputStreamPriority)
+    NS_INTERFACE_TABLE_ENTRY(nsPipeInputStream, nsIZeroCopyInputStream)
     NS_INTERFACE_TABLE_ENTRY_AMBIGUOUS(nsPipeInputStream, nsIInputStream,
                                        nsIAsyncInputStream)
     NS_INTERFACE_TABLE_ENTRY_AMBIGUOUS(nsPipeInputStream, nsISupports,
@@ -1405,6 +1509,52 @@ nsPipeInputStream::ReadSegments(nsWriteSegmentFun aWriter, void* aClosure,
   return rv;
 }
 
+nsresult nsPipeInputStream::ReadSegmentView(RefPtr<StreamBufferSource>* aView) {
+  LOG(("III ReadSegmentView [this=%p]\n", this));
+
+  *aView = nullptr;
+  while (true) {
+    // Hand out the segment itself when we can, it saves a copy.
+    if (RefPtr<StreamBufferSource> source =
+            mPipe->TakeReadSegment(mReadState)) {
+      mLogicalOffset += source->Data().Length();
+      *aView = std::move(source);
+      return NS_OK;
+    }
+
+    AutoReadSegment segment(mPipe, mReadState, UINT32_MAX);
+    nsresult rv = segment.Status();
+    if (NS_FAILED(rv)) {
+      if (rv == NS_BASE_STREAM_WOULD_BLOCK) {
+        // pipe is empty
+        if (!mBlocking) {
+          return rv;
+        }
+        // wait for some data to be written to the pipe
+        rv = Wait();
+        if (NS_SUCCEEDED(rv)) {
+          continue;
+        }
+      }
+      // end of stream.
+      if (rv == NS_BASE_STREAM_CLOSED) {
+        return NS_OK;
+      }
+      mPipe->OnInputStreamException(this, rv);
+      return rv;
+    }
+
+    nsCString copy;
+    if (!copy.Assign(segment.Data(), segment.Length(), fallible)) {
+      return NS_ERROR_OUT_OF_MEMORY;
+    }
+    mLogicalOffset += segment.Length();
+    segment.Advance(segment.Length());
+    *aView = MakeRefPtr<nsCStringSource>(std::move(copy));
+    return NS_OK;
+  }
+}
+
 NS_IMETHODIMP
 nsPipeInputStream::Read(char* aToBuf, uint32_t aBufLen, uint32_t* aReadCount) {
   return ReadSegments(NS_CopySegmentToBuffer, aToBuf, aBufLen, aReadCount);
@@ -1580,7 +1730,8 @@ nsPipeInputStream::~nsPipeInputStream() { Close(); }
 //-----------------------------------------------------------------------------
 
 NS_IMPL_QUERY_INTERFACE(nsPipeOutputStream, nsIOutputStream,
-                        nsIAsyncOutputStream, nsIClassInfo)
+                        nsIAsyncOutputStream, nsIClassInfo,
+                        nsIZeroCopyOutputStream)
 
 NS_IMPL_CI_INTERFACE_GETTER(nsPipeOutputStream, nsIOutputStream,
                             nsIAsyncOutputStream)
@@ -1673,12 +1824,16 @@ nsPipeOutputStream::WriteSegments(nsReadSegmentFun aReader, void* aClosure,
                                   uint32_t aCount, uint32_t* aWriteCount) {
   LOG(("OOO WriteSegments [this=%p count=%u]\n", this, aCount));
 
+  *aWriteCount = 0;
+  if (mWriteLeased) {
+    return NS_ERROR_IN_PROGRESS;
+  }
+
   nsresult rv = NS_OK;
 
   char* segment;
   uint32_t segmentLen;
 
-  *aWriteCount = 0;
   while (aCount) {
     rv = mPipe->GetWriteSegment(segment, segmentLen);
     if (NS_FAILED(rv)) {
@@ -1744,6 +1899,61 @@ nsPipeOutputStream::Write(const char* aFromBuf, uint32_t aBufLen,
                        aWriteCount);
 }
 
+nsresult nsPipeOutputStream::BeginWrite(Span<char>* aBuffer) {
+  LOG(("OOO BeginWrite [this=%p]\n", this));
+
+  if (mWriteLeased) {
+    return NS_ERROR_IN_PROGRESS;
+  }
+
+  char* segment;
+  uint32_t segmentLen;
+  while (true) {
+    nsresult rv = mPipe->GetWriteSegment(segment, segmentLen);
+    if (NS_SUCCEEDED(rv)) {
+      break;
+    }
+    if (rv == NS_BASE_STREAM_WOULD_BLOCK) {
+      // pipe is full
+      if (!mBlocking) {
+        return rv;
+      }
+      // wait for the pipe to have an empty segment.
+      rv = Wait();
+      if (NS_SUCCEEDED(rv)) {
+        continue;
+      }
+    }
+    mPipe->OnPipeException(rv);
+    return rv;
+  }
+
+  MOZ_DIAGNOSTIC_ASSERT(segmentLen);
+  mWriteLeased = true;
+  mLeasedLength = segmentLen;
+  *aBuffer = Span<char>(segment, segmentLen);
+  return NS_OK;
+}
+
+nsresult nsPipeOutputStream::EndWrite(uint32_t aWritten) {
+  LOG(("OOO EndWrite [this=%p written=%u]\n", this, aWritten));
+
+  if (!mWriteLeased) {
+    return NS_ERROR_UNEXPECTED;
+  }
+  if (aWritten > mLeasedLength) {
+    return NS_ERROR_INVALID_ARG;
+  }
+
+  mWriteLeased = false;
+  mLeasedLength = 0;
+  if (aWritten) {
+    mPipe->AdvanceWriteCursor(aWritten);
+    mLogicalOffset += aWritten;
+  }
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 nsPipeOutputStream::Flush() {
   // nothing to do
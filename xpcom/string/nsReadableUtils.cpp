@@ -208,62 +208,73 @@ char16_t* CopyUnicodeTo(const nsAString& aSource, uint32_t aSrcOffset,
   return aDest;
 }
 
-void ToUpperCase(nsACString& aCString) {
-  char* cp = aCString.BeginWriting();
-  char* end = cp + aCString.Length();
-  while (cp != end) {
-    char ch = *cp;
-    if (ch >= 'a' && ch <= 'z') {
-      *cp = ch - ('a' - 'A');
-    }
-    ++cp;
+// ASCII case conversion. Letters of both cases only differ by bit 5, so
+// flipping that bit for chars in [aFirst, aFirst + 26) converts them. Doing
+// this without a conditional store lets the compiler vectorize the loops below
+// (SSE2/AVX2/NEON), which matters for the long header values and URLs these
+// functions are commonly called on.
+static inline char ConvertASCIICase(char aChar, char aFirst) {
+  const bool inRange = static_cast<unsigned char>(aChar - aFirst) < 26;
+  return static_cast<char>(aChar ^ (inRange << 5));
+}
+
+// Returns the index of the first char of aSource in [aFirst, aFirst + 26), or
+// aSource.Length() if there is none.
+static size_t FindFirstCharToConvert(const nsACString& aSource, char aFirst) {
+  const char* begin = aSource.BeginReading();
+  const char* end = begin + aSource.Length();
+  const char* found = std::find_if(begin, end, [aFirst](char aChar) {
+    return static_cast<unsigned char>(aChar - aFirst) < 26;
+  });
+  return found - begin;
+}
+
+static void ConvertASCIICase(nsACString& aCString, char aFirst) {
+  // Don't call BeginWriting() if there's nothing to convert, since that would
+  // copy a shared or literal buffer for nothing.
+  size_t first = FindFirstCharToConvert(aCString, aFirst);
+  if (first == aCString.Length()) {
+    return;
+  }
+  char* begin = aCString.BeginWriting();
+  char* end = begin + aCString.Length();
+  for (char* cp = begin + first; cp != end; ++cp) {
+    *cp = ConvertASCIICase(*cp, aFirst);
+  }
+}
+
+static void ConvertASCIICase(const nsACString& aSource, nsACString& aDest,
+                             char aFirst) {
+  // If there's nothing to convert, share aSource's buffer if it has one rather
+  // than copying it.
+  size_t first = FindFirstCharToConvert(aSource, aFirst);
+  if (first == aSource.Length()) {
+    aDest.Assign(aSource);
+    return;
+  }
+  if (&aSource == &aDest) {
+    ConvertASCIICase(aDest, aFirst);
+    return;
   }
-}
-
-void ToUpperCase(const nsACString& aSource, nsACString& aDest) {
   aDest.SetLength(aSource.Length());
   const char* src = aSource.BeginReading();
-  const char* end = src + aSource.Length();
+  const char* end = aSource.EndReading();
   char* dst = aDest.BeginWriting();
-  while (src != end) {
-    char ch = *src;
-    if (ch >= 'a' && ch <= 'z') {
-      *dst = ch - ('a' - 'A');
-    } else {
-      *dst = ch;
-    }
-    ++src;
-    ++dst;
+  for (; src != end; ++src, ++dst) {
+    *dst = ConvertASCIICase(*src, aFirst);
   }
 }
 
-void ToLowerCase(nsACString& aCString) {
-  char* cp = aCString.BeginWriting();
-  char* end = cp + aCString.Length();
-  while (cp != end) {
-    char ch = *cp;
-    if (ch >= 'A' && ch <= 'Z') {
-      *cp = ch + ('a' - 'A');
-    }
-    ++cp;
-  }
+void ToUpperCase(nsACString& aCString) { ConvertASCIICase(aCString, 'a'); }
+
+void ToUpperCase(const nsACString& aSource, nsACString& aDest) {
+  ConvertASCIICase(aSource, aDest, 'a');
 }
 
+void ToLowerCase(nsACString& aCString) { ConvertASCIICase(aCString, 'A'); }
+
 void ToLowerCase(const nsACString& aSource, nsACString& aDest) {
-  aDest.SetLength(aSource.Length());
-  const char* src = aSource.BeginReading();
-  const char* end = src + aSource.Length();
-  char* dst = aDest.BeginWriting();
-  while (src != end) {
-    char ch = *src;
-    if (ch >= 'A' && ch <= 'Z') {
-      *dst = ch + ('a' - 'A');
-    } else {
-      *dst = ch;
-    }
-    ++src;
-    ++dst;
-  }
+  ConvertASCIICase(aSource, aDest, 'A');
 }
 
 void ParseString(const nsACString& aSource, char aDelimiter,
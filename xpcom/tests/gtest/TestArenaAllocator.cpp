@@ -310,3 +310,68 @@ TEST(ArenaAllocator, Extensions)
   nsAutoCString::char_type* y_copy = mozilla::ArenaStrdup(y, a);
   EXPECT_TRUE(y.Equals(y_copy));
 }
+
+TEST(ArenaAllocator, TryGrowInPlace)
+{
+  ArenaAllocator<4096, 8> a;
+
+  void* x = a.Allocate(10);
+  EXPECT_TRUE(a.TryGrowInPlace(x, 10, 100));
+  // Allocations made after growing must not overlap the grown one.
+  void* y = a.Allocate(8);
+  EXPECT_GE(uintptr_t(y), uintptr_t(x) + 100);
+
+  // Only the most recent allocation can grow.
+  EXPECT_FALSE(a.TryGrowInPlace(x, 100, 200));
+  EXPECT_TRUE(a.TryGrowInPlace(y, 8, 16));
+
+  // Not past the end of the current chunk.
+  EXPECT_FALSE(a.TryGrowInPlace(y, 16, 8192));
+}
+
+TEST(ArenaAllocator, StringBuilder)
+{
+  ArenaAllocator<4096, 8> a;
+
+  mozilla::ArenaStringBuilder<char16_t, 4096, 8> empty(a);
+  EXPECT_TRUE(empty.IsEmpty());
+  EXPECT_EQ(empty.get()[0], u'\0');
+
+  mozilla::ArenaStringBuilder<char16_t, 4096, 8> b(a);
+  b.Append(u"<"_ns);
+  b.Append(u"element"_ns);
+  b.Append(u' ');
+  nsAutoString attr(u"attr=\"value\""_ns);
+  b.Append(attr);
+  b.Append(u'>');
+  EXPECT_EQ(b.Length(), 22u);
+  EXPECT_TRUE(nsDependentString(b.get()).EqualsLiteral(
+      "<element attr=\"value\">"));
+
+  // Escaping the arena.
+  nsString copy;
+  b.AssignTo(copy);
+  EXPECT_TRUE(copy.EqualsLiteral("<element attr=\"value\">"));
+
+  b.Truncate();
+  EXPECT_TRUE(b.IsEmpty());
+  EXPECT_EQ(b.get()[0], u'\0');
+
+  // Interleave two builders so that neither can always grow in place, and
+  // grow them past the arena size.
+  mozilla::ArenaStringBuilder<char, 4096, 8> c1(a);
+  mozilla::ArenaStringBuilder<char, 4096, 8> c2(a);
+  nsAutoCString expected1;
+  nsAutoCString expected2;
+  for (int i = 0; i < 2000; i++) {
+    char ch = 'a' + (i % 26);
+    c1.Append(ch);
+    expected1.Append(ch);
+    c2.Append("xy", 2);
+    expected2.Append("xy");
+  }
+  EXPECT_TRUE(expected1.Equals(c1.get()));
+  EXPECT_TRUE(expected2.Equals(c2.get()));
+  EXPECT_EQ(c1.AsSpan().Length(), expected1.Length());
+  EXPECT_EQ(c2.AsSpan().Length(), expected2.Length());
+}
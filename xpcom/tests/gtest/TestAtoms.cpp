@@ -7,12 +7,14 @@
 #include "mozilla/ArrayUtils.h"
 
 #include "nsAtom.h"
+#include "nsGkAtoms.h"
 #include "nsString.h"
 #include "UTFStrings.h"
 #include "nsIThread.h"
 #include "nsThreadUtils.h"
 
 #include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
 #include "mozilla/gtest/MozAssertions.h"
 
 using namespace mozilla;
@@ -174,4 +176,88 @@ TEST(Atoms, ConcurrentAccessing)
   EXPECT_EQ(NS_GetUnusedAtomCount(), int32_t(1));
 }
 
+TEST(Atoms, StaticAtomLookups)
+{
+  // Look each string up twice, so that the second lookup hits the per-thread
+  // static atom cache.
+  for (int i = 0; i < 2; i++) {
+    RefPtr<nsAtom> div8 = NS_Atomize("div");
+    RefPtr<nsAtom> div16 = NS_Atomize(u"div"_ns);
+    EXPECT_EQ(div8, nsGkAtoms::div);
+    EXPECT_EQ(div16, nsGkAtoms::div);
+
+    RefPtr<nsAtom> span8 = NS_Atomize("span");
+    EXPECT_EQ(span8, nsGkAtoms::span);
+  }
+
+  // Strings that differ from a static atom only in case, or which have the same
+  // number of UTF-8 bytes but aren't ASCII, must not match it.
+  RefPtr<nsAtom> upper = NS_Atomize("DIV");
+  EXPECT_NE(upper, nsGkAtoms::div);
+  EXPECT_FALSE(isStaticAtom(upper));
+  RefPtr<nsAtom> nonAscii = NS_Atomize("d\xC3\xA9");
+  EXPECT_NE(nonAscii, nsGkAtoms::div);
+  EXPECT_TRUE(nonAscii->Equals(u"d\u00E9"_ns));
+}
+
+static const char* const kLookupStrings8[] = {
+    "div", "span", "class", "id", "style", "href",
+    "a-dynamic-atom", "another-dynamic-atom", "caf\xC3\xA9",
+};
+
+static void LookupAtoms(void*) {
+  for (int i = 0; i < 20000; i++) {
+    for (const char* str : kLookupStrings8) {
+      RefPtr<nsAtom> atom8 = NS_Atomize(str);
+      RefPtr<nsAtom> atom16 = NS_Atomize(NS_ConvertUTF8toUTF16(str));
+      MOZ_RELEASE_ASSERT(atom8 == atom16);
+    }
+  }
+}
+
+// Looks the strings up from aThreadCount threads at once, and checks that
+// they all got the same atoms.
+static void RunConcurrentLookups(size_t aThreadCount) {
+  // Keep the dynamic atoms alive so that the threads only look up existing
+  // atoms.
+  nsTArray<RefPtr<nsAtom>> atoms;
+  for (const char* str : kLookupStrings8) {
+    atoms.AppendElement(NS_Atomize(str));
+  }
+
+  nsTArray<PRThread*> threads;
+  for (size_t i = 0; i < aThreadCount; i++) {
+    PRThread* thread = PR_CreateThread(PR_USER_THREAD, LookupAtoms, nullptr,
+                                       PR_PRIORITY_NORMAL, PR_GLOBAL_THREAD,
+                                       PR_JOINABLE_THREAD, 0);
+    EXPECT_TRUE(thread);
+    if (thread) {
+      threads.AppendElement(thread);
+    }
+  }
+
+  for (PRThread* thread : threads) {
+    EXPECT_EQ(PR_SUCCESS, PR_JoinThread(thread));
+  }
+
+  for (size_t i = 0; i < std::size(kLookupStrings8); i++) {
+    RefPtr<nsAtom> atom = NS_Atomize(kLookupStrings8[i]);
+    EXPECT_EQ(atoms[i], atom);
+  }
+}
+
+TEST(Atoms, ConcurrentLookups)
+{
+  RunConcurrentLookups(8);
+}
+
+MOZ_GTEST_BENCH(Atoms, ConcurrentLookups_1Thread,
+                [] { RunConcurrentLookups(1); });
+
+MOZ_GTEST_BENCH(Atoms, ConcurrentLookups_8Threads,
+                [] { RunConcurrentLookups(8); });
+
+MOZ_GTEST_BENCH(Atoms, ConcurrentLookups_16Threads,
+                [] { RunConcurrentLookups(16); });
+
 }  // namespace TestAtoms
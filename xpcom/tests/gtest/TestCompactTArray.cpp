@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+
+#include "mozilla/CompactTArray.h"
+#include "nsString.h"
+#include "nsTArray.h"
+
+using namespace mozilla;
+
+namespace {
+
+// A MallocSizeOf that counts heap buffers instead of measuring them.
+size_t CountCompactTestBuffers(const void* aPtr) { return aPtr ? 1 : 0; }
+
+struct CompactTestReverse {
+  bool Equals(int aA, int aB) const { return aA == aB; }
+  bool LessThan(int aA, int aB) const { return aA > aB; }
+};
+
+const size_t kCompactTestLines = 1000;
+
+// Builds the floats of kCompactTestLines lines the way block reflow does:
+// one or two floats are collected for the current line, and then moved to
+// the line. Returns how many heap buffers the lines own.
+template <typename Array>
+size_t BuildCompactTestLineFloats(nsTArray<Array>& aLines) {
+  static int sFloats[2];
+  Array currentLineFloats;
+  for (size_t i = 0; i < kCompactTestLines; ++i) {
+    currentLineFloats.AppendElement(&sFloats[0]);
+    if (i % 3 == 0) {
+      currentLineFloats.AppendElement(&sFloats[1]);
+    }
+    aLines.AppendElement(std::move(currentLineFloats));
+  }
+
+  size_t buffers = 0;
+  for (const Array& line : aLines) {
+    buffers += line.ShallowSizeOfExcludingThis(CountCompactTestBuffers);
+  }
+  return buffers;
+}
+
+}  // namespace
+
+TEST(CompactTArray, InlineStorage)
+{
+  CompactTArray<uint32_t, 4> array;
+  EXPECT_TRUE(array.IsEmpty());
+  EXPECT_TRUE(array.UsesInlineStorage());
+  EXPECT_EQ(4u, array.Capacity());
+
+  for (uint32_t i = 0; i < 4; ++i) {
+    array.AppendElement(i);
+  }
+  EXPECT_TRUE(array.UsesInlineStorage());
+  EXPECT_EQ(0u, array.ShallowSizeOfExcludingThis(CountCompactTestBuffers));
+
+  array.AppendElement(4u);
+  EXPECT_FALSE(array.UsesInlineStorage());
+  EXPECT_EQ(1u, array.ShallowSizeOfExcludingThis(CountCompactTestBuffers));
+  EXPECT_EQ(5u, array.Length());
+  for (uint32_t i = 0; i < 5; ++i) {
+    EXPECT_EQ(i, array[i]);
+  }
+
+  // Compact() goes back to the inline storage once the elements fit.
+  array.RemoveElementsAt(1, 2);
+  array.Compact();
+  EXPECT_TRUE(array.UsesInlineStorage());
+  EXPECT_EQ(0u, array.ShallowSizeOfExcludingThis(CountCompactTestBuffers));
+  EXPECT_EQ((CompactTArray<uint32_t, 4>{0, 3, 4}), array);
+
+  array.SetLength(10);
+  EXPECT_EQ(10u, array.Length());
+  array.Clear();
+  EXPECT_TRUE(array.IsEmpty());
+  EXPECT_TRUE(array.UsesInlineStorage());
+}
+
+TEST(CompactTArray, MoveStealsHeapBuffer)
+{
+  CompactTArray<nsCString, 2> array{"a"_ns, "b"_ns, "c"_ns};
+  ASSERT_FALSE(array.UsesInlineStorage());
+  const nsCString* elements = array.Elements();
+
+  CompactTArray<nsCString, 2> moved(std::move(array));
+  EXPECT_EQ(elements, moved.Elements());
+  EXPECT_TRUE(array.IsEmpty());
+  EXPECT_TRUE(array.UsesInlineStorage());
+
+  CompactTArray<nsCString, 2> assigned{"x"_ns};
+  assigned = std::move(moved);
+  EXPECT_EQ(elements, assigned.Elements());
+  EXPECT_EQ(3u, assigned.Length());
+  EXPECT_TRUE(moved.IsEmpty());
+
+  // Inline elements are relocated, without an allocation.
+  CompactTArray<nsCString, 2> inlineArray{"d"_ns};
+  CompactTArray<nsCString, 2> inlineMoved(std::move(inlineArray));
+  EXPECT_TRUE(inlineMoved.UsesInlineStorage());
+  EXPECT_TRUE(inlineMoved[0].EqualsLiteral("d"));
+  EXPECT_TRUE(inlineArray.IsEmpty());
+
+  inlineMoved.SwapElements(assigned);
+  EXPECT_EQ(elements, inlineMoved.Elements());
+  EXPECT_EQ((CompactTArray<nsCString, 2>{"d"_ns}), assigned);
+
+  // Appending a moved array takes its buffer when there's nothing to keep.
+  CompactTArray<nsCString, 2> appended;
+  appended.AppendElements(std::move(inlineMoved));
+  EXPECT_EQ(elements, appended.Elements());
+  EXPECT_TRUE(inlineMoved.IsEmpty());
+  appended.AppendElements(std::move(assigned));
+  EXPECT_EQ((CompactTArray<nsCString, 2>{"a"_ns, "b"_ns, "c"_ns, "d"_ns}),
+            appended);
+  EXPECT_TRUE(assigned.IsEmpty());
+}
+
+TEST(CompactTArray, Algorithms)
+{
+  CompactTArray<int, 4> array{5, 1, 4, 1, 3};
+  EXPECT_EQ(1u, array.IndexOf(1));
+  EXPECT_EQ(3u, array.IndexOf(1, 2));
+  EXPECT_EQ(3u, array.LastIndexOf(1));
+  EXPECT_EQ(array.NoIndex, array.IndexOf(2));
+  EXPECT_TRUE(array.Contains(4));
+  EXPECT_FALSE(array.Contains(2));
+
+  array.Sort();
+  EXPECT_EQ((CompactTArray<int, 4>{1, 1, 3, 4, 5}), array);
+  EXPECT_EQ(2u, array.BinaryIndexOf(3));
+  EXPECT_TRUE(array.ContainsSorted(5));
+  EXPECT_FALSE(array.ContainsSorted(2));
+  EXPECT_EQ(2u, array.IndexOfFirstElementGt(1));
+
+  array.InsertElementSorted(2);
+  EXPECT_EQ((CompactTArray<int, 4>{1, 1, 2, 3, 4, 5}), array);
+  EXPECT_TRUE(array.RemoveElementSorted(1));
+  EXPECT_FALSE(array.RemoveElementSorted(7));
+  EXPECT_TRUE(array.RemoveElement(4));
+  EXPECT_EQ((CompactTArray<int, 4>{1, 2, 3, 5}), array);
+
+  array.Sort(CompactTestReverse());
+  EXPECT_EQ((CompactTArray<int, 4>{5, 3, 2, 1}), array);
+  EXPECT_EQ(1u, array.BinaryIndexOf(3, CompactTestReverse()));
+
+  array.StableSort([](int aA, int aB) { return (aA % 2) - (aB % 2); });
+  EXPECT_EQ((CompactTArray<int, 4>{2, 5, 3, 1}), array);
+
+  EXPECT_EQ(2u, array.RemoveElementsBy([](int aI) { return aI > 2; }));
+  EXPECT_EQ((CompactTArray<int, 4>{2, 1}), array);
+
+  array.InsertElementAt(0, 7);
+  EXPECT_EQ(1, array.PopLastElement());
+  EXPECT_EQ(2, array.LastElement());
+  EXPECT_EQ(-1, array.SafeElementAt(5, -1));
+
+  int sum = 0;
+  for (int i : array) {
+    sum += i;
+  }
+  EXPECT_EQ(9, sum);
+}
+
+// Each line's floats cost a heap buffer with nsTArray, and none with
+// nsLineBox::FloatArray.
+TEST(CompactTArray, LineFloatsAllocations)
+{
+  nsTArray<nsTArray<int*>> heapLines;
+  EXPECT_EQ(kCompactTestLines, BuildCompactTestLineFloats(heapLines));
+
+  nsTArray<CompactTArray<int*, 2>> compactLines;
+  EXPECT_EQ(0u, BuildCompactTestLineFloats(compactLines));
+  for (size_t i = 0; i < kCompactTestLines; ++i) {
+    EXPECT_EQ(heapLines[i].Length(), compactLines[i].Length());
+  }
+}
+
+MOZ_GTEST_BENCH(CompactTArray, LineFloats_nsTArray, [] {
+  for (int i = 0; i < 100; ++i) {
+    nsTArray<nsTArray<int*>> lines;
+    BuildCompactTestLineFloats(lines);
+  }
+});
+
+MOZ_GTEST_BENCH(CompactTArray, LineFloats_CompactTArray, [] {
+  for (int i = 0; i < 100; ++i) {
+    nsTArray<CompactTArray<int*, 2>> lines;
+    BuildCompactTestLineFloats(lines);
+  }
+});
@@ -0,0 +1,224 @@
+/* -*- Mode: C++; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+/* vim: set ts=8 sts=2 et sw=2 tw=80: */
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
+#include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/IOBatch.h"
+#include "nsCOMPtr.h"
+#include "nsDirectoryServiceDefs.h"
+#include "nsDirectoryServiceUtils.h"
+#include "nsIFile.h"
+#include "nsPrintfCString.h"
+#include "nsTArray.h"
+#include "prio.h"
+
+using namespace mozilla;
+
+namespace {
+
+class AutoTempDir {
+ public:
+  AutoTempDir() {
+    MOZ_ALWAYS_SUCCEEDS(
+        NS_GetSpecialDirectory(NS_OS_TEMP_DIR, getter_AddRefs(mDir)));
+    MOZ_ALWAYS_SUCCEEDS(mDir->AppendNative("TestIOBatch"_ns));
+    MOZ_ALWAYS_SUCCEEDS(mDir->CreateUnique(nsIFile::DIRECTORY_TYPE, 0700));
+  }
+  ~AutoTempDir() { mDir->Remove(true); }
+
+  already_AddRefed<nsIFile> File(const nsACString& aName) const {
+    nsCOMPtr<nsIFile> file;
+    MOZ_ALWAYS_SUCCEEDS(mDir->Clone(getter_AddRefs(file)));
+    MOZ_ALWAYS_SUCCEEDS(file->AppendNative(aName));
+    return file.forget();
+  }
+
+ private:
+  nsCOMPtr<nsIFile> mDir;
+};
+
+static PRFileDesc* Open(nsIFile* aFile, int32_t aFlags) {
+  PRFileDesc* fd = nullptr;
+  MOZ_ALWAYS_SUCCEEDS(aFile->OpenNSPRFileDesc(aFlags, 0600, &fd));
+  return fd;
+}
+
+static void TestReadWrite(IOBatch::Backend aBackend) {
+  AutoTempDir dir;
+  nsCOMPtr<nsIFile> file = dir.File("data"_ns);
+  PRFileDesc* fd = Open(file, PR_RDWR | PR_CREATE_FILE);
+  ASSERT_TRUE(fd);
+
+  const char kBlocks[3][4] = {{'a', 'a', 'a', 'a'},
+                              {'b', 'b', 'b', 'b'},
+                              {'c', 'c', 'c', 'c'}};
+
+  // Queue the writes out of order, their offsets decide where they land.
+  IOBatch writes;
+  writes.Write(fd, kBlocks[2], 4, 8);
+  writes.Write(fd, kBlocks[0], 4, 0);
+  writes.Write(fd, kBlocks[1], 4, 4);
+  writes.Sync(fd);
+  writes.Run(aBackend);
+  ASSERT_EQ(4u, writes.Length());
+  for (size_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(4, writes.Result(i));
+  }
+  ASSERT_EQ(0, writes.Result(3));
+
+  char middle[4];
+  char tail[8];
+  char pastEnd[4];
+  IOBatch reads;
+  size_t middleIndex = reads.Read(fd, middle, sizeof(middle), 4);
+  size_t tailIndex = reads.Read(fd, tail, sizeof(tail), 8);
+  size_t pastEndIndex = reads.Read(fd, pastEnd, sizeof(pastEnd), 100);
+  reads.Run(aBackend);
+
+  ASSERT_EQ(4, reads.Result(middleIndex));
+  ASSERT_EQ(0, memcmp(middle, kBlocks[1], 4));
+  // Short read at the end of the file.
+  ASSERT_EQ(4, reads.Result(tailIndex));
+  ASSERT_EQ(0, memcmp(tail, kBlocks[2], 4));
+  ASSERT_EQ(0, reads.Result(pastEndIndex));
+
+  // A batch can be reused once cleared.
+  reads.Clear();
+  reads.Read(fd, middle, sizeof(middle), 0);
+  reads.Run(aBackend);
+  ASSERT_EQ(4, reads.Result(0));
+  ASSERT_EQ(0, memcmp(middle, kBlocks[0], 4));
+
+  PR_Close(fd);
+
+  // Errors are reported per operation.
+  fd = Open(file, PR_RDONLY);
+  ASSERT_TRUE(fd);
+  IOBatch failing;
+  failing.Write(fd, kBlocks[0], 4, 0);
+  failing.Read(fd, middle, sizeof(middle), 8);
+  failing.Run(aBackend);
+  ASSERT_EQ(-1, failing.Result(0));
+  ASSERT_EQ(4, failing.Result(1));
+  PR_Close(fd);
+}
+
+}  // namespace
+
+TEST(IOBatch, ReadWrite)
+{ TestReadWrite(IOBatch::Backend::Default); }
+
+TEST(IOBatch, ReadWrite_NSPR)
+{ TestReadWrite(IOBatch::Backend::NSPR); }
+
+// io_uring writes that come back short are finished, like PR_Write does.
+TEST(IOBatch, ShortWrites)
+{
+  if (!IOBatch::IsIOUringAvailable()) {
+    return;
+  }
+
+  AutoTempDir dir;
+  nsCOMPtr<nsIFile> file = dir.File("data"_ns);
+  PRFileDesc* fd = Open(file, PR_RDWR | PR_CREATE_FILE);
+  ASSERT_TRUE(fd);
+
+  const uint32_t kSize = 64 * 1024;
+  nsTArray<char> data;
+  data.SetLength(kSize);
+  for (uint32_t i = 0; i < kSize; ++i) {
+    data[i] = char(i % 251);
+  }
+
+  IOBatch::SetMaxIOUringWriteForTesting(1000);
+  IOBatch writes;
+  writes.Write(fd, data.Elements(), kSize / 2, 0);
+  writes.Sync(fd);
+  writes.Write(fd, data.Elements() + kSize / 2, kSize / 2, kSize / 2);
+  writes.Run();
+  IOBatch::SetMaxIOUringWriteForTesting(UINT32_MAX);
+
+  ASSERT_EQ(int32_t(kSize / 2), writes.Result(0));
+  ASSERT_EQ(0, writes.Result(1));
+  ASSERT_EQ(int32_t(kSize / 2), writes.Result(2));
+
+  nsTArray<char> read;
+  read.SetLength(kSize);
+  IOBatch reads;
+  reads.Read(fd, read.Elements(), kSize, 0);
+  reads.Run();
+  ASSERT_EQ(int32_t(kSize), reads.Result(0));
+  ASSERT_EQ(data, read);
+  PR_Close(fd);
+}
+
+// Mimics what CacheIndex does when it builds the index from a large cache
+// directory: read the trailing offset, then the metadata, of many small files.
+class IOBatchBench : public ::testing::Test {
+ protected:
+  static const uint32_t kFileCount = 2000;
+  static const uint32_t kFileSize = 16 * 1024;
+  static const uint32_t kMetadataSize = 1024;
+  static const uint32_t kBatchSize = 32;
+
+  void SetUp() override {
+    nsTArray<char> data;
+    data.SetLength(kFileSize);
+    memset(data.Elements(), 'x', kFileSize);
+    for (uint32_t i = 0; i < kFileCount; ++i) {
+      nsCOMPtr<nsIFile> file = mDir.File(nsPrintfCString("%u", i));
+      PRFileDesc* fd = Open(file, PR_WRONLY | PR_CREATE_FILE);
+      ASSERT_TRUE(fd);
+      ASSERT_EQ(int32_t(kFileSize), PR_Write(fd, data.Elements(), kFileSize));
+      PR_Close(fd);
+      mFiles.AppendElement(std::move(file));
+    }
+  }
+
+  void ReadMetadata(IOBatch::Backend aBackend) {
+    nsTArray<char> buffers;
+    buffers.SetLength(kBatchSize * kMetadataSize);
+    uint32_t offsets[kBatchSize];
+    PRFileDesc* fds[kBatchSize];
+
+    for (uint32_t start = 0; start < kFileCount; start += kBatchSize) {
+      uint32_t count = std::min(kBatchSize, kFileCount - start);
+      for (uint32_t i = 0; i < count; ++i) {
+        fds[i] = Open(mFiles[start + i], PR_RDONLY);
+      }
+
+      IOBatch tails;
+      for (uint32_t i = 0; i < count; ++i) {
+        tails.Read(fds[i], &offsets[i], sizeof(uint32_t),
+                   kFileSize - sizeof(uint32_t));
+      }
+      tails.Run(aBackend);
+
+      IOBatch metadata;
+      for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_EQ(int32_t(sizeof(uint32_t)), tails.Result(i));
+        metadata.Read(fds[i], &buffers[i * kMetadataSize], kMetadataSize,
+                      kFileSize - kMetadataSize);
+      }
+      metadata.Run(aBackend);
+
+      for (uint32_t i = 0; i < count; ++i) {
+        ASSERT_EQ(int32_t(kMetadataSize), metadata.Result(i));
+        PR_Close(fds[i]);
+      }
+    }
+  }
+
+  AutoTempDir mDir;
+  nsTArray<nsCOMPtr<nsIFile>> mFiles;
+};
+
+MOZ_GTEST_BENCH_F(IOBatchBench, ReadMetadata_2000Files,
+                  [this] { ReadMetadata(IOBatch::Backend::Default); });
+
+MOZ_GTEST_BENCH_F(IOBatchBench, ReadMetadata_2000Files_NSPR,
+                  [this] { ReadMetadata(IOBatch::Backend::NSPR); });
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
 #include "Helpers.h"
 #include "mozilla/gtest/MozAssertions.h"
 #include "mozilla/ReentrantMonitor.h"
@@ -23,6 +24,7 @@
 #include "nsITellableStream.h"
 #include "nsIThread.h"
 #include "nsIRunnable.h"
+#include "nsIZeroCopyStreams.h"
 #include "nsStreamUtils.h"
 #include "nsString.h"
 #include "nsThreadUtils.h"
@@ -1038,4 +1040,270 @@ TEST(Pipes, Interfaces)
 
   nsCOMPtr<nsIBufferedInputStream> readerType6 = do_QueryInterface(reader);
   ASSERT_TRUE(readerType6);
+
+  nsCOMPtr<nsIZeroCopyInputStream> readerType7 = do_QueryInterface(reader);
+  ASSERT_TRUE(readerType7);
+
+  nsCOMPtr<nsIZeroCopyOutputStream> writerType1 = do_QueryInterface(writer);
+  ASSERT_TRUE(writerType1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Write |aData| to |aWriter| through BeginWrite()/EndWrite(), recording the
+// address of every buffer that was lent.
+static void WriteAllInPlace(nsIOutputStream* aWriter,
+                            const nsTArray<char>& aData,
+                            nsTArray<const char*>& aLentBuffers) {
+  nsCOMPtr<nsIZeroCopyOutputStream> writer = do_QueryInterface(aWriter);
+  ASSERT_TRUE(writer);
+
+  uint32_t offset = 0;
+  while (offset < aData.Length()) {
+    Span<char> buffer;
+    ASSERT_NS_SUCCEEDED(writer->BeginWrite(&buffer));
+    ASSERT_FALSE(buffer.IsEmpty());
+    aLentBuffers.AppendElement(buffer.Elements());
+
+    uint32_t count =
+        std::min<uint32_t>(buffer.Length(), aData.Length() - offset);
+    memcpy(buffer.Elements(), aData.Elements() + offset, count);
+    ASSERT_NS_SUCCEEDED(writer->EndWrite(count));
+    offset += count;
+  }
+  aWriter->Close();
 }
+
+// Read everything from |aReader| through ReadSegmentView().
+static void ReadAllViews(nsIInputStream* aReader,
+                         nsTArray<RefPtr<StreamBufferSource>>& aViews,
+                         nsTArray<char>& aData) {
+  nsCOMPtr<nsIZeroCopyInputStream> reader = do_QueryInterface(aReader);
+  ASSERT_TRUE(reader);
+
+  while (true) {
+    RefPtr<StreamBufferSource> view;
+    ASSERT_NS_SUCCEEDED(reader->ReadSegmentView(&view));
+    if (!view) {
+      break;
+    }
+    ASSERT_FALSE(view->Data().IsEmpty());
+    aData.AppendElements(view->Data().Elements(), view->Data().Length());
+    aViews.AppendElement(std::move(view));
+  }
+}
+
+}  // namespace
+
+TEST(Pipes, ZeroCopy_SingleReader)
+{
+  const uint32_t segmentSize = 1024;
+
+  nsCOMPtr<nsIAsyncInputStream> reader;
+  nsCOMPtr<nsIAsyncOutputStream> writer;
+  NS_NewPipe2(getter_AddRefs(reader), getter_AddRefs(writer), false, false,
+              segmentSize, 4);
+
+  nsTArray<char> inputData;
+  testing::CreateData(3 * segmentSize + 100, inputData);
+
+  nsTArray<const char*> lentBuffers;
+  WriteAllInPlace(writer, inputData, lentBuffers);
+  ASSERT_EQ(4u, lentBuffers.Length());
+
+  nsTArray<RefPtr<StreamBufferSource>> views;
+  nsTArray<char> outputData;
+  ReadAllViews(reader, views, outputData);
+  ASSERT_EQ(inputData, outputData);
+
+  // Complete segments are handed over as-is. The last one is copied, since
+  // the writer could still have appended to it.
+  ASSERT_EQ(4u, views.Length());
+  for (uint32_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(lentBuffers[i], views[i]->Data().Elements());
+    ASSERT_EQ(segmentSize, views[i]->Data().Length());
+  }
+  ASSERT_NE(lentBuffers[3], views[3]->Data().Elements());
+  ASSERT_EQ(100u, views[3]->Data().Length());
+
+  // The views outlive the pipe.
+  reader = nullptr;
+  writer = nullptr;
+  nsTArray<char> viewData;
+  for (const auto& view : views) {
+    viewData.AppendElements(view->Data().Elements(), view->Data().Length());
+  }
+  ASSERT_EQ(inputData, viewData);
+}
+
+TEST(Pipes, ZeroCopy_Clone)
+{
+  const uint32_t segmentSize = 1024;
+
+  nsCOMPtr<nsIAsyncInputStream> reader;
+  nsCOMPtr<nsIAsyncOutputStream> writer;
+  NS_NewPipe2(getter_AddRefs(reader), getter_AddRefs(writer), false, false,
+              segmentSize, 4);
+
+  nsCOMPtr<nsICloneableInputStream> cloneable = do_QueryInterface(reader);
+  ASSERT_TRUE(cloneable);
+  nsCOMPtr<nsIInputStream> clone;
+  ASSERT_NS_SUCCEEDED(cloneable->Clone(getter_AddRefs(clone)));
+
+  nsTArray<char> inputData;
+  testing::CreateData(3 * segmentSize, inputData);
+
+  nsTArray<const char*> lentBuffers;
+  WriteAllInPlace(writer, inputData, lentBuffers);
+
+  // Segments are shared with the clone, so they must be copied.
+  nsTArray<RefPtr<StreamBufferSource>> views;
+  nsTArray<char> outputData;
+  ReadAllViews(reader, views, outputData);
+  ASSERT_EQ(inputData, outputData);
+  for (const auto& view : views) {
+    ASSERT_FALSE(lentBuffers.Contains(view->Data().Elements()));
+  }
+
+  testing::ConsumeAndValidateStream(clone, inputData);
+}
+
+TEST(Pipes, ZeroCopy_Lease)
+{
+  const uint32_t segmentSize = 1024;
+
+  nsCOMPtr<nsIAsyncInputStream> reader;
+  nsCOMPtr<nsIAsyncOutputStream> writer;
+  NS_NewPipe2(getter_AddRefs(reader), getter_AddRefs(writer), true, true,
+              segmentSize, 1);
+
+  nsCOMPtr<nsIZeroCopyOutputStream> zeroCopyWriter = do_QueryInterface(writer);
+  ASSERT_TRUE(zeroCopyWriter);
+
+  ASSERT_EQ(NS_ERROR_UNEXPECTED, zeroCopyWriter->EndWrite(0));
+
+  Span<char> buffer;
+  ASSERT_NS_SUCCEEDED(zeroCopyWriter->BeginWrite(&buffer));
+  ASSERT_EQ(segmentSize, buffer.Length());
+
+  // No other write can happen while the buffer is lent.
+  Span<char> other;
+  ASSERT_EQ(NS_ERROR_IN_PROGRESS, zeroCopyWriter->BeginWrite(&other));
+  uint32_t numWritten = 0;
+  ASSERT_EQ(NS_ERROR_IN_PROGRESS, writer->Write("x", 1, &numWritten));
+  ASSERT_EQ(0u, numWritten);
+
+  ASSERT_EQ(NS_ERROR_INVALID_ARG, zeroCopyWriter->EndWrite(segmentSize + 1));
+
+  // Nothing is readable until the buffer is given back.
+  uint64_t available = 0;
+  ASSERT_NS_SUCCEEDED(reader->Available(&available));
+  ASSERT_EQ(0u, available);
+
+  memset(buffer.Elements(), 'a', segmentSize);
+  ASSERT_NS_SUCCEEDED(zeroCopyWriter->EndWrite(segmentSize));
+  ASSERT_NS_SUCCEEDED(reader->Available(&available));
+  ASSERT_EQ(segmentSize, available);
+
+  // The pipe is full.
+  ASSERT_EQ(NS_BASE_STREAM_WOULD_BLOCK, zeroCopyWriter->BeginWrite(&buffer));
+
+  nsCOMPtr<nsIZeroCopyInputStream> zeroCopyReader = do_QueryInterface(reader);
+  ASSERT_TRUE(zeroCopyReader);
+  RefPtr<StreamBufferSource> view;
+  ASSERT_NS_SUCCEEDED(zeroCopyReader->ReadSegmentView(&view));
+  ASSERT_TRUE(view);
+  ASSERT_EQ(segmentSize, view->Data().Length());
+
+  ASSERT_EQ(NS_BASE_STREAM_WOULD_BLOCK,
+            zeroCopyReader->ReadSegmentView(&view));
+  ASSERT_FALSE(view);
+
+  // Reading the segment made room for the writer again.
+  ASSERT_NS_SUCCEEDED(zeroCopyWriter->BeginWrite(&buffer));
+  ASSERT_NS_SUCCEEDED(zeroCopyWriter->EndWrite(0));
+  writer->Close();
+
+  ASSERT_NS_SUCCEEDED(zeroCopyReader->ReadSegmentView(&view));
+  ASSERT_FALSE(view);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Move 64MB through a pipe, with the writer on a background thread. Both sides
+// either copy through Write()/Read(), or fill and read the pipe's segments in
+// place.
+static void TestPipeThroughput(bool aZeroCopy) {
+  const uint64_t totalBytes = uint64_t(64) << 20;
+  const uint32_t segmentSize = 64 * 1024;
+
+  nsCOMPtr<nsIAsyncInputStream> reader;
+  nsCOMPtr<nsIAsyncOutputStream> writer;
+  NS_NewPipe2(getter_AddRefs(reader), getter_AddRefs(writer), false, false,
+              segmentSize, 16);
+
+  nsCOMPtr<nsIThread> thread;
+  ASSERT_NS_SUCCEEDED(NS_NewNamedThread("PipeThroughput",
+                                        getter_AddRefs(thread)));
+  ASSERT_NS_SUCCEEDED(thread->Dispatch(NS_NewRunnableFunction(
+      "TestPipeThroughput", [writer, aZeroCopy, totalBytes, segmentSize]() {
+        nsCOMPtr<nsIZeroCopyOutputStream> zeroCopyWriter =
+            do_QueryInterface(writer);
+        nsTArray<char> scratch;
+        scratch.SetLength(segmentSize);
+
+        uint64_t written = 0;
+        while (written < totalBytes) {
+          uint32_t count = uint32_t(
+              std::min<uint64_t>(segmentSize, totalBytes - written));
+          if (aZeroCopy) {
+            Span<char> buffer;
+            MOZ_ALWAYS_SUCCEEDS(zeroCopyWriter->BeginWrite(&buffer));
+            count = std::min<uint32_t>(count, buffer.Length());
+            memset(buffer.Elements(), char(written), count);
+            MOZ_ALWAYS_SUCCEEDS(zeroCopyWriter->EndWrite(count));
+          } else {
+            memset(scratch.Elements(), char(written), count);
+            uint32_t n;
+            MOZ_ALWAYS_SUCCEEDS(
+                WriteAll(writer, scratch.Elements(), count, &n));
+          }
+          written += count;
+        }
+        writer->Close();
+      })));
+
+  nsCOMPtr<nsIZeroCopyInputStream> zeroCopyReader = do_QueryInterface(reader);
+  nsTArray<char> scratch;
+  scratch.SetLength(segmentSize);
+
+  uint64_t read = 0;
+  while (true) {
+    uint32_t count;
+    if (aZeroCopy) {
+      RefPtr<StreamBufferSource> view;
+      ASSERT_NS_SUCCEEDED(zeroCopyReader->ReadSegmentView(&view));
+      count = view ? view->Data().Length() : 0;
+    } else {
+      ASSERT_NS_SUCCEEDED(
+          reader->Read(scratch.Elements(), segmentSize, &count));
+    }
+    if (!count) {
+      break;
+    }
+    read += count;
+  }
+  ASSERT_EQ(totalBytes, read);
+
+  thread->Shutdown();
+}
+
+}  // namespace
+
+MOZ_GTEST_BENCH(Pipes, Throughput_Copy, [] { TestPipeThroughput(false); });
+
+MOZ_GTEST_BENCH(Pipes, Throughput_ZeroCopy, [] { TestPipeThroughput(true); });
@@ -2064,6 +2064,53 @@ TEST_F(Strings, latin1_to_utf8) {
   EXPECT_TRUE(t.Equals("\xC3\xA4"));
 }
 
+TEST_F(Strings, ASCIICase) {
+  // Every byte value, so that non-ASCII bytes and the chars around the letter
+  // ranges are covered too.
+  nsCString all;
+  for (int c = 1; c < 256; c++) {
+    all.Append(char(c));
+  }
+  nsCString lower;
+  nsCString upper;
+  ToLowerCase(all, lower);
+  ToUpperCase(all, upper);
+  ASSERT_EQ(lower.Length(), all.Length());
+  ASSERT_EQ(upper.Length(), all.Length());
+  for (uint32_t i = 0; i < all.Length(); i++) {
+    char c = all[i];
+    EXPECT_EQ(lower[i], (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c);
+    EXPECT_EQ(upper[i], (c >= 'a' && c <= 'z') ? char(c - ('a' - 'A')) : c);
+  }
+
+  nsCString inPlace(all);
+  ToLowerCase(inPlace);
+  EXPECT_TRUE(inPlace.Equals(lower));
+  ToUpperCase(inPlace);
+  EXPECT_TRUE(inPlace.Equals(upper));
+
+  // Converting into the source string itself.
+  nsCString self("Hello, World"_ns);
+  ToLowerCase(self, self);
+  EXPECT_TRUE(self.EqualsLiteral("hello, world"));
+
+  // Strings which are already in the right case are shared rather than
+  // copied.
+  nsCString alreadyLower("already lower case, with a long enough tail"_ns);
+  alreadyLower.SetCapacity(64);
+  StringBuffer* buffer = alreadyLower.GetStringBuffer();
+  ASSERT_TRUE(buffer);
+  nsCString shared;
+  ToLowerCase(alreadyLower, shared);
+  EXPECT_EQ(shared.GetStringBuffer(), buffer);
+  ToLowerCase(shared);
+  EXPECT_EQ(shared.GetStringBuffer(), buffer);
+
+  nsCString literal("NOT CONVERTED"_ns);
+  ToUpperCase(literal);
+  EXPECT_TRUE(literal.IsLiteral());
+}
+
 TEST_F(Strings, ConvertToSpan) {
   nsString string;
 
@@ -2815,6 +2862,24 @@ CONVERSION_BENCH(PerfUTF8toUTF16VIHundred, CopyUTF8toUTF16, mViHundredUtf8,
 CONVERSION_BENCH(PerfUTF8toUTF16VIThousand, CopyUTF8toUTF16, mViThousandUtf8,
                  nsAutoString);
 
+CONVERSION_BENCH(PerfToLowerCaseASCIIOne, ToLowerCase, mAsciiOneUtf8,
+                 nsAutoCString);
+
+CONVERSION_BENCH(PerfToLowerCaseASCIIFifteen, ToLowerCase, mAsciiFifteenUtf8,
+                 nsAutoCString);
+
+CONVERSION_BENCH(PerfToLowerCaseASCIIHundred, ToLowerCase, mAsciiHundredUtf8,
+                 nsAutoCString);
+
+CONVERSION_BENCH(PerfToLowerCaseASCIIThousand, ToLowerCase,
+                 mAsciiThousandUtf8, nsAutoCString);
+
+CONVERSION_BENCH(PerfToUpperCaseASCIIHundred, ToUpperCase, mAsciiHundredUtf8,
+                 nsAutoCString);
+
+CONVERSION_BENCH(PerfToUpperCaseASCIIThousand, ToUpperCase,
+                 mAsciiThousandUtf8, nsAutoCString);
+
 // Tests for usability of nsTLiteralString in constant expressions.
 static_assert(u""_ns.IsEmpty());
 
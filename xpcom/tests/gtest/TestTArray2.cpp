@@ -1116,6 +1116,38 @@ TEST(TArray, test_swap)
     CHECK_ARRAY(b, expected2);
   }
 
+  // Swap two auto arrays -- one whose data lives on the heap although its auto
+  // storage could hold the other's elements, the other whose data lives on the
+  // stack in auto storage too small for the first one's elements.  The heap
+  // buffer should change hands instead of allocating a new one.
+  {
+    AutoTArray<int, 3> a;
+    AutoTArray<int, 3> b;
+
+    a.AppendElements(data1, std::size(data1));
+    b.AppendElements(data2, std::size(data2));
+
+    CHECK_NOT_USING_AUTO(a);
+    CHECK_IS_USING_AUTO(b);
+    const int* aHeapElements = a.Elements();
+
+    a.SwapElements(b);
+
+    CHECK_IS_USING_AUTO(a);
+    CHECK_NOT_USING_AUTO(b);
+    CHECK_EQ_INT(b.Elements(), aHeapElements);
+    CHECK_ARRAY(a, data2);
+    CHECK_ARRAY(b, data1);
+
+    // Both arrays must still remember their auto buffers.
+    b.Clear();
+    CHECK_IS_USING_AUTO(b);
+    a.AppendElements(data1, std::size(data1));
+    CHECK_NOT_USING_AUTO(a);
+    a.Clear();
+    CHECK_IS_USING_AUTO(a);
+  }
+
   // Swap two arrays, neither of which fits into the other's auto-storage.
   {
     AutoTArray<int, 1> a;
@@ -6,16 +6,22 @@
 
 #include "gtest/gtest.h"
 
+#include <string_view>
+
 #include <stdint.h>  // uint32_t
 
-#include "nsString.h"                // nsACString
-#include "nsThreadUtils.h"           // NS_ProcessNextEvent
-#include "mozilla/Atomics.h"         // Atomic
-#include "mozilla/EventQueue.h"      // EventQueuePriority
-#include "mozilla/Mutex.h"           // Mutex, MutexAutoLock
-#include "mozilla/RefPtr.h"          // RefPtr, do_AddRef
-#include "mozilla/TaskController.h"  // TaskController, Task
-#include "prthread.h"                // PR_Sleep
+#include "GeckoProfiler.h"             // profiler_get_profile
+#include "nsString.h"                  // nsACString
+#include "nsThreadUtils.h"             // NS_ProcessNextEvent
+#include "mozilla/Atomics.h"           // Atomic
+#include "mozilla/EventQueue.h"        // EventQueuePriority
+#include "mozilla/Mutex.h"             // Mutex, MutexAutoLock
+#include "mozilla/ProfilerControl.h"   // profiler_start, profiler_stop
+#include "mozilla/RefPtr.h"            // RefPtr, do_AddRef
+#include "mozilla/ScopeExit.h"         // MakeScopeExit
+#include "mozilla/TaskController.h"    // TaskController, Task
+#include "mozilla/TimeStamp.h"         // TimeStamp, TimeDuration
+#include "prthread.h"                  // PR_Sleep
 
 using namespace mozilla;
 
@@ -211,4 +217,122 @@ TEST(TaskController, RescheduleOrderOffMainThread)
   ASSERT_TRUE(logger3.GetLog() == "333");
 }
 
+class LoggingTask : public Task {
+ public:
+  LoggingTask(Logger* aLogger, const char* aName,
+              EventQueuePriority aPriority = EventQueuePriority::Normal)
+      : Task(Kind::MainThreadOnly, aPriority),
+        mLogger(aLogger),
+        mName(aName) {}
+
+  TaskResult Run() override {
+    mLogger->Add(mName);
+    mRanWithPriority = GetEffectivePriority();
+    return TaskResult::Complete;
+  }
+
+#ifdef MOZ_COLLECTING_RUNNABLE_TELEMETRY
+  bool GetName(nsACString& aName) override {
+    aName.AssignLiteral("LoggingTask");
+    return true;
+  }
+#endif
+
+  uint32_t RanWithPriority() const { return mRanWithPriority; }
+
+ private:
+  Logger* mLogger;
+  const char* mName;
+  uint32_t mRanWithPriority = 0;
+};
+
+TEST(TaskController, DeadlineOrder)
+{
+  Logger logger;
+  TimeStamp now = TimeStamp::Now();
+
+  RefPtr<LoggingTask> noDeadline = new LoggingTask(&logger, "1");
+  RefPtr<LoggingTask> lateDeadline = new LoggingTask(&logger, "2");
+  lateDeadline->SetDeadline(now + TimeDuration::FromSeconds(20));
+  RefPtr<LoggingTask> earlyDeadline = new LoggingTask(&logger, "3");
+  earlyDeadline->SetDeadline(now + TimeDuration::FromSeconds(10));
+  RefPtr<LoggingTask> highPriority =
+      new LoggingTask(&logger, "4", EventQueuePriority::MediumHigh);
+
+  TaskController::Get()->AddTask(do_AddRef(noDeadline));
+  TaskController::Get()->AddTask(do_AddRef(lateDeadline));
+  TaskController::Get()->AddTask(do_AddRef(earlyDeadline));
+  TaskController::Get()->AddTask(do_AddRef(highPriority));
+
+  while (NS_ProcessNextEvent(nullptr, false)) {
+  }
+
+  // Priority first, then earliest deadline first, then tasks without a
+  // deadline in creation order.
+  ASSERT_TRUE(logger.GetLog() == "4321");
+}
+
+TEST(TaskController, PriorityInheritance)
+{
+  Logger logger;
+
+  RefPtr<LoggingTask> dependency = new LoggingTask(&logger, "1");
+  RefPtr<LoggingTask> dependent =
+      new LoggingTask(&logger, "2", EventQueuePriority::MediumHigh);
+  dependent->AddDependency(dependency);
+  RefPtr<LoggingTask> unrelated = new LoggingTask(&logger, "3");
+
+  TaskController::Get()->AddTask(do_AddRef(unrelated));
+  TaskController::Get()->AddTask(do_AddRef(dependency));
+  TaskController::Get()->AddTask(do_AddRef(dependent));
+
+  while (NS_ProcessNextEvent(nullptr, false)) {
+  }
+
+  // The dependency runs ahead of the unrelated normal priority task, with the
+  // priority of the task waiting for it.
+  ASSERT_TRUE(logger.GetLog() == "123");
+  ASSERT_EQ(dependency->RanWithPriority(), dependent->GetPriority());
+  ASSERT_EQ(dependent->RanWithPriority(), dependent->GetPriority());
+  ASSERT_EQ(unrelated->RanWithPriority(), unrelated->GetPriority());
+}
+
+#ifdef MOZ_GECKO_PROFILER
+TEST(TaskController, DeadlineMissedMarker)
+{
+  const char* filters[] = {"GeckoMain"};
+  profiler_start(PROFILER_DEFAULT_ENTRIES, PROFILER_DEFAULT_INTERVAL, 0,
+                 filters, std::size(filters), 0);
+  auto stopProfiler = MakeScopeExit([] { profiler_stop(); });
+  ASSERT_TRUE(profiler_thread_is_being_profiled_for_markers());
+
+  Logger logger;
+  TimeStamp now = TimeStamp::Now();
+
+  RefPtr<LoggingTask> onTime = new LoggingTask(&logger, "1");
+  onTime->SetDeadline(now + TimeDuration::FromSeconds(1000));
+  TaskController::Get()->AddTask(do_AddRef(onTime));
+  while (NS_ProcessNextEvent(nullptr, false)) {
+  }
+
+  UniquePtr<char[]> profile = profiler_get_profile();
+  ASSERT_TRUE(!!profile);
+  ASSERT_EQ(std::string_view(profile.get()).find("TaskDeadlineMissed"),
+            std::string_view::npos);
+
+  RefPtr<LoggingTask> late = new LoggingTask(&logger, "2");
+  late->SetDeadline(now - TimeDuration::FromMilliseconds(1));
+  TaskController::Get()->AddTask(do_AddRef(late));
+  while (NS_ProcessNextEvent(nullptr, false)) {
+  }
+
+  ASSERT_TRUE(logger.GetLog() == "12");
+
+  profile = profiler_get_profile();
+  ASSERT_TRUE(!!profile);
+  ASSERT_NE(std::string_view(profile.get()).find("TaskDeadlineMissed"),
+            std::string_view::npos);
+}
+#endif
+
 }  // namespace TestTaskController
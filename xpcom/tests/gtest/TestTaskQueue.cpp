@@ -95,6 +95,31 @@ TEST(TaskQueue, EventOrder)
   tq3->AwaitShutdownAndIdle();
 }
 
+TEST(TaskQueue, DispatchBatch)
+{
+  RefPtr<TaskQueue> tq =
+      TaskQueue::Create(GetMediaThreadPool(MediaThreadType::SUPERVISOR),
+                        "TestTaskQueue tq");
+
+  nsTArray<int> order;
+  nsTArray<nsCOMPtr<nsIRunnable>> events;
+  for (int i = 0; i < 1000; ++i) {
+    events.AppendElement(NS_NewRunnableFunction(
+        "TestTaskQueue::TaskQueue_DispatchBatch_Test::TestBody",
+        [&order, i]() { order.AppendElement(i); }));
+  }
+  EXPECT_TRUE(NS_SUCCEEDED(NS_DispatchBatch(tq, events)));
+  EXPECT_TRUE(events.IsEmpty());
+
+  tq->BeginShutdown();
+  tq->AwaitShutdownAndIdle();
+
+  ASSERT_EQ(order.Length(), 1000u);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(order[i], i);
+  }
+}
+
 TEST(TaskQueue, GetCurrentSerialEventTarget)
 {
   RefPtr<TaskQueue> tq1 =
@@ -14,8 +14,11 @@
 #include "nsIRunnable.h"
 #include "nsThreadUtils.h"
 #include "mozilla/Atomics.h"
+#include "mozilla/HashFunctions.h"
 #include "mozilla/Monitor.h"
+#include "mozilla/SpinEventLoopUntil.h"
 #include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
 
 using namespace mozilla;
 
@@ -209,3 +212,96 @@ TEST(ThreadPool, ShutdownWithTimeoutThenSleep)
 
   EXPECT_EQ(count, 4);
 }
+
+TEST(ThreadPool, WorkStealing)
+{
+  nsCOMPtr<nsIThreadPool> pool = new nsThreadPool();
+  ASSERT_TRUE(NS_SUCCEEDED(pool->SetThreadLimit(8)));
+  ASSERT_TRUE(NS_SUCCEEDED(pool->EnableWorkStealing()));
+
+  // Each task dispatches more tasks from the pool, which go to the local queue
+  // of the thread running it, for other threads to steal.
+  const int kTasks = 2000;
+  const int kSubtasks = 10;
+  Atomic<int> count(0);
+  for (int i = 0; i < kTasks; ++i) {
+    pool->Dispatch(NS_NewRunnableFunction(
+                       "TestThreadPool::WorkStealing",
+                       [&count, pool]() {
+                         for (int j = 0; j < kSubtasks; ++j) {
+                           pool->Dispatch(NS_NewRunnableFunction(
+                                              "TestThreadPool::WorkStealing",
+                                              [&count]() { ++count; }),
+                                          NS_DISPATCH_NORMAL);
+                         }
+                         ++count;
+                       }),
+                   NS_DISPATCH_NORMAL);
+  }
+
+  SpinEventLoopUntil("TestThreadPool::WorkStealing"_ns,
+                     [&]() { return count == kTasks * (kSubtasks + 1); });
+  pool->Shutdown();
+  EXPECT_EQ(count, kTasks * (kSubtasks + 1));
+}
+
+// Stands in for an image decoder on DecodePool: it decodes a small chunk of
+// the image, then yields by dispatching itself to the pool again.
+class DecodeLikeTask final : public Runnable {
+ public:
+  static const uint32_t kChunks = 200;
+  static const uint32_t kChunkWork = 2000;
+
+  DecodeLikeTask(nsIThreadPool* aPool, Atomic<uint32_t>& aDone)
+      : Runnable("TestThreadPool::DecodeLikeTask"),
+        mPool(aPool),
+        mDone(aDone) {}
+
+  NS_IMETHOD Run() override {
+    for (uint32_t i = 0; i < kChunkWork; ++i) {
+      mHash = AddToHash(mHash, i);
+    }
+    if (++mChunks < kChunks) {
+      return mPool->Dispatch(do_AddRef(this), NS_DISPATCH_NORMAL);
+    }
+    ++mDone;
+    return NS_OK;
+  }
+
+ private:
+  ~DecodeLikeTask() = default;
+
+  nsCOMPtr<nsIThreadPool> mPool;
+  Atomic<uint32_t>& mDone;
+  uint32_t mChunks = 0;
+  HashNumber mHash = 0;
+};
+
+// Decodes 64 images on an 8-thread pool.
+static void RunDecodePoolLikeLoad(bool aWorkStealing) {
+  const uint32_t kDecoders = 64;
+
+  nsCOMPtr<nsIThreadPool> pool = new nsThreadPool();
+  ASSERT_TRUE(NS_SUCCEEDED(pool->SetThreadLimit(8)));
+  ASSERT_TRUE(NS_SUCCEEDED(pool->SetIdleThreadLimit(8)));
+  if (aWorkStealing) {
+    ASSERT_TRUE(NS_SUCCEEDED(pool->EnableWorkStealing()));
+  }
+
+  Atomic<uint32_t> done(0);
+  for (uint32_t i = 0; i < kDecoders; ++i) {
+    pool->Dispatch(MakeAndAddRef<DecodeLikeTask>(pool, done),
+                   NS_DISPATCH_NORMAL);
+  }
+
+  SpinEventLoopUntil("TestThreadPool::RunDecodePoolLikeLoad"_ns,
+                     [&]() { return done == kDecoders; });
+  pool->Shutdown();
+  EXPECT_EQ(done, kDecoders);
+}
+
+MOZ_GTEST_BENCH(ThreadPool, DecodePoolLike_Default,
+                [] { RunDecodePoolLikeLoad(false); });
+
+MOZ_GTEST_BENCH(ThreadPool, DecodePoolLike_WorkStealing,
+                [] { RunDecodePoolLikeLoad(true); });
@@ -14,9 +14,11 @@
 #include "nsIThread.h"
 #include "nsXPCOM.h"
 #include "mozilla/gtest/MozAssertions.h"
+#include "mozilla/Atomics.h"
 #include "mozilla/Monitor.h"
 #include "mozilla/SyncRunnable.h"
 #include "gtest/gtest.h"
+#include "gtest/MozGTestBench.h"
 
 #ifdef XP_WIN
 #  include <windef.h>
@@ -383,6 +385,82 @@ TEST(Threads, UnregisteredShutdownTask)
   thread->Shutdown();
 }
 
+TEST(Threads, DispatchBatch)
+{
+  nsCOMPtr<nsIThread> thread;
+  MOZ_ALWAYS_SUCCEEDS(
+      NS_NewNamedThread("Testing Thread", getter_AddRefs(thread)));
+
+  // Only touched on the target thread, until it's shut down.
+  nsTArray<int> order;
+  {
+    EventTargetBatch batch(thread);
+    for (int i = 0; i < 100; ++i) {
+      batch.Dispatch(NS_NewRunnableFunction(
+          "Threads::DispatchBatch", [&order, i] { order.AppendElement(i); }));
+    }
+    EXPECT_EQ(batch.Length(), 100u);
+  }
+
+  nsTArray<nsCOMPtr<nsIRunnable>> events;
+  for (int i = 100; i < 200; ++i) {
+    events.AppendElement(NS_NewRunnableFunction(
+        "Threads::DispatchBatch", [&order, i] { order.AppendElement(i); }));
+  }
+  EXPECT_NS_SUCCEEDED(NS_DispatchBatch(thread, events));
+  EXPECT_TRUE(events.IsEmpty());
+
+  thread->Shutdown();
+
+  ASSERT_EQ(order.Length(), 200u);
+  for (int i = 0; i < 200; ++i) {
+    EXPECT_EQ(order[i], i);
+  }
+
+  // Events that can't be dispatched are handed back to the caller.
+  events.AppendElement(
+      NS_NewRunnableFunction("Threads::DispatchBatch", [] {}));
+  EXPECT_NS_FAILED(NS_DispatchBatch(thread, events));
+  EXPECT_EQ(events.Length(), 1u);
+}
+
+// Sends many small runnables to another thread in bursts, like a producer
+// that keeps the target busy. Batched, each burst is queued under a single
+// acquisition of the queue lock and wakes the target thread at most once,
+// instead of once per runnable.
+static void DispatchBursts(bool aBatched) {
+  const uint32_t kBursts = 200;
+  const uint32_t kBurstLength = 64;
+
+  nsCOMPtr<nsIThread> thread;
+  MOZ_ALWAYS_SUCCEEDS(
+      NS_NewNamedThread("Testing Thread", getter_AddRefs(thread)));
+
+  Atomic<uint32_t> count{0};
+  for (uint32_t b = 0; b < kBursts; ++b) {
+    if (aBatched) {
+      EventTargetBatch batch(thread);
+      for (uint32_t i = 0; i < kBurstLength; ++i) {
+        batch.Dispatch(NS_NewRunnableFunction("Threads::DispatchBursts",
+                                              [&count] { ++count; }));
+      }
+    } else {
+      for (uint32_t i = 0; i < kBurstLength; ++i) {
+        MOZ_ALWAYS_SUCCEEDS(thread->Dispatch(NS_NewRunnableFunction(
+            "Threads::DispatchBursts", [&count] { ++count; })));
+      }
+    }
+  }
+
+  thread->Shutdown();
+  ASSERT_EQ(uint32_t(count), kBursts * kBurstLength);
+}
+
+MOZ_GTEST_BENCH(Threads, DispatchBursts_OneByOne,
+                [] { DispatchBursts(false); });
+
+MOZ_GTEST_BENCH(Threads, DispatchBursts_Batched, [] { DispatchBursts(true); });
+
 #if (defined(XP_WIN) || !defined(DEBUG)) && !defined(XP_MACOSX)
 TEST(Threads, OptionsIsUiThread)
 {
@@ -926,3 +926,66 @@ TEST(Timers, HighResFuncCallback)
       "TestTimers::HighResFuncCallback"_ns,
       [&] { return !first.IsNull() && !second.IsNull() && !third.IsNull(); });
 }
+
+static void AppendDelay(nsITimer* aTimer, void* aClosure) {
+  auto* fired = static_cast<std::vector<uint32_t>*>(aClosure);
+  uint32_t delay;
+  aTimer->GetDelay(&delay);
+  fired->push_back(delay);
+}
+
+// Arms, cancels and re-arms a large number of timers, to make sure that the
+// timer thread doesn't degrade with many pending timers, and that short timers
+// buried among them still fire in order.
+TEST(Timers, ChurnManyTimers)
+{
+  const uint32_t kNumTimers = 20000;
+  // Long enough to never fire during the test.
+  const uint32_t kLongDelay = 60 * 60 * 1000;
+
+  nsTArray<nsCOMPtr<nsITimer>> timers(kNumTimers);
+  for (uint32_t i = 0; i < kNumTimers; ++i) {
+    timers.AppendElement(NS_NewTimer(GetCurrentSerialEventTarget()));
+  }
+
+  std::vector<uint32_t> fired;
+  auto unusedCallback = [](nsITimer*, void*) { FAIL() << "Shouldn't fire."; };
+
+  for (uint32_t i = 0; i < kNumTimers; ++i) {
+    MOZ_ALWAYS_SUCCEEDS(timers[i]->InitWithNamedFuncCallback(
+        unusedCallback, nullptr, kLongDelay + (i * 7919) % kNumTimers,
+        nsITimer::TYPE_ONE_SHOT, "TestTimers::ChurnManyTimers::long"));
+  }
+  // Cancel every other timer, and re-arm every third timer, which cancels it
+  // first if it is still armed.
+  for (uint32_t i = 0; i < kNumTimers; i += 2) {
+    timers[i]->Cancel();
+  }
+  for (uint32_t i = 0; i < kNumTimers; i += 3) {
+    MOZ_ALWAYS_SUCCEEDS(timers[i]->InitWithNamedFuncCallback(
+        unusedCallback, nullptr, kLongDelay + i, nsITimer::TYPE_ONE_SHOT,
+        "TestTimers::ChurnManyTimers::rearmed"));
+  }
+
+  // Bury some short timers in the middle, armed in reverse order. Their delays
+  // are far enough apart to not be reordered by coalescing.
+  const uint32_t kNumShortTimers = 10;
+  for (uint32_t i = 0; i < kNumShortTimers; ++i) {
+    uint32_t delay = (kNumShortTimers - i) * 20;
+    MOZ_ALWAYS_SUCCEEDS(timers[i * 1000 + 1]->InitWithNamedFuncCallback(
+        &AppendDelay, &fired, delay, nsITimer::TYPE_ONE_SHOT,
+        "TestTimers::ChurnManyTimers::short"));
+  }
+
+  SpinEventLoopUntil<ProcessFailureBehavior::IgnoreAndContinue>(
+      "TestTimers::ChurnManyTimers"_ns,
+      [&] { return fired.size() == kNumShortTimers; });
+  ASSERT_EQ(fired.size(), kNumShortTimers);
+  for (uint32_t i = 0; i < kNumShortTimers; ++i) {
+    EXPECT_EQ(fired[i], (i + 1) * 20) << "Timers must fire in order";
+  }
+
+  for (auto& timer : timers) {
+    timer->Cancel();
+  }
+}
@@ -13,6 +13,7 @@
 #include "mozilla/Mutex.h"
 #include "nsIThreadInternal.h"
 #include "nsCOMPtr.h"
+#include "nsTArray.h"
 #include "nsTObserverArray.h"
 
 class nsIEventTarget;
@@ -42,6 +43,12 @@ class ThreadTargetSink {
   virtual bool PutEvent(already_AddRefed<nsIRunnable>&& aEvent,
                         EventQueuePriority aPriority) = 0;
 
+  // Puts all of aEvents, in order, with a single wake-up of the thread. On
+  // success aEvents is left empty. On failure none of the events were posted
+  // and aEvents is left untouched.
+  virtual bool PutEvents(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                         EventQueuePriority aPriority) = 0;
+
   // After this method is called, no more events can be posted.
   virtual void Disconnect(const MutexAutoLock& aProofOfLock) = 0;
 
@@ -190,6 +190,61 @@ struct IncompleteTaskMarker : BaseMarkerType<IncompleteTaskMarker> {
   }
 };
 
+#endif
+
+struct TaskDeadlineMissedMarker : BaseMarkerType<TaskDeadlineMissedMarker> {
+  static constexpr const char* Name = "TaskDeadlineMissed";
+  static constexpr const char* Description =
+      "A task with a deadline completed after it.";
+
+  using MS = MarkerSchema;
+  static constexpr MS::PayloadField PayloadFields[] = {
+      {"name", MS::InputType::CString, "Task Name", MS::Format::String,
+       MS::PayloadFlags::Searchable},
+      {"priority", MS::InputType::Uint32, "Effective priority level",
+       MS::Format::Integer},
+      {"lateness", MS::InputType::TimeDuration, "Lateness",
+       MS::Format::Duration}};
+
+  static constexpr MS::Location Locations[] = {MS::Location::MarkerChart,
+                                               MS::Location::MarkerTable};
+  static constexpr const char* TableLabel =
+      "{marker.name} - {marker.data.name} - late by {marker.data.lateness}";
+
+  static void StreamJSONMarkerData(baseprofiler::SpliceableJSONWriter& aWriter,
+                                   const nsCString& aName, uint32_t aPriority,
+                                   const TimeDuration& aLateness) {
+    aWriter.StringProperty("name", aName);
+    aWriter.IntProperty("priority", aPriority);
+    aWriter.TimeDoubleMsProperty("lateness", aLateness.ToMilliseconds());
+  }
+};
+
+// Report a task that completed after its (possibly inherited) deadline. The
+// effective deadline is set under the graph mutex before the task is handed
+// to the thread running it, and isn't modified until it completes.
+void TaskController::MaybeAddDeadlineMissedMarker(
+    Task* aTask, const TimeStamp& aStartTime) {
+  const TimeStamp& deadline = aTask->mEffectiveDeadline;
+  if (deadline.IsNull() || !profiler_thread_is_being_profiled_for_markers()) {
+    return;
+  }
+  TimeStamp now = TimeStamp::Now();
+  if (now <= deadline) {
+    return;
+  }
+  nsAutoCString name;
+  if (!aTask->GetName(name)) {
+    name.AssignLiteral("unnamed task");
+  }
+  profiler_add_marker("TaskDeadlineMissed", baseprofiler::category::OTHER,
+                      MarkerTiming::Interval(aStartTime, now),
+                      TaskDeadlineMissedMarker{}, name,
+                      aTask->mEffectivePriority, now - deadline);
+}
+
+#if defined(MOZ_COLLECTING_RUNNABLE_TELEMETRY)
+
 // Wrap task->Run() so that we can add markers for it
 Task::TaskResult TaskController::RunTask(Task* aTask) {
   if (!profiler_is_collecting_markers()) {
@@ -206,6 +261,10 @@ Task::TaskResult TaskController::RunTask(Task* aTask) {
 
   auto result = aTask->Run();
 
+  if (result == Task::TaskResult::Complete) {
+    MaybeAddDeadlineMissedMarker(aTask, startTime);
+  }
+
   if (profiler_thread_is_being_profiled_for_markers()) {
     AUTO_PROFILER_LABEL("AutoProfileTask", PROFILER);
     AUTO_PROFILER_STATS(AUTO_PROFILE_TASK);
@@ -225,7 +284,19 @@ Task::TaskResult TaskController::RunTask(Task* aTask) {
   return result;
 }
 #else
-Task::TaskResult TaskController::RunTask(Task* aTask) { return aTask->Run(); }
+Task::TaskResult TaskController::RunTask(Task* aTask) {
+  if (!profiler_is_collecting_markers()) {
+    return aTask->Run();
+  }
+
+  TimeStamp startTime = TimeStamp::Now();
+  auto result = aTask->Run();
+
+  if (result == Task::TaskResult::Complete) {
+    MaybeAddDeadlineMissedMarker(aTask, startTime);
+  }
+  return result;
+}
 #endif
 
 bool TaskManager::
@@ -557,7 +628,7 @@ bool TaskController::MaybeDispatchOneThreadableTask(
     return false;
   }
 
-  auto [task, effetivePriority] = TakeThreadableTaskToRun(aProofOfLock);
+  auto [task, effectivePriority] = TakeThreadableTaskToRun(aProofOfLock);
   if (!task) {
     return false;
   }
@@ -567,9 +638,8 @@ bool TaskController::MaybeDispatchOneThreadableTask(
   MOZ_ASSERT(!thread->mCurrentTask);
   MOZ_ASSERT(mIdleThreadCount != 0);
   thread->mCurrentTask = task;
-  thread->mEffectiveTaskPriority = effetivePriority;
+  thread->mEffectiveTaskPriority = effectivePriority;
   thread->mThreadCV.Notify();
-  task->mInProgress = true;
   mIdleThreadCount--;
 
   return true;
@@ -589,7 +659,8 @@ TaskController::TaskToRun TaskController::TakeThreadableTaskToRun(
     }
 
     if (task->GetKind() != Task::Kind::MainThreadOnly && !task->mInProgress) {
-      TaskToRun taskToRun{task, rootTask->GetPriority()};
+      SetTaskInProgress(task, rootTask);
+      TaskToRun taskToRun{task, task->mEffectivePriority};
       mThreadableTasks.erase(task->mIterator);
       task->mIterator = mThreadableTasks.end();
       return taskToRun;
@@ -1230,7 +1301,8 @@ bool TaskController::DoExecuteNextTaskOnlyMainThreadInternal(
   if (mMainThreadTasks.size() > totalSuspended) {
     for (auto iter = mMainThreadTasks.begin(); iter != mMainThreadTasks.end();
          iter++) {
-      Task* task = iter->get();
+      Task* rootTask = iter->get();
+      Task* task = rootTask;
 
       if (task->mTaskManager && task->mTaskManager->mCurrentSuspended) {
         // Even though we may want to run some dependencies of this task, we
@@ -1248,9 +1320,9 @@ bool TaskController::DoExecuteNextTaskOnlyMainThreadInternal(
       }
 
       mCurrentTasksMT.push(task);
+      SetTaskInProgress(task, rootTask);
       mMainThreadTasks.erase(task->mIterator);
       task->mIterator = mMainThreadTasks.end();
-      task->mInProgress = true;
       TaskManager* manager = task->GetManager();
       bool result = false;
 
@@ -1373,6 +1445,25 @@ Task* TaskController::GetFinalDependency(Task* aTask) {
   return aTask;
 }
 
+void TaskController::SetTaskInProgress(Task* aTask, Task* aRootTask) {
+  mGraphMutex.AssertCurrentThreadOwns();
+  MOZ_ASSERT(!aTask->mInProgress);
+
+  aTask->mInProgress = true;
+
+  // Priority inheritance: a dependency runs with the priority, and the
+  // deadline, of the task that is waiting for it, so that it isn't preempted
+  // by work that is less urgent than its dependent.
+  aTask->mEffectivePriority =
+      std::max(aTask->GetPriority(), aRootTask->GetPriority());
+  aTask->mEffectiveDeadline = aTask->mDeadline;
+  const TimeStamp& rootDeadline = aRootTask->mDeadline;
+  if (!rootDeadline.IsNull() && (aTask->mEffectiveDeadline.IsNull() ||
+                                 rootDeadline < aTask->mEffectiveDeadline)) {
+    aTask->mEffectiveDeadline = rootDeadline;
+  }
+}
+
 void TaskController::MaybeInterruptTask(Task* aTask,
                                         const MutexAutoLock& aProofOfLock) {
   mGraphMutex.AssertCurrentThreadOwns();
@@ -1416,7 +1507,9 @@ void TaskController::MaybeInterruptTask(Task* aTask,
       return;
     }
 
-    if (mCurrentTasksMT.top()->GetPriority() < aTask->GetPriority()) {
+    // Compare against the inherited priority, so that we don't interrupt a
+    // task that a higher priority task is waiting for.
+    if (mCurrentTasksMT.top()->mEffectivePriority < aTask->GetPriority()) {
       mCurrentTasksMT.top()->RequestInterrupt(aTask->GetPriority());
     }
   } else {
@@ -1427,11 +1520,13 @@ void TaskController::MaybeInterruptTask(Task* aTask,
       return;
     }
 
-    Task* lowestPriorityTask = nullptr;
+    // Priorities are compared using the effective priority of running tasks,
+    // which includes the priority they inherited from their dependents.
+    PoolThread* lowestPriorityThread = nullptr;
     for (auto& thread : mPoolThreads) {
       MOZ_ASSERT(thread->mCurrentTask);
-      if (!lowestPriorityTask) {
-        lowestPriorityTask = thread->mCurrentTask.get();
+      if (!lowestPriorityThread) {
+        lowestPriorityThread = thread.get();
         continue;
       }
 
@@ -1439,13 +1534,15 @@ void TaskController::MaybeInterruptTask(Task* aTask,
       // the latest. But for now we ignore that optimization.
       // This also doesn't guarantee a task is interruptable, so that's an
       // avenue for improvements as well.
-      if (lowestPriorityTask->GetPriority() > thread->mEffectiveTaskPriority) {
-        lowestPriorityTask = thread->mCurrentTask.get();
+      if (lowestPriorityThread->mEffectiveTaskPriority >
+          thread->mEffectiveTaskPriority) {
+        lowestPriorityThread = thread.get();
       }
     }
 
-    if (lowestPriorityTask->GetPriority() < aTask->GetPriority()) {
-      lowestPriorityTask->RequestInterrupt(aTask->GetPriority());
+    if (lowestPriorityThread->mEffectiveTaskPriority < aTask->GetPriority()) {
+      lowestPriorityThread->mCurrentTask->RequestInterrupt(
+          aTask->GetPriority());
     }
 
     // We choose not to interrupt main thread tasks for tasks which may be
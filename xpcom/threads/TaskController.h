@@ -118,7 +118,8 @@ class TaskManager {
 // thread, but they may also be executed in parallel to any other task they do
 // not have a dependency relationship with.
 //
-// Tasks will be run in order of object creation.
+// Tasks of the same priority will be run in order of object creation, except
+// for tasks with a deadline, see SetDeadline().
 class Task {
  public:
   enum class Kind : uint8_t {
@@ -140,6 +141,10 @@ class Task {
   // This returns the current task priority with its modifier applied.
   uint32_t GetPriority() { return mPriority + mPriorityModifier; }
   uint64_t GetSeqNo() { return mSeqNo; }
+  const TimeStamp& GetDeadline() { return mDeadline; }
+  // The priority this task is running with, which includes the priority it
+  // inherited from a task waiting for it. Only valid from within Run().
+  uint32_t GetEffectivePriority() { return mEffectivePriority; }
 
   // Callee needs to assume this may be called on any thread.
   // aInterruptPriority passes the priority of the higher priority task that
@@ -160,6 +165,18 @@ class Task {
     mDependencies.insert(aTask);
   }
 
+  // Give this task a time by which it should have completed, e.g. the next
+  // refresh for rendering work. Within a priority level, tasks with a deadline
+  // run before tasks without one, earliest deadline first. A task that
+  // completes after its deadline is reported with a profiler marker. Tasks
+  // that this task depends on inherit its deadline while they run on its
+  // behalf. Calling this after the task has been added to the TaskController
+  // results in undefined behavior.
+  void SetDeadline(TimeStamp aDeadline) {
+    MOZ_ASSERT(!mIsInGraph);
+    mDeadline = aDeadline;
+  }
+
   // This sets the TaskManager for the current task. Calling this after the
   // task has been added to the TaskController results in undefined behavior.
   void SetManager(TaskManager* aManager) {
@@ -174,8 +191,20 @@ class Task {
                     const RefPtr<Task>& aTaskB) const {
       uint32_t prioA = aTaskA->GetPriority();
       uint32_t prioB = aTaskB->GetPriority();
-      return (prioA > prioB) ||
-             (prioA == prioB && (aTaskA->GetSeqNo() < aTaskB->GetSeqNo()));
+      if (prioA != prioB) {
+        return prioA > prioB;
+      }
+      // Earliest deadline first within a priority level. Tasks without a
+      // deadline keep their creation order, after those that have one.
+      const TimeStamp& deadlineA = aTaskA->GetDeadline();
+      const TimeStamp& deadlineB = aTaskB->GetDeadline();
+      if (deadlineA != deadlineB) {
+        if (deadlineA.IsNull() || deadlineB.IsNull()) {
+          return !deadlineA.IsNull();
+        }
+        return deadlineA < deadlineB;
+      }
+      return aTaskA->GetSeqNo() < aTaskB->GetSeqNo();
     }
   };
 
@@ -252,6 +281,14 @@ class Task {
   // Time this task was inserted into the task graph, this is used by the
   // profiler.
   mozilla::TimeStamp mInsertionTime;
+  // Immutable once the task is in the graph, since it is part of the sort key.
+  mozilla::TimeStamp mDeadline;
+
+  // Priority and deadline this task is running with. They may be higher, resp.
+  // earlier, than its own when it runs on behalf of a task depending on it.
+  // These are only valid while mInProgress is true.
+  uint32_t mEffectivePriority = 0;
+  mozilla::TimeStamp mEffectiveDeadline;
 };
 
 // A task manager implementation for priority levels that should only
@@ -387,6 +424,12 @@ class TaskController {
       const MutexAutoLock& aProofOfLock);
 
   Task* GetFinalDependency(Task* aTask);
+  // Mark aTask as about to run on behalf of aRootTask, which may be aTask
+  // itself, inheriting its priority and deadline.
+  void SetTaskInProgress(Task* aTask, Task* aRootTask);
+  // Called after aTask completed, to report it if it missed its deadline.
+  static void MaybeAddDeadlineMissedMarker(Task* aTask,
+                                           const TimeStamp& aStartTime);
   void MaybeInterruptTask(Task* aTask, const MutexAutoLock& aProofOfLock);
   Task* GetHighestPriorityMTTask();
 
@@ -85,6 +85,7 @@ NS_IMPL_RELEASE_INHERITED(TaskQueue, SupportsThreadSafeWeakPtr<TaskQueue>)
 
 NS_INTERFACE_MAP_BEGIN(TaskQueue)
   NS_INTERFACE_MAP_ENTRY(nsIDirectTaskDispatcher)
+  NS_INTERFACE_MAP_ENTRY(nsIBatchedEventTarget)
   NS_INTERFACE_MAP_ENTRY(nsISerialEventTarget)
   NS_INTERFACE_MAP_ENTRY(nsIEventTarget)
   NS_INTERFACE_MAP_ENTRY_CONCRETE(TaskQueue)
@@ -136,6 +137,33 @@ nsresult TaskQueue::DispatchLocked(nsCOMPtr<nsIRunnable>& aRunnable,
   return NS_OK;
 }
 
+// All the events are queued under a single acquisition of the queue monitor,
+// and only the first one, if the queue was idle, dispatches a Runner to the
+// target.
+NS_IMETHODIMP
+TaskQueue::DispatchBatch(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                         uint32_t aFlags) {
+  for (const auto& event : aEvents) {
+    NS_ENSURE_ARG(event);
+  }
+
+  nsresult rv = NS_OK;
+  {
+    MonitorAutoLock mon(mQueueMonitor);
+    for (auto& event : aEvents) {
+      rv = DispatchLocked(/* passed by ref */ event, aFlags, NormalDispatch);
+      if (NS_FAILED(rv)) {
+        break;
+      }
+    }
+  }
+  // Events whose ownership was transferred to the queue have been nulled out.
+  // The others are left to the caller, to be released outside the lock for the
+  // same reason as in Dispatch().
+  aEvents.RemoveElementsBy([](const auto& aEvent) { return !aEvent; });
+  return rv;
+}
+
 nsresult TaskQueue::RegisterShutdownTask(nsITargetShutdownTask* aTask) {
   NS_ENSURE_ARG(aTask);
 
@@ -15,6 +15,7 @@
 #include "mozilla/RefPtr.h"
 #include "mozilla/TaskDispatcher.h"
 #include "mozilla/ThreadSafeWeakPtr.h"
+#include "nsIBatchedEventTarget.h"
 #include "nsIDirectTaskDispatcher.h"
 #include "nsThreadUtils.h"
 
@@ -54,12 +55,14 @@ class TaskQueueTrackerEntry;
 // a promise that gets resolved once all pending tasks have completed
 class TaskQueue final : public AbstractThread,
                         public nsIDirectTaskDispatcher,
+                        public nsIBatchedEventTarget,
                         public SupportsThreadSafeWeakPtr<TaskQueue> {
   class EventTargetWrapper;
 
  public:
   NS_DECL_ISUPPORTS_INHERITED
   NS_DECL_NSIDIRECTTASKDISPATCHER
+  NS_DECL_NSIBATCHEDEVENTTARGET
   MOZ_DECLARE_REFCOUNTED_TYPENAME(TaskQueue)
   NS_INLINE_DECL_STATIC_IID(MOZILLA_TASKQUEUE_IID)
 
@@ -30,6 +30,11 @@ class ThreadEventQueue::NestedSink : public ThreadTargetSink {
     return mOwner->PutEventInternal(std::move(aEvent), aPriority, this);
   }
 
+  bool PutEvents(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                 EventQueuePriority aPriority) final {
+    return mOwner->PutEventsInternal(aEvents, aPriority, this);
+  }
+
   void Disconnect(const MutexAutoLock& aProofOfLock) final { mQueue = nullptr; }
 
   nsresult RegisterShutdownTask(nsITargetShutdownTask* aTask) final {
@@ -73,6 +78,47 @@ bool ThreadEventQueue::PutEvent(already_AddRefed<nsIRunnable>&& aEvent,
   return PutEventInternal(std::move(aEvent), aPriority, nullptr);
 }
 
+bool ThreadEventQueue::PutEvents(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                                 EventQueuePriority aPriority) {
+  return PutEventsInternal(aEvents, aPriority, nullptr);
+}
+
+EventQueuePriority ThreadEventQueue::GetEventPriority(
+    nsIRunnable* aEvent, EventQueuePriority aPriority) {
+  if (!mIsMainThread) {
+    return aPriority;
+  }
+  if (nsCOMPtr<nsIRunnablePriority> runnablePrio = do_QueryInterface(aEvent)) {
+    uint32_t prio = nsIRunnablePriority::PRIORITY_NORMAL;
+    runnablePrio->GetPriority(&prio);
+    if (prio == nsIRunnablePriority::PRIORITY_CONTROL) {
+      return EventQueuePriority::Control;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_RENDER_BLOCKING) {
+      return EventQueuePriority::RenderBlocking;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_VSYNC) {
+      return EventQueuePriority::Vsync;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_INPUT_HIGH) {
+      return EventQueuePriority::InputHigh;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_MEDIUMHIGH) {
+      return EventQueuePriority::MediumHigh;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_DEFERRED_TIMERS) {
+      return EventQueuePriority::DeferredTimers;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_IDLE) {
+      return EventQueuePriority::Idle;
+    }
+    if (prio == nsIRunnablePriority::PRIORITY_LOW) {
+      return EventQueuePriority::Low;
+    }
+  }
+  return aPriority;
+}
+
 bool ThreadEventQueue::PutEventInternal(already_AddRefed<nsIRunnable>&& aEvent,
                                         EventQueuePriority aPriority,
                                         NestedSink* aSink) {
@@ -85,30 +131,7 @@ bool ThreadEventQueue::PutEventInternal(already_AddRefed<nsIRunnable>&& aEvent,
     // Check if the runnable wants to override the passed-in priority.
     // Do this outside the lock, so runnables implemented in JS can QI
     // (and possibly GC) outside of the lock.
-    if (mIsMainThread) {
-      auto* e = event.get();  // can't do_QueryInterface on LeakRefPtr.
-      if (nsCOMPtr<nsIRunnablePriority> runnablePrio = do_QueryInterface(e)) {
-        uint32_t prio = nsIRunnablePriority::PRIORITY_NORMAL;
-        runnablePrio->GetPriority(&prio);
-        if (prio == nsIRunnablePriority::PRIORITY_CONTROL) {
-          aPriority = EventQueuePriority::Control;
-        } else if (prio == nsIRunnablePriority::PRIORITY_RENDER_BLOCKING) {
-          aPriority = EventQueuePriority::RenderBlocking;
-        } else if (prio == nsIRunnablePriority::PRIORITY_VSYNC) {
-          aPriority = EventQueuePriority::Vsync;
-        } else if (prio == nsIRunnablePriority::PRIORITY_INPUT_HIGH) {
-          aPriority = EventQueuePriority::InputHigh;
-        } else if (prio == nsIRunnablePriority::PRIORITY_MEDIUMHIGH) {
-          aPriority = EventQueuePriority::MediumHigh;
-        } else if (prio == nsIRunnablePriority::PRIORITY_DEFERRED_TIMERS) {
-          aPriority = EventQueuePriority::DeferredTimers;
-        } else if (prio == nsIRunnablePriority::PRIORITY_IDLE) {
-          aPriority = EventQueuePriority::Idle;
-        } else if (prio == nsIRunnablePriority::PRIORITY_LOW) {
-          aPriority = EventQueuePriority::Low;
-        }
-      }
-    }
+    aPriority = GetEventPriority(event.get(), aPriority);
 
     MutexAutoLock lock(mLock);
 
@@ -142,6 +165,55 @@ bool ThreadEventQueue::PutEventInternal(already_AddRefed<nsIRunnable>&& aEvent,
   return true;
 }
 
+bool ThreadEventQueue::PutEventsInternal(
+    nsTArray<nsCOMPtr<nsIRunnable>>& aEvents, EventQueuePriority aPriority,
+    NestedSink* aSink) {
+  if (aEvents.IsEmpty()) {
+    return true;
+  }
+
+  // As in PutEventInternal, compute priorities outside of the lock.
+  AutoTArray<EventQueuePriority, 16> priorities;
+  priorities.SetCapacity(aEvents.Length());
+  for (const auto& event : aEvents) {
+    priorities.AppendElement(GetEventPriority(event, aPriority));
+  }
+
+  nsCOMPtr<nsIThreadObserver> obs;
+  {
+    MutexAutoLock lock(mLock);
+
+    if (mEventsAreDoomed) {
+      return false;
+    }
+
+    EventQueue* queue = mBaseQueue.get();
+    if (aSink) {
+      if (!aSink->mQueue) {
+        return false;
+      }
+      queue = aSink->mQueue;
+    }
+
+    for (size_t i = 0; i < aEvents.Length(); ++i) {
+      queue->PutEvent(aEvents[i].forget(), priorities[i], lock);
+    }
+    aEvents.Clear();
+
+    // A single wake-up for the whole batch.
+    mEventsAvailable.Notify();
+
+    // See PutEventInternal.
+    obs = mObserver;
+  }
+
+  if (obs) {
+    obs->OnDispatchedEvent();
+  }
+
+  return true;
+}
+
 already_AddRefed<nsIRunnable> ThreadEventQueue::GetEvent(
     bool aMayWait, mozilla::TimeDuration* aLastEventDelay) {
   nsCOMPtr<nsIRunnable> event;
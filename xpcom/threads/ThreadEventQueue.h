@@ -34,6 +34,8 @@ class ThreadEventQueue final : public SynchronizedEventQueue {
 
   bool PutEvent(already_AddRefed<nsIRunnable>&& aEvent,
                 EventQueuePriority aPriority) final;
+  bool PutEvents(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                 EventQueuePriority aPriority) final;
 
   already_AddRefed<nsIRunnable> GetEvent(
       bool aMayWait, mozilla::TimeDuration* aLastEventDelay = nullptr) final;
@@ -65,6 +67,13 @@ class ThreadEventQueue final : public SynchronizedEventQueue {
 
   bool PutEventInternal(already_AddRefed<nsIRunnable>&& aEvent,
                         EventQueuePriority aPriority, NestedSink* aQueue);
+  bool PutEventsInternal(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                         EventQueuePriority aPriority, NestedSink* aQueue);
+
+  // On the main thread, runnables can override the priority they are
+  // dispatched with, see nsIRunnablePriority.
+  EventQueuePriority GetEventPriority(nsIRunnable* aEvent,
+                                      EventQueuePriority aPriority);
 
   const UniquePtr<EventQueue> mBaseQueue MOZ_GUARDED_BY(mLock);
 
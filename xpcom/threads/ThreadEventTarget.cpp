@@ -48,7 +48,8 @@ void ThreadEventTarget::SetCurrentThread(PRThread* aThread) {
 
 void ThreadEventTarget::ClearCurrentThread() { mThread = nullptr; }
 
-NS_IMPL_ISUPPORTS(ThreadEventTarget, nsIEventTarget, nsISerialEventTarget)
+NS_IMPL_ISUPPORTS(ThreadEventTarget, nsIEventTarget, nsISerialEventTarget,
+                  nsIBatchedEventTarget)
 
 NS_IMETHODIMP
 ThreadEventTarget::DispatchFromScript(nsIRunnable* aRunnable, uint32_t aFlags) {
@@ -98,6 +99,40 @@ ThreadEventTarget::Dispatch(already_AddRefed<nsIRunnable> aEvent,
   return NS_OK;
 }
 
+NS_IMETHODIMP
+ThreadEventTarget::DispatchBatch(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                                 uint32_t aFlags) {
+  NS_ASSERTION(!gXPCOMThreadsShutDownNotified || mIsMainThread ||
+                   PR_GetCurrentThread() == mThread ||
+                   (aFlags & NS_DISPATCH_IGNORE_BLOCK_DISPATCH),
+               "Dispatch to non-main thread after xpcom-shutdown-threads");
+
+  if (mBlockDispatch && !(aFlags & NS_DISPATCH_IGNORE_BLOCK_DISPATCH)) {
+    MOZ_DIAGNOSTIC_ASSERT(
+        false,
+        "Attempt to dispatch to thread which does not usually process "
+        "dispatched runnables until shutdown");
+    return NS_ERROR_NOT_IMPLEMENTED;
+  }
+
+  NS_ASSERTION((aFlags & (NS_DISPATCH_AT_END |
+                          NS_DISPATCH_IGNORE_BLOCK_DISPATCH)) == aFlags,
+               "unexpected dispatch flags");
+  for (const auto& event : aEvents) {
+    if (NS_WARN_IF(!event)) {
+      return NS_ERROR_INVALID_ARG;
+    }
+    LogRunnable::LogDispatch(event.get());
+  }
+
+  if (!mSink->PutEvents(aEvents, EventQueuePriority::Normal)) {
+    return NS_ERROR_UNEXPECTED;
+  }
+  // Delay to encourage the receiving task to run before we do work.
+  DelayForChaosMode(ChaosFeature::TaskDispatching, 1000);
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 ThreadEventTarget::DelayedDispatch(already_AddRefed<nsIRunnable> aEvent,
                                    uint32_t aDelayMs) {
@@ -10,6 +10,7 @@
 #include "mozilla/MemoryReporting.h"
 #include "mozilla/Mutex.h"
 #include "mozilla/SynchronizedEventQueue.h"  // for ThreadTargetSink
+#include "nsIBatchedEventTarget.h"
 #include "nsISerialEventTarget.h"
 
 namespace mozilla {
@@ -17,13 +18,15 @@ class DelayedRunnable;
 
 // ThreadEventTarget handles the details of posting an event to a thread. It can
 // be used with any ThreadTargetSink implementation.
-class ThreadEventTarget final : public nsISerialEventTarget {
+class ThreadEventTarget final : public nsISerialEventTarget,
+                                public nsIBatchedEventTarget {
  public:
   ThreadEventTarget(ThreadTargetSink* aSink, bool aIsMainThread,
                     bool aBlockDispatch);
 
   NS_DECL_THREADSAFE_ISUPPORTS
   NS_DECL_NSIEVENTTARGET_FULL
+  NS_DECL_NSIBATCHEDEVENTTARGET
 
   // Disconnects the target so that it can no longer post events.
   void Disconnect(const MutexAutoLock& aProofOfLock) {
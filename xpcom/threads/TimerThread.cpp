@@ -21,6 +21,7 @@
 
 #include "mozilla/glean/XpcomMetrics.h"
 
+#include <algorithm>
 #include <math.h>
 
 using namespace mozilla;
@@ -229,6 +230,7 @@ TimerThread::TimerThread()
       mWaiting(false),
       mNotified(false),
       mSleeping(false),
+      mCanceledTimers(0),
       mAllowedEarlyFiringMicroseconds(0) {}
 
 TimerThread::~TimerThread() {
@@ -629,6 +631,7 @@ nsresult TimerThread::Shutdown() {
     // See bug 422472.
     timers = std::move(mTimers);
     MOZ_ASSERT(mTimers.IsEmpty());
+    mCanceledTimers = 0;
 
     // Clear IsInTimerThread while the lock is held, as these timers are no
     // longer in mTimers.
@@ -700,19 +703,16 @@ TimeStamp TimerThread::ComputeWakeupTimeFromTimers() const {
       bundleWakeup + ComputeAcceptableFiringDelay(mTimers[0].mDelay,
                                                   minTimerDelay, maxTimerDelay);
 
-  const size_t timerCount = mTimers.Length();
-  for (size_t entryIndex = 1; entryIndex < timerCount; ++entryIndex) {
-    const Entry& curEntry = mTimers[entryIndex];
-    const nsTimerImpl* curTimer = curEntry.mTimerImpl;
-    if (!curTimer) {
-      // Canceled timer - skip it
-      continue;
+  // Canceled timers are skipped by ForEachTimerInOrder.
+  ForEachTimerInOrder([&](const Entry& aCurEntry) {
+    if (&aCurEntry == &mTimers[0]) {
+      return true;
     }
 
-    const TimeStamp curTimerDue = curEntry.mTimeout;
+    const TimeStamp curTimerDue = aCurEntry.mTimeout;
     if (curTimerDue > cutoffTime) {
       // Can't include this timer in the bundle - it fires too late.
-      break;
+      return false;
     }
 
     // This timer can be included in the bundle. Update bundleWakeup and
@@ -720,10 +720,11 @@ TimeStamp TimerThread::ComputeWakeupTimeFromTimers() const {
     bundleWakeup = curTimerDue;
     cutoffTime = std::min(
         curTimerDue + ComputeAcceptableFiringDelay(
-                          curEntry.mDelay, minTimerDelay, maxTimerDelay),
+                          aCurEntry.mDelay, minTimerDelay, maxTimerDelay),
         cutoffTime);
     MOZ_ASSERT(bundleWakeup <= cutoffTime);
-  }
+    return true;
+  });
 
 #if !defined(XP_WIN)
   // Due to the fact that, on Windows, each TimeStamp object holds two distinct
@@ -755,19 +756,18 @@ uint64_t TimerThread::FireDueTimers(TimeDuration aAllowedEarlyFiring) {
   TimeStamp lastNow = TimeStamp::Now();
 
   // Fire timers that are due. We have to keep removing leading cancelled timers
-  // and looking at the front of the list each time through because firing a
-  // timer can result in timers getting added to/removed from the list.
+  // and looking at the front of the heap each time through because firing a
+  // timer can result in timers getting added to/removed from the heap.
   while (!mTimers.IsEmpty()) {
-    Entry& frontEntry = mTimers[0];
-    MOZ_ASSERT(frontEntry.IsTimerInThreadAndUnchanged());
+    MOZ_ASSERT(mTimers[0].IsTimerInThreadAndUnchanged());
 
-    if (lastNow + aAllowedEarlyFiring < frontEntry.mTimeout) {
+    if (lastNow + aAllowedEarlyFiring < mTimers[0].mTimeout) {
       // This timer is not ready to execute yet, and we need to preserve the
       // order of timers, so we might have to stop here. First let's
       // re-evaluate 'now' though, because some time might have passed since
       // we last got it.
       lastNow = TimeStamp::Now();
-      if (lastNow + aAllowedEarlyFiring < frontEntry.mTimeout) {
+      if (lastNow + aAllowedEarlyFiring < mTimers[0].mTimeout) {
         break;
       }
     }
@@ -777,11 +777,11 @@ uint64_t TimerThread::FireDueTimers(TimeDuration aAllowedEarlyFiring) {
     // instead of on the thread it targets.
     {
       ++timersFired;
+      // Take the entry out of the heap first: PostTimerEvent unlocks mMonitor,
+      // and other threads may reorganize the heap in the meantime.
+      Entry frontEntry = PopFrontTimer();
       LogTimerEvent::Run run(frontEntry.mTimerImpl.get());
       PostTimerEvent(frontEntry);
-      // Note that the call to PostTimerEvent moved mTimerImpl out of
-      // postMe before unlocking and locking mMonitor. The now canceled
-      // slot may be removed below if it was not re-used already.
     }
 
     // PostTimerEvent releases mMonitor, which means that mShutdown could have
@@ -1078,95 +1078,190 @@ TimeStamp TimerThread::FindNextFireTimeForCurrentThread(TimeStamp aDefault,
   MonitorAutoLock lock(mMonitor);
   AUTO_TIMERS_STATS(TimerThread_FindNextFireTimeForCurrentThread);
 
-  for (const Entry& entry : mTimers) {
-    const nsTimerImpl* timer = entry.mTimerImpl;
-    if (timer) {
-      if (entry.mTimeout > aDefault) {
-        return aDefault;
-      }
+  // If there are no timers for this thread, we return the default.
+  TimeStamp result = aDefault;
+  ForEachTimerInOrder([&](const Entry& aEntry) {
+    const nsTimerImpl* timer = aEntry.mTimerImpl;
+    if (aEntry.mTimeout > aDefault) {
+      return false;
+    }
 
-      // Don't yield to timers created with the *_LOW_PRIORITY type.
-      if (!timer->IsLowPriority()) {
-        bool isOnCurrentThread = false;
-        nsresult rv =
-            timer->mEventTarget->IsOnCurrentThread(&isOnCurrentThread);
-        if (NS_SUCCEEDED(rv) && isOnCurrentThread) {
-          return entry.mTimeout;
-        }
+    // Don't yield to timers created with the *_LOW_PRIORITY type.
+    if (!timer->IsLowPriority()) {
+      bool isOnCurrentThread = false;
+      nsresult rv = timer->mEventTarget->IsOnCurrentThread(&isOnCurrentThread);
+      if (NS_SUCCEEDED(rv) && isOnCurrentThread) {
+        result = aEntry.mTimeout;
+        return false;
       }
+    }
 
-      if (aSearchBound == 0) {
-        // Couldn't find any non-low priority timers for the current thread.
-        // Return a compromise between a very short and a long idle time.
-        TimeStamp fallbackDeadline =
-            TimeStamp::Now() + TimeDuration::FromMilliseconds(16);
-        return fallbackDeadline < aDefault ? fallbackDeadline : aDefault;
-      }
+    if (aSearchBound == 0) {
+      // Couldn't find any non-low priority timers for the current thread.
+      // Return a compromise between a very short and a long idle time.
+      TimeStamp fallbackDeadline =
+          TimeStamp::Now() + TimeDuration::FromMilliseconds(16);
+      result = fallbackDeadline < aDefault ? fallbackDeadline : aDefault;
+      return false;
+    }
 
-      --aSearchBound;
+    --aSearchBound;
+    return true;
+  });
+
+  return result;
+}
+
+void TimerThread::AssertTimersHeapOrdered() {
+#ifdef DEBUG
+  size_t canceled = 0;
+  for (size_t i = 0; i < mTimers.Length(); ++i) {
+    const Entry& entry = mTimers[i];
+    MOZ_ASSERT(i == 0 || !(entry < mTimers[(i - 1) / kTimerHeapArity]),
+               "mTimers must be heap-ordered.");
+    if (entry.mTimerImpl) {
+      MOZ_ASSERT(entry.mTimerImpl->mTimerThreadIndex == i,
+                 "Timers must know their position in mTimers.");
+    } else {
+      ++canceled;
     }
   }
+  MOZ_ASSERT(canceled == mCanceledTimers);
+#endif
+}
 
-  // No timers for this thread, return the default.
-  return aDefault;
+void TimerThread::SetEntryAt(size_t aIndex, Entry&& aEntry) {
+  mMonitor.AssertCurrentThreadOwns();
+  Entry& slot = mTimers[aIndex];
+  slot = std::move(aEntry);
+  if (slot.mTimerImpl) {
+    slot.mTimerImpl->mTimerThreadIndex = aIndex;
+  }
 }
 
-void TimerThread::AssertTimersSortedAndUnique() {
-  MOZ_ASSERT(std::is_sorted(mTimers.begin(), mTimers.end()),
-             "mTimers must be sorted.");
-  MOZ_ASSERT(
-      std::adjacent_find(mTimers.begin(), mTimers.end()) == mTimers.end(),
-      "mTimers must not contain duplicate entries.");
+size_t TimerThread::SiftUp(size_t aIndex) {
+  mMonitor.AssertCurrentThreadOwns();
+  // Move the entry out, and move its ancestors down into the hole until we
+  // find where it belongs.
+  Entry entry = std::move(mTimers[aIndex]);
+  while (aIndex > 0) {
+    const size_t parent = (aIndex - 1) / kTimerHeapArity;
+    if (!(entry < mTimers[parent])) {
+      break;
+    }
+    SetEntryAt(aIndex, std::move(mTimers[parent]));
+    aIndex = parent;
+  }
+  SetEntryAt(aIndex, std::move(entry));
+  return aIndex;
 }
 
-// This function must be called from within a lock
-// Also: we hold the mutex for the nsTimerImpl.
-void TimerThread::AddTimerInternal(nsTimerImpl& aTimer) {
+size_t TimerThread::SiftDown(size_t aIndex) {
   mMonitor.AssertCurrentThreadOwns();
-  aTimer.mMutex.AssertCurrentThreadOwns();
-  AUTO_TIMERS_STATS(TimerThread_AddTimerInternal);
-  LogTimerEvent::LogDispatch(&aTimer);
+  const size_t length = mTimers.Length();
+  Entry entry = std::move(mTimers[aIndex]);
+  while (true) {
+    const size_t firstChild = aIndex * kTimerHeapArity + 1;
+    if (firstChild >= length) {
+      break;
+    }
+    const size_t endChild = std::min(firstChild + kTimerHeapArity, length);
+    size_t minChild = firstChild;
+    for (size_t child = firstChild + 1; child < endChild; ++child) {
+      if (mTimers[child] < mTimers[minChild]) {
+        minChild = child;
+      }
+    }
+    if (!(mTimers[minChild] < entry)) {
+      break;
+    }
+    SetEntryAt(aIndex, std::move(mTimers[minChild]));
+    aIndex = minChild;
+  }
+  SetEntryAt(aIndex, std::move(entry));
+  return aIndex;
+}
 
-  // Do the AddRef here.
-  Entry toBeAdded{aTimer};
-  size_t insertAt = mTimers.IndexOfFirstElementGt(toBeAdded);
-
-  if (insertAt > 0 && !mTimers[insertAt - 1].mTimerImpl) {
-    // Very common scenario in practice: The timer just before the insertion
-    // point is canceled, overwrite it.
-    // Note: This is most likely common because we often cancel and re-add the
-    // same timer even shortly after having it added before, such that we find
-    // our very own canceled slot here, given the order of the array.
-    AUTO_TIMERS_STATS(TimerThread_AddTimerInternal_ReuseBefore);
-    mTimers[insertAt - 1] = std::move(toBeAdded);
-    AssertTimersSortedAndUnique();
-    return;
+TimerThread::Entry TimerThread::PopFrontTimer() {
+  mMonitor.AssertCurrentThreadOwns();
+  MOZ_ASSERT(!mTimers.IsEmpty());
+
+  Entry front = std::move(mTimers[0]);
+  Entry last = mTimers.PopLastElement();
+  if (!mTimers.IsEmpty()) {
+    SetEntryAt(0, std::move(last));
+    SiftDown(0);
   }
+  return front;
+}
 
-  bool usedEmptySlot = false;
+void TimerThread::CompactTimers() {
+  mMonitor.AssertCurrentThreadOwns();
+  AUTO_TIMERS_STATS(TimerThread_CompactTimers);
 
-  if (insertAt < mTimers.Length()) {
-    // We shift the elements manually until we find an empty slot if any.
-    AUTO_TIMERS_STATS(TimerThread_AddTimerInternal_ShiftAndFindEmptySlot);
-    Span<Entry> tail = Span{mTimers}.From(insertAt);
-    for (Entry& e : tail) {
-      if (!e.mTimerImpl) {
-        e = std::move(toBeAdded);
-        usedEmptySlot = true;
-        break;
-      }
-      std::swap(e, toBeAdded);
+  mTimers.RemoveElementsBy(
+      [](const Entry& aEntry) { return !aEntry.mTimerImpl; });
+  mCanceledTimers = 0;
+
+  // Removing elements shuffled the positions, so re-index everything before
+  // rebuilding the heap bottom-up.
+  for (size_t i = 0; i < mTimers.Length(); ++i) {
+    mTimers[i].mTimerImpl->mTimerThreadIndex = i;
+  }
+  if (mTimers.Length() > 1) {
+    for (size_t i = (mTimers.Length() - 2) / kTimerHeapArity + 1; i-- > 0;) {
+      SiftDown(i);
     }
   }
+}
+
+template <typename Callback>
+void TimerThread::ForEachTimerInOrder(Callback&& aCallback) const {
+  mMonitor.AssertCurrentThreadOwns();
+
+  if (mTimers.IsEmpty()) {
+    return;
+  }
 
-  if (!usedEmptySlot) {
-    // If we did not find an empty slot while shifting: append. Only this step
-    // may cause a re-alloc, if needed.
-    AUTO_TIMERS_STATS(TimerThread_AddTimerInternal_Expand);
-    mTimers.AppendElement(std::move(toBeAdded));
+  // The next entry in firing order is always the root, or a child of an entry
+  // that was already visited. Keep these candidates in a (binary) heap of
+  // indices into mTimers, with the earliest candidate at the front.
+  auto firesLater = [this](size_t aLhs, size_t aRhs) {
+    return mTimers[aRhs] < mTimers[aLhs];
+  };
+  AutoTArray<size_t, 64> candidates{0};
+  while (!candidates.IsEmpty()) {
+    std::pop_heap(candidates.begin(), candidates.end(), firesLater);
+    const size_t index = candidates.PopLastElement();
+    const Entry& entry = mTimers[index];
+    if (entry.mTimerImpl && !aCallback(entry)) {
+      return;
+    }
+
+    const size_t firstChild = index * kTimerHeapArity + 1;
+    const size_t endChild =
+        std::min(firstChild + kTimerHeapArity, mTimers.Length());
+    for (size_t child = firstChild; child < endChild; ++child) {
+      candidates.AppendElement(child);
+      std::push_heap(candidates.begin(), candidates.end(), firesLater);
+    }
   }
+}
 
-  AssertTimersSortedAndUnique();
+// This function must be called from within a lock
+// Also: we hold the mutex for the nsTimerImpl.
+void TimerThread::AddTimerInternal(nsTimerImpl& aTimer) {
+  mMonitor.AssertCurrentThreadOwns();
+  aTimer.mMutex.AssertCurrentThreadOwns();
+  AUTO_TIMERS_STATS(TimerThread_AddTimerInternal);
+  LogTimerEvent::LogDispatch(&aTimer);
+
+  // Do the AddRef here. Appending at the end of the heap is the only step that
+  // may cause a re-alloc. In the common case of a timer that fires later than
+  // most, it then only moves up by a level or two.
+  mTimers.AppendElement(Entry{aTimer});
+  SiftUp(mTimers.Length() - 1);
+  AssertTimersHeapOrdered();
 }
 
 // This function must be called from within a lock
@@ -1180,12 +1275,20 @@ bool TimerThread::RemoveTimerInternal(nsTimerImpl& aTimer) {
     return false;
   }
 
-  size_t removeAt = mTimers.BinaryIndexOf(EntryKey{aTimer});
-  if (removeAt != nsTArray<Entry>::NoIndex) {
-    MOZ_ASSERT(mTimers[removeAt].mTimerImpl == &aTimer);
-    // Mark the timer as canceled, defer the removal to the timer thread.
+  const size_t removeAt = aTimer.mTimerThreadIndex;
+  if (removeAt < mTimers.Length() &&
+      mTimers[removeAt].mTimerImpl == &aTimer) {
+    // Mark the timer as canceled, defer the removal to the timer thread. The
+    // entry keeps its key, so the heap stays ordered.
     mTimers[removeAt].mTimerImpl = nullptr;
-    AssertTimersSortedAndUnique();
+    ++mCanceledTimers;
+    if (mCanceledTimers > kMinCanceledTimersToCompact &&
+        mCanceledTimers > mTimers.Length() / 2) {
+      // Don't let far-away canceled timers pile up. This is O(n), but only
+      // happens after n/2 cancellations, so cancelling stays O(1) amortized.
+      CompactTimers();
+    }
+    AssertTimersHeapOrdered();
     return true;
   }
 
@@ -1197,14 +1300,13 @@ void TimerThread::RemoveLeadingCanceledTimersInternal() {
   mMonitor.AssertCurrentThreadOwns();
   AUTO_TIMERS_STATS(TimerThread_RemoveLeadingCanceledTimersInternal);
 
-  // Let's check if we are still sorted before removing the canceled timers.
-  AssertTimersSortedAndUnique();
+  // Let's check if we are still ordered before removing the canceled timers.
+  AssertTimersHeapOrdered();
 
-  size_t toRemove = 0;
-  while (toRemove < mTimers.Length() && !mTimers[toRemove].mTimerImpl) {
-    ++toRemove;
+  while (!mTimers.IsEmpty() && !mTimers[0].mTimerImpl) {
+    PopFrontTimer();
+    --mCanceledTimers;
   }
-  mTimers.RemoveElementsAt(0, toRemove);
 }
 
 void TimerThread::PostTimerEvent(Entry& aPostMe) {
@@ -1491,13 +1593,11 @@ nsresult TimerThread::GetTimers(nsTArray<RefPtr<nsITimer>>& aRetVal) {
   nsTArray<RefPtr<nsTimerImpl>> timers;
   {
     MonitorAutoLock lock(mMonitor);
-    for (const auto& entry : mTimers) {
-      nsTimerImpl* timer = entry.mTimerImpl;
-      if (!timer) {
-        continue;
-      }
-      timers.AppendElement(timer);
-    }
+    timers.SetCapacity(mTimers.Length() - mCanceledTimers);
+    ForEachTimerInOrder([&](const Entry& aEntry) {
+      timers.AppendElement(aEntry.mTimerImpl);
+      return true;
+    });
   }
 
   for (nsTimerImpl* timer : timers) {
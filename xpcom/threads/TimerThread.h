@@ -70,7 +70,7 @@ class TimerThread final : public mozilla::Runnable, public nsIObserver {
       MOZ_REQUIRES(mMonitor, aTimer.mMutex);
   void RemoveLeadingCanceledTimersInternal() MOZ_REQUIRES(mMonitor);
   nsresult Init() MOZ_REQUIRES(mMonitor);
-  void AssertTimersSortedAndUnique() MOZ_REQUIRES(mMonitor);
+  void AssertTimersHeapOrdered() MOZ_REQUIRES(mMonitor);
 
   // Using atomic because this value is written to in one place, and read from
   // in another, and those two locations are likely to be executed from separate
@@ -147,6 +147,25 @@ class TimerThread final : public mozilla::Runnable, public nsIObserver {
 
   void PostTimerEvent(Entry& aPostMe) MOZ_REQUIRES(mMonitor);
 
+  // mTimers is a 4-ary min-heap. These maintain the heap property after the
+  // entry at aIndex was inserted or replaced, and keep the position stored in
+  // each live timer up to date. They return the final index of the entry.
+  size_t SiftUp(size_t aIndex) MOZ_REQUIRES(mMonitor);
+  size_t SiftDown(size_t aIndex) MOZ_REQUIRES(mMonitor);
+  void SetEntryAt(size_t aIndex, Entry&& aEntry) MOZ_REQUIRES(mMonitor);
+
+  // Removes mTimers[0] from the heap and returns it.
+  Entry PopFrontTimer() MOZ_REQUIRES(mMonitor);
+
+  // Removes all canceled entries and rebuilds the heap, in O(n).
+  void CompactTimers() MOZ_REQUIRES(mMonitor);
+
+  // Calls aCallback for each non-canceled entry of mTimers in firing order,
+  // until it returns false. Visiting the first k entries costs O(k log k)
+  // regardless of the number of timers.
+  template <typename Callback>
+  void ForEachTimerInOrder(Callback&& aCallback) const MOZ_REQUIRES(mMonitor);
+
   // Computes and returns when we should next try to wake up in order to handle
   // the triggering of the timers in mTimers.
   // If mTimers is empty, returns a null TimeStamp. If mTimers is not empty,
@@ -176,10 +195,18 @@ class TimerThread final : public mozilla::Runnable, public nsIObserver {
   // clears a few flags before and after.
   void Wait(TimeDuration aWaitFor) MOZ_REQUIRES(mMonitor);
 
-  // mTimers is sorted by timeout, followed by a unique sequence number.
-  // Some entries are for cancelled entries, but remain in sorted order based
-  // on the timeout and sequence number they were originally created with.
+  // mTimers is a 4-ary min-heap ordered by timeout, followed by a unique
+  // sequence number, so mTimers[0] is always the next timer to fire. Each live
+  // timer knows its position in the heap (nsTimerImpl::mTimerThreadIndex), so
+  // that removing it is O(1): the entry is only marked as canceled, and stays
+  // in the heap based on the timeout and sequence number it was originally
+  // created with. Canceled entries are dropped once they reach the top of the
+  // heap, or all at once when they make up half of the heap.
+  static constexpr size_t kTimerHeapArity = 4;
+  // Below this, canceled timers are cheaper to keep around than to compact.
+  static constexpr size_t kMinCanceledTimersToCompact = 64;
   nsTArray<Entry> mTimers MOZ_GUARDED_BY(mMonitor);
+  size_t mCanceledTimers MOZ_GUARDED_BY(mMonitor);
 
   // Set only at the start of the thread's Run():
   uint32_t mAllowedEarlyFiringMicroseconds MOZ_GUARDED_BY(mMonitor);
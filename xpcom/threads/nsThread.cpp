@@ -179,6 +179,7 @@ NS_INTERFACE_MAP_BEGIN(nsThread)
   NS_INTERFACE_MAP_ENTRY(nsISerialEventTarget)
   NS_INTERFACE_MAP_ENTRY(nsISupportsPriority)
   NS_INTERFACE_MAP_ENTRY(nsIDirectTaskDispatcher)
+  NS_INTERFACE_MAP_ENTRY(nsIBatchedEventTarget)
   NS_INTERFACE_MAP_ENTRY_AMBIGUOUS(nsISupports, nsIThread)
   if (aIID.Equals(NS_GET_IID(nsIClassInfo))) {
     static nsThreadClassInfo sThreadClassInfo;
@@ -689,6 +690,17 @@ nsThread::Dispatch(already_AddRefed<nsIRunnable> aEvent, uint32_t aFlags) {
   return mEventTarget->Dispatch(std::move(aEvent), aFlags);
 }
 
+NS_IMETHODIMP
+nsThread::DispatchBatch(nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                        uint32_t aFlags) {
+  MOZ_ASSERT(mEventTarget);
+  NS_ENSURE_TRUE(mEventTarget, NS_ERROR_NOT_IMPLEMENTED);
+
+  LOG(("THRD(%p) DispatchBatch [%zu %x]\n", this, aEvents.Length(), aFlags));
+
+  return mEventTarget->DispatchBatch(aEvents, aFlags);
+}
+
 NS_IMETHODIMP
 nsThread::DelayedDispatch(already_AddRefed<nsIRunnable> aEvent,
                           uint32_t aDelayMs) {
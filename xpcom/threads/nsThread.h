@@ -21,6 +21,7 @@
 #include "mozilla/TaskDispatcher.h"
 #include "mozilla/TimeStamp.h"
 #include "mozilla/UniquePtr.h"
+#include "nsIBatchedEventTarget.h"
 #include "nsIDirectTaskDispatcher.h"
 #include "nsIEventTarget.h"
 #include "nsISerialEventTarget.h"
@@ -150,6 +151,7 @@ class PerformanceCounterState {
 class nsThread : public nsIThreadInternal,
                  public nsISupportsPriority,
                  public nsIDirectTaskDispatcher,
+                 public nsIBatchedEventTarget,
                  private mozilla::LinkedListElement<nsThread> {
   friend mozilla::LinkedList<nsThread>;
   friend mozilla::LinkedListElement<nsThread>;
@@ -161,6 +163,7 @@ class nsThread : public nsIThreadInternal,
   NS_DECL_NSITHREADINTERNAL
   NS_DECL_NSISUPPORTSPRIORITY
   NS_DECL_NSIDIRECTTASKDISPATCHER
+  NS_DECL_NSIBATCHEDEVENTTARGET
 
   enum MainThreadFlag { MAIN_THREAD, NOT_MAIN_THREAD };
 
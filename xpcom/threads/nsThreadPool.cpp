@@ -13,15 +13,19 @@
 #include "nsThreadUtils.h"
 #include "prinrval.h"
 #include "mozilla/Logging.h"
+#include "mozilla/MPMCQueue.h"
 #include "mozilla/ProfilerLabels.h"
 #include "mozilla/ProfilerRunnable.h"
 #include "mozilla/SchedulerGroup.h"
 #include "mozilla/ScopeExit.h"
 #include "mozilla/SpinEventLoopUntil.h"
 #include "mozilla/StickyTimeDuration.h"
+#include "mozilla/WorkStealingDeque.h"
 #include "nsThreadSyncDispatch.h"
 
+#include <atomic>
 #include <mutex>
+#include <thread>
 
 using namespace mozilla;
 
@@ -32,14 +36,22 @@ static LazyLogModule sThreadPoolLog("nsThreadPool");
 #define LOG(args) MOZ_LOG(sThreadPoolLog, mozilla::LogLevel::Debug, args)
 
 static MOZ_THREAD_LOCAL(nsThreadPool*) gCurrentThreadPool;
+// The local queue of the current thread, for pools in work-stealing mode.
+static MOZ_THREAD_LOCAL(WorkStealingDeque<nsIRunnable*>*) gCurrentLocalQueue;
 
-void nsThreadPool::InitTLS() { gCurrentThreadPool.infallibleInit(); }
+void nsThreadPool::InitTLS() {
+  gCurrentThreadPool.infallibleInit();
+  gCurrentLocalQueue.infallibleInit();
+}
 
 // DESIGN:
 //  o  Allocate anonymous threads.
 //  o  Use nsThreadPool::Run as the main routine for each thread.
 //  o  Each thread waits on the event queue's monitor, checking for
 //     pending events and rescheduling itself as an idle thread.
+//  o  In work-stealing mode, events are queued in lock-free queues instead,
+//     and threads only take the lock when they run out of events, see
+//     WorkStealingState.
 
 #define DEFAULT_THREAD_LIMIT 4
 #define DEFAULT_IDLE_THREAD_LIMIT 1
@@ -64,6 +76,7 @@ nsThreadPool::nsThreadPool()
           TimeDuration::FromMilliseconds(DEFAULT_IDLE_THREAD_MAX_TIMEOUT_MS)),
       mQoSPriority(nsIThread::QOS_PRIORITY_NORMAL),
       mStackSize(nsIThreadManager::DEFAULT_STACK_SIZE),
+      mHasDispatched(false),
       mShutdown(false),
       mIsAPoolThreadFree(true) {
   LOG(("THRD-P(%p) constructor!!!\n", this));
@@ -96,6 +109,148 @@ struct nsThreadPool::MRUIdleEntry
 #endif
 };
 
+// State of a pool in work-stealing mode:
+//  o  Each thread owns a local queue. Events dispatched from a thread of the
+//     pool go to its local queue, which it runs in LIFO order.
+//  o  Other events go to a shared queue. If it is full, they go to mEvents as
+//     in the default mode.
+//  o  A thread that runs out of events steals from other threads' local
+//     queues, then spins for a little while, and only then takes mMutex to go
+//     to sleep in the MRU idle list.
+//  o  Dispatching only takes mMutex if a thread needs to be woken up or
+//     spawned: when nobody is already spinning, and there are sleeping threads
+//     or the thread limit wasn't reached.
+struct nsThreadPool::WorkStealingState {
+  // Threads beyond this number have no local queue and only use the shared
+  // queue.
+  static constexpr size_t kMaxLocalQueues = 64;
+  static constexpr size_t kSharedQueueCapacity = 1024;
+  // How many more times a thread that ran out of events looks for some before
+  // going to sleep. Only one thread spins at a time.
+  static constexpr uint32_t kSpinCount = 64;
+
+  using Queue = WorkStealingDeque<nsIRunnable*>;
+
+  struct LocalQueue {
+    Queue mEvents{32};
+    // Whether a thread owns this queue. Guarded by nsThreadPool::mMutex.
+    bool mInUse = false;
+  };
+
+  ~WorkStealingState() {
+    // There are no threads left, release whatever could not be run.
+    nsIRunnable* event;
+    while (mSharedEvents.Pop(&event)) {
+      nsCOMPtr<nsIRunnable> dropped = dont_AddRef(event);
+    }
+    for (LocalQueue& queue : mLocalQueues) {
+      while (auto localEvent = queue.mEvents.Pop()) {
+        nsCOMPtr<nsIRunnable> dropped = dont_AddRef(*localEvent);
+      }
+    }
+  }
+
+  // Must be called with nsThreadPool::mMutex held.
+  Queue* ClaimLocalQueue() {
+    for (LocalQueue& queue : mLocalQueues) {
+      if (!queue.mInUse) {
+        MOZ_ASSERT(queue.mEvents.IsEmpty());
+        queue.mInUse = true;
+        return &queue.mEvents;
+      }
+    }
+    return nullptr;
+  }
+
+  // Must be called with nsThreadPool::mMutex held.
+  void ReleaseLocalQueue(Queue* aQueue) {
+    for (LocalQueue& queue : mLocalQueues) {
+      if (&queue.mEvents == aQueue) {
+        // Only the owner pushes to its queue, and it only exits once it found
+        // it empty.
+        MOZ_ASSERT(queue.mEvents.IsEmpty());
+        queue.mInUse = false;
+        return;
+      }
+    }
+    MOZ_ASSERT_UNREACHABLE("Not one of our local queues");
+  }
+
+  // Returns false if the event couldn't be queued, in which case aEvent is
+  // left untouched.
+  bool TryPutEvent(nsCOMPtr<nsIRunnable>& aEvent, Queue* aLocalQueue) {
+    nsIRunnable* event = aEvent.forget().take();
+    if (aLocalQueue) {
+      aLocalQueue->Push(event);
+      return true;
+    }
+    if (!mSharedEvents.Push(event)) {
+      aEvent = dont_AddRef(event);
+      return false;
+    }
+    return true;
+  }
+
+  nsIRunnable* TryGetEvent(Queue* aLocalQueue) {
+    if (aLocalQueue) {
+      if (auto event = aLocalQueue->Pop()) {
+        return *event;
+      }
+    }
+    nsIRunnable* event;
+    if (mSharedEvents.Pop(&event)) {
+      return event;
+    }
+    // Start from a different queue each time, so that thieves spread out.
+    const size_t start = mNextVictim++ % kMaxLocalQueues;
+    for (size_t i = 0; i < kMaxLocalQueues; ++i) {
+      Queue& victim = mLocalQueues[(start + i) % kMaxLocalQueues].mEvents;
+      if (&victim == aLocalQueue) {
+        continue;
+      }
+      if (auto stolen = victim.Steal()) {
+        return *stolen;
+      }
+    }
+    return nullptr;
+  }
+
+  bool HasQueuedEvents() const {
+    if (mSharedEvents.ApproximateLength()) {
+      return true;
+    }
+    for (const LocalQueue& queue : mLocalQueues) {
+      if (!queue.mEvents.IsEmpty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether a dispatcher that just queued an event must take nsThreadPool's
+  // mutex to wake up or spawn a thread. This pairs with the increment of
+  // mSleepingThreads in nsThreadPool::Run(): either the dispatcher sees the
+  // sleeping thread, or the sleeping thread sees the event.
+  bool NeedsThread(bool aIsAPoolThreadFree) const {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mSpinningThreads) {
+      return false;
+    }
+    return mSleepingThreads || aIsAPoolThreadFree;
+  }
+
+  MPMCQueue<nsIRunnable*> mSharedEvents{kSharedQueueCapacity};
+  LocalQueue mLocalQueues[kMaxLocalQueues];
+  Atomic<size_t, Relaxed> mNextVictim{0};
+  // Threads looking for events outside of mMutex, at most one.
+  Atomic<uint32_t> mSpinningThreads{0};
+  // Threads that are about to sleep or sleeping on their MRU idle entry.
+  Atomic<uint32_t> mSleepingThreads{0};
+  // Dispatches that checked mShutdown but might not have queued their event
+  // yet. Threads don't exit on shutdown while there are some.
+  Atomic<uint32_t> mPendingDispatches{0};
+};
+
 #ifdef DEBUG
 // This logging relies on extra members we do not want to bake into release.
 void nsThreadPool::DebugLogPoolStatus(MutexAutoLock& aProofOfLock,
@@ -144,6 +299,28 @@ nsresult nsThreadPool::PutEvent(nsIRunnable* aEvent) {
 
 nsresult nsThreadPool::PutEvent(already_AddRefed<nsIRunnable> aEvent,
                                 uint32_t aFlags) {
+  nsCOMPtr<nsIRunnable> event(aEvent);
+  bool queued = false;
+  if (mWorkStealing) {
+    // Announce the dispatch before checking mShutdown, so that threads don't
+    // all exit before we queued the event.
+    ++mWorkStealing->mPendingDispatches;
+    auto pending =
+        MakeScopeExit([&]() { --mWorkStealing->mPendingDispatches; });
+    if (NS_WARN_IF(mShutdown)) {
+      return NS_ERROR_NOT_AVAILABLE;
+    }
+
+    LogRunnable::LogDispatch(event);
+    WorkStealingState::Queue* localQueue =
+        gCurrentThreadPool.get() == this ? gCurrentLocalQueue.get() : nullptr;
+    queued = mWorkStealing->TryPutEvent(event, localQueue);
+    if (queued && ((aFlags & NS_DISPATCH_AT_END) ||
+                   !mWorkStealing->NeedsThread(mIsAPoolThreadFree))) {
+      return NS_OK;
+    }
+  }
+
   // Avoid spawning a new thread while holding the event queue lock...
 
   bool spawnThread = false;
@@ -153,12 +330,18 @@ nsresult nsThreadPool::PutEvent(already_AddRefed<nsIRunnable> aEvent,
     MutexAutoLock lock(mMutex);
 
     if (NS_WARN_IF(mShutdown)) {
-      return NS_ERROR_NOT_AVAILABLE;
+      // In work-stealing mode, threads still run events queued before
+      // shutdown.
+      return queued ? NS_OK : NS_ERROR_NOT_AVAILABLE;
     }
 
-    nsCOMPtr<nsIRunnable> event(aEvent);
-    LogRunnable::LogDispatch(event);
-    mEvents.PutEvent(event.forget(), EventQueuePriority::Normal, lock);
+    if (!queued) {
+      if (!mWorkStealing) {
+        LogRunnable::LogDispatch(event);
+      }
+      mEvents.PutEvent(event.forget(), EventQueuePriority::Normal, lock);
+    }
+    mHasDispatched = true;
 
 #ifdef DEBUG
     DebugLogPoolStatus(lock, nullptr);
@@ -323,6 +506,7 @@ nsThreadPool::Run() {
   MRUIdleEntry idleEntry(mMutex);
   bool wasIdle = false;
   nsIThread::QoSPriority threadPriority = nsIThread::QOS_PRIORITY_NORMAL;
+  WorkStealingState::Queue* localQueue = nullptr;
 
   // This thread is an nsThread created below with NS_NewNamedThread()
   static_cast<nsThread*>(current.get())
@@ -340,6 +524,10 @@ nsThreadPool::Run() {
       current->SetThreadQoS(threadPriority);
       threadPriority = mQoSPriority;
     }
+
+    if (mWorkStealing) {
+      localQueue = mWorkStealing->ClaimLocalQueue();
+    }
   }
 
   if (listener) {
@@ -348,11 +536,17 @@ nsThreadPool::Run() {
 
   MOZ_ASSERT(!gCurrentThreadPool.get());
   gCurrentThreadPool.set(this);
+  gCurrentLocalQueue.set(localQueue);
 
   do {
     nsCOMPtr<nsIRunnable> event;
     TimeDuration lastEventDelay;
-    {
+    if (mWorkStealing && !wasIdle) {
+      // Keep running events without taking mMutex for as long as we find
+      // some. Once idle, we need the lock to leave the MRU idle list.
+      event = GetEventWorkStealing(/* aSpin */ true);
+    }
+    if (!event) {
       MutexAutoLock lock(mMutex);
 
 #ifdef DEBUG
@@ -367,6 +561,21 @@ nsThreadPool::Run() {
       }
 
       event = mEvents.GetEvent(lock, &lastEventDelay);
+
+      bool announcedSleeping = false;
+      bool hasPendingDispatches = false;
+      if (!event && mWorkStealing) {
+        // Announce that we may sleep before looking for events queued without
+        // mMutex one last time, see WorkStealingState::NeedsThread. Likewise,
+        // check for pending dispatches before looking if we are shutting down:
+        // mShutdown can't change while we hold mMutex.
+        ++mWorkStealing->mSleepingThreads;
+        announcedSleeping = true;
+        hasPendingDispatches = mWorkStealing->mPendingDispatches > 0;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        event = GetEventWorkStealing(/* aSpin */ false);
+      }
+
       if (!event) {
         TimeStamp now = TimeStamp::Now();
         uint32_t cnt = mMRUIdleThreads.length() + ((wasIdle) ? 0 : 1);
@@ -374,7 +583,7 @@ nsThreadPool::Run() {
                                           ? mIdleThreadGraceTimeout
                                           : mIdleThreadMaxTimeout;
 
-        if (mShutdown) {
+        if (mShutdown && !hasPendingDispatches) {
           exitThread = true;
         } else {
           if (!wasIdle) {
@@ -383,7 +592,8 @@ nsThreadPool::Run() {
             idleEntry.mIdleSince = now;
             wasIdle = true;
             mMRUIdleThreads.insertFront(&idleEntry);
-          } else if ((now - idleEntry.mIdleSince) < currentTimeout) {
+          } else if ((now - idleEntry.mIdleSince) < currentTimeout ||
+                     mShutdown) {
             // Continue to stay idle without touching mIdleSince.
             if (!idleEntry.isInList()) {
               mMRUIdleThreads.insertFront(&idleEntry);
@@ -401,6 +611,9 @@ nsThreadPool::Run() {
           }
 
           shutdownThreadOnExit = mThreads.RemoveObject(current);
+          if (localQueue) {
+            mWorkStealing->ReleaseLocalQueue(localQueue);
+          }
 
           // keep track if there are threads available to start
           mIsAPoolThreadFree = (mThreads.Count() < (int32_t)mThreadLimit);
@@ -416,6 +629,10 @@ nsThreadPool::Run() {
           TimeDuration delta{StickyTimeDuration{currentTimeout} -
                              (now - idleEntry.mIdleSince)};
           delta = TimeDuration::Max(delta, TimeDuration::FromMilliseconds(1));
+          if (mShutdown) {
+            // We are only waiting for pending dispatches to queue their event.
+            delta = TimeDuration::FromMilliseconds(1);
+          }
           LOG(("THRD-P(%p) %s waiting [%f]\n", this, mName.get(),
                delta.ToMilliseconds()));
 #ifdef DEBUG
@@ -431,6 +648,10 @@ nsThreadPool::Run() {
           idleEntry.remove();
         }
       }
+
+      if (announcedSleeping) {
+        --mWorkStealing->mSleepingThreads;
+      }
       // Release our lock.
     }
 
@@ -465,6 +686,7 @@ nsThreadPool::Run() {
 
   MOZ_ASSERT(gCurrentThreadPool.get() == this);
   gCurrentThreadPool.set(nullptr);
+  gCurrentLocalQueue.set(nullptr);
 
   if (shutdownThreadOnExit) {
     ShutdownThread(current);
@@ -474,6 +696,37 @@ nsThreadPool::Run() {
   return NS_OK;
 }
 
+already_AddRefed<nsIRunnable> nsThreadPool::GetEventWorkStealing(bool aSpin) {
+  WorkStealingState& state = *mWorkStealing;
+  WorkStealingState::Queue* localQueue = gCurrentLocalQueue.get();
+
+  nsIRunnable* event = state.TryGetEvent(localQueue);
+  if (event || !aSpin || !state.mSpinningThreads.compareExchange(0, 1)) {
+    return dont_AddRef(event);
+  }
+
+  // We are the spinning thread: dispatchers count on us to pick up their
+  // events instead of waking up a sleeping thread.
+  AUTO_PROFILER_LABEL("nsThreadPool::GetEventWorkStealing::Spin", IDLE);
+  for (uint32_t i = 0; !event && i < WorkStealingState::kSpinCount; ++i) {
+    std::this_thread::yield();
+    event = state.TryGetEvent(localQueue);
+  }
+  state.mSpinningThreads = 0;
+
+  // Dispatchers didn't wake anyone up while we were spinning. If we found an
+  // event and there are more, hand the search over to a sleeping thread.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (event && state.mSleepingThreads && state.HasQueuedEvents()) {
+    MutexAutoLock lock(mMutex);
+    if (auto* mruThread = mMRUIdleThreads.getFirst()) {
+      mruThread->remove();
+      mruThread->mEventsAvailable.Notify();
+    }
+  }
+  return dont_AddRef(event);
+}
+
 NS_IMETHODIMP
 nsThreadPool::DispatchFromScript(nsIRunnable* aEvent, uint32_t aFlags) {
   nsCOMPtr<nsIRunnable> event(aEvent);
@@ -720,6 +973,22 @@ nsThreadPool::SetListener(nsIThreadPoolListener* aListener) {
   return NS_OK;
 }
 
+NS_IMETHODIMP
+nsThreadPool::EnableWorkStealing() {
+  MutexAutoLock lock(mMutex);
+  // PutEvent() reads mWorkStealing without mMutex, so it can't change once
+  // some thread may be dispatching.
+  MOZ_ASSERT(!mHasDispatched && !mThreads.Count() && mEvents.IsEmpty(lock),
+             "EnableWorkStealing() must be called before the first dispatch");
+  if (mHasDispatched || mThreads.Count() || mShutdown) {
+    return NS_ERROR_NOT_AVAILABLE;
+  }
+  if (!mWorkStealing) {
+    mWorkStealing = MakeUnique<WorkStealingState>();
+  }
+  return NS_OK;
+}
+
 NS_IMETHODIMP
 nsThreadPool::SetName(const nsACString& aName) {
   MutexAutoLock lock(mMutex);
@@ -19,6 +19,7 @@
 #include "mozilla/EventQueue.h"
 #include "mozilla/LinkedList.h"
 #include "mozilla/Mutex.h"
+#include "mozilla/UniquePtr.h"
 
 class nsIThread;
 
@@ -38,12 +39,18 @@ class nsThreadPool final : public mozilla::Runnable, public nsIThreadPool {
   ~nsThreadPool();
 
   struct MRUIdleEntry;  // forward declaration only, see nsThreadPool.cpp
+  struct WorkStealingState;  // forward declaration only, see nsThreadPool.cpp
 
   void ShutdownThread(nsIThread* aThread);
   nsresult PutEvent(nsIRunnable* aEvent);
   nsresult PutEvent(already_AddRefed<nsIRunnable> aEvent, uint32_t aFlags);
   void NotifyChangeToAllIdleThreads() MOZ_REQUIRES(mMutex);
 
+  // Work-stealing mode only. Looks for an event in the current thread's local
+  // queue, the shared queue, then the other threads' local queues. If aSpin,
+  // keeps looking for a little while before giving up.
+  already_AddRefed<nsIRunnable> GetEventWorkStealing(bool aSpin);
+
 #ifdef DEBUG
   void DebugLogPoolStatus(mozilla::MutexAutoLock& aProofOfLock,
                           MRUIdleEntry* aWakingEntry = nullptr)
@@ -61,7 +68,16 @@ class nsThreadPool final : public mozilla::Runnable, public nsIThreadPool {
   nsIThread::QoSPriority mQoSPriority MOZ_GUARDED_BY(mMutex);
   uint32_t mStackSize MOZ_GUARDED_BY(mMutex);
   nsCOMPtr<nsIThreadPoolListener> mListener MOZ_GUARDED_BY(mMutex);
-  mozilla::Atomic<bool, mozilla::Relaxed> mShutdown;
+  // Set by EnableWorkStealing() before anything is dispatched, and never
+  // changed afterwards. PutEvent() reads it without mMutex, which is only safe
+  // because of that.
+  mozilla::UniquePtr<WorkStealingState> mWorkStealing;
+  // Whether PutEvent() ever queued an event, after which mWorkStealing must
+  // not change anymore.
+  bool mHasDispatched MOZ_GUARDED_BY(mMutex);
+  // Sequentially consistent, because work-stealing mode relies on it to make
+  // sure that no event is queued after the last thread exited.
+  mozilla::Atomic<bool> mShutdown;
   mozilla::Atomic<bool, mozilla::Relaxed> mIsAPoolThreadFree;
   // set once before we start threads
   nsCString mName MOZ_GUARDED_BY(mMutex);
@@ -14,6 +14,7 @@
 #include "mozilla/TimeStamp.h"
 #include "nsComponentManagerUtils.h"
 #include "nsExceptionHandler.h"
+#include "nsIBatchedEventTarget.h"
 #include "nsIEventTarget.h"
 #include "nsITimer.h"
 #include "nsString.h"
@@ -768,3 +769,27 @@ nsresult NS_DispatchAndSpinEventLoopUntilComplete(
   wrapper->SpinEventLoopUntilComplete(aVeryGoodReasonToDoThis);
   return NS_OK;
 }
+
+nsresult NS_DispatchBatch(nsIEventTarget* aEventTarget,
+                          nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                          uint32_t aDispatchFlags) {
+  NS_ENSURE_ARG(aEventTarget);
+  if (aEvents.IsEmpty()) {
+    return NS_OK;
+  }
+
+  if (nsCOMPtr<nsIBatchedEventTarget> batched =
+          do_QueryInterface(aEventTarget)) {
+    return batched->DispatchBatch(aEvents, aDispatchFlags);
+  }
+
+  for (size_t i = 0; i < aEvents.Length(); ++i) {
+    nsresult rv = aEventTarget->Dispatch(do_AddRef(aEvents[i]), aDispatchFlags);
+    if (NS_WARN_IF(NS_FAILED(rv))) {
+      aEvents.RemoveElementsAt(0, i);
+      return rv;
+    }
+  }
+  aEvents.Clear();
+  return NS_OK;
+}
@@ -19,6 +19,7 @@
 #include "mozilla/Maybe.h"
 #include "mozilla/ThreadLocal.h"
 #include "mozilla/TimeStamp.h"
+#include "mozilla/Unused.h"
 
 #include "nsCOMPtr.h"
 #include "nsICancelableRunnable.h"
@@ -30,6 +31,7 @@
 #include "nsIThreadManager.h"
 #include "nsITimer.h"
 #include "nsString.h"
+#include "nsTArray.h"
 #include "prinrval.h"
 #include "prthread.h"
 
@@ -1687,6 +1689,18 @@ extern nsresult NS_DispatchAndSpinEventLoopUntilComplete(
     const nsACString& aVeryGoodReasonToDoThis, nsIEventTarget* aEventTarget,
     already_AddRefed<nsIRunnable> aEvent);
 
+/**
+ * Dispatch all the events of aEvents to aEventTarget, in order. If the target
+ * implements nsIBatchedEventTarget, they are queued at once, with a single
+ * wake-up of the target thread, otherwise they are dispatched one by one.
+ *
+ * On success, aEvents is left empty. On failure, the events that could not be
+ * dispatched are left in aEvents.
+ */
+extern nsresult NS_DispatchBatch(nsIEventTarget* aEventTarget,
+                                 nsTArray<nsCOMPtr<nsIRunnable>>& aEvents,
+                                 uint32_t aDispatchFlags = NS_DISPATCH_NORMAL);
+
 // Predeclaration for logging function below
 namespace IPC {
 class Message;
@@ -1698,6 +1712,57 @@ class nsTimerImpl;
 
 namespace mozilla {
 
+// Stack class collecting runnables for a single event target, that are
+// dispatched together with NS_DispatchBatch() when the batch is flushed or goes
+// out of scope. Use it when dispatching many small runnables back to back to
+// another thread, e.g.:
+//
+//   EventTargetBatch batch(target);
+//   for (auto& item : items) {
+//     batch.Dispatch(NS_NewRunnableFunction(...));
+//   }
+class MOZ_STACK_CLASS EventTargetBatch final {
+ public:
+  explicit EventTargetBatch(nsIEventTarget* aEventTarget,
+                            uint32_t aFlags = NS_DISPATCH_NORMAL)
+      : mEventTarget(aEventTarget), mFlags(aFlags) {
+    MOZ_ASSERT(aEventTarget);
+  }
+
+  ~EventTargetBatch() { Unused << Flush(); }
+
+  EventTargetBatch(const EventTargetBatch&) = delete;
+  EventTargetBatch& operator=(const EventTargetBatch&) = delete;
+
+  void Dispatch(already_AddRefed<nsIRunnable> aEvent) {
+    mEvents.AppendElement(aEvent);
+  }
+
+  size_t Length() const { return mEvents.Length(); }
+
+  // Dispatch the events collected so far. Like with a failed Dispatch(),
+  // events that could not be dispatched are leaked rather than released on
+  // this thread, since they may hold objects that belong to the target.
+  nsresult Flush() {
+    if (mEvents.IsEmpty()) {
+      return NS_OK;
+    }
+    nsresult rv = NS_DispatchBatch(mEventTarget, mEvents, mFlags);
+    if (NS_FAILED(rv)) {
+      for (auto& event : mEvents) {
+        Unused << event.forget().take();
+      }
+    }
+    mEvents.Clear();
+    return rv;
+  }
+
+ private:
+  nsCOMPtr<nsIEventTarget> mEventTarget;
+  nsTArray<nsCOMPtr<nsIRunnable>> mEvents;
+  const uint32_t mFlags;
+};
+
 // RAII class that will set the TLS entry to return the currently running
 // nsISerialEventTarget.
 // It should be used from inner event loop implementation.
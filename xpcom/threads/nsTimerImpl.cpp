@@ -382,6 +382,7 @@ nsTimer::Release(void) {
 nsTimerImpl::nsTimerImpl(nsITimer* aTimer, nsIEventTarget* aTarget)
     : mEventTarget(aTarget),
       mIsInTimerThread(false),
+      mTimerThreadIndex(0),
       mType(0),
       mTimerSeq(0),
       mITimer(aTimer),
@@ -153,6 +153,11 @@ class nsTimerImpl {
   // so consistency is guaranteed by that.
   bool mIsInTimerThread;
 
+  // Position of our TimerThread::Entry in the TimerThread's heap, only
+  // meaningful while mIsInTimerThread is true. Also only accessed under the
+  // TimerThread's Monitor lock.
+  size_t mTimerThreadIndex;
+
   // These members are set by the initiating thread, when the timer's type is
   // changed and during the period where it fires on that thread.
   uint8_t mType;